@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+"""Compares two result files of data_region_bench.
+
+Usage: python3 bench/compare.py BASELINE.json RESULTS.json [--threshold 1.25]
+
+Prints the ratio of the time per operation of each configuration to the
+baseline, and exits with status 1 if any configuration is slower than the
+baseline by more than the threshold factor.
+"""
+import json
+import sys
+
+
+def load(path):
+    with open(path) as file:
+        results = json.load(file)["results"]
+    return {(r["operation"], r["distribution"], r["regions"]): r for r in results}
+
+
+def main(argv):
+    threshold = 1.25
+    if "--threshold" in argv:
+        index = argv.index("--threshold")
+        threshold = float(argv[index + 1])
+        del argv[index:index + 2]
+    if len(argv) != 3:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+
+    baseline = load(argv[1])
+    current = load(argv[2])
+    regressions = 0
+    print("%-14s %-12s %9s %14s %14s %7s" % ("operation", "distribution", "regions", "baseline ns", "current ns", "ratio"))
+    for key in sorted(current, key=lambda k: (k[2], k[0], k[1])):
+        if key not in baseline:
+            continue
+        before = baseline[key]["ns_per_op"]
+        after = current[key]["ns_per_op"]
+        ratio = after / before if before > 0 else 1.0
+        marker = ""
+        if ratio > threshold:
+            marker = "  REGRESSION"
+            regressions += 1
+        print("%-14s %-12s %9d %14.1f %14.1f %6.2fx%s" % (key[0], key[1], key[2], before, after, ratio, marker))
+
+    print("%d of %d configurations regressed by more than %.2fx." % (regressions, len(current), threshold))
+    return 1 if regressions > 0 else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
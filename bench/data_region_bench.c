@@ -0,0 +1,283 @@
+/* Microbenchmark of the DataRegionSet operations of data_region.h, which
+ * prints its results as JSON.
+ *
+ * Build and run (from the repository root):
+ *   make bench && ./data_region_bench > results.json
+ *   python3 bench/compare.py bench/baseline.json results.json
+ *
+ * Options:
+ *   --max-regions N   Largest region count to measure (default 10000000).
+ *   --min-time S      Minimum measured seconds per repetition (default 0.05).
+ *   --repetitions R   Repetitions of each configuration; the fastest one is
+ *                     reported (default 3).
+ *
+ * Every configuration starts from the same set of 'regions' DataRegions,
+ * where the j-th DataRegion is (8j, 8j+3), and uses a fixed seed, so runs
+ * are reproducible. Operations are timed in batches of up to
+ * BENCH_BATCH_OPS, and the changed part of the set is restored (untimed)
+ * after each batch of adds or removes, so its region count stays between
+ * 'regions' and 'regions' plus the batch size.
+ *
+ * Distributions:
+ *   sequential   Adds append after the last DataRegion, removes evict from
+ *                the front (FIFO), queries walk the set in ascending order.
+ *   random       Uniformly random positions.
+ *   adversarial  Adds merge two DataRegions and removes split one, near the
+ *                front, so the most DataRegions are shifted; queries cover
+ *                BENCH_WIDE_QUERY DataRegions at the end of the set.
+ *
+ * For each configuration, 'ns_per_op' is the time of one operation, and
+ * 'bytes_moved_per_op' is the number of bytes of DataRegions that an
+ * operation shifts within the set (adds and removes) or copies into the
+ * destination array (crops). */
+#define _POSIX_C_SOURCE 200809L
+#include "../data_region.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_BATCH_OPS 1024
+#define BENCH_WIDE_QUERY 64
+#define BENCH_SEED 0x2545F4914F6CDD1Dull
+
+typedef enum BenchOperation
+{
+  BENCH_ADD,
+  BENCH_REMOVE,
+  BENCH_CROP,
+  BENCH_COUNT_CROP,
+  BENCH_NEGATIVE_CROP,
+  BENCH_OPERATION_COUNT
+} BenchOperation;
+
+typedef enum BenchDistribution
+{
+  BENCH_SEQUENTIAL,
+  BENCH_RANDOM,
+  BENCH_ADVERSARIAL,
+  BENCH_DISTRIBUTION_COUNT
+} BenchDistribution;
+
+const char* benchOperationNames[BENCH_OPERATION_COUNT] = { "add", "remove", "crop", "count_crop", "negative_crop" };
+const char* benchDistributionNames[BENCH_DISTRIBUTION_COUNT] = { "sequential", "random", "adversarial" };
+
+typedef struct BenchResult
+{
+  int64_t ops;
+  double nsPerOp;
+  double bytesMovedPerOp;
+} BenchResult;
+
+uint64_t bench_rand(uint64_t* state)
+{
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+double bench_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + ((double)now.tv_nsec / 1e9);
+}
+
+/* Generates the argument of the k-th operation of a batch on a set of
+ * 'regionCount' DataRegions. */
+DataRegion bench_region(BenchOperation operation, BenchDistribution distribution, int64_t regionCount, int64_t k, uint64_t* state)
+{
+  int64_t j;
+  if(distribution == BENCH_SEQUENTIAL)
+    j = operation == BENCH_ADD ? regionCount + k : k % regionCount;
+  else if(distribution == BENCH_RANDOM)
+    j = (int64_t)(bench_rand(state) % (uint64_t)regionCount);
+  else if(operation == BENCH_ADD)
+    j = (2 * k) % regionCount;
+  else if(operation == BENCH_REMOVE)
+    j = k % regionCount;
+  else
+    j = regionCount > BENCH_WIDE_QUERY ? regionCount - BENCH_WIDE_QUERY : 0;
+
+  if(operation == BENCH_ADD)
+  {
+    //Either a new DataRegion within the gap after (8j, 8j+3), or a bridge to the next DataRegion
+    if(distribution == BENCH_ADVERSARIAL)
+      return (DataRegion){ (8 * j) + 3, (8 * j) + 8 };
+    return (DataRegion){ (8 * j) + 5, (8 * j) + 6 };
+  }
+  if(operation == BENCH_REMOVE)
+  {
+    //Either the whole DataRegion, or its middle (splitting it in two)
+    if(distribution == BENCH_ADVERSARIAL)
+      return (DataRegion){ (8 * j) + 1, (8 * j) + 2 };
+    return (DataRegion){ 8 * j, (8 * j) + 3 };
+  }
+
+  //Cuts the first and the last covered DataRegion
+  int64_t width = distribution == BENCH_ADVERSARIAL ? BENCH_WIDE_QUERY : 1;
+  return (DataRegion){ (8 * j) + 1, (8 * (j + width)) + 1 };
+}
+
+/* Counts the DataRegions that an operation shifts, by checking how many
+ * DataRegions lie after the ones that it touches. */
+int64_t bench_shifted(DataRegionSet* set, BenchOperation operation, DataRegion region)
+{
+  int64_t countBefore = set->count;
+  int64_t touchedLast = operation == BENCH_ADD && region.last_index < INT64_MAX ? region.last_index + 1 : region.last_index;
+  int64_t after = _data_region_set_lower_bound(set, touchedLast + 1);
+  if(after < set->count && set->regions[after].first_index <= touchedLast)
+    after++;
+
+  if(operation == BENCH_ADD)
+    data_region_set_add(set, region);
+  else
+    data_region_set_remove(set, region);
+  return set->count != countBefore ? countBefore - after : 0;
+}
+
+/* Restores the DataRegions of a set that were changed since it was a copy
+ * of another set, starting at a position before which nothing changed. */
+void bench_restore(DataRegionSet* set, const DataRegionSet* pristine, int64_t from)
+{
+  memcpy(set->regions + from, pristine->regions + from, sizeof(DataRegion) * (pristine->count - from));
+  set->count = pristine->count;
+  set->total_length = pristine->total_length;
+}
+
+/* Runs one configuration until at least 'minTime' seconds were measured.
+ * The batches start with one operation and grow while they are short, so
+ * that slow operations on huge sets don't take minutes. */
+BenchResult bench_run(BenchOperation operation, BenchDistribution distribution, const DataRegionSet* pristine, DataRegionSet* set, double minTime)
+{
+  int64_t regionCount = pristine->count;
+  int64_t maxBatchOps = regionCount < BENCH_BATCH_OPS ? regionCount : BENCH_BATCH_OPS;
+  DataRegion regions[BENCH_BATCH_OPS];
+  DataRegion dst[BENCH_WIDE_QUERY + 2];
+  uint64_t state = BENCH_SEED ^ (uint64_t)regionCount;
+  int isMutation = operation == BENCH_ADD || operation == BENCH_REMOVE;
+
+  BenchResult result = { 0, 0.0, 0.0 };
+  double elapsed = 0.0;
+  int64_t batchOps = 1, restoreFrom = 0;
+  volatile int64_t found = 0;
+  bench_restore(set, pristine, 0);
+  while(elapsed < minTime)
+  {
+    //Nothing before the first DataRegion that the batch can touch changes
+    restoreFrom = regionCount;
+    for(int64_t i = 0; i < batchOps; i++)
+    {
+      regions[i] = bench_region(operation, distribution, regionCount, result.ops + i, &state);
+      int64_t touched = _data_region_set_lower_bound(pristine, regions[i].first_index - 1);
+      restoreFrom = touched < restoreFrom ? touched : restoreFrom;
+    }
+
+    found = 0;
+    double start = bench_now();
+    switch(operation)
+    {
+    case BENCH_ADD:
+      for(int64_t i = 0; i < batchOps; i++)
+        data_region_set_add(set, regions[i]);
+      break;
+    case BENCH_REMOVE:
+      for(int64_t i = 0; i < batchOps; i++)
+        data_region_set_remove(set, regions[i]);
+      break;
+    case BENCH_CROP:
+      for(int64_t i = 0; i < batchOps; i++)
+        found += data_region_set_crop(dst, BENCH_WIDE_QUERY + 2, pristine, regions[i], NULL);
+      break;
+    case BENCH_COUNT_CROP:
+      for(int64_t i = 0; i < batchOps; i++)
+        found += data_region_set_count_crop(pristine, regions[i]);
+      break;
+    default:
+      for(int64_t i = 0; i < batchOps; i++)
+        found += data_region_set_negative_crop(dst, BENCH_WIDE_QUERY + 2, pristine, regions[i], NULL);
+      break;
+    }
+    double batchElapsed = bench_now() - start;
+
+    elapsed += batchElapsed;
+    result.ops += batchOps;
+    if(isMutation)
+      bench_restore(set, pristine, restoreFrom);
+    if(elapsed < minTime && batchElapsed < minTime / 100 && batchOps < maxBatchOps)
+      batchOps = batchOps * 2 < maxBatchOps ? batchOps * 2 : maxBatchOps;
+  }
+
+  //Measure the moved bytes of the last batch, outside of the timed section
+  int64_t bytesMoved = 0;
+  if(isMutation)
+  {
+    for(int64_t i = 0; i < batchOps; i++)
+      bytesMoved += bench_shifted(set, operation, regions[i]) * (int64_t)sizeof(DataRegion);
+    bench_restore(set, pristine, restoreFrom);
+  }
+  else if(operation != BENCH_COUNT_CROP)
+  {
+    bytesMoved = found * (int64_t)sizeof(DataRegion);
+  }
+
+  result.nsPerOp = (elapsed * 1e9) / (double)result.ops;
+  result.bytesMovedPerOp = (double)bytesMoved / (double)batchOps;
+  return result;
+}
+
+int main(int argc, char** argv)
+{
+  int64_t maxRegions = 10000000;
+  double minTime = 0.05;
+  int repetitions = 3;
+  for(int i = 1; i + 1 < argc; i += 2)
+  {
+    if(strcmp(argv[i], "--max-regions") == 0)
+      maxRegions = strtoll(argv[i + 1], NULL, 10);
+    else if(strcmp(argv[i], "--min-time") == 0)
+      minTime = strtod(argv[i + 1], NULL);
+    else if(strcmp(argv[i], "--repetitions") == 0)
+      repetitions = atoi(argv[i + 1]);
+  }
+
+  printf("{\n  \"benchmark\": \"data_region_bench\",\n  \"region_bytes\": %d,\n  \"results\": [", (int)sizeof(DataRegion));
+  const char* separator = "\n";
+  for(int64_t regionCount = 10; regionCount <= maxRegions; regionCount *= 10)
+  {
+    DataRegionSet* pristine = data_region_set_create(regionCount);
+    DataRegionSet* set = data_region_set_create(regionCount + BENCH_BATCH_OPS);
+    if(pristine == NULL || set == NULL)
+    {
+      fprintf(stderr, "Failed to allocate %lld DataRegions.\n", (long long)regionCount);
+      return 1;
+    }
+    for(int64_t j = 0; j < regionCount; j++)
+      data_region_set_add(pristine, (DataRegion){ 8 * j, (8 * j) + 3 });
+
+    for(int operation = 0; operation < BENCH_OPERATION_COUNT; operation++)
+    {
+      for(int distribution = 0; distribution < BENCH_DISTRIBUTION_COUNT; distribution++)
+      {
+        BenchResult best = { 0, 0.0, 0.0 };
+        for(int repetition = 0; repetition < repetitions; repetition++)
+        {
+          BenchResult result = bench_run(operation, distribution, pristine, set, minTime);
+          if(repetition == 0 || result.nsPerOp < best.nsPerOp)
+            best = result;
+        }
+
+        printf("%s    { \"operation\": \"%s\", \"distribution\": \"%s\", \"regions\": %lld, \"ops\": %lld, \"ns_per_op\": %.1f, \"bytes_moved_per_op\": %.1f }",
+          separator, benchOperationNames[operation], benchDistributionNames[distribution], (long long)regionCount, (long long)best.ops, best.nsPerOp, best.bytesMovedPerOp);
+        separator = ",\n";
+        fflush(stdout);
+      }
+    }
+
+    data_region_set_free(pristine);
+    data_region_set_free(set);
+  }
+  printf("\n  ]\n}\n");
+  return 0;
+}
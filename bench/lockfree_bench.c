@@ -0,0 +1,216 @@
+/* Benchmark of DataRegionLockFreeSet against a DataRegionSet that is
+ * protected by a single mutex, at 1 to 64 threads.
+ *
+ * Build and run (from the repository root):
+ *   gcc -O2 -pthread -o lockfree_bench bench/lockfree_bench.c && ./lockfree_bench
+ *
+ * Each thread performs a mix of membership queries, adds and removes of short
+ * DataRegions at random positions within its own stripe of the span, so that
+ * the final contents don't depend on how the threads interleave: both sets
+ * must end up equal, or the benchmark fails. The reported throughput is the
+ * total number of operations per second across all threads, and the scaling
+ * is relative to one thread of the same set. Scaling beyond one thread
+ * needs as many online CPUs, which are reported first. */
+#define _POSIX_C_SOURCE 200809L
+#include "../data_region.h"
+#include "../data_region_lockfree.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_OPS_PER_THREAD 200000
+#define BENCH_SPAN 100000
+#define BENCH_MAX_THREADS 64
+
+/* Percentage of operations that are membership queries (the rest are split
+ * evenly between adds and removes). */
+#define BENCH_QUERY_PERCENT 80
+
+typedef struct BenchMutexSet
+{
+  pthread_mutex_t lock;
+  DataRegionSet* set;
+} BenchMutexSet;
+
+typedef struct BenchThread
+{
+  pthread_t thread;
+  uint64_t seed;
+  int64_t stripeFirst;
+  int64_t stripeLength;
+  BenchMutexSet* mutexSet;
+  DataRegionLockFreeSet* lockFreeSet;
+  pthread_barrier_t* barrier;
+} BenchThread;
+
+uint64_t bench_rand(uint64_t* state)
+{
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+/* Gets a random DataRegion of up to 16 indices within a stripe. */
+DataRegion bench_region(uint64_t random, int64_t stripeFirst, int64_t stripeLength)
+{
+  int64_t first = stripeFirst + (int64_t)((random >> 8) % (uint64_t)(stripeLength - 15));
+  return (DataRegion){ first, first + (int64_t)(random & 15) };
+}
+
+/* Checks whether a DataRegion is entirely present in a DataRegionSet with a
+ * binary search, so that the baseline's queries do the same work as
+ * 'data_region_lockfree_set_contains'. */
+int bench_set_contains(const DataRegionSet* set, DataRegion region)
+{
+  int64_t position = _data_region_set_lower_bound(set, region.first_index);
+  return position < set->count && data_region_contains(set->regions[position], region);
+}
+
+void* bench_mutex_thread(void* arg)
+{
+  BenchThread* thread = arg;
+  uint64_t state = thread->seed;
+  int64_t hits = 0;
+  pthread_barrier_wait(thread->barrier);
+  for(int i = 0; i < BENCH_OPS_PER_THREAD; i++)
+  {
+    uint64_t random = bench_rand(&state);
+    DataRegion region = bench_region(random, thread->stripeFirst, thread->stripeLength);
+    int op = (int)((random >> 40) % 100);
+
+    pthread_mutex_lock(&thread->mutexSet->lock);
+    if(op < BENCH_QUERY_PERCENT)
+      hits += bench_set_contains(thread->mutexSet->set, region);
+    else if(op < BENCH_QUERY_PERCENT + (100 - BENCH_QUERY_PERCENT) / 2)
+      data_region_set_add(thread->mutexSet->set, region);
+    else
+      data_region_set_remove(thread->mutexSet->set, region);
+    pthread_mutex_unlock(&thread->mutexSet->lock);
+  }
+  return (void*)(intptr_t)hits;
+}
+
+void* bench_lockfree_thread(void* arg)
+{
+  BenchThread* thread = arg;
+  uint64_t state = thread->seed;
+  int64_t hits = 0;
+  DataRegionLockFreeHandle* handle = data_region_lockfree_set_attach(thread->lockFreeSet);
+  pthread_barrier_wait(thread->barrier);
+  for(int i = 0; i < BENCH_OPS_PER_THREAD; i++)
+  {
+    uint64_t random = bench_rand(&state);
+    DataRegion region = bench_region(random, thread->stripeFirst, thread->stripeLength);
+    int op = (int)((random >> 40) % 100);
+
+    if(op < BENCH_QUERY_PERCENT)
+      hits += data_region_lockfree_set_contains(handle, region);
+    else if(op < BENCH_QUERY_PERCENT + (100 - BENCH_QUERY_PERCENT) / 2)
+      data_region_lockfree_set_add(handle, region);
+    else
+      data_region_lockfree_set_remove(handle, region);
+  }
+  data_region_lockfree_set_detach(handle);
+  return (void*)(intptr_t)hits;
+}
+
+double bench_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + ((double)now.tv_nsec / 1e9);
+}
+
+/* Runs one configuration and returns the throughput in operations per
+ * second. The final DataRegions of the set are copied to 'result' (which
+ * has room for BENCH_SPAN of them), and their number to 'resultCount'. */
+double bench_run(int threadCount, int lockFree, DataRegion* result, int64_t* resultCount)
+{
+  BenchMutexSet mutexSet;
+  pthread_mutex_init(&mutexSet.lock, NULL);
+  mutexSet.set = data_region_set_create(BENCH_SPAN);
+  DataRegionLockFreeSet* lockFreeSet = data_region_lockfree_set_create();
+
+  //Pre-populate both sets with the same DataRegions
+  DataRegionLockFreeHandle* handle = data_region_lockfree_set_attach(lockFreeSet);
+  uint64_t state = 0x2545F4914F6CDD1Dull;
+  for(int i = 0; i < BENCH_SPAN / 100; i++)
+  {
+    DataRegion region = bench_region(bench_rand(&state), 0, BENCH_SPAN);
+    data_region_set_add(mutexSet.set, region);
+    data_region_lockfree_set_add(handle, region);
+  }
+  data_region_lockfree_set_detach(handle);
+
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, threadCount + 1);
+  BenchThread threads[BENCH_MAX_THREADS];
+  for(int i = 0; i < threadCount; i++)
+  {
+    int64_t stripeLength = BENCH_SPAN / threadCount;
+    threads[i] = (BenchThread){ .seed = 0x9E3779B97F4A7C15ull * (i + 1), .stripeFirst = i * stripeLength, .stripeLength = stripeLength,
+      .mutexSet = &mutexSet, .lockFreeSet = lockFreeSet, .barrier = &barrier };
+    pthread_create(&threads[i].thread, NULL, lockFree ? bench_lockfree_thread : bench_mutex_thread, &threads[i]);
+  }
+
+  pthread_barrier_wait(&barrier);
+  double start = bench_now();
+  for(int i = 0; i < threadCount; i++)
+    pthread_join(threads[i].thread, NULL);
+  double elapsed = bench_now() - start;
+
+  if(lockFree)
+  {
+    handle = data_region_lockfree_set_attach(lockFreeSet);
+    *resultCount = data_region_lockfree_set_crop(result, BENCH_SPAN, handle, (DataRegion){ INT64_MIN, INT64_MAX }, NULL);
+    data_region_lockfree_set_detach(handle);
+  }
+  else
+  {
+    *resultCount = data_region_set_crop(result, BENCH_SPAN, mutexSet.set, (DataRegion){ INT64_MIN, INT64_MAX }, NULL);
+  }
+
+  pthread_barrier_destroy(&barrier);
+  data_region_lockfree_set_free(lockFreeSet);
+  data_region_set_free(mutexSet.set);
+  pthread_mutex_destroy(&mutexSet.lock);
+  return ((double)threadCount * BENCH_OPS_PER_THREAD) / elapsed;
+}
+
+int main()
+{
+  DataRegion* mutexResult = malloc(sizeof(DataRegion) * BENCH_SPAN);
+  DataRegion* lockFreeResult = malloc(sizeof(DataRegion) * BENCH_SPAN);
+  if(mutexResult == NULL || lockFreeResult == NULL)
+    return 1;
+
+  printf("%ld online CPUs\n", sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%8s %18s %8s %18s %8s %8s\n", "threads", "mutex (ops/s)", "scaling", "lock-free (ops/s)", "scaling", "speedup");
+  double mutexBase = 0, lockFreeBase = 0;
+  for(int threadCount = 1; threadCount <= BENCH_MAX_THREADS; threadCount *= 2)
+  {
+    int64_t mutexCount, lockFreeCount;
+    double mutexRate = bench_run(threadCount, 0, mutexResult, &mutexCount);
+    double lockFreeRate = bench_run(threadCount, 1, lockFreeResult, &lockFreeCount);
+    if(mutexCount != lockFreeCount || memcmp(mutexResult, lockFreeResult, sizeof(DataRegion) * mutexCount) != 0)
+    {
+      printf("%8d the final sets differ (%lld and %lld DataRegions)\n", threadCount, (long long)mutexCount, (long long)lockFreeCount);
+      return 1;
+    }
+
+    if(threadCount == 1)
+    {
+      mutexBase = mutexRate;
+      lockFreeBase = lockFreeRate;
+    }
+    printf("%8d %18.0f %7.2fx %18.0f %7.2fx %7.2fx\n", threadCount, mutexRate, mutexRate / mutexBase, lockFreeRate, lockFreeRate / lockFreeBase, lockFreeRate / mutexRate);
+    fflush(stdout);
+  }
+
+  free(mutexResult);
+  free(lockFreeResult);
+  return 0;
+}
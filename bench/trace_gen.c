@@ -0,0 +1,55 @@
+/* Writes a synthetic trace of a realistic workload in the binary trace
+ * format of data_region_trace.h.
+ *
+ * Build and run (from the repository root):
+ *   make trace_gen && ./trace_gen http 1000000 > http.trace
+ *
+ * Usage: trace_gen WORKLOAD RECORDS [SEED] [LENGTH]
+ *   WORKLOAD  http, p2p, video or db (see DataRegionTraceWorkload).
+ *   RECORDS   The number of records to write.
+ *   SEED      The seed of the generator (default 1).
+ *   LENGTH    The length of the modeled file in bytes (default 4 GiB). */
+#include "../data_region.h"
+#include "../data_region_trace.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char** argv)
+{
+  const char* names[] = { "http", "p2p", "video", "db" };
+  if(argc < 3)
+  {
+    fprintf(stderr, "Usage: %s http|p2p|video|db RECORDS [SEED] [LENGTH]\n", argv[0]);
+    return 2;
+  }
+
+  int workload = -1;
+  for(int i = 0; i < 4; i++)
+  {
+    if(strcmp(argv[1], names[i]) == 0)
+      workload = i;
+  }
+  int64_t recordCount = strtoll(argv[2], NULL, 10);
+  uint64_t seed = argc > 3 ? strtoull(argv[3], NULL, 10) : 1;
+  int64_t length = argc > 4 ? strtoll(argv[4], NULL, 10) : (int64_t)4 << 30;
+
+  DataRegionTraceGenerator generator;
+  DataRegionTraceWriter writer;
+  if(workload < 0 || !data_region_trace_generator_init(&generator, (DataRegionTraceWorkload)workload, length, seed))
+  {
+    fprintf(stderr, "Invalid workload or length.\n");
+    return 2;
+  }
+  if(!data_region_trace_writer_init(&writer, stdout))
+    return 1;
+
+  for(int64_t i = 0; i < recordCount; i++)
+  {
+    if(!data_region_trace_write(&writer, data_region_trace_generator_next(&generator)))
+    {
+      fprintf(stderr, "Failed to write the trace.\n");
+      return 1;
+    }
+  }
+  return fflush(stdout) == 0 ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+/* Replays a trace (see data_region_trace.h) against a DataRegionSet or an
+ * alternative engine, and reports the throughput, the latency percentiles
+ * and the peak region count.
+ *
+ * Build and run (from the repository root):
+ *   make trace_gen trace_replay
+ *   ./trace_gen video 1000000 > video.trace && ./trace_replay video.trace set lsm sharded
+ *
+ * Usage: trace_replay TRACE [ENGINE...]
+ *   ENGINE  set (DataRegionSet, the default), lsm (DataRegionLsmSet) or
+ *           sharded (DataRegionShardedSet with 64 shards).
+ *
+ * The trace is loaded into memory first. Each engine replays it twice: once
+ * without per-operation timers for the throughput, and once timing every
+ * operation for the latency percentiles and tracking the region count after
+ * each add and remove (see 'count_interval'). Crops copy into a buffer of REPLAY_DST_CAPACITY
+ * DataRegions. For traces that were recorded with their results (see
+ * 'data_region_trace_write_recording'), 'mismatched' counts the records
+ * whose replayed result differs, which shows where the replay diverges from
+ * the recorded workload (for example, because the recorded set had a
+ * smaller capacity). */
+#define _POSIX_C_SOURCE 200809L
+#include "../data_region.h"
+#include "../data_region_lsm.h"
+#include "../data_region_sharded.h"
+#include "../data_region_trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define REPLAY_REGION_CAPACITY (1 << 22)
+#define REPLAY_DST_CAPACITY 4096
+#define REPLAY_SHARD_COUNT 64
+
+/* The operations of a replayed engine. */
+typedef struct ReplayEngine
+{
+  const char* name;
+  void* (*create)(int64_t first, int64_t last);
+  void (*free)(void* engine);
+  DataRegionSetResult (*add)(void* engine, DataRegion region);
+  DataRegionSetResult (*remove)(void* engine, DataRegion region);
+  int64_t (*crop)(DataRegion* dst, int64_t dstCapacity, void* engine, DataRegion boundaryRegion, int* dstTooSmall);
+  int64_t (*count_crop)(void* engine, DataRegion boundaryRegion);
+  int64_t (*negative_crop)(DataRegion* dst, int64_t dstCapacity, void* engine, DataRegion boundaryRegion, int* dstTooSmall);
+  int64_t (*count)(void* engine);
+
+  /* The number of adds and removes after which the DataRegions are
+   * counted, for the peak region count. */
+  int64_t count_interval;
+} ReplayEngine;
+
+void* replay_set_create(int64_t first, int64_t last)
+{
+  (void)first;
+  (void)last;
+  return data_region_set_create(REPLAY_REGION_CAPACITY);
+}
+
+void* replay_lsm_create(int64_t first, int64_t last)
+{
+  (void)first;
+  (void)last;
+  return data_region_lsm_set_create(REPLAY_REGION_CAPACITY, 4096, 8, 0);
+}
+
+void* replay_sharded_create(int64_t first, int64_t last)
+{
+  int64_t width = ((last - first) / REPLAY_SHARD_COUNT) + 1;
+  return data_region_sharded_set_create(first, width, REPLAY_SHARD_COUNT, REPLAY_REGION_CAPACITY / REPLAY_SHARD_COUNT);
+}
+
+/* Defines the functions of a ReplayEngine for one set type. */
+#define REPLAY_ENGINE_FUNCTIONS(name, Type, prefix)                                                           \
+void replay_##name##_free(void* engine) { prefix##_free((Type*)engine); }                                      \
+DataRegionSetResult replay_##name##_add(void* engine, DataRegion region) { return prefix##_add((Type*)engine, region); } \
+DataRegionSetResult replay_##name##_remove(void* engine, DataRegion region) { return prefix##_remove((Type*)engine, region); } \
+int64_t replay_##name##_crop(DataRegion* dst, int64_t dstCapacity, void* engine, DataRegion boundaryRegion, int* dstTooSmall) \
+{ return prefix##_crop(dst, dstCapacity, (Type*)engine, boundaryRegion, dstTooSmall); }                       \
+int64_t replay_##name##_count_crop(void* engine, DataRegion boundaryRegion) { return prefix##_count_crop((Type*)engine, boundaryRegion); } \
+int64_t replay_##name##_negative_crop(DataRegion* dst, int64_t dstCapacity, void* engine, DataRegion boundaryRegion, int* dstTooSmall) \
+{ return prefix##_negative_crop(dst, dstCapacity, (Type*)engine, boundaryRegion, dstTooSmall); }              \
+int64_t replay_##name##_count(void* engine) { return prefix##_count((Type*)engine); }
+
+#define REPLAY_ENGINE(name, countInterval)                                                                    \
+  { #name, replay_##name##_create, replay_##name##_free, replay_##name##_add, replay_##name##_remove,         \
+    replay_##name##_crop, replay_##name##_count_crop, replay_##name##_negative_crop, replay_##name##_count, countInterval }
+
+REPLAY_ENGINE_FUNCTIONS(set, DataRegionSet, data_region_set)
+REPLAY_ENGINE_FUNCTIONS(lsm, DataRegionLsmSet, data_region_lsm_set)
+REPLAY_ENGINE_FUNCTIONS(sharded, DataRegionShardedSet, data_region_sharded_set)
+
+/* Counting the DataRegions of a DataRegionLsmSet merges all of its levels,
+ * so its peak count is only sampled. */
+ReplayEngine replayEngines[] =
+{
+  REPLAY_ENGINE(set, 1),
+  REPLAY_ENGINE(lsm, 1024),
+  REPLAY_ENGINE(sharded, 1)
+};
+
+double replay_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + ((double)now.tv_nsec / 1e9);
+}
+
+/* Performs one record, and returns its result. */
+int64_t replay_record(const ReplayEngine* engine, void* instance, DataRegionTraceRecord record, DataRegion* dst)
+{
+  switch(record.operation)
+  {
+  case DATA_REGION_TRACE_ADD:
+    return engine->add(instance, record.region);
+  case DATA_REGION_TRACE_REMOVE:
+    return engine->remove(instance, record.region);
+  case DATA_REGION_TRACE_CROP:
+    return engine->crop(dst, REPLAY_DST_CAPACITY, instance, record.region, NULL);
+  case DATA_REGION_TRACE_COUNT_CROP:
+    return engine->count_crop(instance, record.region);
+  default:
+    return engine->negative_crop(dst, REPLAY_DST_CAPACITY, instance, record.region, NULL);
+  }
+}
+
+int replay_compare_latency(const void* a, const void* b)
+{
+  float aLatency = *(const float*)a;
+  float bLatency = *(const float*)b;
+  return (aLatency > bLatency) - (aLatency < bLatency);
+}
+
+int main(int argc, char** argv)
+{
+  if(argc < 2)
+  {
+    fprintf(stderr, "Usage: %s TRACE [set|lsm|sharded...]\n", argv[0]);
+    return 2;
+  }
+
+  FILE* file = fopen(argv[1], "rb");
+  DataRegionTraceReader reader;
+  if(file == NULL || !data_region_trace_reader_init(&reader, file))
+  {
+    fprintf(stderr, "Failed to open the trace '%s'.\n", argv[1]);
+    return 1;
+  }
+
+  int64_t count = 0, capacity = 1 << 16;
+  int64_t first = INT64_MAX, last = INT64_MIN;
+  DataRegionTraceRecord* records = malloc(sizeof(DataRegionTraceRecord) * capacity);
+  int readResult;
+  DataRegionTraceRecord record;
+  while(records != NULL && (readResult = data_region_trace_read(&reader, &record)) == 1)
+  {
+    if(count == capacity)
+    {
+      capacity *= 2;
+      records = realloc(records, sizeof(DataRegionTraceRecord) * capacity);
+      if(records == NULL)
+        break;
+    }
+    records[count++] = record;
+    first = record.region.first_index < first ? record.region.first_index : first;
+    last = record.region.last_index > last ? record.region.last_index : last;
+  }
+  fclose(file);
+  if(records == NULL || readResult != 0 || count == 0)
+  {
+    fprintf(stderr, "Failed to read the trace '%s'.\n", argv[1]);
+    return 1;
+  }
+
+  float* latencies = malloc(sizeof(float) * count);
+  DataRegion* dst = malloc(sizeof(DataRegion) * REPLAY_DST_CAPACITY);
+  if(latencies == NULL || dst == NULL)
+    return 1;
+
+  printf("%-8s %10s %12s %9s %9s %9s %9s %11s %11s %8s %10s\n", "engine", "records", "ops/s", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns", "peak count", "failed", "mismatched");
+  for(int e = argc > 2 ? 2 : 1; e < (argc > 2 ? argc : 2); e++)
+  {
+    const ReplayEngine* engine = &replayEngines[0];
+    if(argc > 2)
+    {
+      engine = NULL;
+      for(size_t i = 0; i < sizeof(replayEngines) / sizeof(replayEngines[0]); i++)
+      {
+        if(strcmp(argv[e], replayEngines[i].name) == 0)
+          engine = &replayEngines[i];
+      }
+      if(engine == NULL)
+      {
+        fprintf(stderr, "Unknown engine '%s'.\n", argv[e]);
+        return 2;
+      }
+    }
+
+    //Throughput, without per-operation timers
+    void* instance = engine->create(first, last);
+    if(instance == NULL)
+      return 1;
+    int64_t failed = 0, mismatched = 0;
+    double start = replay_now();
+    for(int64_t i = 0; i < count; i++)
+    {
+      int64_t result = replay_record(engine, instance, records[i], dst);
+      failed += records[i].operation <= DATA_REGION_TRACE_REMOVE ? result != DATA_REGION_SET_SUCCESS : result < 0;
+      mismatched += records[i].has_result && result != records[i].result;
+    }
+    double elapsed = replay_now() - start;
+    engine->free(instance);
+
+    //Latencies and the peak region count
+    instance = engine->create(first, last);
+    if(instance == NULL)
+      return 1;
+    int64_t peakCount = 0, mutationCount = 0;
+    for(int64_t i = 0; i < count; i++)
+    {
+      double operationStart = replay_now();
+      replay_record(engine, instance, records[i], dst);
+      latencies[i] = (float)((replay_now() - operationStart) * 1e9);
+      if(records[i].operation <= DATA_REGION_TRACE_REMOVE && ++mutationCount % engine->count_interval == 0)
+      {
+        int64_t regionCount = engine->count(instance);
+        peakCount = regionCount > peakCount ? regionCount : peakCount;
+      }
+    }
+    engine->free(instance);
+
+    qsort(latencies, (size_t)count, sizeof(float), replay_compare_latency);
+    printf("%-8s %10lld %12.0f %9.0f %9.0f %9.0f %9.0f %11.0f %11lld %8lld %10lld\n",
+      engine->name, (long long)count, (double)count / elapsed,
+      latencies[(count * 50) / 100], latencies[(count * 90) / 100], latencies[(count * 99) / 100],
+      latencies[(count * 999) / 1000], latencies[count - 1], (long long)peakCount, (long long)failed, (long long)mismatched);
+    fflush(stdout);
+  }
+
+  free(latencies);
+  free(dst);
+  free(records);
+  return 0;
+}
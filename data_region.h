@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* Representation of a region of data (no payload is stored, just indices). */
 typedef struct DataRegion
@@ -32,6 +33,536 @@ typedef struct DataRegionSet
   int64_t total_length;
 } DataRegionSet;
 
+/* USDT (static tracepoints for bpftrace, perf, SystemTap) of the provider
+ * 'data_region', which are compiled in when <sys/sdt.h> is available (from
+ * systemtap-sdt-dev or systemtap-sdt-devel), unless DATA_REGION_NO_USDT is
+ * defined. A probe that isn't attached is a single 'nop'. See the 'tools'
+ * directory for example bpftrace scripts. The probes and their arguments:
+ *   add_entry, remove_entry, crop_entry, count_crop_entry,
+ *   negative_crop_entry (set, first_index, last_index, count)
+ *       An operation starts; 'set' is the source set of the crops.
+ *   add_return, remove_return, crop_return, count_crop_return,
+ *   negative_crop_return (set, result, count)
+ *       An operation returns its DataRegionSetResult (adds and removes) or
+ *       number of DataRegions (crops).
+ *   merge (set, first_index, last_index, merged)
+ *       An add combined 'merged' stored DataRegions into one.
+ *   split (set, first_index, last_index)
+ *       A remove split a stored DataRegion in two.
+ *   shift (set, index, moved)
+ *       'moved' DataRegions from 'index' on were shifted within the set.
+ * The merge, split and shift probes also fire for the destination array of
+ * a negative crop. */
+#if !defined(DATA_REGION_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define _DATA_REGION_USDT
+#endif
+#endif
+
+#ifdef _DATA_REGION_USDT
+#define _DATA_REGION_PROBE3(name, a, b, c) DTRACE_PROBE3(data_region, name, a, b, c)
+#define _DATA_REGION_PROBE4(name, a, b, c, d) DTRACE_PROBE4(data_region, name, a, b, c, d)
+#else
+#define _DATA_REGION_PROBE3(name, a, b, c) ((void)0)
+#define _DATA_REGION_PROBE4(name, a, b, c, d) ((void)0)
+#endif
+
+/* Internal probes at the start and the end of an operation (see the USDT
+ * above). */
+#define _DATA_REGION_PROBE_ENTRY(name, set, region) _DATA_REGION_PROBE4(name, set, (region).first_index, (region).last_index, (set) != NULL ? (set)->count : -1)
+#define _DATA_REGION_PROBE_RETURN(name, set, result) _DATA_REGION_PROBE3(name, set, (int64_t)(result), (set) != NULL ? (set)->count : -1)
+
+/* The operations that are counted by the optional instrumentation.
+ * @see DataRegionStats */
+typedef enum DataRegionStatsOperation
+{
+  DATA_REGION_STATS_ADD = 0,
+  DATA_REGION_STATS_REMOVE = 1,
+  DATA_REGION_STATS_CROP = 2,
+  DATA_REGION_STATS_COUNT_CROP = 3,
+  DATA_REGION_STATS_NEGATIVE_CROP = 4,
+  DATA_REGION_STATS_OPERATION_COUNT = 5
+} DataRegionStatsOperation;
+
+/* The number of buckets of a latency histogram. Bucket 'b' holds the
+ * latencies from 'data_region_stats_bucket_first(b)' through
+ * 'data_region_stats_bucket_first(b + 1) - 1' nanoseconds, so every
+ * power of two is split into four buckets (at most 25% apart). */
+#define DATA_REGION_STATS_LATENCY_BUCKETS 252
+
+/* Snapshot of the counters of the optional instrumentation, which is
+ * compiled in by defining DATA_REGION_STATS before including this header
+ * (and which then requires POSIX's 'clock_gettime'). Each thread counts
+ * into its own DataRegionStats, and 'data_region_stats_snapshot' adds up
+ * those of all threads (including finished ones). Only the operations
+ * that the application calls are counted, not the ones that they use
+ * internally (for example, the adds of a negative crop).
+ * @see data_region_stats_snapshot */
+typedef struct DataRegionStats
+{
+  /* The number of calls of each DataRegionStatsOperation. Adds and removes
+   * include their '_delta' variants. */
+  uint64_t calls[DATA_REGION_STATS_OPERATION_COUNT];
+
+  /* The number of adds and removes that returned
+   * DATA_REGION_SET_OUT_OF_SPACE. */
+  uint64_t out_of_space;
+
+  /* The number of stored DataRegions that adds combined with the added
+   * one. */
+  uint64_t regions_merged;
+
+  /* The number of stored DataRegions that removes split in two. */
+  uint64_t regions_split;
+
+  /* The number of stored DataRegions that were shifted to make room for
+   * (or to close the gap of) inserted (or removed) DataRegions. */
+  uint64_t regions_shifted;
+
+  /* The latency histogram of each DataRegionStatsOperation, in
+   * nanoseconds. */
+  uint64_t latency[DATA_REGION_STATS_OPERATION_COUNT][DATA_REGION_STATS_LATENCY_BUCKETS];
+} DataRegionStats;
+
+/* Gets the first latency (in nanoseconds) of a bucket of a latency
+ * histogram of a DataRegionStats.
+ * @param bucket - The bucket, from 0 through
+ *        DATA_REGION_STATS_LATENCY_BUCKETS.
+ * @returns - The first latency of the bucket (or, for
+ *          DATA_REGION_STATS_LATENCY_BUCKETS, one past the last latency of
+ *          the last bucket). */
+uint64_t data_region_stats_bucket_first(int bucket)
+{
+  if(bucket < 4)
+    return (uint64_t)bucket;
+  if(bucket >= DATA_REGION_STATS_LATENCY_BUCKETS)
+    return UINT64_MAX;
+  return (uint64_t)(4 + (bucket % 4)) << ((bucket / 4) - 1);
+}
+
+/* Gets a percentile of a latency histogram of a DataRegionStats.
+ * @param stats - The DataRegionStats.
+ * @param operation - The DataRegionStatsOperation.
+ * @param percentile - The percentile, from 0 through 100.
+ * @returns - The last latency (in nanoseconds) of the bucket that holds the
+ *          percentile, or zero if no latency was recorded. */
+uint64_t data_region_stats_latency_percentile(const DataRegionStats* stats, DataRegionStatsOperation operation, double percentile)
+{
+  uint64_t total = 0;
+  for(int i = 0; i < DATA_REGION_STATS_LATENCY_BUCKETS; i++)
+    total += stats->latency[operation][i];
+  if(total == 0)
+    return 0;
+
+  double rank = (percentile / 100.0) * (double)total;
+  uint64_t seen = 0;
+  for(int i = 0; i < DATA_REGION_STATS_LATENCY_BUCKETS; i++)
+  {
+    seen += stats->latency[operation][i];
+    if(seen > 0 && (double)seen >= rank)
+      return data_region_stats_bucket_first(i + 1) - 1;
+  }
+  return UINT64_MAX;
+}
+
+#ifdef __cplusplus
+#define _DATA_REGION_THREAD_LOCAL thread_local
+#else
+#define _DATA_REGION_THREAD_LOCAL _Thread_local
+#endif
+
+#if defined(DATA_REGION_STATS) || defined(DATA_REGION_RECORD)
+#include <time.h>
+
+/* Internal function to get a monotonic time in nanoseconds. */
+uint64_t _data_region_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000000000u) + (uint64_t)now.tv_nsec;
+}
+#endif
+
+#ifdef DATA_REGION_STATS
+/* Internal counters of one thread. Only the owning thread writes them, and
+ * 'data_region_stats_snapshot' reads them concurrently, so they are
+ * accessed with relaxed atomic loads and stores (but no read-modify-write
+ * instructions). They are never freed, so the counts of finished threads
+ * remain. */
+typedef struct _DataRegionStatsThread
+{
+  DataRegionStats stats;
+
+  /* The number of instrumented operations that the thread is in, so that
+   * the operations that they use internally aren't counted. */
+  int64_t depth;
+
+  struct _DataRegionStatsThread* next;
+} _DataRegionStatsThread;
+
+/* Internal list of the counters of all threads. */
+_DataRegionStatsThread* _data_region_stats_threads = NULL;
+
+/* Internal counters of the calling thread. */
+_DATA_REGION_THREAD_LOCAL _DataRegionStatsThread* _data_region_stats_local = NULL;
+
+/* Internal function to get the counters of the calling thread.
+ * @returns - The counters, or NULL if they couldn't be allocated (in which
+ *          case nothing is counted). */
+_DataRegionStatsThread* _data_region_stats_thread()
+{
+  if(_data_region_stats_local == NULL)
+  {
+    _DataRegionStatsThread* local = (_DataRegionStatsThread*)calloc(1, sizeof(_DataRegionStatsThread));
+    if(local == NULL)
+      return NULL;
+
+    local->next = __atomic_load_n(&_data_region_stats_threads, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&_data_region_stats_threads, &local->next, local, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+    _data_region_stats_local = local;
+  }
+  return _data_region_stats_local;
+}
+
+/* Internal function to add to a counter of the calling thread. */
+void _data_region_stats_add(uint64_t* counter, uint64_t amount)
+{
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+/* Internal function to start counting an operation.
+ * @returns - The start time of the operation. */
+uint64_t _data_region_stats_begin()
+{
+  _DataRegionStatsThread* local = _data_region_stats_thread();
+  if(local == NULL)
+    return 0;
+
+  local->depth++;
+  return local->depth == 1 ? _data_region_now() : 0;
+}
+
+/* Internal function to finish counting an operation. */
+void _data_region_stats_end(DataRegionStatsOperation operation, uint64_t start, int isOutOfSpace)
+{
+  _DataRegionStatsThread* local = _data_region_stats_local;
+  if(local == NULL)
+    return;
+
+  if(local->depth-- == 1)
+  {
+    uint64_t latency = _data_region_now() - start;
+    int bucket = (int)latency;
+    if(latency >= 4)
+    {
+      int bit = 63 - __builtin_clzll(latency);
+      bucket = ((bit - 1) * 4) + (int)((latency >> (bit - 2)) & 3);
+    }
+    _data_region_stats_add(&local->stats.calls[operation], 1);
+    _data_region_stats_add(&local->stats.latency[operation][bucket], 1);
+    if(isOutOfSpace)
+      _data_region_stats_add(&local->stats.out_of_space, 1);
+  }
+}
+
+/* Internal function to add to a counter (see DataRegionStats), unless the
+ * calling thread is inside an operation that is used by another one. */
+void _data_region_stats_count(size_t counterOffset, uint64_t amount)
+{
+  _DataRegionStatsThread* local = _data_region_stats_thread();
+  if(local != NULL && local->depth <= 1 && amount > 0)
+    _data_region_stats_add((uint64_t*)((char*)&local->stats + counterOffset), amount);
+}
+
+/* Internal function to enter (or leave) work that an operation does
+ * internally, which '_data_region_stats_count' then doesn't count. */
+void _data_region_stats_nest(int64_t change)
+{
+  if(_data_region_stats_local != NULL)
+    _data_region_stats_local->depth += change;
+}
+
+#define _DATA_REGION_STATS_BEGIN() uint64_t _statsStart = _data_region_stats_begin()
+#define _DATA_REGION_STATS_END(operation, isOutOfSpace) _data_region_stats_end(operation, _statsStart, isOutOfSpace)
+#define _DATA_REGION_STATS_COUNT(counter, amount) _data_region_stats_count(offsetof(DataRegionStats, counter), (uint64_t)(amount))
+#define _DATA_REGION_STATS_NEST(change) _data_region_stats_nest(change)
+#else
+#define _DATA_REGION_STATS_BEGIN() ((void)0)
+#define _DATA_REGION_STATS_END(operation, isOutOfSpace) ((void)0)
+#define _DATA_REGION_STATS_COUNT(counter, amount) ((void)0)
+#define _DATA_REGION_STATS_NEST(change) ((void)0)
+#endif
+
+/* Gets the counters of the optional instrumentation (see DataRegionStats),
+ * added up over all threads.
+ * @param dst - Assigned to the counters. If this is NULL, then nothing will
+ *        happen.
+ * @returns - True (1) if the instrumentation is compiled in, otherwise false
+ *          (0), in which case all counters are zero.
+ * @remarks - Each counter is read atomically, but not all of them at the
+ *          same time, so counts of concurrent operations may be partially
+ *          included. Take two snapshots and subtract them to measure an
+ *          interval. */
+int data_region_stats_snapshot(DataRegionStats* dst)
+{
+  if(dst == NULL)
+    return 0;
+
+  memset(dst, 0, sizeof(DataRegionStats));
+#ifdef DATA_REGION_STATS
+  const size_t counterCount = sizeof(DataRegionStats) / sizeof(uint64_t);
+  for(_DataRegionStatsThread* thread = __atomic_load_n(&_data_region_stats_threads, __ATOMIC_ACQUIRE); thread != NULL; thread = thread->next)
+  {
+    uint64_t* src = (uint64_t*)&thread->stats;
+    uint64_t* sum = (uint64_t*)dst;
+    for(size_t i = 0; i < counterCount; i++)
+      sum[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+  }
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/* One operation that the optional recording captured (see
+ * data_region_record_collect).
+ * @see data_region_record_collect */
+typedef struct DataRegionRecordEntry
+{
+  /* The monotonic time at which the operation was recorded, in
+   * nanoseconds. The timestamps of each thread strictly increase, and they
+   * order the operations of different threads. */
+  uint64_t timestamp;
+
+  /* The position of the operation among the recorded operations of its
+   * thread, starting at zero. */
+  uint64_t sequence;
+
+  /* The DataRegionSet that the operation used (the source set of the crop
+   * operations). It may have been freed since. */
+  const DataRegionSet* set;
+
+  DataRegionStatsOperation operation;
+
+  /* The DataRegion argument (the boundary region of the crop operations). */
+  DataRegion region;
+
+  /* The returned DataRegionSetResult (adds and removes) or number of
+   * DataRegions (crops). */
+  int64_t result;
+} DataRegionRecordEntry;
+
+/* The size of the ring buffer of the recording per thread, which has to be
+ * a power of two. It keeps the last DATA_REGION_RECORD_CAPACITY - 1
+ * operations of the thread; older operations are overwritten. */
+#ifndef DATA_REGION_RECORD_CAPACITY
+#define DATA_REGION_RECORD_CAPACITY 16384
+#endif
+
+#ifdef DATA_REGION_RECORD
+/* Internal ring buffer of the recorded operations of one thread. Only the
+ * owning thread writes it, and 'data_region_record_collect' reads it
+ * concurrently, so every field of an entry is accessed atomically, and
+ * each slot is a seqlock: its 'ready' value is zero while the entry is
+ * written, and then the number of entries that were written up to and
+ * including it. A reader that sees the same nonzero 'ready' value before
+ * and after copying an entry got an intact copy. The buffers are never
+ * freed. */
+typedef struct _DataRegionRecordThread
+{
+  DataRegionRecordEntry entries[DATA_REGION_RECORD_CAPACITY];
+
+  uint64_t ready[DATA_REGION_RECORD_CAPACITY];
+
+  /* The number of entries that were ever written. */
+  uint64_t head;
+
+  /* The timestamp of the last written entry (only used by the owning
+   * thread). */
+  uint64_t last_timestamp;
+
+  struct _DataRegionRecordThread* next;
+} _DataRegionRecordThread;
+
+/* Internal list of the ring buffers of all threads. */
+_DataRegionRecordThread* _data_region_record_threads = NULL;
+
+/* Internal ring buffer of the calling thread. */
+_DATA_REGION_THREAD_LOCAL _DataRegionRecordThread* _data_region_record_local = NULL;
+
+/* Internal function to record an operation into the ring buffer of the
+ * calling thread. Operations with a NULL set or an invalid DataRegion
+ * aren't recorded, since they can't be replayed. */
+void _data_region_record(DataRegionStatsOperation operation, const DataRegionSet* set, DataRegion region, int64_t result)
+{
+  if(set == NULL || region.first_index > region.last_index)
+    return;
+
+  _DataRegionRecordThread* local = _data_region_record_local;
+  if(local == NULL)
+  {
+    local = (_DataRegionRecordThread*)calloc(1, sizeof(_DataRegionRecordThread));
+    if(local == NULL)
+      return;
+
+    local->next = __atomic_load_n(&_data_region_record_threads, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&_data_region_record_threads, &local->next, local, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+    _data_region_record_local = local;
+  }
+
+  //Timestamps only order the threads, so they don't need to be unique across them
+  uint64_t timestamp = _data_region_now();
+  if(timestamp <= local->last_timestamp)
+    timestamp = local->last_timestamp + 1;
+  local->last_timestamp = timestamp;
+
+  //Marking the slot as being written has to be visible before any of its fields change
+  uint64_t head = local->head;
+  uint64_t slot = head & (DATA_REGION_RECORD_CAPACITY - 1);
+  DataRegionRecordEntry* entry = &local->entries[slot];
+  __atomic_store_n(&local->ready[slot], 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&entry->timestamp, timestamp, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->sequence, head, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->set, set, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->operation, operation, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->region.first_index, region.first_index, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->region.last_index, region.last_index, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->result, result, __ATOMIC_RELAXED);
+  __atomic_store_n(&local->ready[slot], head + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&local->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#define _DATA_REGION_RECORD(operation, set, region, result) _data_region_record(operation, set, region, (int64_t)(result))
+#else
+#define _DATA_REGION_RECORD(operation, set, region, result) ((void)0)
+#endif
+
+/* Gets the current timestamp of the optional recording, which is compiled
+ * in by defining DATA_REGION_RECORD before including this header. The
+ * operations that are recorded after this call have at least this
+ * timestamp.
+ * @returns - The timestamp, or zero if the recording isn't compiled in.
+ * @see data_region_record_collect */
+uint64_t data_region_record_timestamp()
+{
+#ifdef DATA_REGION_RECORD
+  return _data_region_now();
+#else
+  return 0;
+#endif
+}
+
+/* Gets the maximum number of entries that 'data_region_record_collect'
+ * can currently return.
+ * @returns - DATA_REGION_RECORD_CAPACITY times the number of threads that
+ *          recorded an operation, or zero if the recording isn't compiled
+ *          in. */
+int64_t data_region_record_retained()
+{
+  int64_t retained = 0;
+#ifdef DATA_REGION_RECORD
+  for(_DataRegionRecordThread* thread = __atomic_load_n(&_data_region_record_threads, __ATOMIC_ACQUIRE); thread != NULL; thread = thread->next)
+    retained += DATA_REGION_RECORD_CAPACITY;
+#endif
+  return retained;
+}
+
+/* Internal comparison function (for 'qsort') which orders
+ * DataRegionRecordEntries by their timestamp. */
+int _data_region_record_compare(const void* a, const void* b)
+{
+  uint64_t aTimestamp = ((const DataRegionRecordEntry*)a)->timestamp;
+  uint64_t bTimestamp = ((const DataRegionRecordEntry*)b)->timestamp;
+  return (aTimestamp > bTimestamp) - (aTimestamp < bTimestamp);
+}
+
+/* Copies the operations that the optional recording captured. When
+ * DATA_REGION_RECORD is defined before including this header, every add,
+ * remove, crop, count crop and negative crop (including the '_delta'
+ * variants) is recorded with its arguments, result and timestamp into a
+ * ring buffer of the calling thread (see DATA_REGION_RECORD_CAPACITY), so
+ * that recording doesn't write any memory shared between threads. The
+ * ring buffers are merged by timestamp when collecting them, which doesn't
+ * stop the recording.
+ * @param dst - The destination array.
+ * @param dstCapacity - The number of entries that fit into 'dst', which
+ *        should be at least 'data_region_record_retained()'.
+ * @param set - Only the operations on this DataRegionSet are copied. If
+ *        this is NULL, then the operations on all sets are copied.
+ * @param fromTimestamp - Only the operations with at least this timestamp
+ *        are copied. Pass the timestamp after the last collected entry to
+ *        continue where a previous call stopped.
+ * @param lost - Optional pointer to an integer that will be assigned to
+ *        true (1) if operations at or after 'fromTimestamp' may have been
+ *        overwritten before they were copied, otherwise false (0).
+ * @returns - The number of entries copied into 'dst', ordered by timestamp,
+ *          or -1 if 'dst' is NULL or too small (in which case its contents
+ *          are undefined).
+ * @remarks - If the recording isn't compiled in, then zero is returned.
+ *          The operations of a thread are ordered the same way as they
+ *          happened. So are the operations of a set, as long as they are
+ *          synchronized (which a DataRegionSet requires anyway) and the
+ *          monotonic clock ticks between them; operations of different
+ *          threads within the same nanosecond may be ordered either way.
+ * @see data_region_trace_write_recording */
+int64_t data_region_record_collect(DataRegionRecordEntry* dst, int64_t dstCapacity, const DataRegionSet* set, uint64_t fromTimestamp, int* lost)
+{
+  int lostPlaceholder;
+  if(lost == NULL)
+    lost = &lostPlaceholder;
+  *lost = 0;
+
+  if(dst == NULL)
+    return -1;
+
+  int64_t count = 0;
+#ifdef DATA_REGION_RECORD
+  for(_DataRegionRecordThread* thread = __atomic_load_n(&_data_region_record_threads, __ATOMIC_ACQUIRE); thread != NULL; thread = thread->next)
+  {
+    uint64_t head = __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE);
+    //The slot of the oldest entry is overwritten by the next one, so it's never read
+    uint64_t oldest = head >= DATA_REGION_RECORD_CAPACITY ? head - DATA_REGION_RECORD_CAPACITY + 1 : 0;
+    for(uint64_t i = oldest; i < head; i++)
+    {
+      if(count >= dstCapacity)
+        return -1;
+
+      uint64_t slot = i & (DATA_REGION_RECORD_CAPACITY - 1);
+      const DataRegionRecordEntry* entry = &thread->entries[slot];
+      int intact = __atomic_load_n(&thread->ready[slot], __ATOMIC_ACQUIRE) == i + 1;
+      dst[count].timestamp = __atomic_load_n(&entry->timestamp, __ATOMIC_RELAXED);
+      dst[count].sequence = __atomic_load_n(&entry->sequence, __ATOMIC_RELAXED);
+      dst[count].set = __atomic_load_n(&entry->set, __ATOMIC_RELAXED);
+      dst[count].operation = __atomic_load_n(&entry->operation, __ATOMIC_RELAXED);
+      dst[count].region.first_index = __atomic_load_n(&entry->region.first_index, __ATOMIC_RELAXED);
+      dst[count].region.last_index = __atomic_load_n(&entry->region.last_index, __ATOMIC_RELAXED);
+      dst[count].result = __atomic_load_n(&entry->result, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if(!intact || __atomic_load_n(&thread->ready[slot], __ATOMIC_RELAXED) != i + 1)
+      {
+        //Overwritten while it was copied; its timestamp is unknown, so assume that it was wanted
+        *lost = 1;
+        continue;
+      }
+      if(i == oldest && oldest > 0 && dst[count].timestamp > fromTimestamp)
+        *lost = 1;
+      if(dst[count].timestamp >= fromTimestamp && (set == NULL || dst[count].set == set))
+        count++;
+    }
+  }
+  qsort(dst, (size_t)count, sizeof(DataRegionRecordEntry), _data_region_record_compare);
+#else
+  (void)dstCapacity;
+  (void)set;
+  (void)fromTimestamp;
+#endif
+  return count;
+}
+
 /* Internal function to initialize a DataRegionSet structure.
  * @param set - Pointer to the DataRegionSet to initialize.
  * @param regions - Pointer to the DataRegion array.
@@ -58,7 +589,7 @@ void _data_region_set_init(DataRegionSet* set, DataRegion* regions, int64_t capa
  *          'DataRegionSet' structure, then NULL will be returned. */
 DataRegionSet* data_region_set_init_in(void* dst, int64_t dstSize)
 {
-  if(dst == NULL || dstSize < sizeof(DataRegionSet))
+  if(dst == NULL || dstSize < (int64_t)sizeof(DataRegionSet))
     return NULL;
 
   int64_t sizeForRegions = dstSize - (int64_t)sizeof(DataRegionSet);
@@ -66,7 +597,7 @@ DataRegionSet* data_region_set_init_in(void* dst, int64_t dstSize)
   if(numRegions < 0)
     return NULL;
 
-  DataRegionSet* set = dst;
+  DataRegionSet* set = (DataRegionSet*)dst;
   _data_region_set_init(set, (DataRegion*)((uint8_t*)dst + sizeof(DataRegionSet)), numRegions);
   return set;
 }
@@ -268,6 +799,8 @@ DataRegion data_region_combine(DataRegion a, DataRegion b)
 void _data_region_set_remove_at(DataRegionSet* set, int64_t index)
 {
   int64_t removeLength = data_region_length(set->regions[index]);
+  _DATA_REGION_STATS_COUNT(regions_shifted, set->count - 1 - index);
+  _DATA_REGION_PROBE3(shift, set, index + 1, set->count - 1 - index);
   //Move all values 'up' after the remove index
   for (int64_t i = index; i < set->count - 1; i++)
     set->regions[i] = set->regions[i + 1];
@@ -285,6 +818,8 @@ void _data_region_set_remove_at(DataRegionSet* set, int64_t index)
  *          Instead, the application should call 'data_region_set_add'. */
 void _data_region_set_insert_at(DataRegionSet* set, DataRegion toInsert, int64_t index)
 {
+  _DATA_REGION_STATS_COUNT(regions_shifted, set->count - index);
+  _DATA_REGION_PROBE3(shift, set, index, set->count - index);
   //Move all values 'down' after the insert index
   for (int64_t i = set->count; i > index; i--)
     set->regions[i] = set->regions[i - 1];
@@ -295,6 +830,119 @@ void _data_region_set_insert_at(DataRegionSet* set, DataRegion toInsert, int64_t
   set->total_length += data_region_length(toInsert);
 }
 
+/* Internal comparison function (for 'qsort') which orders DataRegions by
+ * their first index.
+ * @param a - Pointer to the first DataRegion.
+ * @param b - Pointer to the second DataRegion.
+ * @returns - A negative value if 'a' starts before 'b', a positive value if
+ *          'a' starts after 'b', otherwise zero. */
+int _data_region_compare_first_index(const void* a, const void* b)
+{
+  int64_t aFirst = ((const DataRegion*)a)->first_index;
+  int64_t bFirst = ((const DataRegion*)b)->first_index;
+  return (aFirst > bFirst) - (aFirst < bFirst);
+}
+
+/* Internal function to sort an array of (valid) DataRegions and to combine
+ * all combinable DataRegions within it, in place.
+ * @param regions - The DataRegion array.
+ * @param count - The number of DataRegions in 'regions'.
+ * @returns - The number of DataRegions remaining in 'regions', which are
+ *          then stored in the same order as in a DataRegionSet. */
+int64_t _data_region_array_normalize(DataRegion* regions, int64_t count)
+{
+  if (count <= 1)
+    return count;
+
+  qsort(regions, (size_t)count, sizeof(DataRegion), _data_region_compare_first_index);
+
+  int64_t resultCount = 1;
+  for (int64_t i = 1; i < count; i++)
+  {
+    if (data_region_can_combine(regions[resultCount - 1], regions[i]))
+      regions[resultCount - 1] = data_region_combine(regions[resultCount - 1], regions[i]);
+    else
+      regions[resultCount++] = regions[i];
+  }
+  return resultCount;
+}
+
+/* Internal function to merge two normalized DataRegion arrays (sorted, with
+ * no combinable DataRegions) into their union.
+ * @param dst - The destination array, which must be able to hold
+ *        'aCount' + 'bCount' DataRegions and must not overlap the inputs.
+ * @param a - The first normalized array.
+ * @param aCount - The number of DataRegions in 'a'.
+ * @param b - The second normalized array.
+ * @param bCount - The number of DataRegions in 'b'.
+ * @returns - The number of DataRegions written to 'dst', which is normalized.
+ * @remarks - This takes O(aCount + bCount) time, whereas adding each
+ *          DataRegion of 'b' to a DataRegionSet would shift the stored
+ *          DataRegions once per add. */
+int64_t _data_region_array_union(DataRegion* dst, const DataRegion* a, int64_t aCount, const DataRegion* b, int64_t bCount)
+{
+  int64_t count = 0, i = 0, j = 0;
+  while (i < aCount || j < bCount)
+  {
+    DataRegion next;
+    if (j >= bCount || (i < aCount && a[i].first_index <= b[j].first_index))
+      next = a[i++];
+    else
+      next = b[j++];
+
+    if (count > 0 && data_region_can_combine(dst[count - 1], next))
+      dst[count - 1] = data_region_combine(dst[count - 1], next);
+    else
+      dst[count++] = next;
+  }
+  return count;
+}
+
+/* Internal function to subtract one normalized DataRegion array from
+ * another.
+ * @param dst - The destination array, which must be able to hold
+ *        'aCount' + 'bCount' DataRegions and must not overlap the inputs.
+ * @param a - The normalized array to subtract from.
+ * @param aCount - The number of DataRegions in 'a'.
+ * @param b - The normalized array of DataRegions to subtract.
+ * @param bCount - The number of DataRegions in 'b'.
+ * @returns - The number of DataRegions written to 'dst', which is normalized.
+ * @remarks - This takes O(aCount + bCount) time. */
+int64_t _data_region_array_difference(DataRegion* dst, const DataRegion* a, int64_t aCount, const DataRegion* b, int64_t bCount)
+{
+  int64_t count = 0, j = 0;
+  for (int64_t i = 0; i < aCount; i++)
+  {
+    DataRegion current = a[i];
+    int remaining = 1;
+
+    //Skip the subtracted DataRegions that end before 'current'
+    while (j < bCount && b[j].last_index < current.first_index)
+      j++;
+
+    for (int64_t k = j; k < bCount && b[k].first_index <= current.last_index; k++)
+    {
+      if (b[k].first_index > current.first_index)
+      {
+        //The left portion of 'current' remains
+        DataRegion leftPortion = { current.first_index, b[k].first_index - 1 };
+        dst[count++] = leftPortion;
+      }
+
+      if (b[k].last_index >= current.last_index)
+      {
+        remaining = 0;//Nothing of 'current' remains
+        break;
+      }
+      current.first_index = b[k].last_index + 1;
+    }
+
+    if (remaining)
+      dst[count++] = current;
+  }
+  return count;
+}
+
 /* Defines the result of a DataRegionSet operation. */
 typedef enum DataRegionSetResult
 {
@@ -312,95 +960,60 @@ typedef enum DataRegionSetResult
    * was full and the operation needed to insert at least one
    * more DataRegion. */
   DATA_REGION_SET_OUT_OF_SPACE = -3,
+
+  /* The operation failed because memory could not be allocated. This is
+   * only returned by the DataRegionSet variants which allocate their own
+   * storage (such as the DataRegionCowSet), in which case nothing will
+   * have changed. */
+  DATA_REGION_SET_ALLOCATION_FAILED = -4,
 } DataRegionSetResult;
 
-/* Adds a DataRegion to a DataRegionSet.
- * @param set - The destination DataRegionSet. If this is NULL, then
- *        DATA_REGION_SET_NULL_ARG will be returned.
- * @param toAdd - The DataRegion to add. If this is invalid (see
- *        data_region_is_valid), then DATA_REGION_SET_INVALID_REGION will
- *        be returned.
- * @returns - The DataRegionSetResult that defines the result of the add
- *          operation. If all arguments are non-null and valid, then the
- *          result will be either DATA_REGION_SET_SUCCESS or
- *          DATA_REGION_SET_OUT_OF_SPACE.
- * @remarks - The input DataRegion will be 'combined' with any combinable
- *          DataRegions in the set (see 'data_region_can_combine'), so it's
- *          possible for the 'count' of the DataRegionSet to be reduced. If
- *          there is no remaining space in the DataRegionSet, and the input
- *          DataRegion can't be combined with any stored DataRegion, them
- *          DATA_REGION_SET_OUT_OF_SPACE will be returned and nothing will
- *          change. */
-DataRegionSetResult data_region_set_add(DataRegionSet* set, DataRegion toAdd)
+/* Internal function to find the first DataRegion in a DataRegionSet that
+ * ends at or after a specific index.
+ * @param set - Pointer to the DataRegionSet to search.
+ * @param index - The index to search for.
+ * @returns - The zero-based position of the first DataRegion whose
+ *          'last_index' is greater than or equal to 'index', or the 'count'
+ *          of the DataRegionSet if there is no such DataRegion.
+ * @remarks - This is a binary search, so it takes O(log n) time. */
+int64_t _data_region_set_lower_bound(const DataRegionSet* set, int64_t index)
 {
-  if(set == NULL)
-    return DATA_REGION_SET_NULL_ARG;
-  if(!data_region_is_valid(toAdd))
-    return DATA_REGION_SET_INVALID_REGION;
-
-  int64_t insertPos = 0;
-
-  //Find where to insert 'toAdd', and also remove any 'combinable' DataRegions
-  for (int64_t i = 0; i < set->count; i++)
+  int64_t low = 0, high = set->count;
+  while (low < high)
   {
-    DataRegion current = set->regions[i];
-
-    if (data_region_can_combine(current, toAdd))
-    {
-      //Remove this DataRegion since it will be combined with 'toAdd'
-      _data_region_set_remove_at(set, i);
-      toAdd = data_region_combine(current, toAdd);
-      i--;//Since we removed a DataRegion
-    }
+    int64_t mid = low + ((high - low) / 2);
+    if (set->regions[mid].last_index < index)
+      low = mid + 1;
     else
-    {
-      if (current.last_index < toAdd.first_index)
-        insertPos = i + 1;
-
-      if (current.first_index > toAdd.last_index)
-        break;//Done finding the insert position and removing combinable DataRegions
-    }
-  }
-
-  if(set->count < set->capacity)
-  {
-    //Insert 'toAdd'
-    _data_region_set_insert_at(set, toAdd, insertPos);
-    return DATA_REGION_SET_SUCCESS;
-  }
-  else
-  {
-    //Capacity is full, cannot add
-    return DATA_REGION_SET_OUT_OF_SPACE;
+      high = mid;
   }
+  return low;
 }
 
-/* Removes a DataRegion from a DataRegionSet.
- * @param set - Pointer to the DataRegionSet from which to remove the
- *        DataRegion. If this argument is NULL, then
- *        DATA_REGION_SET_NULL_ARG will be returned.
- * @param toRemove - The DataRegion to remove. If this is invalid
- *        (see data_region_is_valid), then DATA_REGION_SET_INVALID_REGION
- *        will be returned.
- * @returns - The DataRegionSetResult that defined the result of the removal
- *          operation. If all arguments are non-null and valid, then the result
- *          is either DATA_REGION_SET_SUCCESS or DATA_REGION_SET_OUT_OF_SPACE.
- * @remarks - This function will 'subtract' from all DataRegions stored in the
- *          set that intersect with 'toRemove'. It's possible for this
- *          'subtraction' to cause an existing DataRegion to be split into two
- *          DataRegions. Note that this means it's possible for the 'count' of
- *          the DataRegionSet to increase after a removal operation. It's also
- *          possible that the removal operation may fail if the DataRegionSet
- *          was full before a split was required, in which case
- *          DATA_REGION_SET_OUT_OF_SPACE will be returned and the DataRegionSet
- *          will remain unchanged. */
-DataRegionSetResult data_region_set_remove(DataRegionSet* set, DataRegion toRemove)
+/* Internal function to check whether a DataRegion can be added to a
+ * DataRegionSet without exceeding its capacity.
+ * @param set - Pointer to the DataRegionSet.
+ * @param toAdd - The (valid) DataRegion that would be added.
+ * @returns - True (1) if 'data_region_set_add' would succeed, otherwise
+ *          false (0). */
+int _data_region_set_can_add(const DataRegionSet* set, DataRegion toAdd)
 {
-  if(set == NULL)
-    return DATA_REGION_SET_NULL_ARG;
-  if(!data_region_is_valid(toRemove))
-    return DATA_REGION_SET_INVALID_REGION;
+  if (set->count < set->capacity)
+    return 1;
+
+  //The set is full, so 'toAdd' must be combined with an existing DataRegion
+  int64_t i = _data_region_set_lower_bound(set, toAdd.first_index > INT64_MIN ? toAdd.first_index - 1 : toAdd.first_index);
+  return i < set->count && data_region_can_combine(set->regions[i], toAdd);
+}
 
+/* Internal function to check whether a DataRegion can be removed from a
+ * DataRegionSet without exceeding its capacity.
+ * @param set - Pointer to the DataRegionSet.
+ * @param toRemove - The (valid) DataRegion that would be removed.
+ * @returns - True (1) if 'data_region_set_remove' would succeed, otherwise
+ *          false (0). */
+int _data_region_set_can_remove(const DataRegionSet* set, DataRegion toRemove)
+{
   if (set->count == set->capacity)
   {
     /* Oh no, we may not have enough memory to complete the remove operation!
@@ -441,65 +1054,348 @@ DataRegionSetResult data_region_set_remove(DataRegionSet* set, DataRegion toRemo
     }
 
     if (insertCount > removeCount)
-    {
-      //We cannot remove, we need more capacity due to the split DataRegions
-      return DATA_REGION_SET_OUT_OF_SPACE;
-    }
+      return 0;//We need more capacity due to the split DataRegions
   }
 
-  //Remove all DataRegions within 'toRemove'
-  for (int64_t i = 0; i < set->count; i++)
+  return 1;
+}
+
+/* Internal function to find the stored DataRegions that a batch of
+ * DataRegions is merged with by '_data_region_set_merge'.
+ * @param set - Pointer to the DataRegionSet.
+ * @param batch - The normalized DataRegions to add or remove.
+ * @param batchCount - The number of DataRegions in 'batch' (at least one).
+ * @param isAdd - True (1) if the DataRegions are added, otherwise false (0).
+ * @param windowStart - Receives the index of the first stored DataRegion.
+ * @param windowEnd - Receives the index after the last stored DataRegion. */
+void _data_region_set_merge_window(const DataRegionSet* set, const DataRegion* batch, int64_t batchCount, int isAdd, int64_t* windowStart, int64_t* windowEnd)
+{
+  int64_t first = batch[0].first_index;
+  int64_t last = batch[batchCount - 1].last_index;
+  if (isAdd)
   {
-    DataRegion currentRegion = set->regions[i];
-    if (data_region_intersects(currentRegion, toRemove))
-    {
-      _data_region_set_remove_at(set, i);//Remove 'currentRegion'
+    //Adjacent DataRegions are combined, too
+    first = first > INT64_MIN ? first - 1 : first;
+    last = last < INT64_MAX ? last + 1 : last;
+  }
+  *windowStart = _data_region_set_lower_bound(set, first);
+  *windowEnd = _data_region_set_lower_bound(set, last);
+  if (*windowEnd < set->count && set->regions[*windowEnd].first_index <= last)
+    (*windowEnd)++;
+}
 
-      if (currentRegion.first_index < toRemove.first_index)
-      {
-        //The left portion of 'currentRegion' will remain (so we will add it to 'regions')
-        DataRegion leftPortion = { currentRegion.first_index, toRemove.first_index - 1 };
-        _data_region_set_insert_at(set, leftPortion, i++);
-      }
+/* Internal function to add (or remove) a whole batch of DataRegions to (or
+ * from) a DataRegionSet with one merge pass.
+ * @param set - Pointer to the DataRegionSet.
+ * @param batch - The DataRegions to add or remove, which must be normalized
+ *        (see '_data_region_array_normalize').
+ * @param batchCount - The number of DataRegions in 'batch'.
+ * @param isAdd - True (1) to add the DataRegions, otherwise false (0) to
+ *        remove them.
+ * @param scratch - Scratch space for at least 'batchCount' DataRegions plus
+ *        the DataRegions of the merge window (see
+ *        '_data_region_set_merge_window'), which are at most 'count'.
+ * @returns - DATA_REGION_SET_SUCCESS, or DATA_REGION_SET_OUT_OF_SPACE if the
+ *          result would exceed the capacity of the set (in which case nothing
+ *          will change).
+ * @remarks - Only the stored DataRegions between the first and the last
+ *          DataRegion of the batch are merged, and the DataRegions after them
+ *          are shifted once for the whole batch. */
+DataRegionSetResult _data_region_set_merge(DataRegionSet* set, const DataRegion* batch, int64_t batchCount, int isAdd, DataRegion* scratch)
+{
+  if (batchCount == 0)
+    return DATA_REGION_SET_SUCCESS;
 
-      if (currentRegion.last_index > toRemove.last_index)
-      {
-        //The right portion of 'currentRegion' will remain (so we will add it to 'regions')
-        DataRegion rightPortion = { toRemove.last_index + 1, currentRegion.last_index };
-        _data_region_set_insert_at(set, rightPortion, i++);
-      }
+  int64_t windowStart, windowEnd;
+  _data_region_set_merge_window(set, batch, batchCount, isAdd, &windowStart, &windowEnd);
 
-      i--;//Since we removed 'currentRegion' (must do this AFTER potentially keeping left/right portions above)
-    }
-    else
+  int64_t mergedCount;
+  if (isAdd)
+    mergedCount = _data_region_array_union(scratch, set->regions + windowStart, windowEnd - windowStart, batch, batchCount);
+  else
+    mergedCount = _data_region_array_difference(scratch, set->regions + windowStart, windowEnd - windowStart, batch, batchCount);
+
+  int64_t newCount = set->count - (windowEnd - windowStart) + mergedCount;
+  if (newCount > set->capacity)
+    return DATA_REGION_SET_OUT_OF_SPACE;
+
+  //Shift the DataRegions after the window once, then copy the merged window into place
+  for (int64_t i = windowStart; i < windowEnd; i++)
+    set->total_length -= data_region_length(set->regions[i]);
+  if (mergedCount != windowEnd - windowStart)
+  {
+    memmove(set->regions + windowStart + mergedCount, set->regions + windowEnd, sizeof(DataRegion) * (set->count - windowEnd));
+    _DATA_REGION_STATS_COUNT(regions_shifted, set->count - windowEnd);
+    _DATA_REGION_PROBE3(shift, set, windowEnd, set->count - windowEnd);
+  }
+  memcpy(set->regions + windowStart, scratch, sizeof(DataRegion) * mergedCount);
+  for (int64_t i = 0; i < mergedCount; i++)
+    set->total_length += data_region_length(scratch[i]);
+  set->count = newCount;
+  return DATA_REGION_SET_SUCCESS;
+}
+
+/* Function that receives one byte range that an add or a removal changed.
+ * @see data_region_set_add_delta
+ * @see data_region_set_remove_delta */
+typedef void (*DataRegionDeltaCallback)(void* context, DataRegion changed);
+
+/* Internal function to replace the DataRegions at ['start', 'end') of a
+ * DataRegionSet with other DataRegions, shifting the DataRegions after them
+ * once.
+ * @param removedLength - The total length of the replaced DataRegions. */
+void _data_region_set_replace(DataRegionSet* set, int64_t start, int64_t end, int64_t removedLength, const DataRegion* replacements, int64_t replacementCount)
+{
+  if (replacementCount != end - start)
+  {
+    memmove(set->regions + start + replacementCount, set->regions + end, sizeof(DataRegion) * (set->count - end));
+    _DATA_REGION_STATS_COUNT(regions_shifted, set->count - end);
+    _DATA_REGION_PROBE3(shift, set, end, set->count - end);
+  }
+  for (int64_t i = 0; i < replacementCount; i++)
+  {
+    set->regions[start + i] = replacements[i];
+    set->total_length += data_region_length(replacements[i]);
+  }
+  set->count += replacementCount - (end - start);
+  set->total_length -= removedLength;
+}
+
+/* Internal function that implements 'data_region_set_add_delta'. */
+DataRegionSetResult _data_region_set_add_delta(DataRegionSet* set, DataRegion toAdd, DataRegionDeltaCallback callback, void* context, int64_t* changedLength)
+{
+  int64_t changedLengthPlaceholder;
+  if(changedLength == NULL)
+    changedLength = &changedLengthPlaceholder;
+  *changedLength = 0;
+
+  if(set == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(toAdd))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  //Find the DataRegions that 'toAdd' combines with, which are consecutive
+  int64_t start = _data_region_set_lower_bound(set, toAdd.first_index);
+  if (start > 0 && data_region_can_combine(set->regions[start - 1], toAdd))
+    start--;
+  int64_t end = start;
+  while (end < set->count && data_region_can_combine(set->regions[end], toAdd))
+    end++;
+
+  if (end == start && set->count >= set->capacity)
+  {
+    //Capacity is full, cannot add
+    return DATA_REGION_SET_OUT_OF_SPACE;
+  }
+
+  //Report the gaps of 'toAdd' between the combined DataRegions
+  DataRegion combined = toAdd;
+  int64_t removedLength = 0;
+  int64_t position = toAdd.first_index;
+  int covered = 0;
+  for (int64_t i = start; i < end; i++)
+  {
+    DataRegion current = set->regions[i];
+    removedLength += data_region_length(current);
+    combined = data_region_combine(combined, current);
+    if (covered)
+      continue;
+
+    if (current.first_index > position)
     {
-      if (set->regions[i].first_index > toRemove.last_index)
-        break;//Done checking for intersections
+      DataRegion gap = { position, current.first_index - 1 };
+      *changedLength += data_region_length(gap);
+      if (callback != NULL)
+        callback(context, gap);
     }
+    if (current.last_index >= toAdd.last_index)
+      covered = 1;
+    else if (current.last_index >= position)
+      position = current.last_index + 1;
+  }
+  if (!covered)
+  {
+    DataRegion gap = { position, toAdd.last_index };
+    *changedLength += data_region_length(gap);
+    if (callback != NULL)
+      callback(context, gap);
   }
 
+  _DATA_REGION_STATS_COUNT(regions_merged, end - start);
+  if (end > start)
+    _DATA_REGION_PROBE4(merge, set, combined.first_index, combined.last_index, end - start);
+  _data_region_set_replace(set, start, end, removedLength, &combined, 1);
   return DATA_REGION_SET_SUCCESS;
 }
 
-/* Copies a subset of DataRegions in a DataRegionSet to an array.
- * @param dst - The destination array. This may be NULL if you want to only
- *        count the DataRegions.
- * @param dstCapacity - The maximum number of DataRegions that can be stored in
- *        the 'dst' array. If this is less than zero, then zero is returned.
- * @param src - The source DataRegionSet. If 'dst' is NULL, then this argument
- *        should be zero.
- * @param boundaryRegion - The DataRegion that defines the crop boundary. No
- *        DataRegions will be read from outside of this region, and all
- *        DataRegions that cross this region will be trimmed to fit inside
- *        this region. If this region is invalid (see data_region_is_valid),
- *        then zero will be returned.
- * @param dstTooSmall - Optional pointer to an integer that will be assigned
- *        to true (1) if the destination buffer was too small to contain the
- *        cropped DataRegions, otherwise false (0). This argument may be NULL,
- *        in which case it will not be dereferenced for assignment.
- * @returns - The number of DataRegions that were found within the 'crop'
- *          region, limited to 'dstCapacity' if 'dst' was non-NULL. */
-int64_t data_region_set_crop(DataRegion* dst, int64_t dstCapacity, const DataRegionSet* src, DataRegion boundaryRegion, int* dstTooSmall)
+/* Adds a DataRegion to a DataRegionSet, and reports the byte ranges that
+ * were newly covered (the same ones that 'data_region_set_negative_crop'
+ * would have found before the add).
+ * @param set - The destination DataRegionSet. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toAdd - The DataRegion to add. If this is invalid (see
+ *        data_region_is_valid), then DATA_REGION_SET_INVALID_REGION will
+ *        be returned.
+ * @param callback - Optional function that receives each newly covered
+ *        byte range, in ascending order. It is called before the set
+ *        changes, and must not use the set.
+ * @param context - Passed to 'callback'.
+ * @param changedLength - Optional pointer to an integer that will be
+ *        assigned to the number of newly covered bytes (zero unless
+ *        DATA_REGION_SET_SUCCESS is returned).
+ * @returns - The DataRegionSetResult that defines the result of the add
+ *          operation (see 'data_region_set_add').
+ * @remarks - This finds the combinable DataRegions with a binary search and
+ *          a single pass over them, so it takes O(log n + k) time plus the
+ *          time to shift the DataRegions after them. Nothing is reported if
+ *          the add fails. */
+DataRegionSetResult data_region_set_add_delta(DataRegionSet* set, DataRegion toAdd, DataRegionDeltaCallback callback, void* context, int64_t* changedLength)
+{
+  _DATA_REGION_PROBE_ENTRY(add_entry, set, toAdd);
+  _DATA_REGION_STATS_BEGIN();
+  DataRegionSetResult result = _data_region_set_add_delta(set, toAdd, callback, context, changedLength);
+  _DATA_REGION_STATS_END(DATA_REGION_STATS_ADD, result == DATA_REGION_SET_OUT_OF_SPACE);
+  _DATA_REGION_RECORD(DATA_REGION_STATS_ADD, set, toAdd, result);
+  _DATA_REGION_PROBE_RETURN(add_return, set, result);
+  return result;
+}
+
+/* Internal function that implements 'data_region_set_remove_delta'. */
+DataRegionSetResult _data_region_set_remove_delta(DataRegionSet* set, DataRegion toRemove, DataRegionDeltaCallback callback, void* context, int64_t* changedLength)
+{
+  int64_t changedLengthPlaceholder;
+  if(changedLength == NULL)
+    changedLength = &changedLengthPlaceholder;
+  *changedLength = 0;
+
+  if(set == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(toRemove))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  //Find the DataRegions that intersect 'toRemove', which are consecutive
+  int64_t start = _data_region_set_lower_bound(set, toRemove.first_index);
+  int64_t end = start;
+  while (end < set->count && set->regions[end].first_index <= toRemove.last_index)
+    end++;
+  if (end == start)
+    return DATA_REGION_SET_SUCCESS;
+
+  //The portions of the first and last DataRegions outside of 'toRemove' remain
+  DataRegion remaining[2];
+  int64_t remainingCount = 0;
+  if (set->regions[start].first_index < toRemove.first_index)
+    remaining[remainingCount++] = (DataRegion){ set->regions[start].first_index, toRemove.first_index - 1 };
+  if (set->regions[end - 1].last_index > toRemove.last_index)
+    remaining[remainingCount++] = (DataRegion){ toRemove.last_index + 1, set->regions[end - 1].last_index };
+
+  if (set->count - (end - start) + remainingCount > set->capacity)
+  {
+    //We cannot remove, we need more capacity due to the split DataRegions
+    return DATA_REGION_SET_OUT_OF_SPACE;
+  }
+
+  int64_t removedLength = 0;
+  for (int64_t i = start; i < end; i++)
+  {
+    DataRegion current = set->regions[i];
+    DataRegion removed = { current.first_index > toRemove.first_index ? current.first_index : toRemove.first_index,
+                           current.last_index < toRemove.last_index ? current.last_index : toRemove.last_index };
+    removedLength += data_region_length(current);
+    *changedLength += data_region_length(removed);
+    if (callback != NULL)
+      callback(context, removed);
+  }
+
+  if (remainingCount == 2 && end - start == 1)
+  {
+    _DATA_REGION_STATS_COUNT(regions_split, 1);
+    _DATA_REGION_PROBE3(split, set, set->regions[start].first_index, set->regions[start].last_index);
+  }
+  _data_region_set_replace(set, start, end, removedLength, remaining, remainingCount);
+  return DATA_REGION_SET_SUCCESS;
+}
+
+/* Removes a DataRegion from a DataRegionSet, and reports the byte ranges
+ * that were actually removed (the same ones that 'data_region_set_crop'
+ * would have found before the removal).
+ * @param set - Pointer to the DataRegionSet from which to remove the
+ *        DataRegion. If this argument is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toRemove - The DataRegion to remove. If this is invalid
+ *        (see data_region_is_valid), then DATA_REGION_SET_INVALID_REGION
+ *        will be returned.
+ * @param callback - Optional function that receives each removed byte
+ *        range, in ascending order. It is called before the set changes,
+ *        and must not use the set.
+ * @param context - Passed to 'callback'.
+ * @param changedLength - Optional pointer to an integer that will be
+ *        assigned to the number of removed bytes (zero unless
+ *        DATA_REGION_SET_SUCCESS is returned).
+ * @returns - The DataRegionSetResult that defines the result of the removal
+ *          operation (see 'data_region_set_remove').
+ * @remarks - This takes O(log n + k) time plus the time to shift the
+ *          DataRegions after the removed ones. Nothing is reported if the
+ *          removal fails. */
+DataRegionSetResult data_region_set_remove_delta(DataRegionSet* set, DataRegion toRemove, DataRegionDeltaCallback callback, void* context, int64_t* changedLength)
+{
+  _DATA_REGION_PROBE_ENTRY(remove_entry, set, toRemove);
+  _DATA_REGION_STATS_BEGIN();
+  DataRegionSetResult result = _data_region_set_remove_delta(set, toRemove, callback, context, changedLength);
+  _DATA_REGION_STATS_END(DATA_REGION_STATS_REMOVE, result == DATA_REGION_SET_OUT_OF_SPACE);
+  _DATA_REGION_RECORD(DATA_REGION_STATS_REMOVE, set, toRemove, result);
+  _DATA_REGION_PROBE_RETURN(remove_return, set, result);
+  return result;
+}
+
+/* Adds a DataRegion to a DataRegionSet.
+ * @param set - The destination DataRegionSet. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toAdd - The DataRegion to add. If this is invalid (see
+ *        data_region_is_valid), then DATA_REGION_SET_INVALID_REGION will
+ *        be returned.
+ * @returns - The DataRegionSetResult that defines the result of the add
+ *          operation. If all arguments are non-null and valid, then the
+ *          result will be either DATA_REGION_SET_SUCCESS or
+ *          DATA_REGION_SET_OUT_OF_SPACE.
+ * @remarks - The input DataRegion will be 'combined' with any combinable
+ *          DataRegions in the set (see 'data_region_can_combine'), so it's
+ *          possible for the 'count' of the DataRegionSet to be reduced. If
+ *          there is no remaining space in the DataRegionSet, and the input
+ *          DataRegion can't be combined with any stored DataRegion, them
+ *          DATA_REGION_SET_OUT_OF_SPACE will be returned and nothing will
+ *          change. */
+DataRegionSetResult data_region_set_add(DataRegionSet* set, DataRegion toAdd)
+{
+  return data_region_set_add_delta(set, toAdd, NULL, NULL, NULL);
+}
+
+/* Removes a DataRegion from a DataRegionSet.
+ * @param set - Pointer to the DataRegionSet from which to remove the
+ *        DataRegion. If this argument is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toRemove - The DataRegion to remove. If this is invalid
+ *        (see data_region_is_valid), then DATA_REGION_SET_INVALID_REGION
+ *        will be returned.
+ * @returns - The DataRegionSetResult that defined the result of the removal
+ *          operation. If all arguments are non-null and valid, then the result
+ *          is either DATA_REGION_SET_SUCCESS or DATA_REGION_SET_OUT_OF_SPACE.
+ * @remarks - This function will 'subtract' from all DataRegions stored in the
+ *          set that intersect with 'toRemove'. It's possible for this
+ *          'subtraction' to cause an existing DataRegion to be split into two
+ *          DataRegions. Note that this means it's possible for the 'count' of
+ *          the DataRegionSet to increase after a removal operation. It's also
+ *          possible that the removal operation may fail if the DataRegionSet
+ *          was full before a split was required, in which case
+ *          DATA_REGION_SET_OUT_OF_SPACE will be returned and the DataRegionSet
+ *          will remain unchanged. */
+DataRegionSetResult data_region_set_remove(DataRegionSet* set, DataRegion toRemove)
+{
+  return data_region_set_remove_delta(set, toRemove, NULL, NULL, NULL);
+}
+
+/* Internal function that implements 'data_region_set_crop'. */
+int64_t _data_region_set_crop(DataRegion* dst, int64_t dstCapacity, const DataRegionSet* src, DataRegion boundaryRegion, int* dstTooSmall)
 {
   int dstTooSmallPlaceholder;
   if(dstTooSmall == NULL)
@@ -573,6 +1469,35 @@ int64_t data_region_set_crop(DataRegion* dst, int64_t dstCapacity, const DataReg
   return count;
 }
 
+/* Copies a subset of DataRegions in a DataRegionSet to an array.
+ * @param dst - The destination array. This may be NULL if you want to only
+ *        count the DataRegions.
+ * @param dstCapacity - The maximum number of DataRegions that can be stored in
+ *        the 'dst' array. If this is less than zero, then zero is returned.
+ * @param src - The source DataRegionSet. If 'dst' is NULL, then this argument
+ *        should be zero.
+ * @param boundaryRegion - The DataRegion that defines the crop boundary. No
+ *        DataRegions will be read from outside of this region, and all
+ *        DataRegions that cross this region will be trimmed to fit inside
+ *        this region. If this region is invalid (see data_region_is_valid),
+ *        then zero will be returned.
+ * @param dstTooSmall - Optional pointer to an integer that will be assigned
+ *        to true (1) if the destination buffer was too small to contain the
+ *        cropped DataRegions, otherwise false (0). This argument may be NULL,
+ *        in which case it will not be dereferenced for assignment.
+ * @returns - The number of DataRegions that were found within the 'crop'
+ *          region, limited to 'dstCapacity' if 'dst' was non-NULL. */
+int64_t data_region_set_crop(DataRegion* dst, int64_t dstCapacity, const DataRegionSet* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  _DATA_REGION_PROBE_ENTRY(crop_entry, src, boundaryRegion);
+  _DATA_REGION_STATS_BEGIN();
+  int64_t result = _data_region_set_crop(dst, dstCapacity, src, boundaryRegion, dstTooSmall);
+  _DATA_REGION_STATS_END(DATA_REGION_STATS_CROP, 0);
+  _DATA_REGION_RECORD(DATA_REGION_STATS_CROP, src, boundaryRegion, result);
+  _DATA_REGION_PROBE_RETURN(crop_return, src, result);
+  return result;
+}
+
 /* Counts the number of DataRegions that are at least partially contained
  * within a specific boundary region.
  * @param src - Pointer to the DataRegionSet. If this is NULL, then zero
@@ -586,38 +1511,18 @@ int64_t data_region_set_crop(DataRegion* dst, int64_t dstCapacity, const DataReg
  *          with a NULL 'dst' argument. */
 int64_t data_region_set_count_crop(const DataRegionSet* src, DataRegion boundaryRegion)
 {
-  if(src == NULL)
-    return 0;
-  if(!data_region_is_valid(boundaryRegion))
-    return 0;
-
-  return data_region_set_crop(NULL/*NULL indicates that we only want to count the DataRegions*/, 0, src, boundaryRegion, NULL);
+  //A NULL 'src' or an invalid 'boundaryRegion' count zero DataRegions, and are still counted as calls
+  _DATA_REGION_PROBE_ENTRY(count_crop_entry, src, boundaryRegion);
+  _DATA_REGION_STATS_BEGIN();
+  int64_t result = _data_region_set_crop(NULL/*NULL indicates that we only want to count the DataRegions*/, 0, src, boundaryRegion, NULL);
+  _DATA_REGION_STATS_END(DATA_REGION_STATS_COUNT_CROP, 0);
+  _DATA_REGION_RECORD(DATA_REGION_STATS_COUNT_CROP, src, boundaryRegion, result);
+  _DATA_REGION_PROBE_RETURN(count_crop_return, src, result);
+  return result;
 }
 
-/* Copies a 'negative' of a subset of DataRegions within a DataRegionSet.
- * @param dst - The destination DataRegion array which will contain the results.
- *        If this is NULL, then zero will be returned.
- * @param dstCapacity - The maximum number of DataRegions that can be stored in
- *        the 'dst' array.
- * @param src - Pointer to the source DataRegionSet. If this argument is NULL,
- *        then zero will be returned.
- * @param boundaryRegion - DataRegion that defines the boundary of the negative
- *        crop region. No DataRegions will be read outside of this region, and
- *        DataRegions that intersect it will be trimmed. If this argument is
- *        invalid (see data_region_is_valid), then zero will be returned.
- * @param dstTooSmall - Optional pointer to an integer that will be assigned
- *        to true (1) if the destination buffer was too small to contain the
- *        cropped and negated DataRegions, otherwise false (0). This argument
- *        may be NULL, in which case it will not be dereferenced for assignment.
- * @returns - The number of negative cropped DataRegions that were copied into the
- *          'dst' array, or zero upon failure.
- * @remarks - A 'negative crop' is similar to a normal crop (see
- *          data_region_set_crop), but where DataRegions that are present in the
- *          DataRegionSet will be omitted, and DataRegions that are missing in the
- *          DataRegionSet will be yielded.
- *          If the 'dstCapacity' is too small, then zero will be returned but some
- *          garbage data will have been written to 'dst'. */
-int64_t data_region_set_negative_crop(DataRegion* dst, int64_t dstCapacity, const DataRegionSet* src, DataRegion boundaryRegion, int* dstTooSmall)
+/* Internal function that implements 'data_region_set_negative_crop'. */
+int64_t _data_region_set_negative_crop(DataRegion* dst, int64_t dstCapacity, const DataRegionSet* src, DataRegion boundaryRegion, int* dstTooSmall)
 {
   int dstTooSmallPlaceholder;
   if (dstTooSmall == NULL)
@@ -640,7 +1545,7 @@ int64_t data_region_set_negative_crop(DataRegion* dst, int64_t dstCapacity, cons
   DataRegionSet dstSet;
   _data_region_set_init(&dstSet, dst, dstCapacity);
 
-  if (data_region_set_add(&dstSet, boundaryRegion) == DATA_REGION_SET_SUCCESS)
+  if (_data_region_set_add_delta(&dstSet, boundaryRegion, NULL, NULL, NULL) == DATA_REGION_SET_SUCCESS)
   {
     for (int64_t i = 0; i < src->count; i++)
     {
@@ -670,7 +1575,7 @@ int64_t data_region_set_negative_crop(DataRegion* dst, int64_t dstCapacity, cons
 
       if (doRemoveCurrent)
       {
-        if (data_region_set_remove(&dstSet, toRemove) != DATA_REGION_SET_SUCCESS)
+        if (_data_region_set_remove_delta(&dstSet, toRemove, NULL, NULL, NULL) != DATA_REGION_SET_SUCCESS)
         {
           *dstTooSmall = 1;
           //The regions stored in 'dst' are not correct, the latest region needs to be split but there isn't enough capacity.
@@ -689,4 +1594,41 @@ int64_t data_region_set_negative_crop(DataRegion* dst, int64_t dstCapacity, cons
   }
 }
 
+/* Copies a 'negative' of a subset of DataRegions within a DataRegionSet.
+ * @param dst - The destination DataRegion array which will contain the results.
+ *        If this is NULL, then zero will be returned.
+ * @param dstCapacity - The maximum number of DataRegions that can be stored in
+ *        the 'dst' array.
+ * @param src - Pointer to the source DataRegionSet. If this argument is NULL,
+ *        then zero will be returned.
+ * @param boundaryRegion - DataRegion that defines the boundary of the negative
+ *        crop region. No DataRegions will be read outside of this region, and
+ *        DataRegions that intersect it will be trimmed. If this argument is
+ *        invalid (see data_region_is_valid), then zero will be returned.
+ * @param dstTooSmall - Optional pointer to an integer that will be assigned
+ *        to true (1) if the destination buffer was too small to contain the
+ *        cropped and negated DataRegions, otherwise false (0). This argument
+ *        may be NULL, in which case it will not be dereferenced for assignment.
+ * @returns - The number of negative cropped DataRegions that were copied into the
+ *          'dst' array, or zero upon failure.
+ * @remarks - A 'negative crop' is similar to a normal crop (see
+ *          data_region_set_crop), but where DataRegions that are present in the
+ *          DataRegionSet will be omitted, and DataRegions that are missing in the
+ *          DataRegionSet will be yielded.
+ *          If the 'dstCapacity' is too small, then zero will be returned but some
+ *          garbage data will have been written to 'dst'. */
+int64_t data_region_set_negative_crop(DataRegion* dst, int64_t dstCapacity, const DataRegionSet* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  _DATA_REGION_PROBE_ENTRY(negative_crop_entry, src, boundaryRegion);
+  _DATA_REGION_STATS_BEGIN();
+  //The adds and removes on 'dst' aren't counted
+  _DATA_REGION_STATS_NEST(1);
+  int64_t result = _data_region_set_negative_crop(dst, dstCapacity, src, boundaryRegion, dstTooSmall);
+  _DATA_REGION_STATS_NEST(-1);
+  _DATA_REGION_STATS_END(DATA_REGION_STATS_NEGATIVE_CROP, 0);
+  _DATA_REGION_RECORD(DATA_REGION_STATS_NEGATIVE_CROP, src, boundaryRegion, result);
+  _DATA_REGION_PROBE_RETURN(negative_crop_return, src, result);
+  return result;
+}
+
 #endif//DATA_REGION_H
@@ -0,0 +1,538 @@
+#ifndef DATA_REGION_HPP
+#define DATA_REGION_HPP
+#include "data_region.h"
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace data_region
+{
+
+/* Region of data with a configurable index type, laid out like DataRegion.
+ * @see Region */
+template<typename Index>
+struct BasicRegion
+{
+  Index first_index;
+  Index last_index;
+};
+
+/* Internal mapping of an index type to its region type: DataRegion itself
+ * for int64_t, so that int64_t sets share their memory with the C API. */
+template<typename Index>
+struct _RegionType
+{
+  using type = BasicRegion<Index>;
+};
+
+template<>
+struct _RegionType<int64_t>
+{
+  using type = DataRegion;
+};
+
+/* The region type of an index type (DataRegion for int64_t). */
+template<typename Index>
+using Region = typename _RegionType<Index>::type;
+
+/* The predicates of data_region.h for any index type. They are templates in
+ * this header, so they inline fully into the set operations, and they don't
+ * overflow at the limits of the index type. */
+
+/* Gets the length of a (valid) region. The indices are widened before
+ * subtracting, since the distance between them may not fit the index
+ * type. */
+template<typename R>
+constexpr int64_t length(R region)
+{
+  return static_cast<int64_t>(region.last_index) - static_cast<int64_t>(region.first_index) + 1;
+}
+
+/* Checks whether a region is valid (see data_region_is_valid). */
+template<typename R>
+constexpr bool is_valid(R region)
+{
+  return region.first_index <= region.last_index;
+}
+
+/* Checks whether 'outer' contains 'inner' (see data_region_contains). */
+template<typename R>
+constexpr bool contains(R outer, R inner)
+{
+  return inner.first_index >= outer.first_index && inner.last_index <= outer.last_index;
+}
+
+/* Checks whether two regions intersect (see data_region_intersects). */
+template<typename R>
+constexpr bool intersects(R a, R b)
+{
+  return a.last_index >= b.first_index && b.last_index >= a.first_index;
+}
+
+/* Checks whether two regions intersect or are adjacent (see
+ * data_region_can_combine). */
+template<typename R>
+constexpr bool can_combine(R a, R b)
+{
+  using Index = decltype(a.first_index);
+  constexpr Index maxIndex = std::numeric_limits<Index>::max();
+  return (a.last_index == maxIndex || a.last_index + 1 >= b.first_index)
+    && (b.last_index == maxIndex || b.last_index + 1 >= a.first_index);
+}
+
+/* Combines two combinable regions (see data_region_combine). */
+template<typename R>
+constexpr R combine(R a, R b)
+{
+  return R{ a.first_index < b.first_index ? a.first_index : b.first_index,
+            a.last_index > b.last_index ? a.last_index : b.last_index };
+}
+
+/* Storage policy that keeps up to 'Capacity' regions inside the set itself,
+ * without any heap allocation.
+ *
+ * A storage policy of a BasicRegionSet provides:
+ *   Region              The region type.
+ *   data(), size()      The sorted regions.
+ *   total_length()      The sum of their lengths.
+ *   reserve(count)      Makes room for 'count' regions, returning
+ *                       DATA_REGION_SET_SUCCESS, DATA_REGION_SET_OUT_OF_SPACE
+ *                       or DATA_REGION_SET_ALLOCATION_FAILED.
+ *   replace(start, end, removedLength, replacements, replacementCount)
+ *                       Replaces the regions at ['start', 'end'), whose total
+ *                       length is 'removedLength', after a successful
+ *                       'reserve' (see '_data_region_set_replace').
+ *   clear()             Removes all regions. */
+template<typename Index, int64_t Capacity>
+class InlineStorage
+{
+public:
+  using Region = data_region::Region<Index>;
+
+  constexpr Region* data() { return regions; }
+  constexpr const Region* data() const { return regions; }
+  constexpr int64_t size() const { return count; }
+  constexpr int64_t total_length() const { return totalLength; }
+
+  constexpr DataRegionSetResult reserve(int64_t regionCount) const
+  {
+    return regionCount <= Capacity ? DATA_REGION_SET_SUCCESS : DATA_REGION_SET_OUT_OF_SPACE;
+  }
+
+  constexpr void replace(int64_t start, int64_t end, int64_t removedLength, const Region* replacements, int64_t replacementCount)
+  {
+    if(replacementCount < end - start)
+      std::move(regions + end, regions + count, regions + start + replacementCount);
+    else if(replacementCount > end - start)
+      std::move_backward(regions + end, regions + count, regions + count + replacementCount - (end - start));
+    for(int64_t i = 0; i < replacementCount; i++)
+    {
+      regions[start + i] = replacements[i];
+      totalLength += length(replacements[i]);
+    }
+    count += replacementCount - (end - start);
+    totalLength -= removedLength;
+  }
+
+  constexpr void clear()
+  {
+    count = 0;
+    totalLength = 0;
+  }
+
+private:
+  //Value-initialized, so that sets are usable in constant expressions
+  Region regions[Capacity] = {};
+  int64_t count = 0;
+  int64_t totalLength = 0;
+};
+
+/* Storage policy that keeps the regions in a std::vector, which grows as
+ * needed up to an optional maximum number of regions.
+ * @see InlineStorage */
+template<typename Index, typename Allocator = std::allocator<Region<Index>>>
+class VectorStorage
+{
+public:
+  using Region = data_region::Region<Index>;
+
+  /* @param maxCount - The maximum number of regions, beyond which adds and
+   *        removes return DATA_REGION_SET_OUT_OF_SPACE.
+   * @param allocator - The allocator of the vector. */
+  explicit VectorStorage(int64_t maxCount = std::numeric_limits<int64_t>::max(), const Allocator& allocator = Allocator())
+    : regions(allocator), maxCount(maxCount) {}
+
+  Region* data() { return regions.data(); }
+  const Region* data() const { return regions.data(); }
+  int64_t size() const { return static_cast<int64_t>(regions.size()); }
+  int64_t total_length() const { return totalLength; }
+
+  DataRegionSetResult reserve(int64_t regionCount)
+  {
+    if(regionCount > maxCount)
+      return DATA_REGION_SET_OUT_OF_SPACE;
+    try
+    {
+      if(static_cast<size_t>(regionCount) > regions.capacity())
+        regions.reserve(std::max(static_cast<size_t>(regionCount), regions.capacity() * 2));
+    }
+    catch(const std::bad_alloc&)
+    {
+      return DATA_REGION_SET_ALLOCATION_FAILED;
+    }
+    return DATA_REGION_SET_SUCCESS;
+  }
+
+  void replace(int64_t start, int64_t end, int64_t removedLength, const Region* replacements, int64_t replacementCount)
+  {
+    //The capacity was reserved, so neither insert nor erase allocates
+    int64_t overlap = std::min(end - start, replacementCount);
+    std::copy(replacements, replacements + overlap, regions.begin() + start);
+    if(replacementCount > overlap)
+      regions.insert(regions.begin() + end, replacements + overlap, replacements + replacementCount);
+    else
+      regions.erase(regions.begin() + start + overlap, regions.begin() + end);
+    for(int64_t i = 0; i < replacementCount; i++)
+      totalLength += length(replacements[i]);
+    totalLength -= removedLength;
+  }
+
+  void clear()
+  {
+    regions.clear();
+    totalLength = 0;
+  }
+
+private:
+  std::vector<Region, Allocator> regions;
+  int64_t maxCount;
+  int64_t totalLength = 0;
+};
+
+/* Storage policy that owns a DataRegionSet of data_region.h, so the C
+ * functions (and the other headers) work on the same regions without
+ * copying them.
+ * @see InlineStorage */
+class CStorage
+{
+public:
+  using Region = DataRegion;
+
+  /* Creates an empty DataRegionSet (see data_region_set_create).
+   * @remarks - Throws std::bad_alloc if it can't be allocated. */
+  explicit CStorage(int64_t regionCapacity) : CStorage(data_region_set_create(regionCapacity)) {}
+
+  /* Takes ownership of a DataRegionSet that was allocated by
+   * 'data_region_set_create'.
+   * @remarks - Throws std::bad_alloc if 'adopted' is NULL. */
+  explicit CStorage(DataRegionSet* adopted) : set(adopted)
+  {
+    if(set == nullptr)
+      throw std::bad_alloc();
+  }
+
+  CStorage(CStorage&& other) noexcept : set(std::exchange(other.set, nullptr)) {}
+
+  CStorage& operator=(CStorage&& other) noexcept
+  {
+    std::swap(set, other.set);
+    return *this;
+  }
+
+  ~CStorage()
+  {
+    data_region_set_free(set);
+  }
+
+  /* The owned DataRegionSet, for the C functions. */
+  DataRegionSet* c_set() { return set; }
+  const DataRegionSet* c_set() const { return set; }
+
+  /* Gives up the ownership of the DataRegionSet, which has to be freed by
+   * calling 'data_region_set_free'. The storage can't be used anymore. */
+  DataRegionSet* release() { return std::exchange(set, nullptr); }
+
+  Region* data() { return set->regions; }
+  const Region* data() const { return set->regions; }
+  int64_t size() const { return set->count; }
+  int64_t total_length() const { return set->total_length; }
+
+  DataRegionSetResult reserve(int64_t regionCount) const
+  {
+    return regionCount <= set->capacity ? DATA_REGION_SET_SUCCESS : DATA_REGION_SET_OUT_OF_SPACE;
+  }
+
+  void replace(int64_t start, int64_t end, int64_t removedLength, const Region* replacements, int64_t replacementCount)
+  {
+    _data_region_set_replace(set, start, end, removedLength, replacements, replacementCount);
+  }
+
+  void clear()
+  {
+    data_region_set_clear(set);
+  }
+
+private:
+  DataRegionSet* set;
+};
+
+/* Set of regions with the semantics of a DataRegionSet (sorted, neither
+ * overlapping nor adjacent), with a configurable index type and storage
+ * policy (see InlineStorage, VectorStorage and CStorage). The storage is
+ * chosen at compile time, so the operations and the predicates that they
+ * use are inlined for it. The set owns its storage (RAII), and it is
+ * movable, and copyable if its storage is. With an InlineStorage, it is
+ * usable in constant expressions (see StaticRegionSet).
+ * @remarks - The operations have the arguments and results of their
+ *          counterparts in data_region.h, but look up the affected regions
+ *          with a binary search, and don't report to the optional
+ *          statistics, recording or USDT probes of data_region.h. */
+template<typename Index, typename Storage = VectorStorage<Index>>
+class BasicRegionSet
+{
+public:
+  using Region = data_region::Region<Index>;
+  static_assert(std::is_same<Region, typename Storage::Region>::value, "The storage has to hold the regions of the index type.");
+
+  /* Creates an empty set with a default-constructed storage. */
+  constexpr BasicRegionSet() = default;
+
+  /* Creates an empty set, passing the arguments to the storage (for
+   * example, the region capacity of a CStorage). */
+  template<typename First, typename... Rest, typename = typename std::enable_if<!std::is_same<typename std::decay<First>::type, BasicRegionSet>::value>::type>
+  constexpr explicit BasicRegionSet(First&& first, Rest&&... rest) : storage(std::forward<First>(first), std::forward<Rest>(rest)...) {}
+
+  /* Adds a region (see data_region_set_add). */
+  constexpr DataRegionSetResult add(Region toAdd)
+  {
+    if(!is_valid(toAdd))
+      return DATA_REGION_SET_INVALID_REGION;
+
+    const Region* regions = storage.data();
+    int64_t count = storage.size();
+    int64_t start = _lower_bound(toAdd.first_index);
+    if(start > 0 && can_combine(regions[start - 1], toAdd))
+      start--;
+    int64_t end = start;
+    Region combined = toAdd;
+    int64_t removedLength = 0;
+    for(; end < count && can_combine(regions[end], toAdd); end++)
+    {
+      combined = combine(combined, regions[end]);
+      removedLength += length(regions[end]);
+    }
+
+    if(end == start)
+    {
+      DataRegionSetResult result = storage.reserve(count + 1);
+      if(result != DATA_REGION_SET_SUCCESS)
+        return result;
+    }
+    storage.replace(start, end, removedLength, &combined, 1);
+    return DATA_REGION_SET_SUCCESS;
+  }
+
+  /* Removes a region (see data_region_set_remove). */
+  constexpr DataRegionSetResult remove(Region toRemove)
+  {
+    if(!is_valid(toRemove))
+      return DATA_REGION_SET_INVALID_REGION;
+
+    const Region* regions = storage.data();
+    int64_t count = storage.size();
+    int64_t start = _lower_bound(toRemove.first_index);
+    int64_t end = start;
+    int64_t removedLength = 0;
+    for(; end < count && regions[end].first_index <= toRemove.last_index; end++)
+      removedLength += length(regions[end]);
+    if(end == start)
+      return DATA_REGION_SET_SUCCESS;
+
+    //The portions of the first and last regions outside of 'toRemove' remain
+    Region remaining[2];
+    int64_t remainingCount = 0;
+    if(regions[start].first_index < toRemove.first_index)
+      remaining[remainingCount++] = Region{ regions[start].first_index, static_cast<Index>(toRemove.first_index - 1) };
+    if(regions[end - 1].last_index > toRemove.last_index)
+      remaining[remainingCount++] = Region{ static_cast<Index>(toRemove.last_index + 1), regions[end - 1].last_index };
+
+    if(remainingCount > end - start)
+    {
+      DataRegionSetResult result = storage.reserve(count + 1);
+      if(result != DATA_REGION_SET_SUCCESS)
+        return result;
+    }
+    storage.replace(start, end, removedLength, remaining, remainingCount);
+    return DATA_REGION_SET_SUCCESS;
+  }
+
+  /* Copies the regions within a boundary region, trimmed to it (see
+   * data_region_set_crop). If 'dst' is nullptr, they are only counted. */
+  constexpr int64_t crop(Region* dst, int64_t dstCapacity, Region boundaryRegion, int* dstTooSmall = nullptr) const
+  {
+    int dstTooSmallPlaceholder;
+    if(dstTooSmall == nullptr)
+      dstTooSmall = &dstTooSmallPlaceholder;
+    *dstTooSmall = 0;
+    if(!is_valid(boundaryRegion))
+      return 0;
+    if(dstCapacity < 0)
+    {
+      *dstTooSmall = 1;
+      return 0;
+    }
+
+    const Region* regions = storage.data();
+    int64_t found = 0;
+    for(int64_t i = _lower_bound(boundaryRegion.first_index); i < storage.size() && regions[i].first_index <= boundaryRegion.last_index; i++)
+    {
+      if(dst != nullptr)
+      {
+        if(found >= dstCapacity)
+        {
+          *dstTooSmall = 1;
+          break;
+        }
+        dst[found] = Region{ regions[i].first_index > boundaryRegion.first_index ? regions[i].first_index : boundaryRegion.first_index,
+                             regions[i].last_index < boundaryRegion.last_index ? regions[i].last_index : boundaryRegion.last_index };
+      }
+      found++;
+    }
+    return found;
+  }
+
+  /* Counts the regions within a boundary region (see
+   * data_region_set_count_crop). */
+  constexpr int64_t count_crop(Region boundaryRegion) const
+  {
+    return crop(nullptr, 0, boundaryRegion);
+  }
+
+  /* Copies the gaps between the regions within a boundary region (see
+   * data_region_set_negative_crop). */
+  constexpr int64_t negative_crop(Region* dst, int64_t dstCapacity, Region boundaryRegion, int* dstTooSmall = nullptr) const
+  {
+    int dstTooSmallPlaceholder;
+    if(dstTooSmall == nullptr)
+      dstTooSmall = &dstTooSmallPlaceholder;
+    *dstTooSmall = 0;
+    if(dst == nullptr || !is_valid(boundaryRegion))
+      return 0;
+
+    const Region* regions = storage.data();
+    int64_t found = 0;
+    Index position = boundaryRegion.first_index;
+    bool covered = false;
+    for(int64_t i = _lower_bound(boundaryRegion.first_index); i < storage.size() && regions[i].first_index <= boundaryRegion.last_index; i++)
+    {
+      if(regions[i].first_index > position)
+      {
+        if(found >= dstCapacity)
+        {
+          *dstTooSmall = 1;
+          return 0;
+        }
+        dst[found++] = Region{ position, static_cast<Index>(regions[i].first_index - 1) };
+      }
+      if(regions[i].last_index >= boundaryRegion.last_index)
+      {
+        covered = true;
+        break;
+      }
+      position = static_cast<Index>(regions[i].last_index + 1);
+    }
+    if(!covered)
+    {
+      if(found >= dstCapacity)
+      {
+        *dstTooSmall = 1;
+        return 0;
+      }
+      dst[found++] = Region{ position, boundaryRegion.last_index };
+    }
+    return found;
+  }
+
+  constexpr void clear() { storage.clear(); }
+
+  constexpr int64_t count() const { return storage.size(); }
+  constexpr int64_t total_length() const { return storage.total_length(); }
+
+  constexpr const Region& operator[](int64_t index) const { return storage.data()[index]; }
+  constexpr const Region* begin() const { return storage.data(); }
+  constexpr const Region* end() const { return storage.data() + storage.size(); }
+
+  /* The storage, for example to get the DataRegionSet of a CStorage. */
+  constexpr Storage& get_storage() { return storage; }
+  constexpr const Storage& get_storage() const { return storage; }
+
+private:
+  /* Internal binary search for the first region that ends at or after
+   * 'index' (see _data_region_set_lower_bound). */
+  constexpr int64_t _lower_bound(Index index) const
+  {
+    const Region* regions = storage.data();
+    int64_t low = 0, high = storage.size();
+    while(low < high)
+    {
+      int64_t mid = low + ((high - low) / 2);
+      if(regions[mid].last_index < index)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+    return low;
+  }
+
+  Storage storage;
+};
+
+/* A set of int64_t regions in a growable vector. */
+using RegionSet = BasicRegionSet<int64_t>;
+
+/* A set of int64_t regions in a DataRegionSet of data_region.h. */
+using CRegionSet = BasicRegionSet<int64_t, CStorage>;
+
+/* A set of up to 'Capacity' regions inside itself, for tables that are
+ * computed at compile time: a constexpr StaticRegionSet has no startup cost
+ * and is placed in read-only data, and its queries work both in constant
+ * expressions and at runtime.
+ * @see make_static_region_set */
+template<typename Index, int64_t Capacity>
+using StaticRegionSet = BasicRegionSet<Index, InlineStorage<Index, Capacity>>;
+
+/* Creates a StaticRegionSet by adding and then removing regions.
+ * @param toAdd - The regions to add, in order.
+ * @param toRemove - The regions to remove afterwards, in order.
+ * @returns - The set.
+ * @remarks - Throws std::invalid_argument for an invalid region, and
+ *          std::length_error if the regions don't fit into 'Capacity', so
+ *          neither compiles in a constant expression. */
+template<int64_t Capacity, typename Index = int64_t>
+constexpr StaticRegionSet<Index, Capacity> make_static_region_set(std::initializer_list<Region<Index>> toAdd, std::initializer_list<Region<Index>> toRemove = {})
+{
+  StaticRegionSet<Index, Capacity> set;
+  for(int pass = 0; pass < 2; pass++)
+  {
+    for(const Region<Index>& region : pass == 0 ? toAdd : toRemove)
+    {
+      DataRegionSetResult result = pass == 0 ? set.add(region) : set.remove(region);
+      if(result == DATA_REGION_SET_INVALID_REGION)
+        throw std::invalid_argument("Invalid region.");
+      if(result != DATA_REGION_SET_SUCCESS)
+        throw std::length_error("The regions don't fit into the capacity of the set.");
+    }
+  }
+  return set;
+}
+
+}//namespace data_region
+
+#endif//DATA_REGION_HPP
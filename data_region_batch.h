@@ -0,0 +1,238 @@
+#ifndef DATA_REGION_BATCH_H
+#define DATA_REGION_BATCH_H
+#include "data_region.h"
+
+/* Transaction of adds and removes on a DataRegionSet, which are recorded
+ * first and then committed all at once. The recorded operations are kept
+ * as their net effect: committing them to a set 'S' yields
+ * '(S - removes) + adds', where 'adds' and 'removes' are normalized and never
+ * intersect each other (a later operation overrides an earlier one). A
+ * commit computes the resulting DataRegions with one linear merge, and then
+ * either applies them with a single shift of the set, or (if they don't fit)
+ * leaves the set untouched.
+ * @see data_region_batch_create
+ * @see data_region_batch_add
+ * @see data_region_batch_remove
+ * @see data_region_batch_commit */
+typedef struct DataRegionBatch
+{
+  /* The DataRegionSet that the batch is committed to. */
+  DataRegionSet* set;
+
+  /* The net adds and removes of the recorded operations. */
+  DataRegionSet* adds;
+  DataRegionSet* removes;
+
+  /* Scratch space for the merged DataRegions of a commit, followed by
+   * scratch space for the intermediate difference. Each holds the capacity
+   * of 'set' plus the capacities of 'adds' and 'removes'. */
+  DataRegion* merged;
+  DataRegion* temp;
+} DataRegionBatch;
+
+/* Allocates a new, empty DataRegionBatch for a DataRegionSet.
+ * @param set - Pointer to the DataRegionSet that the batch is committed to.
+ *        It has to outlive the batch. If this is NULL, then NULL will be
+ *        returned.
+ * @param regionCapacity - The maximum number of separate DataRegions that
+ *        the batch records as adds, and as removes. If this is less than
+ *        one, then NULL will be returned.
+ * @returns - A pointer to the allocated DataRegionBatch, or NULL upon
+ *          failure.
+ * @remarks - Be sure to free the returned DataRegionBatch by calling the
+ *          'data_region_batch_free' function.
+ * @see data_region_batch_free */
+DataRegionBatch* data_region_batch_create(DataRegionSet* set, int64_t regionCapacity)
+{
+  if(set == NULL || regionCapacity < 1)
+    return NULL;
+
+  DataRegionBatch* batch = malloc(sizeof(DataRegionBatch));
+  if(batch == NULL)
+    return NULL;
+
+  int64_t scratchCapacity = set->capacity + (2 * regionCapacity);
+  batch->set = set;
+  batch->adds = data_region_set_create(regionCapacity);
+  batch->removes = data_region_set_create(regionCapacity);
+  batch->merged = malloc(sizeof(DataRegion) * 2 * scratchCapacity);
+  if(batch->adds == NULL || batch->removes == NULL || batch->merged == NULL)
+  {
+    data_region_set_free(batch->adds);
+    data_region_set_free(batch->removes);
+    free(batch->merged);
+    free(batch);
+    return NULL;
+  }
+
+  batch->temp = batch->merged + scratchCapacity;
+  return batch;
+}
+
+/* Frees a DataRegionBatch that was allocated by the
+ * 'data_region_batch_create' function. Uncommitted operations are
+ * discarded.
+ * @param batch - Pointer to the DataRegionBatch. If this argument is NULL,
+ *        then nothing will happen. */
+void data_region_batch_free(DataRegionBatch* batch)
+{
+  if(batch == NULL)
+    return;
+
+  data_region_set_free(batch->adds);
+  data_region_set_free(batch->removes);
+  free(batch->merged);
+  free(batch);
+}
+
+/* Discards all recorded operations of a DataRegionBatch, without touching
+ * its DataRegionSet.
+ * @param batch - Pointer to the DataRegionBatch. If this argument is NULL,
+ *        then nothing will happen. */
+void data_region_batch_clear(DataRegionBatch* batch)
+{
+  if(batch == NULL)
+    return;
+
+  data_region_set_clear(batch->adds);
+  data_region_set_clear(batch->removes);
+}
+
+/* Internal function to record an operation. The DataRegion is taken out of
+ * the opposite kind of operation and combined into its own kind, which only
+ * happens if both fit, so a failed operation records nothing. */
+DataRegionSetResult _data_region_batch_record(DataRegionBatch* batch, DataRegion region, int isAdd)
+{
+  if(batch == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(region))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  DataRegionSet* own = isAdd ? batch->adds : batch->removes;
+  DataRegionSet* opposite = isAdd ? batch->removes : batch->adds;
+  if(!_data_region_set_can_add(own, region) || !_data_region_set_can_remove(opposite, region))
+    return DATA_REGION_SET_OUT_OF_SPACE;
+
+  _data_region_set_remove_delta(opposite, region, NULL, NULL, NULL);
+  _data_region_set_add_delta(own, region, NULL, NULL, NULL);
+  return DATA_REGION_SET_SUCCESS;
+}
+
+/* Records that a DataRegion is added by a DataRegionBatch.
+ * @param batch - Pointer to the DataRegionBatch.
+ * @param toAdd - The DataRegion to add on commit.
+ * @returns - DATA_REGION_SET_SUCCESS, DATA_REGION_SET_NULL_ARG,
+ *          DATA_REGION_SET_INVALID_REGION, or DATA_REGION_SET_OUT_OF_SPACE
+ *          if the batch can't record more separate DataRegions (in which
+ *          case nothing is recorded).
+ * @remarks - The DataRegionSet isn't touched until the batch is committed.
+ * @see data_region_batch_commit */
+DataRegionSetResult data_region_batch_add(DataRegionBatch* batch, DataRegion toAdd)
+{
+  return _data_region_batch_record(batch, toAdd, 1);
+}
+
+/* Records that a DataRegion is removed by a DataRegionBatch.
+ * @param batch - Pointer to the DataRegionBatch.
+ * @param toRemove - The DataRegion to remove on commit.
+ * @returns - DATA_REGION_SET_SUCCESS, DATA_REGION_SET_NULL_ARG,
+ *          DATA_REGION_SET_INVALID_REGION, or DATA_REGION_SET_OUT_OF_SPACE
+ *          if the batch can't record more separate DataRegions (in which
+ *          case nothing is recorded).
+ * @remarks - The DataRegionSet isn't touched until the batch is committed.
+ * @see data_region_batch_commit */
+DataRegionSetResult data_region_batch_remove(DataRegionBatch* batch, DataRegion toRemove)
+{
+  return _data_region_batch_record(batch, toRemove, 0);
+}
+
+/* Internal function to merge the recorded operations with the DataRegions
+ * of the set that they can affect.
+ * @param batch - The DataRegionBatch, which records at least one operation.
+ * @param windowStart - Assigned to the position of the first DataRegion of
+ *        the set that is replaced.
+ * @param windowEnd - Assigned to the position after the last DataRegion of
+ *        the set that is replaced.
+ * @returns - The number of DataRegions in 'batch->merged', which replace
+ *          the DataRegions at ['windowStart', 'windowEnd'). */
+int64_t _data_region_batch_merge(DataRegionBatch* batch, int64_t* windowStart, int64_t* windowEnd)
+{
+  DataRegionSet* set = batch->set;
+  DataRegionSet* adds = batch->adds;
+  DataRegionSet* removes = batch->removes;
+  int64_t first = INT64_MAX, last = INT64_MIN;
+  if(adds->count > 0)
+  {
+    //Adjacent DataRegions are combined, too
+    first = adds->regions[0].first_index > INT64_MIN ? adds->regions[0].first_index - 1 : INT64_MIN;
+    last = adds->regions[adds->count - 1].last_index < INT64_MAX ? adds->regions[adds->count - 1].last_index + 1 : INT64_MAX;
+  }
+  if(removes->count > 0)
+  {
+    first = removes->regions[0].first_index < first ? removes->regions[0].first_index : first;
+    last = removes->regions[removes->count - 1].last_index > last ? removes->regions[removes->count - 1].last_index : last;
+  }
+
+  int64_t start = _data_region_set_lower_bound(set, first);
+  int64_t end = _data_region_set_lower_bound(set, last);
+  if(end < set->count && set->regions[end].first_index <= last)
+    end++;
+
+  int64_t tempCount = _data_region_array_difference(batch->temp, set->regions + start, end - start, removes->regions, removes->count);
+  *windowStart = start;
+  *windowEnd = end;
+  return _data_region_array_union(batch->merged, batch->temp, tempCount, adds->regions, adds->count);
+}
+
+/* Gets the exact number of DataRegions that the DataRegionSet of a
+ * DataRegionBatch would store after committing it.
+ * @param batch - Pointer to the DataRegionBatch.
+ * @returns - The number of DataRegions (which may exceed the capacity of the
+ *          set), or -1 if 'batch' is NULL.
+ * @remarks - This takes O(k) time, where k is the number of recorded and
+ *          affected DataRegions. */
+int64_t data_region_batch_result_count(DataRegionBatch* batch)
+{
+  if(batch == NULL)
+    return -1;
+  if(batch->adds->count == 0 && batch->removes->count == 0)
+    return batch->set->count;
+
+  int64_t windowStart, windowEnd;
+  int64_t mergedCount = _data_region_batch_merge(batch, &windowStart, &windowEnd);
+  return batch->set->count - (windowEnd - windowStart) + mergedCount;
+}
+
+/* Applies all recorded operations of a DataRegionBatch to its DataRegionSet
+ * at once, or none of them.
+ * @param batch - Pointer to the DataRegionBatch.
+ * @returns - DATA_REGION_SET_SUCCESS (in which case the batch is cleared),
+ *          DATA_REGION_SET_NULL_ARG, or DATA_REGION_SET_OUT_OF_SPACE if the
+ *          result would exceed the capacity of the set (in which case
+ *          neither the set nor the batch is changed).
+ * @remarks - The result is the same as performing the recorded operations
+ *          one by one, but each operation would shift the stored DataRegions
+ *          and could fail halfway through. This takes O(k) time, plus one
+ *          shift of the DataRegions after the affected ones. */
+DataRegionSetResult data_region_batch_commit(DataRegionBatch* batch)
+{
+  if(batch == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(batch->adds->count == 0 && batch->removes->count == 0)
+    return DATA_REGION_SET_SUCCESS;
+
+  DataRegionSet* set = batch->set;
+  int64_t windowStart, windowEnd;
+  int64_t mergedCount = _data_region_batch_merge(batch, &windowStart, &windowEnd);
+  if(set->count - (windowEnd - windowStart) + mergedCount > set->capacity)
+    return DATA_REGION_SET_OUT_OF_SPACE;
+
+  int64_t removedLength = 0;
+  for(int64_t i = windowStart; i < windowEnd; i++)
+    removedLength += data_region_length(set->regions[i]);
+  _data_region_set_replace(set, windowStart, windowEnd, removedLength, batch->merged, mergedCount);
+  data_region_batch_clear(batch);
+  return DATA_REGION_SET_SUCCESS;
+}
+
+#endif//DATA_REGION_BATCH_H
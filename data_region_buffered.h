@@ -0,0 +1,505 @@
+#ifndef DATA_REGION_BUFFERED_H
+#define DATA_REGION_BUFFERED_H
+#include "data_region.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Defines which DataRegions a query of a DataRegionBufferedSet sees. */
+typedef enum DataRegionBufferedQueryMode
+{
+  /* Only the shared DataRegionSet is read. DataRegions that are still
+   * buffered by writers are not seen, but the query never waits for a
+   * writer. */
+  DATA_REGION_BUFFERED_SHARED_ONLY = 0,
+
+  /* All writers' buffers are flushed into the shared DataRegionSet before
+   * it is read. */
+  DATA_REGION_BUFFERED_FLUSH_FIRST = 1,
+
+  /* The query reads the union of the shared DataRegionSet and all writers'
+   * buffers, without flushing the buffers. The union is built in a view
+   * which the set keeps for the next queries. If the memory for it can't be
+   * allocated, then the buffers are flushed first instead (like
+   * DATA_REGION_BUFFERED_FLUSH_FIRST), so that the query still sees all
+   * DataRegions. */
+  DATA_REGION_BUFFERED_INCLUDE_PENDING = 2,
+} DataRegionBufferedQueryMode;
+
+/* Per-thread writer of a DataRegionBufferedSet, which accumulates added
+ * DataRegions in a private, already-combined buffer. Obtain one via
+ * 'data_region_buffered_set_attach' and release it via
+ * 'data_region_buffered_set_detach'. A writer must only be used by one
+ * thread at a time. */
+typedef struct DataRegionBufferedWriter
+{
+  /* Protects 'buffer'. Only contended while another thread flushes or
+   * reads the buffer. */
+  _Alignas(64) pthread_mutex_t lock;
+
+  /* The buffered DataRegions, which are not yet in the shared set. */
+  DataRegionSet* buffer;
+
+  /* True (1) while a thread owns this writer. */
+  atomic_int in_use;
+
+  /* The DataRegionBufferedSet that the writer belongs to. */
+  struct DataRegionBufferedSet* set;
+
+  /* The next writer registered with the set. */
+  struct DataRegionBufferedWriter* next_writer;
+} DataRegionBufferedWriter;
+
+/* Shared DataRegionSet which threads add to through per-thread write
+ * buffers. An add only touches the writer's own buffer; the buffer is
+ * folded into the shared DataRegionSet (with one merge pass) when it fills
+ * up, when it is flushed explicitly, or when a query asks for it (see
+ * DataRegionBufferedQueryMode). The shared DataRegionSet therefore lags
+ * behind by at most the buffer capacity of each writer.
+ * @see data_region_buffered_set_create
+ * @see data_region_buffered_set_attach
+ * @see data_region_buffered_set_add
+ * @see data_region_buffered_set_flush */
+typedef struct DataRegionBufferedSet
+{
+  /* Protects 'set', 'scratch' and 'view'. Always acquired after a writer's
+   * lock. */
+  pthread_mutex_t lock;
+
+  /* The shared DataRegionSet. */
+  DataRegionSet* set;
+
+  /* Scratch space for merging a buffer into 'set'. */
+  DataRegion* scratch;
+
+  /* The union of 'set' and the buffers for the
+   * DATA_REGION_BUFFERED_INCLUDE_PENDING queries (NULL until the first
+   * one), which only grows. */
+  DataRegionSet* view;
+
+  /* The capacity of each writer's buffer. */
+  int64_t buffer_capacity;
+
+  /* All writers that were ever attached. */
+  _Atomic(DataRegionBufferedWriter*) writers;
+} DataRegionBufferedSet;
+
+/* Allocates a new, empty DataRegionBufferedSet.
+ * @param regionCapacity - The maximum number of DataRegions that can be
+ *        stored in the shared DataRegionSet. If this value is less than zero,
+ *        then NULL will be returned.
+ * @param bufferCapacity - The maximum number of DataRegions that each writer
+ *        buffers before flushing. If this value is less than one, then NULL
+ *        will be returned.
+ * @returns - A pointer to the allocated DataRegionBufferedSet, or NULL upon
+ *          failure.
+ * @remarks - Be sure to free the returned DataRegionBufferedSet by calling
+ *          the 'data_region_buffered_set_free' function.
+ * @see data_region_buffered_set_free */
+DataRegionBufferedSet* data_region_buffered_set_create(int64_t regionCapacity, int64_t bufferCapacity)
+{
+  if(regionCapacity < 0 || bufferCapacity < 1)
+    return NULL;
+
+  DataRegionBufferedSet* set = malloc(sizeof(DataRegionBufferedSet));
+  if(set == NULL)
+    return NULL;
+
+  set->set = data_region_set_create(regionCapacity);
+  set->scratch = malloc(sizeof(DataRegion) * (regionCapacity + bufferCapacity));
+  if(set->set == NULL || set->scratch == NULL)
+  {
+    data_region_set_free(set->set);
+    free(set->scratch);
+    free(set);
+    return NULL;
+  }
+
+  pthread_mutex_init(&set->lock, NULL);
+  set->view = NULL;
+  set->buffer_capacity = bufferCapacity;
+  atomic_init(&set->writers, NULL);
+  return set;
+}
+
+/* Frees a DataRegionBufferedSet that was allocated by the
+ * 'data_region_buffered_set_create' function, along with all of its
+ * writers.
+ * @param set - Pointer to the DataRegionBufferedSet. If this argument is
+ *        NULL, then nothing will happen.
+ * @remarks - No other thread may be using the set (or any of its writers)
+ *          when it is freed. DataRegions that are still buffered are
+ *          discarded. */
+void data_region_buffered_set_free(DataRegionBufferedSet* set)
+{
+  if(set == NULL)
+    return;
+
+  DataRegionBufferedWriter* writer = atomic_load(&set->writers);
+  while(writer != NULL)
+  {
+    DataRegionBufferedWriter* next = writer->next_writer;
+    pthread_mutex_destroy(&writer->lock);
+    data_region_set_free(writer->buffer);
+    free(writer);
+    writer = next;
+  }
+
+  pthread_mutex_destroy(&set->lock);
+  data_region_set_free(set->set);
+  data_region_set_free(set->view);
+  free(set->scratch);
+  free(set);
+}
+
+/* Internal function to fold a writer's buffer into the shared DataRegionSet.
+ * @param writer - The writer (whose lock is held).
+ * @returns - DATA_REGION_SET_SUCCESS, or DATA_REGION_SET_OUT_OF_SPACE if some
+ *          buffered DataRegions didn't fit into the shared DataRegionSet (in
+ *          which case they remain buffered). */
+DataRegionSetResult _data_region_buffered_writer_flush(DataRegionBufferedWriter* writer)
+{
+  DataRegionBufferedSet* set = writer->set;
+  DataRegionSet* buffer = writer->buffer;
+  if(buffer->count == 0)
+    return DATA_REGION_SET_SUCCESS;
+
+  DataRegionSetResult result = DATA_REGION_SET_SUCCESS;
+  pthread_mutex_lock(&set->lock);
+  if(_data_region_set_merge(set->set, buffer->regions, buffer->count, 1, set->scratch) == DATA_REGION_SET_SUCCESS)
+  {
+    data_region_set_clear(buffer);
+  }
+  else
+  {
+    //The whole buffer doesn't fit, so add what fits and keep the rest buffered
+    int64_t remaining = 0;
+    for(int64_t i = 0; i < buffer->count; i++)
+    {
+      if(data_region_set_add(set->set, buffer->regions[i]) != DATA_REGION_SET_SUCCESS)
+        buffer->regions[remaining++] = buffer->regions[i];
+      else
+        buffer->total_length -= data_region_length(buffer->regions[i]);
+    }
+    buffer->count = remaining;
+    result = DATA_REGION_SET_OUT_OF_SPACE;
+  }
+  pthread_mutex_unlock(&set->lock);
+  return result;
+}
+
+/* Obtains a writer through which the calling thread can add DataRegions to a
+ * DataRegionBufferedSet.
+ * @param set - Pointer to the DataRegionBufferedSet. If this is NULL, then
+ *        NULL will be returned.
+ * @returns - The writer, or NULL if the allocation failed.
+ * @remarks - Each thread should attach once and keep using its writer.
+ *          Release the writer via 'data_region_buffered_set_detach' so that
+ *          another thread can reuse it. Writers are freed along with the
+ *          set.
+ * @see data_region_buffered_set_detach */
+DataRegionBufferedWriter* data_region_buffered_set_attach(DataRegionBufferedSet* set)
+{
+  if(set == NULL)
+    return NULL;
+
+  //Reuse a detached writer if possible
+  for(DataRegionBufferedWriter* writer = atomic_load(&set->writers); writer != NULL; writer = writer->next_writer)
+  {
+    int expected = 0;
+    if(atomic_load(&writer->in_use) == 0 && atomic_compare_exchange_strong(&writer->in_use, &expected, 1))
+      return writer;
+  }
+
+  DataRegionBufferedWriter* writer = aligned_alloc(64, sizeof(DataRegionBufferedWriter));
+  if(writer == NULL)
+    return NULL;
+
+  writer->buffer = data_region_set_create(set->buffer_capacity);
+  if(writer->buffer == NULL)
+  {
+    free(writer);
+    return NULL;
+  }
+
+  pthread_mutex_init(&writer->lock, NULL);
+  atomic_init(&writer->in_use, 1);
+  writer->set = set;
+
+  //Publish the writer (writers are never removed from the list)
+  DataRegionBufferedWriter* head = atomic_load(&set->writers);
+  do
+  {
+    writer->next_writer = head;
+  } while(!atomic_compare_exchange_weak(&set->writers, &head, writer));
+  return writer;
+}
+
+/* Flushes and releases a writer that was obtained by
+ * 'data_region_buffered_set_attach'.
+ * @param writer - The writer. If this is NULL, then nothing will happen.
+ * @returns - The result of flushing the writer (see
+ *          'data_region_buffered_set_flush').
+ * @remarks - The writer must not be used after it has been detached. */
+DataRegionSetResult data_region_buffered_set_detach(DataRegionBufferedWriter* writer)
+{
+  if(writer == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+
+  pthread_mutex_lock(&writer->lock);
+  DataRegionSetResult result = _data_region_buffered_writer_flush(writer);
+  pthread_mutex_unlock(&writer->lock);
+  atomic_store(&writer->in_use, 0);
+  return result;
+}
+
+/* Adds a DataRegion to a DataRegionBufferedSet via a writer's buffer.
+ * @param writer - The calling thread's writer. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toAdd - The DataRegion to add. If this is invalid (see
+ *        data_region_is_valid), then DATA_REGION_SET_INVALID_REGION will
+ *        be returned.
+ * @returns - The DataRegionSetResult that defines the result of the add
+ *          operation. If all arguments are non-null and valid, then the
+ *          result will be either DATA_REGION_SET_SUCCESS or
+ *          DATA_REGION_SET_OUT_OF_SPACE (if neither the buffer nor the
+ *          shared DataRegionSet has room for 'toAdd').
+ * @remarks - The DataRegion is combined into the writer's buffer, and only
+ *          reaches the shared DataRegionSet when the buffer is flushed. */
+DataRegionSetResult data_region_buffered_set_add(DataRegionBufferedWriter* writer, DataRegion toAdd)
+{
+  if(writer == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(toAdd))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  pthread_mutex_lock(&writer->lock);
+  DataRegionSetResult result = data_region_set_add(writer->buffer, toAdd);
+  if(result == DATA_REGION_SET_OUT_OF_SPACE)
+  {
+    //The buffer is full, so fold it into the shared set and try again
+    _data_region_buffered_writer_flush(writer);
+    result = data_region_set_add(writer->buffer, toAdd);
+  }
+  pthread_mutex_unlock(&writer->lock);
+  return result;
+}
+
+/* Flushes a writer's buffer into the shared DataRegionSet.
+ * @param writer - The writer. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @returns - DATA_REGION_SET_SUCCESS, or DATA_REGION_SET_OUT_OF_SPACE if some
+ *          buffered DataRegions didn't fit into the shared DataRegionSet (in
+ *          which case they remain buffered). */
+DataRegionSetResult data_region_buffered_set_flush(DataRegionBufferedWriter* writer)
+{
+  if(writer == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+
+  pthread_mutex_lock(&writer->lock);
+  DataRegionSetResult result = _data_region_buffered_writer_flush(writer);
+  pthread_mutex_unlock(&writer->lock);
+  return result;
+}
+
+/* Flushes the buffers of all writers of a DataRegionBufferedSet.
+ * @param set - Pointer to the DataRegionBufferedSet. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @returns - DATA_REGION_SET_SUCCESS, or DATA_REGION_SET_OUT_OF_SPACE if some
+ *          buffered DataRegions didn't fit into the shared DataRegionSet. */
+DataRegionSetResult data_region_buffered_set_flush_all(DataRegionBufferedSet* set)
+{
+  if(set == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+
+  DataRegionSetResult result = DATA_REGION_SET_SUCCESS;
+  for(DataRegionBufferedWriter* writer = atomic_load(&set->writers); writer != NULL; writer = writer->next_writer)
+  {
+    if(data_region_buffered_set_flush(writer) != DATA_REGION_SET_SUCCESS)
+      result = DATA_REGION_SET_OUT_OF_SPACE;
+  }
+  return result;
+}
+
+/* Removes a DataRegion from a DataRegionBufferedSet.
+ * @param set - Pointer to the DataRegionBufferedSet. If this argument is
+ *        NULL, then DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toRemove - The DataRegion to remove. If this is invalid
+ *        (see data_region_is_valid), then DATA_REGION_SET_INVALID_REGION
+ *        will be returned.
+ * @returns - The DataRegionSetResult that defines the result of the removal
+ *          operation, like 'data_region_set_remove'.
+ * @remarks - All buffers are flushed first, so that buffered DataRegions
+ *          which were added before the removal are removed as well.
+ * @see data_region_set_remove */
+DataRegionSetResult data_region_buffered_set_remove(DataRegionBufferedSet* set, DataRegion toRemove)
+{
+  if(set == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(toRemove))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  if(data_region_buffered_set_flush_all(set) != DATA_REGION_SET_SUCCESS)
+    return DATA_REGION_SET_OUT_OF_SPACE;
+
+  pthread_mutex_lock(&set->lock);
+  DataRegionSetResult result = data_region_set_remove(set->set, toRemove);
+  pthread_mutex_unlock(&set->lock);
+  return result;
+}
+
+/* Internal function to get the DataRegionSet that a query reads.
+ * @param set - Pointer to the DataRegionBufferedSet.
+ * @param mode - The DataRegionBufferedQueryMode.
+ * @returns - The DataRegionSet to read (the shared DataRegionSet or the
+ *          view), with the set's lock held until
+ *          '_data_region_buffered_set_end_query'. */
+DataRegionSet* _data_region_buffered_set_begin_query(DataRegionBufferedSet* set, DataRegionBufferedQueryMode mode)
+{
+  if(mode == DATA_REGION_BUFFERED_INCLUDE_PENDING)
+  {
+    //Gather the (normalized) union of all buffers, walking one snapshot of the writers, which are only ever prepended
+    DataRegionBufferedWriter* writers = atomic_load(&set->writers);
+    int64_t writerCount = 0;
+    for(DataRegionBufferedWriter* writer = writers; writer != NULL; writer = writer->next_writer)
+      writerCount++;
+
+    DataRegion* pending = malloc(sizeof(DataRegion) * (writerCount * set->buffer_capacity + 1));
+    if(pending != NULL)
+    {
+      int64_t pendingCount = 0;
+      for(DataRegionBufferedWriter* writer = writers; writer != NULL; writer = writer->next_writer)
+      {
+        pthread_mutex_lock(&writer->lock);
+        for(int64_t j = 0; j < writer->buffer->count; j++)
+          pending[pendingCount++] = writer->buffer->regions[j];
+        pthread_mutex_unlock(&writer->lock);
+      }
+      pendingCount = _data_region_array_normalize(pending, pendingCount);
+
+      pthread_mutex_lock(&set->lock);
+      int64_t needed = set->set->count + pendingCount;
+      if(set->view == NULL || set->view->capacity < needed)
+      {
+        //Grow geometrically, so that a growing set doesn't reallocate the view for every query
+        int64_t capacity = set->view != NULL && set->view->capacity * 2 > needed ? set->view->capacity * 2 : needed;
+        DataRegionSet* view = data_region_set_create(capacity);
+        if(view != NULL)
+        {
+          data_region_set_free(set->view);
+          set->view = view;
+        }
+      }
+      if(set->view != NULL && set->view->capacity >= needed)
+      {
+        DataRegionSet* view = set->view;
+        view->count = _data_region_array_union(view->regions, set->set->regions, set->set->count, pending, pendingCount);
+        view->total_length = 0;
+        for(int64_t i = 0; i < view->count; i++)
+          view->total_length += data_region_length(view->regions[i]);
+        free(pending);
+        return view;
+      }
+      pthread_mutex_unlock(&set->lock);
+      free(pending);
+    }
+  }
+
+  //Without memory for the view, the buffers are flushed instead (see DATA_REGION_BUFFERED_INCLUDE_PENDING)
+  if(mode != DATA_REGION_BUFFERED_SHARED_ONLY)
+    data_region_buffered_set_flush_all(set);
+
+  pthread_mutex_lock(&set->lock);
+  return set->set;
+}
+
+/* Internal function to release the DataRegionSet of a query.
+ * @param set - Pointer to the DataRegionBufferedSet.
+ * @param view - The DataRegionSet returned by
+ *        '_data_region_buffered_set_begin_query'. */
+void _data_region_buffered_set_end_query(DataRegionBufferedSet* set, DataRegionSet* view)
+{
+  (void)view;
+  pthread_mutex_unlock(&set->lock);
+}
+
+/* Copies a subset of DataRegions in a DataRegionBufferedSet to an array.
+ * @param mode - Which DataRegions the query sees (see
+ *        DataRegionBufferedQueryMode).
+ * @remarks - Apart from 'mode', this function behaves like
+ *          'data_region_set_crop'.
+ * @see data_region_set_crop */
+int64_t data_region_buffered_set_crop(DataRegion* dst, int64_t dstCapacity, DataRegionBufferedSet* src, DataRegion boundaryRegion, DataRegionBufferedQueryMode mode, int* dstTooSmall)
+{
+  if(src == NULL)
+    return data_region_set_crop(dst, dstCapacity, NULL, boundaryRegion, dstTooSmall);
+
+  DataRegionSet* view = _data_region_buffered_set_begin_query(src, mode);
+  int64_t count = data_region_set_crop(dst, dstCapacity, view, boundaryRegion, dstTooSmall);
+  _data_region_buffered_set_end_query(src, view);
+  return count;
+}
+
+/* Counts the number of DataRegions in a DataRegionBufferedSet that are at
+ * least partially contained within a specific boundary region.
+ * @param mode - Which DataRegions the query sees (see
+ *        DataRegionBufferedQueryMode).
+ * @see data_region_set_count_crop */
+int64_t data_region_buffered_set_count_crop(DataRegionBufferedSet* src, DataRegion boundaryRegion, DataRegionBufferedQueryMode mode)
+{
+  return data_region_buffered_set_crop(NULL/*NULL indicates that we only want to count the DataRegions*/, 0, src, boundaryRegion, mode, NULL);
+}
+
+/* Copies a 'negative' of a subset of DataRegions within a
+ * DataRegionBufferedSet.
+ * @param mode - Which DataRegions the query sees (see
+ *        DataRegionBufferedQueryMode).
+ * @remarks - Apart from 'mode', this function behaves like
+ *          'data_region_set_negative_crop'.
+ * @see data_region_set_negative_crop */
+int64_t data_region_buffered_set_negative_crop(DataRegion* dst, int64_t dstCapacity, DataRegionBufferedSet* src, DataRegion boundaryRegion, DataRegionBufferedQueryMode mode, int* dstTooSmall)
+{
+  if(src == NULL)
+    return data_region_set_negative_crop(dst, dstCapacity, NULL, boundaryRegion, dstTooSmall);
+
+  DataRegionSet* view = _data_region_buffered_set_begin_query(src, mode);
+  int64_t count = data_region_set_negative_crop(dst, dstCapacity, view, boundaryRegion, dstTooSmall);
+  _data_region_buffered_set_end_query(src, view);
+  return count;
+}
+
+/* Gets the number of DataRegions that are stored in a DataRegionBufferedSet.
+ * @param set - Pointer to the DataRegionBufferedSet. If this is NULL, then
+ *        zero will be returned.
+ * @param mode - Which DataRegions are counted (see
+ *        DataRegionBufferedQueryMode).
+ * @returns - The number of DataRegions. */
+int64_t data_region_buffered_set_count(DataRegionBufferedSet* set, DataRegionBufferedQueryMode mode)
+{
+  if(set == NULL)
+    return 0;
+
+  DataRegionSet* view = _data_region_buffered_set_begin_query(set, mode);
+  int64_t count = data_region_set_count(view);
+  _data_region_buffered_set_end_query(set, view);
+  return count;
+}
+
+/* Gets the length of the sum of all DataRegions stored in a
+ * DataRegionBufferedSet.
+ * @param set - Pointer to the DataRegionBufferedSet. If this is NULL, then
+ *        zero will be returned.
+ * @param mode - Which DataRegions are summed (see
+ *        DataRegionBufferedQueryMode).
+ * @returns - The total length of the DataRegions. */
+int64_t data_region_buffered_set_total_length(DataRegionBufferedSet* set, DataRegionBufferedQueryMode mode)
+{
+  if(set == NULL)
+    return 0;
+
+  DataRegionSet* view = _data_region_buffered_set_begin_query(set, mode);
+  int64_t totalLength = data_region_set_total_length(view);
+  _data_region_buffered_set_end_query(set, view);
+  return totalLength;
+}
+
+#endif//DATA_REGION_BUFFERED_H
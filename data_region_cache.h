@@ -0,0 +1,595 @@
+#ifndef DATA_REGION_CACHE_H
+#define DATA_REGION_CACHE_H
+#include "data_region.h"
+#include "data_region_inflight.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/falloc.h>
+#include <sys/syscall.h>
+#endif
+
+/* Source of the bytes that a DataRegionCache caches, such as a file or a
+ * remote object.
+ * @see data_region_cache_file_backend_open
+ * @see data_region_cache_slow_backend_create */
+typedef struct DataRegionCacheBackend
+{
+  /* Passed to 'read' and 'close'. */
+  void* context;
+
+  /* Reads up to 'length' bytes at 'offset' into 'dst'. Returns the number
+   * of bytes read (which is less than 'length' only at the end of the
+   * source), or -1 upon failure. Must be safe to call from several threads
+   * at once. */
+  int64_t (*read)(void* context, void* dst, int64_t offset, int64_t length);
+
+  /* Releases 'context'. May be NULL. */
+  void (*close)(void* context);
+} DataRegionCacheBackend;
+
+/* Byte counters of a DataRegionCache.
+ * @see data_region_cache_get_stats */
+typedef struct DataRegionCacheStats
+{
+  /* The number of bytes that were read from the cache file. */
+  int64_t hit_bytes;
+
+  /* The number of bytes that were fetched from the backend. */
+  int64_t miss_bytes;
+
+  /* The number of bytes that were evicted from the cache. */
+  int64_t evicted_bytes;
+} DataRegionCacheStats;
+
+/* Read-through cache in front of a DataRegionCacheBackend. Fetched bytes are
+ * written to a sparse cache file at their own offsets, and a DataRegionSet
+ * tracks which bytes are present, so each read only fetches its gaps (see
+ * 'data_region_set_negative_crop') from the backend. Gaps that another read
+ * is already fetching are waited for instead of being fetched twice.
+ * @see data_region_cache_create
+ * @see data_region_cache_read
+ * @see data_region_cache_evict */
+typedef struct DataRegionCache
+{
+  /* Protects 'present', 'stats', 'generation' and the writes to the cache
+   * file. The backend and the present bytes of the cache file are read
+   * without holding it. */
+  pthread_mutex_t lock;
+
+  /* The source of the cached bytes. */
+  DataRegionCacheBackend backend;
+
+  /* The sparse cache file. */
+  int fd;
+
+  /* The byte ranges that are present in the cache file. */
+  DataRegionSet* present;
+
+  /* The byte ranges that are being fetched from the backend. */
+  DataRegionInflight* inflight;
+
+  /* The maximum number of bytes that are kept in the cache file. */
+  int64_t max_cached_bytes;
+
+  /* Incremented whenever bytes are dropped from the cache file, so that a
+   * read of present bytes without the lock can tell whether they may have
+   * been punched (or rewritten) meanwhile. */
+  uint64_t generation;
+
+  DataRegionCacheStats stats;
+} DataRegionCache;
+
+/* Internal function to read a whole byte range from a file descriptor.
+ * @returns - The number of bytes read, which is less than 'length' only at
+ *          the end of the file, or -1 upon failure. */
+int64_t _data_region_cache_pread(int fd, void* dst, int64_t offset, int64_t length)
+{
+  int64_t total = 0;
+  while(total < length)
+  {
+    ssize_t count = pread(fd, (char*)dst + total, (size_t)(length - total), (off_t)(offset + total));
+    if(count < 0)
+      return -1;
+    if(count == 0)
+      break;//End of file
+    total += count;
+  }
+  return total;
+}
+
+/* Internal function to write a whole byte range to a file descriptor.
+ * @returns - True (1) upon success, otherwise false (0). */
+int _data_region_cache_pwrite(int fd, const void* src, int64_t offset, int64_t length)
+{
+  int64_t total = 0;
+  while(total < length)
+  {
+    ssize_t count = pwrite(fd, (const char*)src + total, (size_t)(length - total), (off_t)(offset + total));
+    if(count <= 0)
+      return 0;
+    total += count;
+  }
+  return 1;
+}
+
+/* Internal 'read' function of the local file backend. */
+int64_t _data_region_cache_file_backend_read(void* context, void* dst, int64_t offset, int64_t length)
+{
+  return _data_region_cache_pread((int)(intptr_t)context, dst, offset, length);
+}
+
+/* Internal 'close' function of the local file backend. */
+void _data_region_cache_file_backend_close(void* context)
+{
+  close((int)(intptr_t)context);
+}
+
+/* Opens a local file as a DataRegionCacheBackend.
+ * @param dst - Receives the backend. If this is NULL, then false (0) will be
+ *        returned.
+ * @param path - The path of the file to read. If this is NULL, then false
+ *        (0) will be returned.
+ * @returns - True (1) upon success, otherwise false (0). */
+int data_region_cache_file_backend_open(DataRegionCacheBackend* dst, const char* path)
+{
+  if(dst == NULL || path == NULL)
+    return 0;
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return 0;
+
+  dst->context = (void*)(intptr_t)fd;
+  dst->read = _data_region_cache_file_backend_read;
+  dst->close = _data_region_cache_file_backend_close;
+  return 1;
+}
+
+/* Context of a slowed DataRegionCacheBackend.
+ * @see data_region_cache_slow_backend_create */
+typedef struct DataRegionCacheSlowBackend
+{
+  /* The backend that is slowed down. */
+  DataRegionCacheBackend inner;
+
+  /* The delay of each read. */
+  int64_t delay_microseconds;
+
+  /* The number of reads, and the number of bytes requested by them. */
+  _Atomic int64_t read_count;
+  _Atomic int64_t read_bytes;
+} DataRegionCacheSlowBackend;
+
+/* Internal 'read' function of the slowed backend. */
+int64_t _data_region_cache_slow_backend_read(void* context, void* dst, int64_t offset, int64_t length)
+{
+  DataRegionCacheSlowBackend* slow = context;
+  atomic_fetch_add(&slow->read_count, 1);
+  atomic_fetch_add(&slow->read_bytes, length);
+
+  struct timespec delay = { slow->delay_microseconds / 1000000, (slow->delay_microseconds % 1000000) * 1000 };
+  nanosleep(&delay, NULL);
+  return slow->inner.read(slow->inner.context, dst, offset, length);
+}
+
+/* Internal 'close' function of the slowed backend. */
+void _data_region_cache_slow_backend_close(void* context)
+{
+  DataRegionCacheSlowBackend* slow = context;
+  if(slow->inner.close != NULL)
+    slow->inner.close(slow->inner.context);
+  free(slow);
+}
+
+/* Wraps a DataRegionCacheBackend in one that delays every read, to test
+ * a DataRegionCache against a slow source.
+ * @param dst - Receives the backend. Its 'context' is a
+ *        DataRegionCacheSlowBackend, which counts the reads. If this is
+ *        NULL, then false (0) will be returned.
+ * @param inner - The backend to slow down, which is closed along with the
+ *        new one.
+ * @param delayMicroseconds - The delay of each read.
+ * @returns - True (1) upon success, otherwise false (0). */
+int data_region_cache_slow_backend_create(DataRegionCacheBackend* dst, DataRegionCacheBackend inner, int64_t delayMicroseconds)
+{
+  if(dst == NULL || inner.read == NULL || delayMicroseconds < 0)
+    return 0;
+
+  DataRegionCacheSlowBackend* slow = malloc(sizeof(DataRegionCacheSlowBackend));
+  if(slow == NULL)
+    return 0;
+
+  slow->inner = inner;
+  slow->delay_microseconds = delayMicroseconds;
+  atomic_init(&slow->read_count, 0);
+  atomic_init(&slow->read_bytes, 0);
+  dst->context = slow;
+  dst->read = _data_region_cache_slow_backend_read;
+  dst->close = _data_region_cache_slow_backend_close;
+  return 1;
+}
+
+/* Allocates a new, empty DataRegionCache.
+ * @param backend - The source of the cached bytes. The cache takes ownership
+ *        of it (see 'data_region_cache_free'). If its 'read' function is
+ *        NULL, then NULL will be returned.
+ * @param cachePath - The path of the cache file, which is created (or
+ *        truncated). If this is NULL, then NULL will be returned.
+ * @param regionCapacity - The maximum number of separate byte ranges that
+ *        are cached. If this is less than one, then NULL will be returned.
+ * @param maxCachedBytes - The maximum number of bytes that are cached. If
+ *        this is less than zero, then NULL will be returned.
+ * @returns - A pointer to the allocated DataRegionCache, or NULL upon
+ *          failure (in which case the backend is not closed).
+ * @remarks - Be sure to free the returned DataRegionCache by calling the
+ *          'data_region_cache_free' function.
+ * @see data_region_cache_free */
+DataRegionCache* data_region_cache_create(DataRegionCacheBackend backend, const char* cachePath, int64_t regionCapacity, int64_t maxCachedBytes)
+{
+  if(backend.read == NULL || cachePath == NULL || regionCapacity < 1 || maxCachedBytes < 0)
+    return NULL;
+
+  DataRegionCache* cache = malloc(sizeof(DataRegionCache));
+  if(cache == NULL)
+    return NULL;
+
+  cache->present = data_region_set_create(regionCapacity);
+  cache->inflight = data_region_inflight_create(regionCapacity);
+  cache->fd = open(cachePath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if(cache->present == NULL || cache->inflight == NULL || cache->fd < 0)
+  {
+    if(cache->fd >= 0)
+      close(cache->fd);
+    data_region_set_free(cache->present);
+    data_region_inflight_free(cache->inflight);
+    free(cache);
+    return NULL;
+  }
+
+  pthread_mutex_init(&cache->lock, NULL);
+  cache->backend = backend;
+  cache->max_cached_bytes = maxCachedBytes;
+  cache->stats = (DataRegionCacheStats){ 0, 0, 0 };
+  cache->generation = 0;
+  return cache;
+}
+
+/* Frees a DataRegionCache that was allocated by the
+ * 'data_region_cache_create' function, and closes its backend.
+ * @param cache - Pointer to the DataRegionCache. If this argument is NULL,
+ *        then nothing will happen.
+ * @remarks - The cache file is closed, but not deleted. */
+void data_region_cache_free(DataRegionCache* cache)
+{
+  if(cache == NULL)
+    return;
+
+  if(cache->backend.close != NULL)
+    cache->backend.close(cache->backend.context);
+  close(cache->fd);
+  pthread_mutex_destroy(&cache->lock);
+  data_region_set_free(cache->present);
+  data_region_inflight_free(cache->inflight);
+  free(cache);
+}
+
+/* Internal function to drop a byte range from a DataRegionCache.
+ * @param cache - The DataRegionCache (whose lock is held).
+ * @param region - The byte range to drop.
+ * @returns - The number of bytes that were dropped. */
+int64_t _data_region_cache_drop(DataRegionCache* cache, DataRegion region)
+{
+  int64_t previousLength = data_region_set_total_length(cache->present);
+  if(data_region_set_remove(cache->present, region) != DATA_REGION_SET_SUCCESS)
+    return 0;
+
+  int64_t dropped = previousLength - data_region_set_total_length(cache->present);
+  if(dropped > 0)
+  {
+#if defined(__linux__)
+    //Release the disk space of the dropped bytes (this is only an optimization)
+    syscall(SYS_fallocate, cache->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)region.first_index, (off_t)data_region_length(region));
+#endif
+    cache->stats.evicted_bytes += dropped;
+    cache->generation++;
+  }
+  return dropped;
+}
+
+/* Internal function to make room for a byte range in a DataRegionCache,
+ * by evicting the cached bytes that are farthest from it.
+ * @param cache - The DataRegionCache (whose lock is held).
+ * @param toAdd - The byte range that will be added. Bytes within it are
+ *        never evicted.
+ * @returns - True (1) if 'toAdd' fits, otherwise false (0). */
+int _data_region_cache_make_room(DataRegionCache* cache, DataRegion toAdd)
+{
+  DataRegionSet* present = cache->present;
+  int64_t length = data_region_length(toAdd);
+  if(length > cache->max_cached_bytes)
+    return 0;
+
+  while(data_region_set_total_length(present) + length > cache->max_cached_bytes || !_data_region_set_can_add(present, toAdd))
+  {
+    if(present->count == 0)
+      return 0;
+
+    //The cached ranges that are farthest from 'toAdd' are at either end of the set
+    DataRegion first = present->regions[0];
+    DataRegion last = present->regions[present->count - 1];
+    int useLast = last.first_index > toAdd.last_index &&
+      (first.last_index >= toAdd.first_index || last.last_index - toAdd.last_index > toAdd.first_index - first.first_index);
+    DataRegion victim = useLast ? last : first;
+    if(data_region_intersects(victim, toAdd))
+      return 0;//Everything that remains cached is needed
+
+    //Evict whole ranges while short of DataRegions, otherwise only the excess bytes from the far end
+    int64_t excess = data_region_set_total_length(present) + length - cache->max_cached_bytes;
+    if(_data_region_set_can_add(present, toAdd) && excess < data_region_length(victim))
+    {
+      if(useLast)
+        victim.first_index = victim.last_index - excess + 1;
+      else
+        victim.last_index = victim.first_index + excess - 1;
+    }
+    _data_region_cache_drop(cache, victim);
+  }
+  return 1;
+}
+
+/* Internal function to fetch a byte range from the backend of a
+ * DataRegionCache, and to cache it.
+ * @param cache - The DataRegionCache (whose lock isn't held).
+ * @param dst - The destination of the fetched bytes.
+ * @param region - The byte range to fetch.
+ * @returns - The number of bytes fetched, or -1 upon failure. */
+int64_t _data_region_cache_fetch(DataRegionCache* cache, void* dst, DataRegion region)
+{
+  int64_t count = cache->backend.read(cache->backend.context, dst, region.first_index, data_region_length(region));
+  if(count <= 0)
+    return count;
+
+  pthread_mutex_lock(&cache->lock);
+  cache->stats.miss_bytes += count;
+  DataRegion fetched = { region.first_index, region.first_index + count - 1 };
+  if(_data_region_cache_make_room(cache, fetched) && _data_region_cache_pwrite(cache->fd, dst, fetched.first_index, count))
+    data_region_set_add(cache->present, fetched);
+  pthread_mutex_unlock(&cache->lock);
+  return count;
+}
+
+/* Internal function to read a byte range from the cache file of a
+ * DataRegionCache while holding its lock, if the range is entirely present.
+ * @param cache - The DataRegionCache (whose lock isn't held).
+ * @param dst - The destination of the bytes.
+ * @param region - The byte range to read.
+ * @returns - The number of bytes read, or -1 if they aren't all present (or
+ *          couldn't be read). */
+int64_t _data_region_cache_read_present(DataRegionCache* cache, void* dst, DataRegion region)
+{
+  int64_t length = data_region_length(region);
+  int64_t count = -1;
+  pthread_mutex_lock(&cache->lock);
+  int64_t i = _data_region_set_lower_bound(cache->present, region.first_index);
+  if(i < cache->present->count && data_region_contains(cache->present->regions[i], region) && _data_region_cache_pread(cache->fd, dst, region.first_index, length) == length)
+  {
+    cache->stats.hit_bytes += length;
+    count = length;
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return count;
+}
+
+/* Reads bytes through a DataRegionCache. Bytes that are present in the cache
+ * file are read from it, and only the missing byte ranges are fetched from
+ * the backend (and then cached).
+ * @param cache - Pointer to the DataRegionCache. If this is NULL, then -1
+ *        will be returned.
+ * @param dst - The destination buffer. If this is NULL, then -1 will be
+ *        returned.
+ * @param offset - The offset of the first byte to read. If this is less
+ *        than zero, then -1 will be returned.
+ * @param length - The number of bytes to read. If this is less than zero,
+ *        or if the range would exceed INT64_MAX, then -1 will be returned.
+ * @returns - The number of bytes read, which is less than 'length' only if
+ *          the backend ended before 'offset + length', or -1 if the cache
+ *          file or the backend could not be read.
+ * @remarks - Neither the backend nor the present bytes are read while
+ *          holding the lock of the cache, so several threads can read and
+ *          fetch at once. Present bytes that are evicted during the read are
+ *          read again (or fetched again) afterwards. Missing bytes that another
+ *          thread is already fetching (see DataRegionInflight) are waited
+ *          for, and then read from the cache file, so concurrent reads of
+ *          the same bytes fetch them only once. Fetched bytes which don't
+ *          fit into the cache (see 'maxCachedBytes') are still returned. */
+int64_t data_region_cache_read(DataRegionCache* cache, void* dst, int64_t offset, int64_t length)
+{
+  if(cache == NULL || dst == NULL || offset < 0 || length < 0 || length > INT64_MAX - offset)
+    return -1;
+  if(length == 0)
+    return 0;
+
+  DataRegion request = { offset, offset + length - 1 };
+  char* bytes = dst;
+
+  //Find the gaps between the present bytes
+  pthread_mutex_lock(&cache->lock);
+  int64_t gapCapacity = data_region_set_count_crop(cache->present, request) + 1;
+  DataRegion* gaps = malloc(sizeof(DataRegion) * gapCapacity);
+  if(gaps == NULL)
+  {
+    pthread_mutex_unlock(&cache->lock);
+    return -1;
+  }
+  int64_t gapCount = data_region_set_negative_crop(gaps, gapCapacity, cache->present, request, NULL);
+  uint64_t generation = cache->generation;
+
+  //Claim the gaps while still holding the lock, so that a gap is either present, being fetched, or claimed by this read
+  int64_t claimCapacity = 0;
+  for(int64_t i = 0; i < gapCount; i++)
+    claimCapacity += data_region_inflight_begin(NULL, 0, cache->inflight, gaps[i], NULL);
+  DataRegionInflightClaim* claims = malloc(sizeof(DataRegionInflightClaim) * (claimCapacity > 0 ? claimCapacity : 1));
+  if(claims == NULL)
+  {
+    pthread_mutex_unlock(&cache->lock);
+    free(gaps);
+    return -1;
+  }
+
+  //A gap that can't be registered is fetched without deduplication
+  int64_t claimCount = 0;
+  for(int64_t i = 0; i < gapCount; i++)
+  {
+    int dstTooSmall;
+    int64_t count = data_region_inflight_begin(claims + claimCount, claimCapacity - claimCount, cache->inflight, gaps[i], &dstTooSmall);
+    if(dstTooSmall)
+      claims[claimCount++] = (DataRegionInflightClaim){ gaps[i], NULL, 1 };
+    else
+      claimCount += count;
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+  //Fetch the owned gaps first, because other reads may be waiting for them
+  int failed = 0;
+  int64_t end = request.last_index + 1;
+  for(int64_t i = 0; i < claimCount; i++)
+  {
+    if(!claims[i].is_owner)
+      continue;
+
+    int64_t claimLength = data_region_length(claims[i].region);
+    int64_t count = _data_region_cache_fetch(cache, bytes + (claims[i].region.first_index - offset), claims[i].region);
+    data_region_inflight_end(cache->inflight, claims[i].handle, count == claimLength);
+    if(count < 0)
+      failed = 1;
+    else if(count < claimLength && claims[i].region.first_index + count < end)
+      end = claims[i].region.first_index + count;//The backend ended within this gap
+  }
+
+  //Read the present bytes without the lock; if any bytes were dropped meanwhile, then read them again with it
+  int hitFailed = 0;
+  int64_t hitBytes = 0;
+  int64_t position = offset;
+  for(int64_t i = 0; i <= gapCount; i++)
+  {
+    int64_t hitEnd = i < gapCount ? gaps[i].first_index : request.last_index + 1;
+    if(hitEnd > position && _data_region_cache_pread(cache->fd, bytes + (position - offset), position, hitEnd - position) != hitEnd - position)
+      hitFailed = 1;
+    hitBytes += hitEnd - position;
+    if(i < gapCount)
+      position = gaps[i].last_index + 1;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  int isStale = cache->generation != generation;
+  if(!isStale && !hitFailed)
+    cache->stats.hit_bytes += hitBytes;
+  pthread_mutex_unlock(&cache->lock);
+
+  if(isStale)
+  {
+    position = offset;
+    for(int64_t i = 0; i <= gapCount; i++)
+    {
+      int64_t hitEnd = i < gapCount ? gaps[i].first_index : request.last_index + 1;
+      DataRegion hit = { position, hitEnd - 1 };
+      if(hitEnd > position && _data_region_cache_read_present(cache, bytes + (position - offset), hit) < 0 &&
+        _data_region_cache_fetch(cache, bytes + (position - offset), hit) != hitEnd - position)
+        failed = 1;
+      if(i < gapCount)
+        position = gaps[i].last_index + 1;
+    }
+  }
+  else if(hitFailed)
+    failed = 1;
+  free(gaps);
+
+  //Then read the gaps that other reads fetched, or fetch them if that failed (or they were already evicted)
+  for(int64_t i = 0; i < claimCount; i++)
+  {
+    if(claims[i].is_owner)
+      continue;
+
+    DataRegion region = claims[i].region;
+    int64_t claimLength = data_region_length(region);
+    char* claimBytes = bytes + (region.first_index - offset);
+    int succeeded = data_region_inflight_wait(claims[i].handle);
+    data_region_inflight_release(claims[i].handle);
+
+    int64_t count = succeeded ? _data_region_cache_read_present(cache, claimBytes, region) : -1;
+    if(count < 0)
+      count = _data_region_cache_fetch(cache, claimBytes, region);
+
+    if(count < 0)
+      failed = 1;
+    else if(count < claimLength && region.first_index + count < end)
+      end = region.first_index + count;
+  }
+
+  free(claims);
+  return failed ? -1 : end - offset;
+}
+
+/* Evicts a byte range from a DataRegionCache.
+ * @param cache - Pointer to the DataRegionCache. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param offset - The offset of the first byte to evict.
+ * @param length - The number of bytes to evict. If the range is invalid,
+ *        then DATA_REGION_SET_INVALID_REGION will be returned.
+ * @returns - The DataRegionSetResult that defines the result of the
+ *          eviction (see 'data_region_set_remove').
+ * @remarks - The evicted bytes will be fetched again when they are next
+ *          read. */
+DataRegionSetResult data_region_cache_evict(DataRegionCache* cache, int64_t offset, int64_t length)
+{
+  if(cache == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+
+  if(length < 1 || offset > INT64_MAX - (length - 1))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  DataRegion region = { offset, offset + length - 1 };
+  pthread_mutex_lock(&cache->lock);
+  DataRegionSetResult result = _data_region_set_can_remove(cache->present, region) ? DATA_REGION_SET_SUCCESS : DATA_REGION_SET_OUT_OF_SPACE;
+  if(result == DATA_REGION_SET_SUCCESS)
+    _data_region_cache_drop(cache, region);
+  pthread_mutex_unlock(&cache->lock);
+  return result;
+}
+
+/* Gets the byte counters of a DataRegionCache.
+ * @param cache - Pointer to the DataRegionCache. If this is NULL, then all
+ *        counters will be zero.
+ * @returns - The byte counters. */
+DataRegionCacheStats data_region_cache_get_stats(DataRegionCache* cache)
+{
+  DataRegionCacheStats stats = { 0, 0, 0 };
+  if(cache == NULL)
+    return stats;
+
+  pthread_mutex_lock(&cache->lock);
+  stats = cache->stats;
+  pthread_mutex_unlock(&cache->lock);
+  return stats;
+}
+
+/* Gets the number of bytes that are currently cached by a DataRegionCache.
+ * @param cache - Pointer to the DataRegionCache. If this is NULL, then zero
+ *        will be returned.
+ * @returns - The number of cached bytes. */
+int64_t data_region_cache_cached_bytes(DataRegionCache* cache)
+{
+  if(cache == NULL)
+    return 0;
+
+  pthread_mutex_lock(&cache->lock);
+  int64_t cachedBytes = data_region_set_total_length(cache->present);
+  pthread_mutex_unlock(&cache->lock);
+  return cachedBytes;
+}
+
+#endif//DATA_REGION_CACHE_H
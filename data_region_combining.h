@@ -0,0 +1,452 @@
+#ifndef DATA_REGION_COMBINING_H
+#define DATA_REGION_COMBINING_H
+#include "data_region.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+enum
+{
+  _DATA_REGION_COMBINING_IDLE = 0,
+  _DATA_REGION_COMBINING_PENDING = 1,
+  _DATA_REGION_COMBINING_DONE = 2,
+};
+
+/* Per-thread publication slot of a DataRegionCombiningSet. Obtain one via
+ * 'data_region_combining_set_attach' and release it via
+ * 'data_region_combining_set_detach'. A slot must only be used by one thread
+ * at a time. Each slot occupies its own cache line, so publishing an
+ * operation doesn't disturb the slots of other threads. */
+typedef struct DataRegionCombiningSlot
+{
+  /* Whether the slot holds a pending operation, or the result of one. */
+  _Alignas(64) atomic_int state;
+
+  /* The pending operation (written by the owning thread). */
+  int is_add;
+  DataRegion region;
+
+  /* The result of the operation (written by the combiner). */
+  DataRegionSetResult result;
+
+  /* True (1) while a thread owns this slot. */
+  atomic_int in_use;
+
+  /* The DataRegionCombiningSet that the slot belongs to. */
+  struct DataRegionCombiningSet* set;
+
+  /* The next slot registered with the set. */
+  struct DataRegionCombiningSlot* next_slot;
+} DataRegionCombiningSlot;
+
+/* Flat-combining wrapper around a DataRegionSet for many threads that add
+ * or remove DataRegions at a high rate. Instead of each thread acquiring the
+ * lock and shifting the stored DataRegions, threads publish their operation
+ * in a per-thread slot. Whichever thread acquires the lock (the 'combiner')
+ * collects all pending operations, sorts and combines them, and applies
+ * them to the DataRegionSet with one merge pass.
+ * @see data_region_combining_set_create
+ * @see data_region_combining_set_attach
+ * @see data_region_combining_set_add
+ * @see data_region_combining_set_remove */
+typedef struct DataRegionCombiningSet
+{
+  /* Held by the combiner, and by readers of the DataRegionSet. */
+  pthread_mutex_t lock;
+
+  /* The DataRegionSet (protected by 'lock'). */
+  DataRegionSet* set;
+
+  /* All slots that were ever attached. */
+  _Atomic(DataRegionCombiningSlot*) slots;
+
+  /* Scratch space for the combiner (protected by 'lock'). */
+  DataRegionCombiningSlot** pending;
+  DataRegion* batch;
+  DataRegion* merged;
+  int64_t pending_capacity;
+  int64_t merged_capacity;
+} DataRegionCombiningSet;
+
+/* Allocates a new, empty DataRegionCombiningSet.
+ * @param regionCapacity - The maximum number of DataRegions that can be
+ *        stored in the set. If this value is less than zero, then NULL will
+ *        be returned.
+ * @returns - A pointer to the allocated DataRegionCombiningSet, or NULL upon
+ *          failure.
+ * @remarks - Be sure to free the returned DataRegionCombiningSet by calling
+ *          the 'data_region_combining_set_free' function.
+ * @see data_region_combining_set_free */
+DataRegionCombiningSet* data_region_combining_set_create(int64_t regionCapacity)
+{
+  if(regionCapacity < 0)
+    return NULL;
+
+  DataRegionCombiningSet* set = malloc(sizeof(DataRegionCombiningSet));
+  if(set == NULL)
+    return NULL;
+
+  set->set = data_region_set_create(regionCapacity);
+  if(set->set == NULL)
+  {
+    free(set);
+    return NULL;
+  }
+
+  pthread_mutex_init(&set->lock, NULL);
+  atomic_init(&set->slots, NULL);
+  set->pending = NULL;
+  set->batch = NULL;
+  set->merged = NULL;
+  set->pending_capacity = 0;
+  set->merged_capacity = 0;
+  return set;
+}
+
+/* Frees a DataRegionCombiningSet that was allocated by the
+ * 'data_region_combining_set_create' function, along with all of its
+ * slots.
+ * @param set - Pointer to the DataRegionCombiningSet. If this argument is
+ *        NULL, then nothing will happen.
+ * @remarks - No other thread may be using the set (or any of its slots) when
+ *          it is freed. */
+void data_region_combining_set_free(DataRegionCombiningSet* set)
+{
+  if(set == NULL)
+    return;
+
+  DataRegionCombiningSlot* slot = atomic_load(&set->slots);
+  while(slot != NULL)
+  {
+    DataRegionCombiningSlot* next = slot->next_slot;
+    free(slot);
+    slot = next;
+  }
+
+  pthread_mutex_destroy(&set->lock);
+  data_region_set_free(set->set);
+  free(set->pending);
+  free(set->batch);
+  free(set->merged);
+  free(set);
+}
+
+/* Obtains a slot through which the calling thread can update a
+ * DataRegionCombiningSet.
+ * @param set - Pointer to the DataRegionCombiningSet. If this is NULL, then
+ *        NULL will be returned.
+ * @returns - The slot, or NULL if the allocation failed.
+ * @remarks - Each thread should attach once and keep using its slot. Release
+ *          the slot via 'data_region_combining_set_detach' so that another
+ *          thread can reuse it. Slots are freed along with the set.
+ * @see data_region_combining_set_detach */
+DataRegionCombiningSlot* data_region_combining_set_attach(DataRegionCombiningSet* set)
+{
+  if(set == NULL)
+    return NULL;
+
+  //Reuse a detached slot if possible
+  for(DataRegionCombiningSlot* slot = atomic_load(&set->slots); slot != NULL; slot = slot->next_slot)
+  {
+    int expected = 0;
+    if(atomic_load(&slot->in_use) == 0 && atomic_compare_exchange_strong(&slot->in_use, &expected, 1))
+      return slot;
+  }
+
+  DataRegionCombiningSlot* slot = aligned_alloc(64, sizeof(DataRegionCombiningSlot));
+  if(slot == NULL)
+    return NULL;
+
+  atomic_init(&slot->state, _DATA_REGION_COMBINING_IDLE);
+  atomic_init(&slot->in_use, 1);
+  slot->set = set;
+
+  //Publish the slot (slots are never removed from the list)
+  DataRegionCombiningSlot* head = atomic_load(&set->slots);
+  do
+  {
+    slot->next_slot = head;
+  } while(!atomic_compare_exchange_weak(&set->slots, &head, slot));
+  return slot;
+}
+
+/* Releases a slot that was obtained by 'data_region_combining_set_attach'.
+ * @param slot - The slot. If this is NULL, then nothing will happen.
+ * @remarks - The slot must not be used after it has been detached. */
+void data_region_combining_set_detach(DataRegionCombiningSlot* slot)
+{
+  if(slot != NULL)
+    atomic_store(&slot->in_use, 0);
+}
+
+/* Internal function to make sure that the combiner's scratch space can hold
+ * the operations of all slots.
+ * @param set - Pointer to the DataRegionCombiningSet (whose lock is held).
+ * @param slotCount - The number of slots.
+ * @returns - True (1) upon success, or false (0) if 'realloc' failed. */
+int _data_region_combining_set_reserve(DataRegionCombiningSet* set, int64_t slotCount)
+{
+  if(slotCount <= set->pending_capacity)
+    return 1;
+
+  int64_t capacity = set->pending_capacity * 2 > slotCount ? set->pending_capacity * 2 : slotCount;
+  DataRegionCombiningSlot** pending = realloc(set->pending, sizeof(DataRegionCombiningSlot*) * capacity);
+  if(pending == NULL)
+    return 0;
+  set->pending = pending;
+
+  DataRegion* batch = realloc(set->batch, sizeof(DataRegion) * capacity);
+  if(batch == NULL)
+    return 0;
+  set->batch = batch;
+
+  set->pending_capacity = capacity;
+  return 1;
+}
+
+/* Internal function to make sure that the combiner's scratch space can hold
+ * the result of merging a batch (see '_data_region_set_merge').
+ * @param set - Pointer to the DataRegionCombiningSet (whose lock is held).
+ * @param batchCount - The number of normalized DataRegions in the batch.
+ * @param isAdd - True (1) if the batch is added, otherwise false (0).
+ * @returns - True (1) upon success, or false (0) if 'realloc' failed. */
+int _data_region_combining_set_reserve_merged(DataRegionCombiningSet* set, int64_t batchCount, int isAdd)
+{
+  int64_t windowStart, windowEnd;
+  _data_region_set_merge_window(set->set, set->batch, batchCount, isAdd, &windowStart, &windowEnd);
+  int64_t required = (windowEnd - windowStart) + batchCount;
+  if(required <= set->merged_capacity)
+    return 1;
+
+  int64_t capacity = set->merged_capacity * 2 > required ? set->merged_capacity * 2 : required;
+  DataRegion* merged = realloc(set->merged, sizeof(DataRegion) * capacity);
+  if(merged == NULL)
+    return 0;
+  set->merged = merged;
+  set->merged_capacity = capacity;
+  return 1;
+}
+
+/* Internal function to apply the pending adds or removes of a batch with one
+ * merge pass (see '_data_region_set_merge').
+ * @param set - Pointer to the DataRegionCombiningSet (whose lock is held).
+ * @param pendingCount - The number of slots in 'set->pending'.
+ * @param isAdd - True (1) to apply the adds, otherwise false (0) to apply
+ *        the removes. */
+void _data_region_combining_set_apply(DataRegionCombiningSet* set, int64_t pendingCount, int isAdd)
+{
+  int64_t batchCount = 0;
+  for(int64_t i = 0; i < pendingCount; i++)
+  {
+    if(set->pending[i]->is_add == isAdd)
+      set->batch[batchCount++] = set->pending[i]->region;
+  }
+  if(batchCount == 0)
+    return;
+
+  batchCount = _data_region_array_normalize(set->batch, batchCount);
+  if(_data_region_combining_set_reserve_merged(set, batchCount, isAdd)
+    && _data_region_set_merge(set->set, set->batch, batchCount, isAdd, set->merged) == DATA_REGION_SET_SUCCESS)
+  {
+    for(int64_t i = 0; i < pendingCount; i++)
+    {
+      if(set->pending[i]->is_add == isAdd)
+        set->pending[i]->result = DATA_REGION_SET_SUCCESS;
+    }
+    return;
+  }
+
+  //The whole batch doesn't fit (or there is no scratch space), so apply the operations one by one to find out which of them fail
+  for(int64_t i = 0; i < pendingCount; i++)
+  {
+    DataRegionCombiningSlot* slot = set->pending[i];
+    if(slot->is_add == isAdd)
+      slot->result = isAdd ? data_region_set_add(set->set, slot->region) : data_region_set_remove(set->set, slot->region);
+  }
+}
+
+/* Internal function to apply all pending operations. Must be called by the
+ * combiner (while holding the lock).
+ * @param set - Pointer to the DataRegionCombiningSet.
+ * @remarks - All pending operations are concurrent with each other, so they
+ *          may be applied in any order: the adds are applied first, and the
+ *          removes second. */
+void _data_region_combining_set_combine(DataRegionCombiningSet* set)
+{
+  int64_t slotCount = 0;
+  for(DataRegionCombiningSlot* slot = atomic_load(&set->slots); slot != NULL; slot = slot->next_slot)
+    slotCount++;
+
+  if(!_data_region_combining_set_reserve(set, slotCount))
+  {
+    //Without scratch space, apply the pending operations one by one
+    for(DataRegionCombiningSlot* slot = atomic_load(&set->slots); slot != NULL; slot = slot->next_slot)
+    {
+      if(atomic_load_explicit(&slot->state, memory_order_acquire) != _DATA_REGION_COMBINING_PENDING)
+        continue;
+      slot->result = slot->is_add ? data_region_set_add(set->set, slot->region) : data_region_set_remove(set->set, slot->region);
+      atomic_store_explicit(&slot->state, _DATA_REGION_COMBINING_DONE, memory_order_release);
+    }
+    return;
+  }
+
+  //Collect the pending operations (slots attached after counting are picked up by the next combiner)
+  int64_t pendingCount = 0;
+  for(DataRegionCombiningSlot* slot = atomic_load(&set->slots); slot != NULL && pendingCount < slotCount; slot = slot->next_slot)
+  {
+    if(atomic_load_explicit(&slot->state, memory_order_acquire) == _DATA_REGION_COMBINING_PENDING)
+      set->pending[pendingCount++] = slot;
+  }
+
+  _data_region_combining_set_apply(set, pendingCount, 1);
+  _data_region_combining_set_apply(set, pendingCount, 0);
+
+  for(int64_t i = 0; i < pendingCount; i++)
+    atomic_store_explicit(&set->pending[i]->state, _DATA_REGION_COMBINING_DONE, memory_order_release);
+}
+
+/* Internal function to publish an operation and wait for its result.
+ * @param slot - The calling thread's slot.
+ * @param region - The (valid) DataRegion to add or remove.
+ * @param isAdd - True (1) to add 'region', otherwise false (0) to remove it.
+ * @returns - The result of the operation. */
+DataRegionSetResult _data_region_combining_set_execute(DataRegionCombiningSlot* slot, DataRegion region, int isAdd)
+{
+  DataRegionCombiningSet* set = slot->set;
+  slot->is_add = isAdd;
+  slot->region = region;
+  atomic_store_explicit(&slot->state, _DATA_REGION_COMBINING_PENDING, memory_order_release);
+
+  while(atomic_load_explicit(&slot->state, memory_order_acquire) != _DATA_REGION_COMBINING_DONE)
+  {
+    if(pthread_mutex_trylock(&set->lock) == 0)
+    {
+      //Become the combiner (unless another combiner already applied this operation)
+      if(atomic_load_explicit(&slot->state, memory_order_acquire) != _DATA_REGION_COMBINING_DONE)
+        _data_region_combining_set_combine(set);
+      pthread_mutex_unlock(&set->lock);
+    }
+    else
+    {
+      sched_yield();//Another thread is combining, which will likely apply this operation
+    }
+  }
+
+  atomic_store_explicit(&slot->state, _DATA_REGION_COMBINING_IDLE, memory_order_relaxed);
+  return slot->result;
+}
+
+/* Adds a DataRegion to a DataRegionCombiningSet.
+ * @param slot - The calling thread's slot of the destination set. If this
+ *        is NULL, then DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toAdd - The DataRegion to add. If this is invalid (see
+ *        data_region_is_valid), then DATA_REGION_SET_INVALID_REGION will
+ *        be returned.
+ * @returns - The DataRegionSetResult that defines the result of the add
+ *          operation, like 'data_region_set_add'.
+ * @remarks - The add may be applied by another thread, together with the
+ *          concurrent operations of other threads. This function returns
+ *          once the add has been applied.
+ * @see data_region_set_add */
+DataRegionSetResult data_region_combining_set_add(DataRegionCombiningSlot* slot, DataRegion toAdd)
+{
+  if(slot == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(toAdd))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  return _data_region_combining_set_execute(slot, toAdd, 1);
+}
+
+/* Removes a DataRegion from a DataRegionCombiningSet.
+ * @param slot - The calling thread's slot of the set. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toRemove - The DataRegion to remove. If this is invalid
+ *        (see data_region_is_valid), then DATA_REGION_SET_INVALID_REGION
+ *        will be returned.
+ * @returns - The DataRegionSetResult that defines the result of the removal
+ *          operation, like 'data_region_set_remove'.
+ * @remarks - Like 'data_region_combining_set_add', the removal may be
+ *          applied by another thread.
+ * @see data_region_set_remove */
+DataRegionSetResult data_region_combining_set_remove(DataRegionCombiningSlot* slot, DataRegion toRemove)
+{
+  if(slot == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(toRemove))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  return _data_region_combining_set_execute(slot, toRemove, 0);
+}
+
+/* Copies a subset of DataRegions in a DataRegionCombiningSet to an array.
+ * @remarks - This function behaves like 'data_region_set_crop', but locks the
+ *          DataRegionCombiningSet while reading it.
+ * @see data_region_set_crop */
+int64_t data_region_combining_set_crop(DataRegion* dst, int64_t dstCapacity, DataRegionCombiningSet* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  if(src == NULL)
+    return data_region_set_crop(dst, dstCapacity, NULL, boundaryRegion, dstTooSmall);
+
+  pthread_mutex_lock(&src->lock);
+  int64_t count = data_region_set_crop(dst, dstCapacity, src->set, boundaryRegion, dstTooSmall);
+  pthread_mutex_unlock(&src->lock);
+  return count;
+}
+
+/* Counts the number of DataRegions in a DataRegionCombiningSet that are at
+ * least partially contained within a specific boundary region.
+ * @see data_region_set_count_crop */
+int64_t data_region_combining_set_count_crop(DataRegionCombiningSet* src, DataRegion boundaryRegion)
+{
+  return data_region_combining_set_crop(NULL/*NULL indicates that we only want to count the DataRegions*/, 0, src, boundaryRegion, NULL);
+}
+
+/* Copies a 'negative' of a subset of DataRegions within a
+ * DataRegionCombiningSet.
+ * @remarks - This function behaves like 'data_region_set_negative_crop', but
+ *          locks the DataRegionCombiningSet while reading it.
+ * @see data_region_set_negative_crop */
+int64_t data_region_combining_set_negative_crop(DataRegion* dst, int64_t dstCapacity, DataRegionCombiningSet* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  if(src == NULL)
+    return data_region_set_negative_crop(dst, dstCapacity, NULL, boundaryRegion, dstTooSmall);
+
+  pthread_mutex_lock(&src->lock);
+  int64_t count = data_region_set_negative_crop(dst, dstCapacity, src->set, boundaryRegion, dstTooSmall);
+  pthread_mutex_unlock(&src->lock);
+  return count;
+}
+
+/* Gets the number of DataRegions that are stored in a DataRegionCombiningSet.
+ * @param set - Pointer to the DataRegionCombiningSet. If this is NULL, then
+ *        zero will be returned.
+ * @returns - The number of DataRegions. */
+int64_t data_region_combining_set_count(DataRegionCombiningSet* set)
+{
+  if(set == NULL)
+    return 0;
+
+  pthread_mutex_lock(&set->lock);
+  int64_t count = data_region_set_count(set->set);
+  pthread_mutex_unlock(&set->lock);
+  return count;
+}
+
+/* Gets the length of the sum of all DataRegions stored in a
+ * DataRegionCombiningSet.
+ * @param set - Pointer to the DataRegionCombiningSet. If this is NULL, then
+ *        zero will be returned.
+ * @returns - The total length of all stored DataRegions. */
+int64_t data_region_combining_set_total_length(DataRegionCombiningSet* set)
+{
+  if(set == NULL)
+    return 0;
+
+  pthread_mutex_lock(&set->lock);
+  int64_t totalLength = data_region_set_total_length(set->set);
+  pthread_mutex_unlock(&set->lock);
+  return totalLength;
+}
+
+#endif//DATA_REGION_COMBINING_H
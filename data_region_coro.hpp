@@ -0,0 +1,375 @@
+#ifndef DATA_REGION_CORO_HPP
+#define DATA_REGION_CORO_HPP
+#include "data_region.h"
+#include <algorithm>
+#include <coroutine>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace data_region
+{
+
+/* Resumes the coroutines whose awaited condition became true. Implement this
+ * to resume them on an event loop or a thread pool.
+ * @see InlineExecutor
+ * @see QueueExecutor */
+class Executor
+{
+public:
+  virtual ~Executor() = default;
+
+  /* Schedules a suspended coroutine to be resumed. Called without holding
+   * any lock of this header, from the thread that made the condition true. */
+  virtual void post(std::coroutine_handle<> coroutine) = 0;
+};
+
+/* Executor that resumes each coroutine right away, on the thread that made
+ * its condition true. */
+class InlineExecutor : public Executor
+{
+public:
+  void post(std::coroutine_handle<> coroutine) override
+  {
+    coroutine.resume();
+  }
+};
+
+/* Executor that queues coroutines until 'run' is called, for example by
+ * the loop of a single-threaded service. */
+class QueueExecutor : public Executor
+{
+public:
+  void post(std::coroutine_handle<> coroutine) override
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    queue.push_back(coroutine);
+  }
+
+  /* Resumes the queued coroutines (but not the ones that they queue).
+   * @returns - The number of resumed coroutines. */
+  size_t run()
+  {
+    std::vector<std::coroutine_handle<>> ready;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      ready.swap(queue);
+    }
+    for(std::coroutine_handle<> coroutine : ready)
+      coroutine.resume();
+    return ready.size();
+  }
+
+private:
+  std::mutex lock;
+  std::vector<std::coroutine_handle<>> queue;
+};
+
+/* Internal suspended coroutine that waits for a byte range. It lives in the
+ * awaitable (and therefore in the coroutine frame), so waiting doesn't
+ * allocate. */
+struct _RegionWaiter
+{
+  DataRegion region;
+  std::coroutine_handle<> coroutine;
+};
+
+/* Tracks the present and the dirty bytes of a stream, and lets coroutines
+ * wait for byte ranges to become present ('co_await tracker.available(r)')
+ * or to become clean ('co_await tracker.flushed(r)') without blocking a
+ * thread. The waiters of each kind are kept in ascending order of their
+ * first byte, so each change only checks the waiters that start within the
+ * present (or clean) span that it extended.
+ * @remarks - All waiters have to be resumed before the tracker is
+ *          destroyed. */
+class RegionTracker
+{
+public:
+  /* Awaitable of 'available' and 'flushed'. */
+  class Awaitable
+  {
+  public:
+    bool await_ready()
+    {
+      std::lock_guard<std::mutex> guard(tracker->lock);
+      return tracker->_is_satisfied(waiter.region, isFlush);
+    }
+
+    bool await_suspend(std::coroutine_handle<> coroutine)
+    {
+      //Check again under the lock, since the bytes may have arrived since 'await_ready'
+      std::lock_guard<std::mutex> guard(tracker->lock);
+      if(tracker->_is_satisfied(waiter.region, isFlush))
+        return false;
+
+      waiter.coroutine = coroutine;
+      std::vector<_RegionWaiter*>& waiters = isFlush ? tracker->flushWaiters : tracker->presentWaiters;
+      auto position = std::upper_bound(waiters.begin(), waiters.end(), waiter.region.first_index,
+        [](int64_t index, const _RegionWaiter* other) { return index < other->region.first_index; });
+      waiters.insert(position, &waiter);
+      return true;
+    }
+
+    void await_resume() {}
+
+  private:
+    friend class RegionTracker;
+
+    Awaitable(RegionTracker* tracker, DataRegion region, bool isFlush) : tracker(tracker), waiter{ region, {} }, isFlush(isFlush) {}
+
+    RegionTracker* tracker;
+    _RegionWaiter waiter;
+    bool isFlush;
+  };
+
+  /* Creates a tracker in which no bytes are present or dirty.
+   * @param regionCapacity - The maximum number of separate present byte
+   *        ranges, and of separate dirty byte ranges.
+   * @param executor - Resumes the waiting coroutines. It has to outlive the
+   *        tracker.
+   * @remarks - Throws std::bad_alloc if the DataRegionSets can't be
+   *          allocated. */
+  RegionTracker(int64_t regionCapacity, Executor& executor) : executor(executor)
+  {
+    present = data_region_set_create(regionCapacity);
+    dirty = data_region_set_create(regionCapacity);
+    if(present == nullptr || dirty == nullptr)
+    {
+      data_region_set_free(present);
+      data_region_set_free(dirty);
+      throw std::bad_alloc();
+    }
+  }
+
+  ~RegionTracker()
+  {
+    data_region_set_free(present);
+    data_region_set_free(dirty);
+  }
+
+  RegionTracker(const RegionTracker&) = delete;
+  RegionTracker& operator=(const RegionTracker&) = delete;
+
+  /* Marks bytes as present, and resumes the coroutines waiting for byte
+   * ranges that became fully present.
+   * @returns - A DataRegionSetResult (see data_region_set_add). */
+  DataRegionSetResult mark_present(DataRegion region)
+  {
+    return _change(present, region, true, false);
+  }
+
+  /* Marks bytes as missing, for example after they were evicted.
+   * @returns - A DataRegionSetResult (see data_region_set_remove). */
+  DataRegionSetResult mark_missing(DataRegion region)
+  {
+    return _change(present, region, false, false);
+  }
+
+  /* Marks bytes as dirty, so that 'flushed' waits for them.
+   * @returns - A DataRegionSetResult (see data_region_set_add). */
+  DataRegionSetResult mark_dirty(DataRegion region)
+  {
+    return _change(dirty, region, true, true);
+  }
+
+  /* Marks bytes as clean (written back), and resumes the coroutines waiting
+   * for byte ranges that have no dirty bytes left.
+   * @returns - A DataRegionSetResult (see data_region_set_remove). */
+  DataRegionSetResult mark_clean(DataRegion region)
+  {
+    return _change(dirty, region, false, true);
+  }
+
+  /* Checks whether every byte of a byte range is present. */
+  bool is_present(DataRegion region)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return data_region_is_valid(region) && _is_satisfied(region, false);
+  }
+
+  /* Checks whether no byte of a byte range is dirty. */
+  bool is_flushed(DataRegion region)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return data_region_is_valid(region) && _is_satisfied(region, true);
+  }
+
+  /* Gets an awaitable that completes once every byte of a (valid) byte
+   * range is present. */
+  Awaitable available(DataRegion region)
+  {
+    return Awaitable(this, region, false);
+  }
+
+  /* Gets an awaitable that completes once no byte of a (valid) byte range
+   * is dirty. */
+  Awaitable flushed(DataRegion region)
+  {
+    return Awaitable(this, region, true);
+  }
+
+private:
+  /* Internal function to check the condition of a waiter. The lock has to
+   * be held. */
+  bool _is_satisfied(DataRegion region, bool isFlush) const
+  {
+    if(isFlush)
+      return data_region_set_count_crop(dirty, region) == 0;
+
+    int64_t i = _data_region_set_lower_bound(present, region.first_index);
+    return i < present->count && data_region_contains(present->regions[i], region);
+  }
+
+  /* Internal function to add to (or remove from) a set, and to resume the
+   * waiters whose condition became true. The waiters that can be resumed
+   * lie within 'span', the present (or clean) span that now contains
+   * 'region', and start no later than 'region' ends; every other waiter
+   * either doesn't overlap 'region' or was resumed before. */
+  DataRegionSetResult _change(DataRegionSet* set, DataRegion region, bool isAdd, bool isFlush)
+  {
+    std::vector<std::coroutine_handle<>> ready;
+    DataRegionSetResult result;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      result = isAdd ? data_region_set_add(set, region) : data_region_set_remove(set, region);
+      if(result != DATA_REGION_SET_SUCCESS || isAdd == isFlush)
+        return result;
+
+      DataRegion span;
+      int64_t i = _data_region_set_lower_bound(set, region.first_index);
+      if(isFlush)
+      {
+        span.first_index = i > 0 ? set->regions[i - 1].last_index + 1 : INT64_MIN;
+        span.last_index = i < set->count ? set->regions[i].first_index - 1 : INT64_MAX;
+      }
+      else
+      {
+        span = set->regions[i];
+      }
+
+      std::vector<_RegionWaiter*>& waiters = isFlush ? flushWaiters : presentWaiters;
+      auto first = std::lower_bound(waiters.begin(), waiters.end(), span.first_index,
+        [](const _RegionWaiter* waiter, int64_t index) { return waiter->region.first_index < index; });
+      auto kept = first;
+      auto current = first;
+      for(; current != waiters.end() && (*current)->region.first_index <= region.last_index; ++current)
+      {
+        if((*current)->region.last_index <= span.last_index)
+          ready.push_back((*current)->coroutine);
+        else
+          *kept++ = *current;
+      }
+      waiters.erase(kept, current);
+    }
+
+    for(std::coroutine_handle<> coroutine : ready)
+      executor.post(coroutine);
+    return result;
+  }
+
+  std::mutex lock;
+  Executor& executor;
+  DataRegionSet* present;
+  DataRegionSet* dirty;
+  std::vector<_RegionWaiter*> presentWaiters;
+  std::vector<_RegionWaiter*> flushWaiters;
+};
+
+/* One-shot completion of a fetch, which any number of coroutines can
+ * 'co_await' (yielding whether the fetch succeeded). Awaiting a completed
+ * fetch doesn't suspend. */
+class FetchCompletion
+{
+public:
+  /* Awaitable of a FetchCompletion. */
+  class Awaitable
+  {
+  public:
+    bool await_ready()
+    {
+      std::lock_guard<std::mutex> guard(completion->lock);
+      return completion->done;
+    }
+
+    bool await_suspend(std::coroutine_handle<> coroutine)
+    {
+      std::lock_guard<std::mutex> guard(completion->lock);
+      if(completion->done)
+        return false;
+
+      this->coroutine = coroutine;
+      next = completion->waiters;
+      completion->waiters = this;
+      return true;
+    }
+
+    bool await_resume()
+    {
+      std::lock_guard<std::mutex> guard(completion->lock);
+      return completion->succeeded;
+    }
+
+  private:
+    friend class FetchCompletion;
+
+    explicit Awaitable(FetchCompletion* completion) : completion(completion) {}
+
+    FetchCompletion* completion;
+    std::coroutine_handle<> coroutine;
+    Awaitable* next = nullptr;
+  };
+
+  /* @param executor - Resumes the waiting coroutines. It has to outlive the
+   *        completion. */
+  explicit FetchCompletion(Executor& executor) : executor(executor) {}
+
+  FetchCompletion(const FetchCompletion&) = delete;
+  FetchCompletion& operator=(const FetchCompletion&) = delete;
+
+  /* Completes the fetch, and resumes the waiting coroutines. Only the first
+   * call has an effect. */
+  void complete(bool fetchSucceeded)
+  {
+    Awaitable* ready;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if(done)
+        return;
+      done = true;
+      succeeded = fetchSucceeded;
+      ready = waiters;
+      waiters = nullptr;
+    }
+
+    //A resumed coroutine may destroy its awaitable, so read the link first
+    while(ready != nullptr)
+    {
+      Awaitable* awaitable = ready;
+      ready = awaitable->next;
+      executor.post(awaitable->coroutine);
+    }
+  }
+
+  bool is_done()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return done;
+  }
+
+  Awaitable operator co_await()
+  {
+    return Awaitable(this);
+  }
+
+private:
+  std::mutex lock;
+  Executor& executor;
+  bool done = false;
+  bool succeeded = false;
+  Awaitable* waiters = nullptr;
+};
+
+}//namespace data_region
+
+#endif//DATA_REGION_CORO_HPP
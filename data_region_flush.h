@@ -0,0 +1,362 @@
+#ifndef DATA_REGION_FLUSH_H
+#define DATA_REGION_FLUSH_H
+#include "data_region.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Memory that holds the cached bytes of a DataRegionFlusher, divided into
+ * fixed-size pages. */
+typedef struct DataRegionFlushSource
+{
+  /* Passed to 'page'. */
+  void* context;
+
+  /* The size of each page, in bytes. */
+  int64_t page_size;
+
+  /* Gets the memory of page 'pageIndex' (which holds bytes 'pageIndex' *
+   * 'page_size' onwards), or NULL if the page isn't cached. Called without
+   * holding the lock of the DataRegionFlusher. */
+  void* (*page)(void* context, int64_t pageIndex);
+} DataRegionFlushSource;
+
+/* Options of a DataRegionFlusher. */
+typedef struct DataRegionFlushOptions
+{
+  /* The maximum number of bytes of one write. */
+  int64_t max_write_bytes;
+
+  /* The maximum number of clean bytes that a write re-writes in order to
+   * combine two dirty byte ranges. Only use this if every cached page holds
+   * valid bytes throughout. */
+  int64_t max_gap_bytes;
+} DataRegionFlushOptions;
+
+/* Write-back flush scheduler over a DataRegionSet of dirty bytes. Each
+ * flush sweeps the dirty byte ranges in ascending offset order (continuing
+ * where the previous flush stopped), combines nearby ranges into large
+ * vectored writes, and cleans the ranges only once their writes complete.
+ * Bytes that are marked dirty again while they are being written stay
+ * dirty.
+ * @see data_region_flusher_create
+ * @see data_region_flusher_mark_dirty
+ * @see data_region_flusher_flush */
+typedef struct DataRegionFlusher
+{
+  /* Protects 'dirty', 'flushing', 'redirtied' and 'cursor'. */
+  pthread_mutex_t lock;
+
+  /* Serializes flushes. Always acquired before 'lock'. */
+  pthread_mutex_t flush_lock;
+
+  /* The file that dirty bytes are written to (not owned). */
+  int fd;
+
+  DataRegionFlushSource source;
+  DataRegionFlushOptions options;
+
+  /* The dirty byte ranges. */
+  DataRegionSet* dirty;
+
+  /* The byte ranges that the current flush is writing. */
+  DataRegionSet* flushing;
+
+  /* The byte ranges that were marked dirty while being written. If this
+   * overflows, then 'redirtied_overflow' is set and no write of the current
+   * flush cleans anything. */
+  DataRegionSet* redirtied;
+  int redirtied_overflow;
+
+  /* The offset at which the next flush continues. */
+  int64_t cursor;
+} DataRegionFlusher;
+
+/* Allocates a new DataRegionFlusher without any dirty bytes.
+ * @param fd - The file that dirty bytes are written to. If this is less
+ *        than zero, then NULL will be returned.
+ * @param dirtyCapacity - The maximum number of separate dirty byte ranges.
+ *        If this is less than one, then NULL will be returned.
+ * @param source - The cached pages. If its 'page' function is NULL, or its
+ *        'page_size' is less than one, then NULL will be returned.
+ * @param options - The options. If this is NULL, then writes of up to 1 MiB
+ *        which don't re-write clean bytes are used.
+ * @returns - A pointer to the allocated DataRegionFlusher, or NULL upon
+ *          failure.
+ * @remarks - Be sure to free the returned DataRegionFlusher by calling the
+ *          'data_region_flusher_free' function.
+ * @see data_region_flusher_free */
+DataRegionFlusher* data_region_flusher_create(int fd, int64_t dirtyCapacity, DataRegionFlushSource source, const DataRegionFlushOptions* options)
+{
+  DataRegionFlushOptions flushOptions = { 1024 * 1024, 0 };
+  if(options != NULL)
+    flushOptions = *options;
+  if(fd < 0 || dirtyCapacity < 1 || source.page == NULL || source.page_size < 1)
+    return NULL;
+  if(flushOptions.max_write_bytes < 1 || flushOptions.max_gap_bytes < 0)
+    return NULL;
+
+  DataRegionFlusher* flusher = malloc(sizeof(DataRegionFlusher));
+  if(flusher == NULL)
+    return NULL;
+
+  flusher->dirty = data_region_set_create(dirtyCapacity);
+  flusher->flushing = data_region_set_create(dirtyCapacity);
+  flusher->redirtied = data_region_set_create(dirtyCapacity);
+  if(flusher->dirty == NULL || flusher->flushing == NULL || flusher->redirtied == NULL)
+  {
+    data_region_set_free(flusher->dirty);
+    data_region_set_free(flusher->flushing);
+    data_region_set_free(flusher->redirtied);
+    free(flusher);
+    return NULL;
+  }
+
+  pthread_mutex_init(&flusher->lock, NULL);
+  pthread_mutex_init(&flusher->flush_lock, NULL);
+  flusher->fd = fd;
+  flusher->source = source;
+  flusher->options = flushOptions;
+  flusher->redirtied_overflow = 0;
+  flusher->cursor = 0;
+  return flusher;
+}
+
+/* Frees a DataRegionFlusher that was allocated by the
+ * 'data_region_flusher_create' function.
+ * @param flusher - Pointer to the DataRegionFlusher. If this argument is
+ *        NULL, then nothing will happen.
+ * @remarks - Dirty bytes are not flushed, and the file is not closed. */
+void data_region_flusher_free(DataRegionFlusher* flusher)
+{
+  if(flusher == NULL)
+    return;
+
+  pthread_mutex_destroy(&flusher->flush_lock);
+  pthread_mutex_destroy(&flusher->lock);
+  data_region_set_free(flusher->dirty);
+  data_region_set_free(flusher->flushing);
+  data_region_set_free(flusher->redirtied);
+  free(flusher);
+}
+
+/* Marks a byte range as dirty, after it was written to the cached pages.
+ * @param flusher - Pointer to the DataRegionFlusher. If this argument is
+ *        NULL, then DATA_REGION_SET_NULL_ARG will be returned.
+ * @param region - The dirty byte range. If this is invalid (see
+ *        data_region_is_valid) or negative, then
+ *        DATA_REGION_SET_INVALID_REGION will be returned.
+ * @returns - The result of adding 'region' to the dirty DataRegionSet (see
+ *          'data_region_set_add'). Upon DATA_REGION_SET_OUT_OF_SPACE, flush
+ *          and try again.
+ * @remarks - This may be called while another thread flushes. */
+DataRegionSetResult data_region_flusher_mark_dirty(DataRegionFlusher* flusher, DataRegion region)
+{
+  if(flusher == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(region) || region.first_index < 0)
+    return DATA_REGION_SET_INVALID_REGION;
+
+  pthread_mutex_lock(&flusher->lock);
+  DataRegionSetResult result = data_region_set_add(flusher->dirty, region);
+  if(result == DATA_REGION_SET_SUCCESS && data_region_set_count_crop(flusher->flushing, region) > 0)
+  {
+    //The write in flight may miss these bytes, so its completion must not clean them
+    if(data_region_set_add(flusher->redirtied, region) != DATA_REGION_SET_SUCCESS)
+      flusher->redirtied_overflow = 1;
+  }
+  pthread_mutex_unlock(&flusher->lock);
+  return result;
+}
+
+/* Internal function to check whether all pages of a byte range are
+ * cached. */
+int _data_region_flusher_is_cached(DataRegionFlusher* flusher, DataRegion region)
+{
+  int64_t pageSize = flusher->source.page_size;
+  for(int64_t page = region.first_index / pageSize; page <= region.last_index / pageSize; page++)
+  {
+    if(flusher->source.page(flusher->source.context, page) == NULL)
+      return 0;
+  }
+  return 1;
+}
+
+/* Internal function to write a byte range from the cached pages to the
+ * file, with as few vectored writes as possible.
+ * @returns - True (1) upon success, otherwise false (0). */
+int _data_region_flusher_write(DataRegionFlusher* flusher, DataRegion region)
+{
+  struct iovec iov[64];
+  int64_t pageSize = flusher->source.page_size;
+  int64_t offset = region.first_index;
+  while(offset <= region.last_index)
+  {
+    //Gather up to 64 page pieces
+    int iovCount = 0;
+    int64_t gathered = 0;
+    while(iovCount < 64 && offset + gathered <= region.last_index)
+    {
+      int64_t position = offset + gathered;
+      int64_t pageEnd = ((position / pageSize) + 1) * pageSize - 1;
+      int64_t last = pageEnd < region.last_index ? pageEnd : region.last_index;
+      char* page = flusher->source.page(flusher->source.context, position / pageSize);
+      if(page == NULL)
+        return 0;//Dirty bytes must be cached
+
+      iov[iovCount].iov_base = page + (position % pageSize);
+      iov[iovCount].iov_len = (size_t)(last - position + 1);
+      iovCount++;
+      gathered += last - position + 1;
+    }
+
+    ssize_t written = pwritev(flusher->fd, iov, iovCount, (off_t)offset);
+    if(written < 0 && errno == EINTR)
+      continue;
+    if(written <= 0)
+      return 0;
+    offset += written;//A short write continues with the remaining bytes
+  }
+  return 1;
+}
+
+/* Flushes dirty bytes, in ascending offset order.
+ * @param flusher - Pointer to the DataRegionFlusher. If this argument is
+ *        NULL, then -1 will be returned.
+ * @param budgetBytes - The maximum number of bytes to write (which bounds
+ *        the latency of the flush), or zero to write all bytes that are
+ *        dirty when the flush starts.
+ * @returns - The number of bytes written (including clean bytes that were
+ *          re-written to combine dirty byte ranges), or -1 if a write failed
+ *          (in which case its bytes stay dirty).
+ * @remarks - A flush continues at the offset where the previous one stopped,
+ *          and wraps around to the lowest dirty offset once, so repeated
+ *          budgeted flushes sweep the file sequentially. Dirty byte ranges
+ *          are combined while the clean bytes between them are at most
+ *          'max_gap_bytes' (and cached), and writes are split at
+ *          'max_write_bytes'. Dirty byte ranges are cleaned once their write
+ *          completes, unless they were marked dirty again in the
+ *          meantime. */
+int64_t data_region_flusher_flush(DataRegionFlusher* flusher, int64_t budgetBytes)
+{
+  if(flusher == NULL || budgetBytes < 0)
+    return -1;
+
+  pthread_mutex_lock(&flusher->flush_lock);
+  pthread_mutex_lock(&flusher->lock);
+  DataRegionSet* dirty = flusher->dirty;
+  int64_t maxWrite = flusher->options.max_write_bytes;
+  int64_t remainingBudget = budgetBytes > 0 ? budgetBytes : INT64_MAX;
+
+  //Take the dirty byte ranges from the cursor to the end, then from the beginning up to the cursor
+  DataRegion* writes = malloc(sizeof(DataRegion) * (dirty->count + 1));
+  int64_t candidateCount = 0, candidateBytes = 0, wrapIndex = dirty->count;
+  int64_t start = _data_region_set_lower_bound(dirty, flusher->cursor);
+  for(int64_t k = 0; writes != NULL && k < dirty->count && candidateBytes < remainingBudget; k++)
+  {
+    int64_t i = (start + k) % dirty->count;
+    if(i == 0 && k > 0)
+      wrapIndex = candidateCount;
+    writes[candidateCount++] = dirty->regions[i];
+    candidateBytes += data_region_length(dirty->regions[i]);
+  }
+  pthread_mutex_unlock(&flusher->lock);
+
+  if(writes == NULL)
+  {
+    pthread_mutex_unlock(&flusher->flush_lock);
+    return -1;
+  }
+
+  //Combine nearby dirty byte ranges (in place), within the budget
+  int64_t writeCount = 0;
+  for(int64_t i = 0; i < candidateCount && remainingBudget > 0; i++)
+  {
+    DataRegion write = writes[i];
+    if(writeCount > 0 && i != wrapIndex)
+    {
+      DataRegion* previous = writes + writeCount - 1;
+      DataRegion gap = { previous->last_index + 1, write.first_index - 1 };
+      int64_t gapBytes = write.first_index - previous->last_index - 1;
+      if(gapBytes <= flusher->options.max_gap_bytes && write.last_index - previous->first_index + 1 <= maxWrite &&
+        gapBytes + data_region_length(write) <= remainingBudget && _data_region_flusher_is_cached(flusher, gap))
+      {
+        previous->last_index = write.last_index;
+        remainingBudget -= gapBytes + data_region_length(write);
+        continue;
+      }
+    }
+
+    if(data_region_length(write) > remainingBudget)
+      write.last_index = write.first_index + remainingBudget - 1;
+    writes[writeCount++] = write;
+    remainingBudget -= data_region_length(write);
+  }
+
+  //Bytes that are marked dirty from now on may be missed by the writes
+  pthread_mutex_lock(&flusher->lock);
+  for(int64_t i = 0; i < writeCount; i++)
+  {
+    if(data_region_set_add(flusher->flushing, writes[i]) != DATA_REGION_SET_SUCCESS)
+      flusher->redirtied_overflow = 1;
+  }
+  pthread_mutex_unlock(&flusher->lock);
+
+  //Write without holding the lock, splitting at 'max_write_bytes'
+  int64_t writtenCount = 0, writtenBytes = 0;
+  int failed = 0;
+  for(; writtenCount < writeCount && !failed; writtenCount++)
+  {
+    DataRegion write = writes[writtenCount];
+    for(int64_t offset = write.first_index; offset <= write.last_index && !failed; offset += maxWrite)
+    {
+      DataRegion piece = { offset, offset + maxWrite - 1 < write.last_index ? offset + maxWrite - 1 : write.last_index };
+      failed = !_data_region_flusher_write(flusher, piece);
+    }
+    if(failed)
+      break;
+    writtenBytes += data_region_length(write);
+  }
+
+  //Clean what was written, except for what was marked dirty in the meantime
+  pthread_mutex_lock(&flusher->lock);
+  if(!flusher->redirtied_overflow)
+  {
+    DataRegion* clean = malloc(sizeof(DataRegion) * (flusher->redirtied->count + 1));
+    for(int64_t i = 0; clean != NULL && i < writtenCount; i++)
+    {
+      int64_t cleanCount = _data_region_array_difference(clean, writes + i, 1, flusher->redirtied->regions, flusher->redirtied->count);
+      for(int64_t j = 0; j < cleanCount; j++)
+        data_region_set_remove(flusher->dirty, clean[j]);//If this fails, then the bytes simply stay dirty
+    }
+    free(clean);
+  }
+  if(writtenCount > 0)
+    flusher->cursor = writes[writtenCount - 1].last_index + 1;
+  data_region_set_clear(flusher->flushing);
+  data_region_set_clear(flusher->redirtied);
+  flusher->redirtied_overflow = 0;
+  pthread_mutex_unlock(&flusher->lock);
+  pthread_mutex_unlock(&flusher->flush_lock);
+
+  free(writes);
+  return failed ? -1 : writtenBytes;
+}
+
+/* Gets the number of dirty bytes of a DataRegionFlusher.
+ * @param flusher - Pointer to the DataRegionFlusher. If this is NULL, then
+ *        zero will be returned.
+ * @returns - The number of dirty bytes. */
+int64_t data_region_flusher_dirty_bytes(DataRegionFlusher* flusher)
+{
+  if(flusher == NULL)
+    return 0;
+
+  pthread_mutex_lock(&flusher->lock);
+  int64_t dirtyBytes = data_region_set_total_length(flusher->dirty);
+  pthread_mutex_unlock(&flusher->lock);
+  return dirtyBytes;
+}
+
+#endif//DATA_REGION_FLUSH_H
@@ -0,0 +1,339 @@
+#ifndef DATA_REGION_INFLIGHT_H
+#define DATA_REGION_INFLIGHT_H
+#include "data_region.h"
+#include <pthread.h>
+
+/* Completion handle of a byte range that is being fetched. The fetcher
+ * completes it with 'data_region_inflight_end', and every other reader of
+ * the byte range waits for it with 'data_region_inflight_wait'.
+ * @see data_region_inflight_begin */
+typedef struct DataRegionInflightHandle
+{
+  /* Protects everything below. */
+  pthread_mutex_t lock;
+  pthread_cond_t completed;
+
+  /* The byte range being fetched. */
+  DataRegion region;
+
+  /* Whether the fetch completed, and whether it succeeded. */
+  int done;
+  int succeeded;
+
+  /* The number of references: one of the registry (until the fetch
+   * completes), one of the fetcher, and one of each waiter. */
+  int64_t references;
+} DataRegionInflightHandle;
+
+/* One piece of a byte range that was passed to 'data_region_inflight_begin'.
+ * Either the caller owns the piece (and has to fetch it, then complete its
+ * handle), or another caller is already fetching it. */
+typedef struct DataRegionInflightClaim
+{
+  DataRegion region;
+  DataRegionInflightHandle* handle;
+
+  /* True (1) if the caller has to fetch the piece and call
+   * 'data_region_inflight_end', or false (0) if the caller has to call
+   * 'data_region_inflight_wait' and 'data_region_inflight_release'. */
+  int is_owner;
+} DataRegionInflightClaim;
+
+/* Registry of byte ranges that are being fetched, so that concurrent
+ * readers of overlapping byte ranges fetch each byte only once. The
+ * registered byte ranges never overlap, and are kept in ascending order, so
+ * that finding the ones within a byte range is a binary search.
+ * @see data_region_inflight_create
+ * @see data_region_inflight_begin */
+typedef struct DataRegionInflight
+{
+  /* Protects 'handles' and 'count'. Always acquired before the lock of a
+   * handle. */
+  pthread_mutex_t lock;
+
+  /* The handles of the registered byte ranges, in ascending order. */
+  DataRegionInflightHandle** handles;
+  int64_t count;
+  int64_t capacity;
+} DataRegionInflight;
+
+/* Allocates a new, empty DataRegionInflight.
+ * @param capacity - The maximum number of byte ranges that are fetched at
+ *        once. If this is less than one, then NULL will be returned.
+ * @returns - A pointer to the allocated DataRegionInflight, or NULL upon
+ *          failure.
+ * @remarks - Be sure to free the returned DataRegionInflight by calling the
+ *          'data_region_inflight_free' function.
+ * @see data_region_inflight_free */
+DataRegionInflight* data_region_inflight_create(int64_t capacity)
+{
+  if(capacity < 1)
+    return NULL;
+
+  DataRegionInflight* inflight = malloc(sizeof(DataRegionInflight) + (sizeof(DataRegionInflightHandle*) * capacity));
+  if(inflight == NULL)
+    return NULL;
+
+  pthread_mutex_init(&inflight->lock, NULL);
+  inflight->handles = (DataRegionInflightHandle**)(inflight + 1);
+  inflight->count = 0;
+  inflight->capacity = capacity;
+  return inflight;
+}
+
+/* Frees a DataRegionInflight that was allocated by the
+ * 'data_region_inflight_create' function.
+ * @param inflight - Pointer to the DataRegionInflight. If this argument is
+ *        NULL, then nothing will happen.
+ * @remarks - Every fetch has to be completed first. */
+void data_region_inflight_free(DataRegionInflight* inflight)
+{
+  if(inflight == NULL)
+    return;
+
+  pthread_mutex_destroy(&inflight->lock);
+  free(inflight);
+}
+
+/* Internal function to drop a reference to a handle, and to free it when
+ * this was the last one. */
+void _data_region_inflight_unref(DataRegionInflightHandle* handle, int64_t count)
+{
+  pthread_mutex_lock(&handle->lock);
+  handle->references -= count;
+  int isLast = handle->references == 0;
+  pthread_mutex_unlock(&handle->lock);
+
+  if(isLast)
+  {
+    pthread_cond_destroy(&handle->completed);
+    pthread_mutex_destroy(&handle->lock);
+    free(handle);
+  }
+}
+
+/* Internal function to find the first registered handle whose byte range
+ * ends at or after an index. */
+int64_t _data_region_inflight_lower_bound(const DataRegionInflight* inflight, int64_t index)
+{
+  int64_t low = 0, high = inflight->count;
+  while(low < high)
+  {
+    int64_t mid = low + ((high - low) / 2);
+    if(inflight->handles[mid]->region.last_index < index)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+/* Internal function to split a byte range into the pieces that are
+ * registered, and the pieces between them.
+ * @param dst - Receives the claims, or NULL to only count them.
+ * @param owned - The new handles of the pieces between registered ones (if
+ *        'dst' isn't NULL), which are initialized.
+ * @param ownedCount - Receives the number of pieces between registered
+ *        ones.
+ * @returns - The number of pieces. */
+int64_t _data_region_inflight_split(DataRegionInflightClaim* dst, DataRegionInflightHandle** owned, int64_t* ownedCount, DataRegionInflight* inflight, DataRegion region)
+{
+  int64_t count = 0;
+  *ownedCount = 0;
+  int64_t position = region.first_index;
+  for(int64_t i = _data_region_inflight_lower_bound(inflight, region.first_index); ; i++)
+  {
+    DataRegionInflightHandle* existing = i < inflight->count && inflight->handles[i]->region.first_index <= region.last_index ? inflight->handles[i] : NULL;
+    int64_t gapLast = existing != NULL ? existing->region.first_index - 1 : region.last_index;
+    if(position <= gapLast)
+    {
+      if(dst != NULL)
+      {
+        DataRegionInflightHandle* handle = owned[*ownedCount];
+        pthread_mutex_init(&handle->lock, NULL);
+        pthread_cond_init(&handle->completed, NULL);
+        handle->region = (DataRegion){ position, gapLast };
+        handle->done = 0;
+        handle->succeeded = 0;
+        handle->references = 2;
+        dst[count] = (DataRegionInflightClaim){ handle->region, handle, 1 };
+      }
+      (*ownedCount)++;
+      count++;
+    }
+    if(existing == NULL)
+      break;
+
+    if(dst != NULL)
+    {
+      DataRegion piece = { existing->region.first_index > position ? existing->region.first_index : position,
+                           existing->region.last_index < region.last_index ? existing->region.last_index : region.last_index };
+      pthread_mutex_lock(&existing->lock);
+      existing->references++;
+      pthread_mutex_unlock(&existing->lock);
+      dst[count] = (DataRegionInflightClaim){ piece, existing, 0 };
+    }
+    count++;
+    if(existing->region.last_index >= region.last_index)
+      break;
+    position = existing->region.last_index + 1;
+  }
+  return count;
+}
+
+/* Claims a byte range: the pieces of it that are already being fetched are
+ * waited for, and the others are registered as being fetched by the
+ * caller.
+ * @param dst - The destination array of claims, in ascending order, which
+ *        cover 'region' exactly. This may be NULL if you want to only count
+ *        the claims, in which case nothing is claimed.
+ * @param dstCapacity - The maximum number of claims that can be stored in
+ *        the 'dst' array.
+ * @param inflight - The DataRegionInflight. If this is NULL, then zero will
+ *        be returned.
+ * @param region - The byte range to claim, usually a gap of the present
+ *        bytes (see data_region_set_negative_crop). If this is invalid (see
+ *        data_region_is_valid), then zero will be returned.
+ * @param dstTooSmall - Optional pointer to an integer that will be assigned
+ *        to true (1) if the destination buffer was too small to contain all
+ *        claims, or if there was no room to register them (or memory could
+ *        not be allocated), otherwise false (0). In that case nothing is
+ *        claimed.
+ * @returns - The number of claims (which is also returned if nothing was
+ *          claimed because 'dst' was too small).
+ * @remarks - The caller has to fetch every piece that it owns, and complete
+ *          it with 'data_region_inflight_end', before it waits for any other
+ *          piece. Otherwise two callers that wait for each other deadlock.
+ *          Finding the registered pieces takes O(log n + k) time. */
+int64_t data_region_inflight_begin(DataRegionInflightClaim* dst, int64_t dstCapacity, DataRegionInflight* inflight, DataRegion region, int* dstTooSmall)
+{
+  int dstTooSmallPlaceholder;
+  if(dstTooSmall == NULL)
+    dstTooSmall = &dstTooSmallPlaceholder;
+  *dstTooSmall = 0;
+
+  if(inflight == NULL || !data_region_is_valid(region))
+    return 0;
+
+  pthread_mutex_lock(&inflight->lock);
+  int64_t ownedCount;
+  int64_t count = _data_region_inflight_split(NULL, NULL, &ownedCount, inflight, region);
+  if(dst == NULL)
+  {
+    pthread_mutex_unlock(&inflight->lock);
+    return count;
+  }
+
+  //Allocate the handles of the owned pieces up front, so that failing claims nothing
+  DataRegionInflightHandle** owned = NULL;
+  int allocated = count <= dstCapacity && inflight->count + ownedCount <= inflight->capacity;
+  if(allocated && ownedCount > 0)
+  {
+    owned = calloc((size_t)ownedCount, sizeof(DataRegionInflightHandle*));
+    for(int64_t i = 0; owned != NULL && i < ownedCount; i++)
+      allocated = allocated && (owned[i] = malloc(sizeof(DataRegionInflightHandle))) != NULL;
+    allocated = allocated && owned != NULL;
+  }
+  if(!allocated)
+  {
+    for(int64_t i = 0; owned != NULL && i < ownedCount; i++)
+      free(owned[i]);
+    free(owned);
+    pthread_mutex_unlock(&inflight->lock);
+    *dstTooSmall = 1;
+    return count;
+  }
+
+  //The claims are the registered handles within 'region' in order, with the owned ones in between
+  int64_t first = _data_region_inflight_lower_bound(inflight, region.first_index);
+  _data_region_inflight_split(dst, owned, &ownedCount, inflight, region);
+  int64_t end = first + (count - ownedCount);
+  memmove(inflight->handles + end + ownedCount, inflight->handles + end, sizeof(DataRegionInflightHandle*) * (inflight->count - end));
+  for(int64_t i = 0; i < count; i++)
+    inflight->handles[first + i] = dst[i].handle;
+  inflight->count += ownedCount;
+
+  pthread_mutex_unlock(&inflight->lock);
+  free(owned);
+  return count;
+}
+
+/* Completes a byte range that was claimed as owned by
+ * 'data_region_inflight_begin', which wakes its waiters.
+ * @param inflight - The DataRegionInflight. If this is NULL, then nothing
+ *        will happen.
+ * @param handle - The handle of the owned claim. If this is NULL, then
+ *        nothing will happen. It must not be used afterwards.
+ * @param succeeded - True (1) if the whole byte range was fetched (and is
+ *        now present, so that later readers find it), otherwise false (0),
+ *        in which case the waiters have to fetch it themselves. */
+void data_region_inflight_end(DataRegionInflight* inflight, DataRegionInflightHandle* handle, int succeeded)
+{
+  if(inflight == NULL || handle == NULL)
+    return;
+
+  pthread_mutex_lock(&inflight->lock);
+  int64_t i = _data_region_inflight_lower_bound(inflight, handle->region.first_index);
+  if(i < inflight->count && inflight->handles[i] == handle)
+  {
+    memmove(inflight->handles + i, inflight->handles + i + 1, sizeof(DataRegionInflightHandle*) * (inflight->count - i - 1));
+    inflight->count--;
+  }
+  pthread_mutex_unlock(&inflight->lock);
+
+  pthread_mutex_lock(&handle->lock);
+  handle->done = 1;
+  handle->succeeded = succeeded;
+  pthread_cond_broadcast(&handle->completed);
+  pthread_mutex_unlock(&handle->lock);
+
+  //Drop the references of the registry and of the fetcher
+  _data_region_inflight_unref(handle, 2);
+}
+
+/* Waits for a byte range that another caller is fetching.
+ * @param handle - The handle of a claim that isn't owned. If this is NULL,
+ *        then false (0) will be returned.
+ * @returns - True (1) if the fetch succeeded, otherwise false (0).
+ * @remarks - Call 'data_region_inflight_release' afterwards. */
+int data_region_inflight_wait(DataRegionInflightHandle* handle)
+{
+  if(handle == NULL)
+    return 0;
+
+  pthread_mutex_lock(&handle->lock);
+  while(!handle->done)
+    pthread_cond_wait(&handle->completed, &handle->lock);
+  int succeeded = handle->succeeded;
+  pthread_mutex_unlock(&handle->lock);
+  return succeeded;
+}
+
+/* Releases a claim that isn't owned, after waiting for it (or instead of
+ * waiting for it).
+ * @param handle - The handle of the claim. If this is NULL, then nothing
+ *        will happen. It must not be used afterwards. */
+void data_region_inflight_release(DataRegionInflightHandle* handle)
+{
+  if(handle == NULL)
+    return;
+
+  _data_region_inflight_unref(handle, 1);
+}
+
+/* Gets the number of byte ranges that are being fetched.
+ * @param inflight - The DataRegionInflight. If this is NULL, then zero will
+ *        be returned.
+ * @returns - The number of registered byte ranges. */
+int64_t data_region_inflight_count(DataRegionInflight* inflight)
+{
+  if(inflight == NULL)
+    return 0;
+
+  pthread_mutex_lock(&inflight->lock);
+  int64_t count = inflight->count;
+  pthread_mutex_unlock(&inflight->lock);
+  return count;
+}
+
+#endif//DATA_REGION_INFLIGHT_H
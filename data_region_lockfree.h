@@ -0,0 +1,1502 @@
+#ifndef DATA_REGION_LOCKFREE_H
+#define DATA_REGION_LOCKFREE_H
+#include "data_region.h"
+#include <stdatomic.h>
+#include <string.h>
+
+/* The maximum number of index levels above the list of DataRegions. */
+#ifndef DATA_REGION_LOCKFREE_MAX_LEVEL
+#define DATA_REGION_LOCKFREE_MAX_LEVEL 16
+#endif
+
+/* The number of retired objects a thread accumulates before it tries to
+ * advance the reclamation epoch. */
+#ifndef DATA_REGION_LOCKFREE_RETIRE_THRESHOLD
+#define DATA_REGION_LOCKFREE_RETIRE_THRESHOLD 64
+#endif
+
+/* The allocation functions of a DataRegionLockFreeSet, which may be
+ * defined before including this header (for example, to use another
+ * allocator). Its memory is released with 'free'. */
+#ifndef DATA_REGION_LOCKFREE_MALLOC
+#define DATA_REGION_LOCKFREE_MALLOC(size) malloc(size)
+#endif
+#ifndef DATA_REGION_LOCKFREE_REALLOC
+#define DATA_REGION_LOCKFREE_REALLOC(pointer, size) realloc(pointer, size)
+#endif
+
+/* Internal header of every object that is reclaimed via the epoch-based
+ * reclamation scheme of a DataRegionLockFreeSet. */
+typedef struct _DataRegionLockFreeRetirable
+{
+  struct _DataRegionLockFreeRetirable* retire_next;
+  int kind;
+} _DataRegionLockFreeRetirable;
+
+enum
+{
+  _DATA_REGION_LOCKFREE_NODE = 0,
+  _DATA_REGION_LOCKFREE_RECORD = 1,
+  _DATA_REGION_LOCKFREE_INDEX = 2,
+};
+
+enum
+{
+  _DATA_REGION_LOCKFREE_REGULAR = 0,
+  _DATA_REGION_LOCKFREE_HEAD = 1,
+  _DATA_REGION_LOCKFREE_TAIL = 2,
+};
+
+enum
+{
+  _DATA_REGION_LOCKFREE_IN_PROGRESS = 0,
+  _DATA_REGION_LOCKFREE_COMMITTED = 1,
+  _DATA_REGION_LOCKFREE_ABORTED = 2,
+};
+
+/* Internal node of the (bottom level) list of DataRegions. The 'region' of a
+ * node never changes: DataRegions are combined or split by replacing nodes.
+ * A node is 'frozen' while an update is replacing it, and 'marked' once it
+ * has been removed from the list. */
+typedef struct _DataRegionLockFreeNode
+{
+  _DataRegionLockFreeRetirable retirable;
+
+  /* The DataRegion (only meaningful for regular nodes). */
+  DataRegion region;
+
+  /* Whether this is a regular, head or tail node. */
+  int type;
+
+  /* The number of index levels to build above this node. */
+  int level;
+
+  /* One reference while the node is in the list, plus one reference per
+   * update record and index node that refers to this node. */
+  atomic_int_fast64_t ref_count;
+
+  /* The next node in the list. */
+  _Atomic(struct _DataRegionLockFreeNode*) next;
+
+  /* Either a pointer to the update record that most recently froze this node,
+   * or an odd token (which means that the node is not frozen). */
+  atomic_uintptr_t info;
+
+  /* True (1) once the node has been removed from the list. */
+  atomic_int marked;
+} _DataRegionLockFreeNode;
+
+/* Internal record of an update which replaces nodes V[1..] (and the link to
+ * them from V[0]) with a new chain of nodes. Every thread which encounters a
+ * node frozen by an in-progress update helps to complete it, so no thread
+ * ever waits for another. */
+typedef struct _DataRegionLockFreeRecord
+{
+  _DataRegionLockFreeRetirable retirable;
+  atomic_int state;
+  atomic_int all_frozen;
+
+  /* One reference while any node may refer to this record, plus one
+   * reference per newer record whose 'info_fields' refers to this one. */
+  atomic_int_fast64_t ref_count;
+
+  _DataRegionLockFreeNode* old_next;
+  _DataRegionLockFreeNode* new_next;
+  int64_t v_count;
+  _DataRegionLockFreeNode** v;
+  uintptr_t* info_fields;
+} _DataRegionLockFreeRecord;
+
+/* Internal node of an index level. Each level is a sorted linked list whose
+ * 'right' pointer has its lowest bit set once the index node is deleted. */
+typedef struct _DataRegionLockFreeIndex
+{
+  _DataRegionLockFreeRetirable retirable;
+  _DataRegionLockFreeNode* node;
+  struct _DataRegionLockFreeIndex* down;
+  atomic_uintptr_t right;
+} _DataRegionLockFreeIndex;
+
+struct DataRegionLockFreeSet;
+
+/* Per-thread handle used to access a DataRegionLockFreeSet. Obtain one via
+ * 'data_region_lockfree_set_attach' and release it via
+ * 'data_region_lockfree_set_detach'. A handle must only be used by one
+ * thread at a time. */
+typedef struct DataRegionLockFreeHandle
+{
+  struct DataRegionLockFreeSet* set;
+
+  /* The next handle registered with the set. */
+  struct DataRegionLockFreeHandle* next_handle;
+
+  /* True (1) while a thread owns this handle. */
+  atomic_int in_use;
+
+  /* The epoch observed by this thread shifted left by one, with the lowest
+   * bit set while the thread is accessing the set (or zero). */
+  atomic_uint_fast64_t epoch_state;
+
+  /* Objects retired by this thread, bucketed by the epoch of retirement. */
+  _DataRegionLockFreeRetirable* limbo[3];
+  uint64_t limbo_epoch[3];
+  int64_t retired_since_advance;
+
+  /* Scratch space for building updates. */
+  _DataRegionLockFreeNode** v;
+  uintptr_t* v_info;
+  int64_t v_capacity;
+
+  /* State of the random level generator. */
+  uint64_t rng;
+} DataRegionLockFreeHandle;
+
+/* Lock-free collection of DataRegions. All DataRegions are stored in
+ * ascending order, and no DataRegions are overlapping or immediately
+ * adjacent. The DataRegions are stored in a skip list: the bottom level is a
+ * linked list of nodes, each holding one DataRegion, and the index levels
+ * above it speed up searches.
+ * Adding a DataRegion atomically replaces all of the nodes that it would be
+ * combined with by a single node, and removing a DataRegion atomically
+ * replaces the nodes it intersects by their remaining pieces. Memory is
+ * reclaimed with epoch-based reclamation.
+ * All operations are performed through a DataRegionLockFreeHandle.
+ * @see data_region_lockfree_set_create
+ * @see data_region_lockfree_set_attach
+ * @see data_region_lockfree_set_add
+ * @see data_region_lockfree_set_remove
+ * @see data_region_lockfree_set_contains */
+typedef struct DataRegionLockFreeSet
+{
+  /* The head of the bottom level list. */
+  _DataRegionLockFreeNode* head;
+
+  /* The heads of the index levels ([0] is unused). */
+  _DataRegionLockFreeIndex* index_heads[DATA_REGION_LOCKFREE_MAX_LEVEL + 1];
+
+  /* The global reclamation epoch. */
+  atomic_uint_fast64_t epoch;
+
+  /* Source of unique 'info' tokens. */
+  atomic_uint_fast64_t next_token;
+
+  /* All handles that were ever attached. */
+  _Atomic(DataRegionLockFreeHandle*) handles;
+
+  /* The number of DataRegions stored in the set. */
+  atomic_int_fast64_t count;
+
+  /* The sum of the lengths of all DataRegions stored in the set. */
+  atomic_int_fast64_t total_length;
+
+  /* True (1) while the set is being freed, so that retired objects are
+   * reclaimed immediately. */
+  int destroying;
+} DataRegionLockFreeSet;
+
+/* Internal function to get a new, unique 'info' token for a node.
+ * @param set - The DataRegionLockFreeSet.
+ * @returns - An odd value which has never been returned before. */
+uintptr_t _data_region_lockfree_token(DataRegionLockFreeSet* set)
+{
+  return (uintptr_t)((atomic_fetch_add(&set->next_token, 1) << 1) | 1);
+}
+
+/* Internal function to acquire a reference unless the count already reached
+ * zero (in which case the object is being reclaimed).
+ * @param refCount - The reference count.
+ * @returns - True (1) if the reference was acquired, otherwise false (0). */
+int _data_region_lockfree_try_retain(atomic_int_fast64_t* refCount)
+{
+  int_fast64_t current = atomic_load(refCount);
+  while(current > 0)
+  {
+    if(atomic_compare_exchange_weak(refCount, &current, current + 1))
+      return 1;
+  }
+  return 0;
+}
+
+void _data_region_lockfree_retire(DataRegionLockFreeHandle* handle, _DataRegionLockFreeRetirable* object);
+
+/* Internal function to release a reference to a node.
+ * @param handle - The calling thread's handle.
+ * @param node - The node, which will be retired once it is unreferenced. */
+void _data_region_lockfree_node_release(DataRegionLockFreeHandle* handle, _DataRegionLockFreeNode* node)
+{
+  if(atomic_fetch_sub(&node->ref_count, 1) == 1)
+    _data_region_lockfree_retire(handle, &node->retirable);
+}
+
+/* Internal function to release a reference to an update record.
+ * @param handle - The calling thread's handle.
+ * @param record - The record, which will be retired once it is
+ *        unreferenced. */
+void _data_region_lockfree_record_release(DataRegionLockFreeHandle* handle, _DataRegionLockFreeRecord* record)
+{
+  if(atomic_fetch_sub(&record->ref_count, 1) == 1)
+    _data_region_lockfree_retire(handle, &record->retirable);
+}
+
+/* Internal function to free an object whose grace period has elapsed.
+ * @param handle - The calling thread's handle.
+ * @param object - The object to free. */
+void _data_region_lockfree_reclaim(DataRegionLockFreeHandle* handle, _DataRegionLockFreeRetirable* object)
+{
+  if(object->kind == _DATA_REGION_LOCKFREE_RECORD)
+  {
+    _DataRegionLockFreeRecord* record = (_DataRegionLockFreeRecord*)object;
+    for(int64_t i = 0; i < record->v_count; i++)
+    {
+      _data_region_lockfree_node_release(handle, record->v[i]);
+      if((record->info_fields[i] & 1) == 0)
+        _data_region_lockfree_record_release(handle, (_DataRegionLockFreeRecord*)record->info_fields[i]);
+    }
+  }
+  else if(object->kind == _DATA_REGION_LOCKFREE_INDEX)
+  {
+    _data_region_lockfree_node_release(handle, ((_DataRegionLockFreeIndex*)object)->node);
+  }
+  free(object);
+}
+
+/* Internal function to free all objects of a limbo list.
+ * @param handle - The calling thread's handle.
+ * @param list - The first object of the list. */
+void _data_region_lockfree_reclaim_list(DataRegionLockFreeHandle* handle, _DataRegionLockFreeRetirable* list)
+{
+  while(list != NULL)
+  {
+    _DataRegionLockFreeRetirable* next = list->retire_next;
+    _data_region_lockfree_reclaim(handle, list);//May retire (not reclaim) more objects
+    list = next;
+  }
+}
+
+/* Internal function to free the retired objects of a handle whose grace
+ * period has elapsed.
+ * @param handle - The calling thread's handle.
+ * @param epoch - The current global epoch. */
+void _data_region_lockfree_reclaim_expired(DataRegionLockFreeHandle* handle, uint64_t epoch)
+{
+  for(int i = 0; i < 3; i++)
+  {
+    if(handle->limbo[i] != NULL && handle->limbo_epoch[i] + 2 <= epoch)
+    {
+      _DataRegionLockFreeRetirable* list = handle->limbo[i];
+      handle->limbo[i] = NULL;
+      _data_region_lockfree_reclaim_list(handle, list);
+    }
+  }
+}
+
+/* Internal function to advance the global epoch if every thread that is
+ * accessing the set has observed the current epoch.
+ * @param handle - The calling thread's handle. */
+void _data_region_lockfree_try_advance(DataRegionLockFreeHandle* handle)
+{
+  DataRegionLockFreeSet* set = handle->set;
+  uint64_t epoch = atomic_load(&set->epoch);
+  for(DataRegionLockFreeHandle* other = atomic_load(&set->handles); other != NULL; other = other->next_handle)
+  {
+    uint64_t state = atomic_load(&other->epoch_state);
+    if((state & 1) && (state >> 1) != epoch)
+      return;//That thread may still hold references from an older epoch
+  }
+  atomic_compare_exchange_strong(&set->epoch, &epoch, epoch + 1);
+}
+
+/* Internal function to retire an object, which will be freed once no thread
+ * can hold a reference to it.
+ * @param handle - The calling thread's handle.
+ * @param object - The object, which must already be unreachable. */
+void _data_region_lockfree_retire(DataRegionLockFreeHandle* handle, _DataRegionLockFreeRetirable* object)
+{
+  if(handle->set->destroying)
+  {
+    _data_region_lockfree_reclaim(handle, object);
+    return;
+  }
+
+  //A thread that announced an older epoch may still hold a reference, so use the current global epoch
+  uint64_t epoch = atomic_load(&handle->set->epoch);
+  int bucket = (int)(epoch % 3);
+  if(handle->limbo_epoch[bucket] != epoch)
+  {
+    //The bucket holds objects from at least three epochs ago, which are safe to free
+    _DataRegionLockFreeRetirable* list = handle->limbo[bucket];
+    handle->limbo[bucket] = NULL;
+    handle->limbo_epoch[bucket] = epoch;
+    _data_region_lockfree_reclaim_list(handle, list);
+  }
+
+  object->retire_next = handle->limbo[bucket];
+  handle->limbo[bucket] = object;
+
+  if(++handle->retired_since_advance >= DATA_REGION_LOCKFREE_RETIRE_THRESHOLD)
+  {
+    handle->retired_since_advance = 0;
+    _data_region_lockfree_try_advance(handle);
+  }
+}
+
+/* Internal function called before a thread accesses the set.
+ * @param handle - The calling thread's handle. */
+void _data_region_lockfree_enter(DataRegionLockFreeHandle* handle)
+{
+  uint64_t epoch = atomic_load(&handle->set->epoch);
+  for(;;)
+  {
+    atomic_store(&handle->epoch_state, (epoch << 1) | 1);
+    uint64_t current = atomic_load(&handle->set->epoch);
+    if(current == epoch)
+      break;
+    epoch = current;//The epoch advanced while announcing it, so announce again
+  }
+  _data_region_lockfree_reclaim_expired(handle, epoch);
+}
+
+/* Internal function called after a thread has finished accessing the set.
+ * @param handle - The calling thread's handle. */
+void _data_region_lockfree_exit(DataRegionLockFreeHandle* handle)
+{
+  atomic_store(&handle->epoch_state, 0);
+}
+
+/* Internal function to allocate a node with one reference.
+ * @param handle - The calling thread's handle.
+ * @param region - The DataRegion of the node.
+ * @param type - Whether this is a regular, head or tail node.
+ * @param next - The next node.
+ * @returns - The node, or NULL if 'malloc' failed. */
+_DataRegionLockFreeNode* _data_region_lockfree_node_create(DataRegionLockFreeHandle* handle, DataRegion region, int type, _DataRegionLockFreeNode* next)
+{
+  _DataRegionLockFreeNode* node = DATA_REGION_LOCKFREE_MALLOC(sizeof(_DataRegionLockFreeNode));
+  if(node == NULL)
+    return NULL;
+
+  node->retirable.kind = _DATA_REGION_LOCKFREE_NODE;
+  node->region = region;
+  node->type = type;
+
+  //Choose a random level, where each level is four times less likely than the previous one
+  node->level = 0;
+  uint64_t random = handle->rng;
+  random ^= random << 13;
+  random ^= random >> 7;
+  random ^= random << 17;
+  handle->rng = random;
+  while(node->level < DATA_REGION_LOCKFREE_MAX_LEVEL && (random & 3) == 0)
+  {
+    node->level++;
+    random >>= 2;
+  }
+
+  atomic_init(&node->ref_count, 1);
+  atomic_init(&node->next, next);
+  atomic_init(&node->info, _data_region_lockfree_token(handle->set));
+  atomic_init(&node->marked, 0);
+  return node;
+}
+
+/* Internal function to get the state of the update that an 'info' field
+ * refers to.
+ * @param info - The value of a node's 'info' field.
+ * @returns - The state of the update. A token is treated like an aborted
+ *          update, since both mean that the node is not frozen. */
+int _data_region_lockfree_state_of(uintptr_t info)
+{
+  if(info & 1)
+    return _DATA_REGION_LOCKFREE_ABORTED;
+  return atomic_load(&((_DataRegionLockFreeRecord*)info)->state);
+}
+
+/* Internal function to complete an update. Any thread may call this for an
+ * in-progress update.
+ * @param record - The update record.
+ * @returns - True (1) if the update was (or had already been) committed,
+ *          otherwise false (0) if it was aborted. */
+int _data_region_lockfree_help(_DataRegionLockFreeRecord* record)
+{
+  //Freeze all nodes in V, in order
+  for(int64_t i = 0; i < record->v_count; i++)
+  {
+    uintptr_t expected = record->info_fields[i];
+    if(!atomic_compare_exchange_strong(&record->v[i]->info, &expected, (uintptr_t)record))
+    {
+      if(expected != (uintptr_t)record)
+      {
+        //Another update changed this node since it was read
+        if(atomic_load(&record->all_frozen))
+          return 1;//This update was already completed by another thread
+        atomic_store(&record->state, _DATA_REGION_LOCKFREE_ABORTED);
+        return 0;
+      }
+    }
+  }
+
+  atomic_store(&record->all_frozen, 1);
+  for(int64_t i = 1; i < record->v_count; i++)
+    atomic_store(&record->v[i]->marked, 1);
+
+  _DataRegionLockFreeNode* expected = record->old_next;
+  atomic_compare_exchange_strong(&record->v[0]->next, &expected, record->new_next);
+  atomic_store(&record->state, _DATA_REGION_LOCKFREE_COMMITTED);
+  return 1;
+}
+
+enum
+{
+  _DATA_REGION_LOCKFREE_LLX_SUCCESS = 0,
+  _DATA_REGION_LOCKFREE_LLX_FAIL = 1,
+  _DATA_REGION_LOCKFREE_LLX_FINALIZED = 2,
+};
+
+/* Internal function to read a consistent snapshot of a node (its 'next'
+ * field) together with the 'info' value that must still be present for an
+ * update of the node to succeed.
+ * @param node - The node to read.
+ * @param next - Receives the snapshot of the node's 'next' field.
+ * @param info - Receives the node's 'info' value.
+ * @returns - _DATA_REGION_LOCKFREE_LLX_SUCCESS, _DATA_REGION_LOCKFREE_LLX_FAIL
+ *          if the node is frozen by another update (which has been helped),
+ *          or _DATA_REGION_LOCKFREE_LLX_FINALIZED if it was removed. */
+int _data_region_lockfree_llx(_DataRegionLockFreeNode* node, _DataRegionLockFreeNode** next, uintptr_t* info)
+{
+  int marked1 = atomic_load(&node->marked);
+  uintptr_t nodeInfo = atomic_load(&node->info);
+  int state = _data_region_lockfree_state_of(nodeInfo);
+  int marked2 = atomic_load(&node->marked);
+
+  //Removed nodes are detached from their record, so a token does not imply that the node is unmarked
+  if(!marked2 && (state == _DATA_REGION_LOCKFREE_ABORTED || state == _DATA_REGION_LOCKFREE_COMMITTED))
+  {
+    _DataRegionLockFreeNode* snapshot = atomic_load(&node->next);
+    if(atomic_load(&node->info) == nodeInfo)
+    {
+      *next = snapshot;
+      *info = nodeInfo;
+      return _DATA_REGION_LOCKFREE_LLX_SUCCESS;
+    }
+  }
+
+  nodeInfo = atomic_load(&node->info);
+  if(_data_region_lockfree_state_of(nodeInfo) == _DATA_REGION_LOCKFREE_IN_PROGRESS)
+    _data_region_lockfree_help((_DataRegionLockFreeRecord*)nodeInfo);
+
+  return marked1 || marked2 ? _DATA_REGION_LOCKFREE_LLX_FINALIZED : _DATA_REGION_LOCKFREE_LLX_FAIL;
+}
+
+/* Internal function to append a node to the handle's scratch V sequence.
+ * @param handle - The calling thread's handle.
+ * @param count - The number of nodes already in the sequence.
+ * @param node - The node.
+ * @param info - The node's 'info' value read by '_data_region_lockfree_llx'.
+ * @returns - True (1) upon success, or false (0) if 'realloc' failed. */
+int _data_region_lockfree_push_v(DataRegionLockFreeHandle* handle, int64_t count, _DataRegionLockFreeNode* node, uintptr_t info)
+{
+  if(count == handle->v_capacity)
+  {
+    int64_t capacity = handle->v_capacity * 2;
+    _DataRegionLockFreeNode** v = DATA_REGION_LOCKFREE_REALLOC(handle->v, sizeof(_DataRegionLockFreeNode*) * capacity);
+    if(v == NULL)
+      return 0;
+    handle->v = v;
+    uintptr_t* vInfo = DATA_REGION_LOCKFREE_REALLOC(handle->v_info, sizeof(uintptr_t) * capacity);
+    if(vInfo == NULL)
+      return 0;
+    handle->v_info = vInfo;
+    handle->v_capacity = capacity;
+  }
+  handle->v[count] = node;
+  handle->v_info[count] = info;
+  return 1;
+}
+
+enum
+{
+  _DATA_REGION_LOCKFREE_SCX_COMMITTED = 0,
+  _DATA_REGION_LOCKFREE_SCX_RETRY = 1,
+  _DATA_REGION_LOCKFREE_SCX_NO_MEMORY = 2,
+};
+
+/* Internal function to atomically replace the nodes V[1..] of the handle's
+ * scratch sequence (and the link to them from V[0]) with a new chain.
+ * @param handle - The calling thread's handle.
+ * @param count - The number of nodes in the scratch sequence (at least 2).
+ * @param newNext - The first node of the new chain (which must be a newly
+ *        allocated node), to be stored into V[0]->next.
+ * @returns - _DATA_REGION_LOCKFREE_SCX_COMMITTED,
+ *          _DATA_REGION_LOCKFREE_SCX_RETRY if a concurrent update
+ *          interfered, or _DATA_REGION_LOCKFREE_SCX_NO_MEMORY. */
+int _data_region_lockfree_scx(DataRegionLockFreeHandle* handle, int64_t count, _DataRegionLockFreeNode* newNext)
+{
+  _DataRegionLockFreeRecord* record = DATA_REGION_LOCKFREE_MALLOC(sizeof(_DataRegionLockFreeRecord) + ((sizeof(_DataRegionLockFreeNode*) + sizeof(uintptr_t)) * count));
+  if(record == NULL)
+    return _DATA_REGION_LOCKFREE_SCX_NO_MEMORY;
+
+  record->retirable.kind = _DATA_REGION_LOCKFREE_RECORD;
+  atomic_init(&record->state, _DATA_REGION_LOCKFREE_IN_PROGRESS);
+  atomic_init(&record->all_frozen, 0);
+  atomic_init(&record->ref_count, 1);
+  record->old_next = handle->v[1];
+  record->new_next = newNext;
+  record->v = (_DataRegionLockFreeNode**)(record + 1);
+  record->info_fields = (uintptr_t*)(record->v + count);
+  record->v_count = 0;
+
+  /* The record keeps the nodes of V and the records in 'info_fields' alive.
+   * This guarantees that a slow helper never accesses reclaimed memory, and
+   * that an 'info' or 'next' value which it compares against can never be
+   * reused by a newer object. */
+  for(int64_t i = 0; i < count; i++)
+  {
+    int retained = _data_region_lockfree_try_retain(&handle->v[i]->ref_count);
+    if(retained && (handle->v_info[i] & 1) == 0)
+    {
+      retained = _data_region_lockfree_try_retain(&((_DataRegionLockFreeRecord*)handle->v_info[i])->ref_count);
+      if(!retained)
+        _data_region_lockfree_node_release(handle, handle->v[i]);
+    }
+
+    if(!retained)
+    {
+      //Something was already reclaimed, so the snapshot is out of date
+      for(int64_t j = 0; j < record->v_count; j++)
+      {
+        _data_region_lockfree_node_release(handle, record->v[j]);
+        if((record->info_fields[j] & 1) == 0)
+          _data_region_lockfree_record_release(handle, (_DataRegionLockFreeRecord*)record->info_fields[j]);
+      }
+      free(record);
+      return _DATA_REGION_LOCKFREE_SCX_RETRY;
+    }
+
+    record->v[i] = handle->v[i];
+    record->info_fields[i] = handle->v_info[i];
+    record->v_count++;
+  }
+
+  int committed = _data_region_lockfree_help(record);
+
+  //Detach the record from all nodes, so that its memory can be reclaimed
+  for(int64_t i = 0; i < count; i++)
+  {
+    _DataRegionLockFreeNode* node = record->v[i];
+    uintptr_t current = atomic_load(&node->info);
+    while(current == (uintptr_t)record || (!committed && current == record->info_fields[i]))
+    {
+      //Once this succeeds, no (slow) helper can ever freeze the node for this record
+      if(atomic_compare_exchange_strong(&node->info, &current, _data_region_lockfree_token(handle->set)))
+        break;
+    }
+  }
+
+  if(committed)
+  {
+    for(int64_t i = 1; i < count; i++)
+      _data_region_lockfree_node_release(handle, record->v[i]);//Release the reference held by the list
+  }
+
+  _data_region_lockfree_record_release(handle, record);
+  return committed ? _DATA_REGION_LOCKFREE_SCX_COMMITTED : _DATA_REGION_LOCKFREE_SCX_RETRY;
+}
+
+/* Internal function to get the index node after another, deleting index
+ * nodes of removed nodes along the way.
+ * @param handle - The calling thread's handle.
+ * @param index - The (non-deleted) index node.
+ * @param right - Receives the next index node, or NULL.
+ * @returns - True (1) upon success, or false (0) if 'index' itself was
+ *          deleted (in which case the search must restart). */
+int _data_region_lockfree_index_right(DataRegionLockFreeHandle* handle, _DataRegionLockFreeIndex* index, _DataRegionLockFreeIndex** right)
+{
+  for(;;)
+  {
+    uintptr_t link = atomic_load(&index->right);
+    if(link & 1)
+      return 0;
+
+    _DataRegionLockFreeIndex* candidate = (_DataRegionLockFreeIndex*)link;
+    if(candidate == NULL || !atomic_load(&candidate->node->marked))
+    {
+      *right = candidate;
+      return 1;
+    }
+
+    //The node was removed, so delete its index node: mark it, then unlink it
+    uintptr_t candidateLink = atomic_load(&candidate->right);
+    while(!(candidateLink & 1) && !atomic_compare_exchange_weak(&candidate->right, &candidateLink, candidateLink | 1))
+    {
+    }
+
+    uintptr_t expected = link;
+    if(atomic_compare_exchange_strong(&index->right, &expected, (atomic_load(&candidate->right) & ~(uintptr_t)1)))
+      _data_region_lockfree_retire(handle, &candidate->retirable);
+  }
+}
+
+enum
+{
+  _DATA_REGION_LOCKFREE_BEFORE = 0,
+  _DATA_REGION_LOCKFREE_BEFORE_NON_ADJACENT = 1,
+  _DATA_REGION_LOCKFREE_NOT_AFTER = 2,
+};
+
+/* Internal function to check whether a search passes a node.
+ * @param node - The node.
+ * @param region - The DataRegion that is searched for.
+ * @param mode - _DATA_REGION_LOCKFREE_BEFORE to pass nodes that end before
+ *        'region', _DATA_REGION_LOCKFREE_BEFORE_NON_ADJACENT to pass nodes
+ *        that end before 'region' without being adjacent to it (for an add),
+ *        or _DATA_REGION_LOCKFREE_NOT_AFTER to pass nodes that do not start
+ *        after 'region'.
+ * @returns - True (1) if 'node' is a regular node that is passed, otherwise
+ *          false (0).
+ * @remarks - Unlike 'data_region_are_adjacent', this never overflows at the
+ *          extremes of the index range. */
+int _data_region_lockfree_passes(const _DataRegionLockFreeNode* node, DataRegion region, int mode)
+{
+  if(node->type != _DATA_REGION_LOCKFREE_REGULAR)
+    return 0;
+  if(mode == _DATA_REGION_LOCKFREE_NOT_AFTER)
+    return node->region.first_index <= region.last_index;
+  return node->region.last_index < region.first_index
+    && !(mode == _DATA_REGION_LOCKFREE_BEFORE_NON_ADJACENT && node->region.last_index == region.first_index - 1);
+}
+
+/* Internal function to search the index levels.
+ * @param handle - The calling thread's handle.
+ * @param region - The DataRegion to search for.
+ * @param mode - Which nodes to pass (see '_data_region_lockfree_passes').
+ * @param level - The lowest index level to descend to (at least one).
+ * @param predecessor - Receives the last index node at 'level' whose node is
+ *        passed.
+ * @param successor - Receives the index node after 'predecessor'. */
+void _data_region_lockfree_index_search(DataRegionLockFreeHandle* handle, DataRegion region, int mode, int level, _DataRegionLockFreeIndex** predecessor, _DataRegionLockFreeIndex** successor)
+{
+restart:;
+  _DataRegionLockFreeIndex* index = handle->set->index_heads[DATA_REGION_LOCKFREE_MAX_LEVEL];
+  for(int currentLevel = DATA_REGION_LOCKFREE_MAX_LEVEL;; currentLevel--)
+  {
+    _DataRegionLockFreeIndex* right;
+    for(;;)
+    {
+      if(!_data_region_lockfree_index_right(handle, index, &right))
+        goto restart;
+      if(right == NULL || !_data_region_lockfree_passes(right->node, region, mode))
+        break;
+      index = right;
+    }
+
+    if(currentLevel == level)
+    {
+      *predecessor = index;
+      *successor = right;
+      return;
+    }
+    index = index->down;
+  }
+}
+
+/* Internal function to find a node of the list from which to start a search.
+ * @param handle - The calling thread's handle.
+ * @param region - The DataRegion to search for.
+ * @param mode - Which nodes to pass (see '_data_region_lockfree_passes').
+ * @returns - A node which is (or was, during the call) in the list, and which
+ *          is either the head node or a node that is passed. */
+_DataRegionLockFreeNode* _data_region_lockfree_find_start(DataRegionLockFreeHandle* handle, DataRegion region, int mode)
+{
+  for(int attempt = 0; attempt < 4; attempt++)
+  {
+    _DataRegionLockFreeIndex* predecessor, *successor;
+    _data_region_lockfree_index_search(handle, region, mode, 1, &predecessor, &successor);
+
+    //The index may briefly be out of order while nodes are replaced, so check the node itself
+    _DataRegionLockFreeNode* node = predecessor->node;
+    if(!atomic_load(&node->marked) && (node->type == _DATA_REGION_LOCKFREE_HEAD || _data_region_lockfree_passes(node, region, mode)))
+      return node;
+  }
+  return handle->set->head;//The head node is never removed
+}
+
+/* Internal function to build the index levels above a newly added node.
+ * @param handle - The calling thread's handle.
+ * @param node - The node. */
+void _data_region_lockfree_build_tower(DataRegionLockFreeHandle* handle, _DataRegionLockFreeNode* node)
+{
+  _DataRegionLockFreeIndex* down = NULL;
+  for(int level = 1; level <= node->level; level++)
+  {
+    if(atomic_load(&node->marked) || !_data_region_lockfree_try_retain(&node->ref_count))
+      return;//The node was already removed
+
+    _DataRegionLockFreeIndex* index = DATA_REGION_LOCKFREE_MALLOC(sizeof(_DataRegionLockFreeIndex));
+    if(index == NULL)
+    {
+      _data_region_lockfree_node_release(handle, node);
+      return;//The index is only an optimization, so it may be incomplete
+    }
+    index->retirable.kind = _DATA_REGION_LOCKFREE_INDEX;
+    index->node = node;
+    index->down = down;
+
+    for(;;)
+    {
+      _DataRegionLockFreeIndex* predecessor, *successor;
+      _data_region_lockfree_index_search(handle, node->region, _DATA_REGION_LOCKFREE_BEFORE, level, &predecessor, &successor);
+      if(atomic_load(&node->marked))
+      {
+        _data_region_lockfree_reclaim(handle, &index->retirable);//Never published
+        return;
+      }
+
+      atomic_init(&index->right, (uintptr_t)successor);
+      uintptr_t expected = (uintptr_t)successor;
+      if(atomic_compare_exchange_strong(&predecessor->right, &expected, (uintptr_t)index))
+        break;
+    }
+    down = index;
+  }
+}
+
+/* Internal function to clean up after nodes were removed from the list.
+ * @param handle - The calling thread's handle.
+ * @param count - The number of nodes in the handle's scratch sequence, whose
+ *        nodes V[1..] were removed. */
+void _data_region_lockfree_unlink_towers(DataRegionLockFreeHandle* handle, int64_t count)
+{
+  for(int64_t i = 1; i < count; i++)
+  {
+    _DataRegionLockFreeNode* node = handle->v[i];
+    if(node->level == 0)
+      continue;
+
+    //Searching past the node deletes the index nodes of all removed nodes that are encountered
+    _DataRegionLockFreeIndex* predecessor, *successor;
+    _data_region_lockfree_index_search(handle, node->region, _DATA_REGION_LOCKFREE_NOT_AFTER, 1, &predecessor, &successor);
+  }
+}
+
+/* Allocates a new, empty DataRegionLockFreeSet.
+ * @returns - A pointer to the allocated DataRegionLockFreeSet, or NULL upon
+ *          failure.
+ * @remarks - Be sure to free the returned DataRegionLockFreeSet by calling
+ *          the 'data_region_lockfree_set_free' function.
+ * @see data_region_lockfree_set_free
+ * @see data_region_lockfree_set_attach */
+DataRegionLockFreeSet* data_region_lockfree_set_create()
+{
+  DataRegionLockFreeSet* set = calloc(1, sizeof(DataRegionLockFreeSet));
+  if(set == NULL)
+    return NULL;
+
+  atomic_init(&set->epoch, 3);
+  atomic_init(&set->next_token, 1);
+  atomic_init(&set->handles, NULL);
+  atomic_init(&set->count, 0);
+  atomic_init(&set->total_length, 0);
+
+  set->head = DATA_REGION_LOCKFREE_MALLOC(sizeof(_DataRegionLockFreeNode));
+  _DataRegionLockFreeNode* tail = DATA_REGION_LOCKFREE_MALLOC(sizeof(_DataRegionLockFreeNode));
+  if(set->head == NULL || tail == NULL)
+  {
+    free(set->head);
+    free(tail);
+    free(set);
+    return NULL;
+  }
+
+  tail->retirable.kind = _DATA_REGION_LOCKFREE_NODE;
+  tail->type = _DATA_REGION_LOCKFREE_TAIL;
+  tail->level = 0;
+  atomic_init(&tail->ref_count, 1);
+  atomic_init(&tail->next, NULL);
+  atomic_init(&tail->info, _data_region_lockfree_token(set));
+  atomic_init(&tail->marked, 0);
+
+  set->head->retirable.kind = _DATA_REGION_LOCKFREE_NODE;
+  set->head->type = _DATA_REGION_LOCKFREE_HEAD;
+  set->head->level = DATA_REGION_LOCKFREE_MAX_LEVEL;
+  atomic_init(&set->head->ref_count, 1);
+  atomic_init(&set->head->next, tail);
+  atomic_init(&set->head->info, _data_region_lockfree_token(set));
+  atomic_init(&set->head->marked, 0);
+
+  for(int level = 1; level <= DATA_REGION_LOCKFREE_MAX_LEVEL; level++)
+  {
+    _DataRegionLockFreeIndex* index = DATA_REGION_LOCKFREE_MALLOC(sizeof(_DataRegionLockFreeIndex));
+    if(index == NULL)
+    {
+      for(int i = 1; i < level; i++)
+        free(set->index_heads[i]);
+      free(set->head);
+      free(tail);
+      free(set);
+      return NULL;
+    }
+    index->retirable.kind = _DATA_REGION_LOCKFREE_INDEX;
+    index->node = set->head;
+    index->down = level > 1 ? set->index_heads[level - 1] : NULL;
+    atomic_init(&index->right, (uintptr_t)NULL);
+    set->index_heads[level] = index;
+  }
+
+  return set;
+}
+
+/* Frees a DataRegionLockFreeSet that was allocated by the
+ * 'data_region_lockfree_set_create' function, along with all of its
+ * handles.
+ * @param set - Pointer to the DataRegionLockFreeSet. If this argument is
+ *        NULL, then nothing will happen.
+ * @remarks - No other thread may be using the set (or any of its handles)
+ *          when it is freed. */
+void data_region_lockfree_set_free(DataRegionLockFreeSet* set)
+{
+  if(set == NULL)
+    return;
+
+  DataRegionLockFreeHandle* handle = atomic_load(&set->handles);
+  DataRegionLockFreeHandle placeholder;
+  if(handle == NULL)
+  {
+    memset(&placeholder, 0, sizeof(placeholder));
+    placeholder.set = set;
+    handle = &placeholder;
+  }
+  set->destroying = 1;//Reclaim immediately from now on
+
+  //Free the index levels
+  for(int level = 1; level <= DATA_REGION_LOCKFREE_MAX_LEVEL; level++)
+  {
+    _DataRegionLockFreeIndex* index = (_DataRegionLockFreeIndex*)(atomic_load(&set->index_heads[level]->right) & ~(uintptr_t)1);
+    while(index != NULL)
+    {
+      _DataRegionLockFreeIndex* next = (_DataRegionLockFreeIndex*)(atomic_load(&index->right) & ~(uintptr_t)1);
+      _data_region_lockfree_reclaim(handle, &index->retirable);
+      index = next;
+    }
+    free(set->index_heads[level]);
+  }
+
+  //Free the nodes of the list (retired update records may still refer to them)
+  _DataRegionLockFreeNode* node = set->head;
+  while(node != NULL)
+  {
+    _DataRegionLockFreeNode* next = atomic_load(&node->next);
+    _data_region_lockfree_node_release(handle, node);
+    node = next;
+  }
+
+  //Free everything that was retired, along with the handles
+  DataRegionLockFreeHandle* current = atomic_load(&set->handles);
+  while(current != NULL)
+  {
+    for(int i = 0; i < 3; i++)
+    {
+      _DataRegionLockFreeRetirable* list = current->limbo[i];
+      current->limbo[i] = NULL;
+      _data_region_lockfree_reclaim_list(current, list);
+    }
+    current = current->next_handle;
+  }
+
+  current = atomic_load(&set->handles);
+  while(current != NULL)
+  {
+    DataRegionLockFreeHandle* next = current->next_handle;
+    free(current->v);
+    free(current->v_info);
+    free(current);
+    current = next;
+  }
+  free(set);
+}
+
+/* Obtains a handle through which the calling thread can access a
+ * DataRegionLockFreeSet.
+ * @param set - Pointer to the DataRegionLockFreeSet. If this is NULL, then
+ *        NULL will be returned.
+ * @returns - The handle, or NULL if 'malloc' failed.
+ * @remarks - Each thread should attach once and keep using its handle.
+ *          Release the handle via 'data_region_lockfree_set_detach' so that
+ *          another thread can reuse it. Handles are freed along with the set.
+ * @see data_region_lockfree_set_detach */
+DataRegionLockFreeHandle* data_region_lockfree_set_attach(DataRegionLockFreeSet* set)
+{
+  if(set == NULL)
+    return NULL;
+
+  //Reuse a detached handle if possible
+  for(DataRegionLockFreeHandle* handle = atomic_load(&set->handles); handle != NULL; handle = handle->next_handle)
+  {
+    int expected = 0;
+    if(atomic_load(&handle->in_use) == 0 && atomic_compare_exchange_strong(&handle->in_use, &expected, 1))
+      return handle;
+  }
+
+  DataRegionLockFreeHandle* handle = calloc(1, sizeof(DataRegionLockFreeHandle));
+  if(handle == NULL)
+    return NULL;
+
+  handle->v_capacity = 16;
+  handle->v = DATA_REGION_LOCKFREE_MALLOC(sizeof(_DataRegionLockFreeNode*) * handle->v_capacity);
+  handle->v_info = DATA_REGION_LOCKFREE_MALLOC(sizeof(uintptr_t) * handle->v_capacity);
+  if(handle->v == NULL || handle->v_info == NULL)
+  {
+    free(handle->v);
+    free(handle->v_info);
+    free(handle);
+    return NULL;
+  }
+
+  handle->set = set;
+  handle->rng = 0x9E3779B97F4A7C15ull ^ (uint64_t)(uintptr_t)handle;
+  atomic_init(&handle->in_use, 1);
+  atomic_init(&handle->epoch_state, 0);
+
+  //Publish the handle (handles are never removed from the list)
+  DataRegionLockFreeHandle* head = atomic_load(&set->handles);
+  do
+  {
+    handle->next_handle = head;
+  } while(!atomic_compare_exchange_weak(&set->handles, &head, handle));
+  return handle;
+}
+
+/* Releases a handle that was obtained by 'data_region_lockfree_set_attach'.
+ * @param handle - The handle. If this is NULL, then nothing will happen.
+ * @remarks - The handle must not be used after it has been detached. Objects
+ *          that it retired are freed once another thread reuses it, or when
+ *          the set is freed. */
+void data_region_lockfree_set_detach(DataRegionLockFreeHandle* handle)
+{
+  if(handle != NULL)
+    atomic_store(&handle->in_use, 0);
+}
+
+/* Internal function to find the last node which precedes a DataRegion,
+ * and to read a snapshot of it.
+ * @param handle - The calling thread's handle.
+ * @param region - The DataRegion.
+ * @param adjacentCombines - True (1) if nodes adjacent to 'region' must not
+ *        be passed (for an add), otherwise false (0).
+ * @param predecessor - Receives the predecessor node.
+ * @param next - Receives the snapshot of the predecessor's 'next' field.
+ * @param info - Receives the predecessor's 'info' value.
+ * @returns - True (1) upon success, or false (0) if the search must be
+ *          retried. */
+int _data_region_lockfree_find_predecessor(DataRegionLockFreeHandle* handle, DataRegion region, int adjacentCombines, _DataRegionLockFreeNode** predecessor, _DataRegionLockFreeNode** next, uintptr_t* info)
+{
+  int mode = adjacentCombines ? _DATA_REGION_LOCKFREE_BEFORE_NON_ADJACENT : _DATA_REGION_LOCKFREE_BEFORE;
+  _DataRegionLockFreeNode* node = _data_region_lockfree_find_start(handle, region, mode);
+  for(;;)
+  {
+    _DataRegionLockFreeNode* candidate = atomic_load(&node->next);
+    if(_data_region_lockfree_passes(candidate, region, mode))
+    {
+      node = candidate;//'candidate' entirely precedes 'region'
+      continue;
+    }
+
+    if(_data_region_lockfree_llx(node, next, info) != _DATA_REGION_LOCKFREE_LLX_SUCCESS)
+      return 0;
+
+    candidate = *next;
+    if(_data_region_lockfree_passes(candidate, region, mode))
+    {
+      node = candidate;//A node was inserted after the first read
+      continue;
+    }
+
+    *predecessor = node;
+    return 1;
+  }
+}
+
+/* Internal function to allocate a copy of a node that is being replaced.
+ * @param handle - The calling thread's handle.
+ * @param node - The node to copy.
+ * @param next - The snapshot of the node's 'next' field.
+ * @returns - The copy, or NULL if 'malloc' failed. */
+_DataRegionLockFreeNode* _data_region_lockfree_copy_node(DataRegionLockFreeHandle* handle, _DataRegionLockFreeNode* node, _DataRegionLockFreeNode* next)
+{
+  _DataRegionLockFreeNode* copy = _data_region_lockfree_node_create(handle, node->region, node->type, next);
+  if(copy != NULL)
+    copy->level = node->level;
+  return copy;
+}
+
+/* Adds a DataRegion to a DataRegionLockFreeSet.
+ * @param handle - The calling thread's handle to the destination set. If
+ *        this is NULL, then DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toAdd - The DataRegion to add. If this is invalid (see
+ *        data_region_is_valid), then DATA_REGION_SET_INVALID_REGION will
+ *        be returned.
+ * @returns - The DataRegionSetResult that defines the result of the add
+ *          operation. If all arguments are non-null and valid, then the
+ *          result will be either DATA_REGION_SET_SUCCESS or
+ *          DATA_REGION_SET_ALLOCATION_FAILED.
+ * @remarks - The input DataRegion is combined with all combinable DataRegions
+ *          in the set (see 'data_region_can_combine') in one atomic step, so
+ *          concurrent readers never observe a partially combined set. */
+DataRegionSetResult data_region_lockfree_set_add(DataRegionLockFreeHandle* handle, DataRegion toAdd)
+{
+  if(handle == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(toAdd))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  _data_region_lockfree_enter(handle);
+  for(;;)
+  {
+    _DataRegionLockFreeNode* predecessor, *next;
+    uintptr_t info;
+    if(!_data_region_lockfree_find_predecessor(handle, toAdd, 1, &predecessor, &next, &info))
+      continue;
+
+    if(!_data_region_lockfree_push_v(handle, 0, predecessor, info))
+    {
+      _data_region_lockfree_exit(handle);
+      return DATA_REGION_SET_ALLOCATION_FAILED;
+    }
+
+    //Collect all nodes that will be combined with 'toAdd'
+    int64_t count = 1;
+    int64_t absorbedLength = 0;
+    int ok = 1;
+    DataRegion combined = toAdd;
+    _DataRegionLockFreeNode* current = next;
+    while(current->type == _DATA_REGION_LOCKFREE_REGULAR
+      && (current->region.first_index <= toAdd.last_index || current->region.first_index - 1 == toAdd.last_index))
+    {
+      _DataRegionLockFreeNode* currentNext;
+      if(_data_region_lockfree_llx(current, &currentNext, &info) != _DATA_REGION_LOCKFREE_LLX_SUCCESS)
+      {
+        ok = 0;
+        break;
+      }
+      if(!_data_region_lockfree_push_v(handle, count, current, info))
+      {
+        _data_region_lockfree_exit(handle);
+        return DATA_REGION_SET_ALLOCATION_FAILED;
+      }
+      count++;
+      combined = data_region_combine(combined, current->region);
+      absorbedLength += data_region_length(current->region);
+      current = currentNext;
+    }
+    if(!ok)
+      continue;
+
+    if(count == 2 && data_region_contains(handle->v[1]->region, toAdd))
+      break;//Already present, nothing to change
+
+    _DataRegionLockFreeNode* copy = NULL;
+    if(count == 1)
+    {
+      //Nothing to combine with, so replace the successor with a copy (the new link must always point to a new node)
+      _DataRegionLockFreeNode* currentNext;
+      if(_data_region_lockfree_llx(current, &currentNext, &info) != _DATA_REGION_LOCKFREE_LLX_SUCCESS)
+        continue;
+      if(!_data_region_lockfree_push_v(handle, count, current, info))
+      {
+        _data_region_lockfree_exit(handle);
+        return DATA_REGION_SET_ALLOCATION_FAILED;
+      }
+      count++;
+
+      copy = _data_region_lockfree_copy_node(handle, current, currentNext);
+      if(copy == NULL)
+      {
+        _data_region_lockfree_exit(handle);
+        return DATA_REGION_SET_ALLOCATION_FAILED;
+      }
+      current = copy;
+    }
+
+    _DataRegionLockFreeNode* node = _data_region_lockfree_node_create(handle, combined, _DATA_REGION_LOCKFREE_REGULAR, current);
+    if(node == NULL)
+    {
+      if(copy != NULL)
+        _data_region_lockfree_node_release(handle, copy);
+      _data_region_lockfree_exit(handle);
+      return DATA_REGION_SET_ALLOCATION_FAILED;
+    }
+
+    int result = _data_region_lockfree_scx(handle, count, node);
+    if(result == _DATA_REGION_LOCKFREE_SCX_COMMITTED)
+    {
+      atomic_fetch_add(&handle->set->count, 1 - (copy == NULL ? count - 1 : 0));
+      atomic_fetch_add(&handle->set->total_length, data_region_length(combined) - absorbedLength);
+      _data_region_lockfree_unlink_towers(handle, count);
+      _data_region_lockfree_build_tower(handle, node);
+      if(copy != NULL)
+        _data_region_lockfree_build_tower(handle, copy);
+      break;
+    }
+
+    _data_region_lockfree_node_release(handle, node);
+    if(copy != NULL)
+      _data_region_lockfree_node_release(handle, copy);
+    if(result == _DATA_REGION_LOCKFREE_SCX_NO_MEMORY)
+    {
+      _data_region_lockfree_exit(handle);
+      return DATA_REGION_SET_ALLOCATION_FAILED;
+    }
+  }
+
+  _data_region_lockfree_exit(handle);
+  return DATA_REGION_SET_SUCCESS;
+}
+
+/* Removes a DataRegion from a DataRegionLockFreeSet.
+ * @param handle - The calling thread's handle to the set. If this argument is
+ *        NULL, then DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toRemove - The DataRegion to remove. If this is invalid
+ *        (see data_region_is_valid), then DATA_REGION_SET_INVALID_REGION
+ *        will be returned.
+ * @returns - The DataRegionSetResult that defines the result of the removal
+ *          operation. If all arguments are non-null and valid, then the
+ *          result will be either DATA_REGION_SET_SUCCESS or
+ *          DATA_REGION_SET_ALLOCATION_FAILED.
+ * @remarks - All DataRegions that intersect 'toRemove' are replaced by their
+ *          remaining pieces in one atomic step. */
+DataRegionSetResult data_region_lockfree_set_remove(DataRegionLockFreeHandle* handle, DataRegion toRemove)
+{
+  if(handle == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(toRemove))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  _data_region_lockfree_enter(handle);
+  for(;;)
+  {
+    _DataRegionLockFreeNode* predecessor, *next;
+    uintptr_t info;
+    if(!_data_region_lockfree_find_predecessor(handle, toRemove, 0, &predecessor, &next, &info))
+      continue;
+
+    if(!_data_region_lockfree_push_v(handle, 0, predecessor, info))
+    {
+      _data_region_lockfree_exit(handle);
+      return DATA_REGION_SET_ALLOCATION_FAILED;
+    }
+
+    //Collect all nodes that intersect 'toRemove'
+    int64_t count = 1;
+    int64_t removedLength = 0;
+    int ok = 1;
+    _DataRegionLockFreeNode* current = next;
+    while(current->type == _DATA_REGION_LOCKFREE_REGULAR && current->region.first_index <= toRemove.last_index)
+    {
+      _DataRegionLockFreeNode* currentNext;
+      if(_data_region_lockfree_llx(current, &currentNext, &info) != _DATA_REGION_LOCKFREE_LLX_SUCCESS)
+      {
+        ok = 0;
+        break;
+      }
+      if(!_data_region_lockfree_push_v(handle, count, current, info))
+      {
+        _data_region_lockfree_exit(handle);
+        return DATA_REGION_SET_ALLOCATION_FAILED;
+      }
+      count++;
+      removedLength += data_region_length(current->region);
+      current = currentNext;
+    }
+    if(!ok)
+      continue;
+
+    if(count == 1)
+      break;//Nothing intersects 'toRemove'
+
+    //Build the chain of remaining pieces
+    DataRegion first = handle->v[1]->region;
+    DataRegion last = handle->v[count - 1]->region;
+    _DataRegionLockFreeNode* pieces[2] = { NULL, NULL };
+    int pieceCount = 0;
+    int64_t remainingLength = 0;
+    int noMemory = 0;
+    if(last.last_index > toRemove.last_index)
+    {
+      DataRegion right = { toRemove.last_index + 1, last.last_index };
+      pieces[1] = _data_region_lockfree_node_create(handle, right, _DATA_REGION_LOCKFREE_REGULAR, current);
+      noMemory |= pieces[1] == NULL;
+      pieceCount++;
+      remainingLength += data_region_length(right);
+    }
+    if(first.first_index < toRemove.first_index)
+    {
+      DataRegion left = { first.first_index, toRemove.first_index - 1 };
+      pieces[0] = _data_region_lockfree_node_create(handle, left, _DATA_REGION_LOCKFREE_REGULAR, pieces[1] != NULL ? pieces[1] : current);
+      noMemory |= pieces[0] == NULL;
+      pieceCount++;
+      remainingLength += data_region_length(left);
+    }
+
+    _DataRegionLockFreeNode* copy = NULL;
+    if(pieceCount == 0 && !noMemory)
+    {
+      //Nothing remains, so replace the successor with a copy (the new link must always point to a new node)
+      _DataRegionLockFreeNode* currentNext;
+      if(_data_region_lockfree_llx(current, &currentNext, &info) != _DATA_REGION_LOCKFREE_LLX_SUCCESS)
+        continue;
+      if(_data_region_lockfree_push_v(handle, count, current, info))
+      {
+        count++;
+        copy = _data_region_lockfree_copy_node(handle, current, currentNext);
+      }
+      noMemory |= copy == NULL;
+    }
+
+    int result = _DATA_REGION_LOCKFREE_SCX_NO_MEMORY;
+    if(!noMemory)
+      result = _data_region_lockfree_scx(handle, count, pieces[0] != NULL ? pieces[0] : pieces[1] != NULL ? pieces[1] : copy);
+
+    if(result == _DATA_REGION_LOCKFREE_SCX_COMMITTED)
+    {
+      atomic_fetch_add(&handle->set->count, pieceCount - (copy == NULL ? count - 1 : count - 2));
+      atomic_fetch_add(&handle->set->total_length, remainingLength - removedLength);
+      _data_region_lockfree_unlink_towers(handle, count);
+      for(int i = 0; i < 2; i++)
+      {
+        if(pieces[i] != NULL)
+          _data_region_lockfree_build_tower(handle, pieces[i]);
+      }
+      if(copy != NULL)
+        _data_region_lockfree_build_tower(handle, copy);
+      break;
+    }
+
+    for(int i = 0; i < 2; i++)
+    {
+      if(pieces[i] != NULL)
+        _data_region_lockfree_node_release(handle, pieces[i]);
+    }
+    if(copy != NULL)
+      _data_region_lockfree_node_release(handle, copy);
+    if(result == _DATA_REGION_LOCKFREE_SCX_NO_MEMORY)
+    {
+      _data_region_lockfree_exit(handle);
+      return DATA_REGION_SET_ALLOCATION_FAILED;
+    }
+  }
+
+  _data_region_lockfree_exit(handle);
+  return DATA_REGION_SET_SUCCESS;
+}
+
+/* Internal function to find the node that may contain an index.
+ * @param handle - The calling thread's handle.
+ * @param index - The index.
+ * @returns - The last node (possibly the head node) whose 'first_index' is
+ *          less than or equal to 'index', as observed at some moment during
+ *          the call. */
+_DataRegionLockFreeNode* _data_region_lockfree_find_node(DataRegionLockFreeHandle* handle, int64_t index)
+{
+  DataRegion region = { index, index };
+  _DataRegionLockFreeNode* node = _data_region_lockfree_find_start(handle, region, _DATA_REGION_LOCKFREE_NOT_AFTER);
+  for(;;)
+  {
+    _DataRegionLockFreeNode* next = atomic_load(&node->next);
+    if(!_data_region_lockfree_passes(next, region, _DATA_REGION_LOCKFREE_NOT_AFTER))
+      return node;
+    node = next;
+  }
+}
+
+/* Checks whether a DataRegion is entirely present in a DataRegionLockFreeSet.
+ * @param handle - The calling thread's handle to the set. If this is NULL,
+ *        then false (0) will be returned.
+ * @param region - The DataRegion to look for. If this is invalid (see
+ *        data_region_is_valid), then false (0) will be returned.
+ * @returns - True (1) if all of 'region' is present, otherwise false (0).
+ * @remarks - This is linearizable: the result is correct at some moment
+ *          between the call and its return. To check a single index, pass a
+ *          DataRegion of length one. */
+int data_region_lockfree_set_contains(DataRegionLockFreeHandle* handle, DataRegion region)
+{
+  if(handle == NULL || !data_region_is_valid(region))
+    return 0;
+
+  _data_region_lockfree_enter(handle);
+  _DataRegionLockFreeNode* node = _data_region_lockfree_find_node(handle, region.first_index);
+  int contains = node->type == _DATA_REGION_LOCKFREE_REGULAR && data_region_contains(node->region, region);
+  _data_region_lockfree_exit(handle);
+  return contains;
+}
+
+/* Copies a subset of DataRegions in a DataRegionLockFreeSet to an array.
+ * @remarks - This function behaves like 'data_region_set_crop', but reads
+ *          from a DataRegionLockFreeSet through the calling thread's handle.
+ *          The DataRegions are read one at a time, so concurrent updates may
+ *          or may not be reflected in the result (though every yielded
+ *          DataRegion was present at some moment during the call).
+ * @see data_region_set_crop */
+int64_t data_region_lockfree_set_crop(DataRegion* dst, int64_t dstCapacity, DataRegionLockFreeHandle* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  int dstTooSmallPlaceholder;
+  if(dstTooSmall == NULL)
+    dstTooSmall = &dstTooSmallPlaceholder;
+  *dstTooSmall = 0;
+
+  if(src == NULL)
+    return 0;
+  if(!data_region_is_valid(boundaryRegion))
+    return 0;
+
+  if(dstCapacity < 0)
+  {
+    //Cannot have a negative destination capacity
+    *dstTooSmall = 1;
+    return 0;
+  }
+
+  _data_region_lockfree_enter(src);
+  int64_t count = 0;
+  _DataRegionLockFreeNode* node = _data_region_lockfree_find_node(src, boundaryRegion.first_index);
+  if(node->type != _DATA_REGION_LOCKFREE_REGULAR || node->region.last_index < boundaryRegion.first_index)
+    node = atomic_load(&node->next);
+
+  for(; node->type == _DATA_REGION_LOCKFREE_REGULAR && node->region.first_index <= boundaryRegion.last_index; node = atomic_load(&node->next))
+  {
+    if(dst != NULL)
+    {
+      if(count >= dstCapacity)
+      {
+        *dstTooSmall = 1;
+        break;
+      }
+
+      DataRegion current = node->region;
+      if(current.first_index < boundaryRegion.first_index)
+        current.first_index = boundaryRegion.first_index;
+      if(current.last_index > boundaryRegion.last_index)
+        current.last_index = boundaryRegion.last_index;
+      dst[count] = current;
+    }
+    count++;//When 'dst' is NULL, it indicates that we are only counting the DataRegions
+  }
+
+  _data_region_lockfree_exit(src);
+  return count;
+}
+
+/* Counts the number of DataRegions in a DataRegionLockFreeSet that are at
+ * least partially contained within a specific boundary region.
+ * @remarks - This function is equivalent to calling
+ *          'data_region_lockfree_set_crop' with a NULL 'dst' argument.
+ * @see data_region_set_count_crop */
+int64_t data_region_lockfree_set_count_crop(DataRegionLockFreeHandle* src, DataRegion boundaryRegion)
+{
+  return data_region_lockfree_set_crop(NULL/*NULL indicates that we only want to count the DataRegions*/, 0, src, boundaryRegion, NULL);
+}
+
+/* Copies a 'negative' of a subset of DataRegions within a
+ * DataRegionLockFreeSet.
+ * @remarks - This function behaves like 'data_region_set_negative_crop', but
+ *          reads from a DataRegionLockFreeSet through the calling thread's
+ *          handle. Like 'data_region_lockfree_set_crop', concurrent updates
+ *          may or may not be reflected in the result.
+ * @see data_region_set_negative_crop */
+int64_t data_region_lockfree_set_negative_crop(DataRegion* dst, int64_t dstCapacity, DataRegionLockFreeHandle* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  int dstTooSmallPlaceholder;
+  if (dstTooSmall == NULL)
+    dstTooSmall = &dstTooSmallPlaceholder;
+  *dstTooSmall = 0;
+
+  if(dst == NULL)
+    return 0;
+  if(src == NULL)
+    return 0;
+  if(!data_region_is_valid(boundaryRegion))
+    return 0;
+
+  if(dstCapacity < 1)
+  {
+    //Like 'data_region_set_negative_crop', at least one DataRegion is required
+    *dstTooSmall = 1;
+    return 0;
+  }
+
+  _data_region_lockfree_enter(src);
+  int64_t count = 0;
+  int64_t nextMissing = boundaryRegion.first_index;
+  int complete = 0;
+  _DataRegionLockFreeNode* node = _data_region_lockfree_find_node(src, boundaryRegion.first_index);
+  if(node->type != _DATA_REGION_LOCKFREE_REGULAR || node->region.last_index < boundaryRegion.first_index)
+    node = atomic_load(&node->next);
+
+  for(; node->type == _DATA_REGION_LOCKFREE_REGULAR && node->region.first_index <= boundaryRegion.last_index; node = atomic_load(&node->next))
+  {
+    DataRegion current = node->region;
+    if(current.first_index > nextMissing)
+    {
+      //Yield the gap before 'current'
+      if(count >= dstCapacity)
+      {
+        *dstTooSmall = 1;
+        count = 0;
+        complete = 1;
+        break;
+      }
+      dst[count++] = (DataRegion){ nextMissing, current.first_index - 1 };
+    }
+
+    if(current.last_index >= boundaryRegion.last_index)
+    {
+      complete = 1;//The remainder of the boundary region is present
+      break;
+    }
+    nextMissing = current.last_index + 1;
+  }
+
+  if(!complete)
+  {
+    //Yield the gap after the last present DataRegion
+    if(count >= dstCapacity)
+    {
+      *dstTooSmall = 1;
+      count = 0;
+    }
+    else
+    {
+      dst[count++] = (DataRegion){ nextMissing, boundaryRegion.last_index };
+    }
+  }
+
+  _data_region_lockfree_exit(src);
+  return count;
+}
+
+/* Gets the number of DataRegions that are stored in a DataRegionLockFreeSet.
+ * @param set - Pointer to the DataRegionLockFreeSet. If this is NULL, then
+ *        zero will be returned.
+ * @returns - The number of DataRegions. While updates are in progress, this
+ *          may lag behind the contents of the set. */
+int64_t data_region_lockfree_set_count(const DataRegionLockFreeSet* set)
+{
+  if(set == NULL)
+    return 0;
+  else
+    return atomic_load(&((DataRegionLockFreeSet*)set)->count);
+}
+
+/* Gets the length of the sum of all DataRegions stored in a
+ * DataRegionLockFreeSet.
+ * @param set - Pointer to the DataRegionLockFreeSet. If this is NULL, then
+ *        zero will be returned.
+ * @returns - The total length of all stored DataRegions. While updates are
+ *          in progress, this may lag behind the contents of the set. */
+int64_t data_region_lockfree_set_total_length(const DataRegionLockFreeSet* set)
+{
+  if(set == NULL)
+    return 0;
+  else
+    return atomic_load(&((DataRegionLockFreeSet*)set)->total_length);
+}
+
+#endif//DATA_REGION_LOCKFREE_H
@@ -0,0 +1,696 @@
+#ifndef DATA_REGION_LSM_H
+#define DATA_REGION_LSM_H
+#include "data_region.h"
+#include <pthread.h>
+
+/* Internal entry of the mutation log of a DataRegionLsmSet. */
+typedef struct _DataRegionLsmLogEntry
+{
+  DataRegion region;
+  int is_add;
+} _DataRegionLsmLogEntry;
+
+/* Internal immutable, sorted run of a DataRegionLsmSet. A run is the net
+ * effect of a sequence of adds and removes: applying it to a set of
+ * DataRegions 'S' yields '(S - removes) + adds'. Both arrays are
+ * normalized (sorted, with no combinable DataRegions) and never intersect
+ * each other. */
+typedef struct _DataRegionLsmRun
+{
+  int64_t add_count;
+  int64_t remove_count;
+  DataRegion* adds;
+  DataRegion* removes;
+
+  /* Storage for 'adds' followed by 'removes'. */
+  DataRegion regions[];
+} _DataRegionLsmRun;
+
+/* Log-structured DataRegionSet for write-heavy, read-rarely workloads.
+ * Adds and removes are appended to an unsorted mutation log in O(1) time.
+ * When the log is full, it is merged into an immutable sorted run, and
+ * when there are too many runs, they are compacted into the base
+ * DataRegionSet (optionally on a background thread). Queries merge the
+ * base, the runs and the log on the fly, within their boundary region.
+ * @see data_region_lsm_set_create
+ * @see data_region_lsm_set_add
+ * @see data_region_lsm_set_remove
+ * @see data_region_lsm_set_compact */
+typedef struct DataRegionLsmSet
+{
+  /* Protects all of the fields below. */
+  pthread_mutex_t lock;
+
+  /* Serializes compactions. Always acquired before 'lock'. */
+  pthread_mutex_t compact_lock;
+
+  /* The compacted DataRegions, which are only replaced by compactions. */
+  DataRegionSet* base;
+
+  /* The runs that are not yet compacted, from oldest to newest. */
+  _DataRegionLsmRun** runs;
+  int64_t run_count;
+  int64_t run_capacity;
+
+  /* The number of runs at which a compaction is started. */
+  int64_t max_run_count;
+
+  /* Whether the last compaction failed with DATA_REGION_SET_OUT_OF_SPACE,
+   * in which case adds are rejected, and compactions are only started
+   * again once a remove was logged. */
+  int over_capacity;
+
+  /* Whether a remove was logged since the last compaction started. */
+  int removed_since_compaction;
+
+  /* The mutations that are not yet merged into a run, in order. */
+  _DataRegionLsmLogEntry* log;
+  int64_t log_count;
+  int64_t log_capacity;
+
+  /* The background compaction thread, if there is one. */
+  int has_compactor;
+  pthread_t compactor;
+  pthread_cond_t compact_requested;
+  int compaction_pending;
+  int stopping;
+} DataRegionLsmSet;
+
+/* Internal function to find the DataRegions within a normalized array that
+ * intersect a boundary region.
+ * @param regions - The normalized DataRegion array.
+ * @param count - The number of DataRegions in 'regions'.
+ * @param boundaryRegion - The (valid) boundary region.
+ * @param start - Assigned to the position of the first DataRegion that
+ *        intersects 'boundaryRegion'.
+ * @returns - The number of consecutive DataRegions, starting at 'start',
+ *          that intersect 'boundaryRegion'. */
+int64_t _data_region_lsm_window(const DataRegion* regions, int64_t count, DataRegion boundaryRegion, int64_t* start)
+{
+  const DataRegionSet wrapper = { (DataRegion*)regions, count, count, 0 };
+  int64_t first = _data_region_set_lower_bound(&wrapper, boundaryRegion.first_index);
+  int64_t end = first;
+  while(end < count && regions[end].first_index <= boundaryRegion.last_index)
+    end++;
+
+  *start = first;
+  return end - first;
+}
+
+/* Internal function to allocate a run.
+ * @param addCapacity - The number of adds that the run can hold.
+ * @param removeCapacity - The number of removes that the run can hold.
+ * @returns - The empty run, or NULL if the allocation failed. */
+_DataRegionLsmRun* _data_region_lsm_run_create(int64_t addCapacity, int64_t removeCapacity)
+{
+  _DataRegionLsmRun* run = malloc(sizeof(_DataRegionLsmRun) + (sizeof(DataRegion) * (addCapacity + removeCapacity)));
+  if(run == NULL)
+    return NULL;
+
+  run->add_count = 0;
+  run->remove_count = 0;
+  run->adds = run->regions;
+  run->removes = run->regions + addCapacity;
+  return run;
+}
+
+/* Internal function to combine two consecutive runs into one.
+ * @param older - The run whose mutations happened first.
+ * @param newer - The run whose mutations happened afterwards.
+ * @returns - A new run with the same effect as applying 'older' and then
+ *          'newer', or NULL if an allocation failed.
+ * @remarks - The new run is 'adds = (older.adds - newer.removes) +
+ *          newer.adds' and 'removes = (older.removes - newer.adds) +
+ *          newer.removes', which takes O(n) time. */
+_DataRegionLsmRun* _data_region_lsm_run_compose(const _DataRegionLsmRun* older, const _DataRegionLsmRun* newer)
+{
+  int64_t addCapacity = older->add_count + newer->remove_count + newer->add_count;
+  int64_t removeCapacity = older->remove_count + newer->add_count + newer->remove_count;
+  _DataRegionLsmRun* run = _data_region_lsm_run_create(addCapacity, removeCapacity);
+  DataRegion* temp = malloc(sizeof(DataRegion) * (addCapacity > removeCapacity ? addCapacity : removeCapacity));
+  if(run == NULL || temp == NULL)
+  {
+    free(run);
+    free(temp);
+    return NULL;
+  }
+
+  int64_t tempCount = _data_region_array_difference(temp, older->adds, older->add_count, newer->removes, newer->remove_count);
+  run->add_count = _data_region_array_union(run->adds, temp, tempCount, newer->adds, newer->add_count);
+
+  tempCount = _data_region_array_difference(temp, older->removes, older->remove_count, newer->adds, newer->add_count);
+  run->remove_count = _data_region_array_union(run->removes, temp, tempCount, newer->removes, newer->remove_count);
+
+  free(temp);
+  return run;
+}
+
+/* Internal function to build a run from a sequence of log entries.
+ * @param entries - The log entries, in order.
+ * @param count - The number of log entries (at least one).
+ * @returns - The run, or NULL if an allocation failed.
+ * @remarks - Both halves of the log are built recursively and then
+ *          composed, which takes O(n log n) time. */
+_DataRegionLsmRun* _data_region_lsm_run_build(const _DataRegionLsmLogEntry* entries, int64_t count)
+{
+  if(count == 1)
+  {
+    _DataRegionLsmRun* run = _data_region_lsm_run_create(1, 1);
+    if(run == NULL)
+      return NULL;
+
+    if(entries->is_add)
+      run->adds[run->add_count++] = entries->region;
+    else
+      run->removes[run->remove_count++] = entries->region;
+    return run;
+  }
+
+  _DataRegionLsmRun* older = _data_region_lsm_run_build(entries, count / 2);
+  _DataRegionLsmRun* newer = _data_region_lsm_run_build(entries + (count / 2), count - (count / 2));
+  _DataRegionLsmRun* run = NULL;
+  if(older != NULL && newer != NULL)
+    run = _data_region_lsm_run_compose(older, newer);
+
+  free(older);
+  free(newer);
+  return run;
+}
+
+/* Internal function to apply a run to a normalized DataRegion array, within
+ * a boundary region.
+ * @param regions - The normalized DataRegion array, which receives the
+ *        result. It must be able to hold 'count' plus the number of adds
+ *        and removes of 'run' that intersect 'boundaryRegion'.
+ * @param temp - Scratch space of the same size as 'regions'.
+ * @param count - The number of DataRegions in 'regions'.
+ * @param run - The run to apply.
+ * @param boundaryRegion - Only the part of the result within this region is
+ *        exact (DataRegions outside of it are untouched).
+ * @returns - The number of DataRegions in 'regions'. */
+int64_t _data_region_lsm_run_apply(DataRegion* regions, DataRegion* temp, int64_t count, const _DataRegionLsmRun* run, DataRegion boundaryRegion)
+{
+  int64_t addStart, removeStart;
+  int64_t addCount = _data_region_lsm_window(run->adds, run->add_count, boundaryRegion, &addStart);
+  int64_t removeCount = _data_region_lsm_window(run->removes, run->remove_count, boundaryRegion, &removeStart);
+
+  int64_t tempCount = _data_region_array_difference(temp, regions, count, run->removes + removeStart, removeCount);
+  return _data_region_array_union(regions, temp, tempCount, run->adds + addStart, addCount);
+}
+
+/* Internal function to merge the mutation log into a new run.
+ * @param set - The DataRegionLsmSet (whose lock is held).
+ * @returns - DATA_REGION_SET_SUCCESS, or DATA_REGION_SET_ALLOCATION_FAILED
+ *          (in which case the log is unchanged). */
+DataRegionSetResult _data_region_lsm_set_flush_log(DataRegionLsmSet* set)
+{
+  if(set->log_count == 0)
+    return DATA_REGION_SET_SUCCESS;
+
+  if(set->run_count == set->run_capacity)
+  {
+    int64_t runCapacity = set->run_capacity * 2;
+    _DataRegionLsmRun** runs = realloc(set->runs, sizeof(_DataRegionLsmRun*) * runCapacity);
+    if(runs == NULL)
+      return DATA_REGION_SET_ALLOCATION_FAILED;
+
+    set->runs = runs;
+    set->run_capacity = runCapacity;
+  }
+
+  _DataRegionLsmRun* run = _data_region_lsm_run_build(set->log, set->log_count);
+  if(run == NULL)
+    return DATA_REGION_SET_ALLOCATION_FAILED;
+
+  set->runs[set->run_count++] = run;
+  set->log_count = 0;
+  return DATA_REGION_SET_SUCCESS;
+}
+
+/* Compacts all runs of a DataRegionLsmSet into its base DataRegionSet.
+ * @param set - Pointer to the DataRegionLsmSet. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @returns - DATA_REGION_SET_SUCCESS, DATA_REGION_SET_OUT_OF_SPACE if the
+ *          compacted DataRegions would exceed the capacity of the set, or
+ *          DATA_REGION_SET_ALLOCATION_FAILED. Upon failure, the runs are
+ *          kept, so queries still see every mutation. After
+ *          DATA_REGION_SET_OUT_OF_SPACE, adds are rejected until a
+ *          compaction succeeds.
+ * @remarks - The mutation log is merged into a run first, so a successful
+ *          compaction leaves every DataRegion in the base DataRegionSet.
+ *          The runs are merged without holding the lock of the set, so
+ *          adds, removes and queries can proceed during a compaction. */
+DataRegionSetResult data_region_lsm_set_compact(DataRegionLsmSet* set)
+{
+  if(set == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+
+  pthread_mutex_lock(&set->compact_lock);
+  pthread_mutex_lock(&set->lock);
+  DataRegionSetResult result = _data_region_lsm_set_flush_log(set);
+  set->removed_since_compaction = 0;
+
+  //The base and the runs are only replaced by compactions, so they can be read without the lock
+  DataRegionSet* base = set->base;
+  int64_t runCount = set->run_count;
+  int64_t scratchCapacity = base->count;
+  for(int64_t i = 0; i < runCount; i++)
+    scratchCapacity += set->runs[i]->add_count + set->runs[i]->remove_count;
+  _DataRegionLsmRun** runs = malloc(sizeof(_DataRegionLsmRun*) * (runCount + 1));
+  if(runs != NULL)
+    memcpy(runs, set->runs, sizeof(_DataRegionLsmRun*) * runCount);
+  pthread_mutex_unlock(&set->lock);
+
+  DataRegion* regions = malloc(sizeof(DataRegion) * (scratchCapacity + 1));
+  DataRegion* temp = malloc(sizeof(DataRegion) * (scratchCapacity + 1));
+  DataRegionSet* newBase = NULL;
+  if(runs == NULL || regions == NULL || temp == NULL)
+  {
+    result = DATA_REGION_SET_ALLOCATION_FAILED;
+  }
+  else if(runCount > 0)
+  {
+    DataRegion everything = { INT64_MIN, INT64_MAX };
+    int64_t count = base->count;
+    memcpy(regions, base->regions, sizeof(DataRegion) * count);
+    for(int64_t i = 0; i < runCount; i++)
+      count = _data_region_lsm_run_apply(regions, temp, count, runs[i], everything);
+
+    if(count > base->capacity)
+    {
+      result = DATA_REGION_SET_OUT_OF_SPACE;
+    }
+    else if((newBase = data_region_set_create(base->capacity)) == NULL)
+    {
+      result = DATA_REGION_SET_ALLOCATION_FAILED;
+    }
+    else
+    {
+      memcpy(newBase->regions, regions, sizeof(DataRegion) * count);
+      newBase->count = count;
+      for(int64_t i = 0; i < count; i++)
+        newBase->total_length += data_region_length(regions[i]);
+    }
+  }
+  free(regions);
+  free(temp);
+
+  pthread_mutex_lock(&set->lock);
+  if(result == DATA_REGION_SET_OUT_OF_SPACE)
+    set->over_capacity = 1;
+  else if(result == DATA_REGION_SET_SUCCESS)
+    set->over_capacity = 0;
+  if(newBase != NULL)
+  {
+    //Install the new base, and drop the runs that were compacted into it
+    set->base = newBase;
+    set->run_count -= runCount;
+    memmove(set->runs, set->runs + runCount, sizeof(_DataRegionLsmRun*) * set->run_count);
+  }
+  pthread_mutex_unlock(&set->lock);
+
+  if(newBase != NULL)
+  {
+
+    data_region_set_free(base);
+    for(int64_t i = 0; i < runCount; i++)
+      free(runs[i]);
+  }
+  free(runs);
+  pthread_mutex_unlock(&set->compact_lock);
+  return result;
+}
+
+/* Internal function that runs the background compaction thread.
+ * @param arg - The DataRegionLsmSet. */
+void* _data_region_lsm_set_compactor(void* arg)
+{
+  DataRegionLsmSet* set = arg;
+  pthread_mutex_lock(&set->lock);
+  while(!set->stopping)
+  {
+    if(!set->compaction_pending)
+    {
+      pthread_cond_wait(&set->compact_requested, &set->lock);
+      continue;
+    }
+
+    set->compaction_pending = 0;
+    pthread_mutex_unlock(&set->lock);
+    data_region_lsm_set_compact(set);
+    pthread_mutex_lock(&set->lock);
+  }
+  pthread_mutex_unlock(&set->lock);
+  return NULL;
+}
+
+/* Allocates a new, empty DataRegionLsmSet.
+ * @param regionCapacity - The maximum number of DataRegions that can be
+ *        stored in the base DataRegionSet. If this value is less than zero,
+ *        then NULL will be returned.
+ * @param logCapacity - The number of mutations that are logged before they
+ *        are merged into a run. If this value is less than one, then NULL
+ *        will be returned.
+ * @param maxRunCount - The number of runs at which they are compacted into
+ *        the base DataRegionSet. If this value is less than one, then NULL
+ *        will be returned.
+ * @param backgroundCompaction - If true (non-zero), then compactions are run
+ *        on a background thread, otherwise by the add or remove operation
+ *        that reaches 'maxRunCount'.
+ * @returns - A pointer to the allocated DataRegionLsmSet, or NULL upon
+ *          failure.
+ * @remarks - Larger logs and more runs make adds and removes cheaper, but
+ *          queries more expensive. Be sure to free the returned
+ *          DataRegionLsmSet by calling the 'data_region_lsm_set_free'
+ *          function.
+ * @see data_region_lsm_set_free */
+DataRegionLsmSet* data_region_lsm_set_create(int64_t regionCapacity, int64_t logCapacity, int64_t maxRunCount, int backgroundCompaction)
+{
+  if(regionCapacity < 0 || logCapacity < 1 || maxRunCount < 1)
+    return NULL;
+
+  DataRegionLsmSet* set = malloc(sizeof(DataRegionLsmSet));
+  if(set == NULL)
+    return NULL;
+
+  set->base = data_region_set_create(regionCapacity);
+  set->log = malloc(sizeof(_DataRegionLsmLogEntry) * logCapacity);
+  set->runs = malloc(sizeof(_DataRegionLsmRun*) * maxRunCount);
+  if(set->base == NULL || set->log == NULL || set->runs == NULL)
+  {
+    data_region_set_free(set->base);
+    free(set->log);
+    free(set->runs);
+    free(set);
+    return NULL;
+  }
+
+  pthread_mutex_init(&set->lock, NULL);
+  pthread_mutex_init(&set->compact_lock, NULL);
+  pthread_cond_init(&set->compact_requested, NULL);
+  set->run_count = 0;
+  set->run_capacity = maxRunCount;
+  set->max_run_count = maxRunCount;
+  set->over_capacity = 0;
+  set->removed_since_compaction = 0;
+  set->log_count = 0;
+  set->log_capacity = logCapacity;
+  set->compaction_pending = 0;
+  set->stopping = 0;
+  set->has_compactor = backgroundCompaction && pthread_create(&set->compactor, NULL, _data_region_lsm_set_compactor, set) == 0;
+  if(backgroundCompaction && !set->has_compactor)
+  {
+    pthread_cond_destroy(&set->compact_requested);
+    pthread_mutex_destroy(&set->compact_lock);
+    pthread_mutex_destroy(&set->lock);
+    data_region_set_free(set->base);
+    free(set->log);
+    free(set->runs);
+    free(set);
+    return NULL;
+  }
+  return set;
+}
+
+/* Frees a DataRegionLsmSet that was allocated by the
+ * 'data_region_lsm_set_create' function.
+ * @param set - Pointer to the DataRegionLsmSet. If this argument is NULL,
+ *        then nothing will happen.
+ * @remarks - The background compaction thread (if any) is stopped first. No
+ *          other thread may be using the set when it is freed. */
+void data_region_lsm_set_free(DataRegionLsmSet* set)
+{
+  if(set == NULL)
+    return;
+
+  if(set->has_compactor)
+  {
+    pthread_mutex_lock(&set->lock);
+    set->stopping = 1;
+    pthread_cond_signal(&set->compact_requested);
+    pthread_mutex_unlock(&set->lock);
+    pthread_join(set->compactor, NULL);
+  }
+
+  for(int64_t i = 0; i < set->run_count; i++)
+    free(set->runs[i]);
+  pthread_cond_destroy(&set->compact_requested);
+  pthread_mutex_destroy(&set->compact_lock);
+  pthread_mutex_destroy(&set->lock);
+  data_region_set_free(set->base);
+  free(set->log);
+  free(set->runs);
+  free(set);
+}
+
+/* Internal function to log a mutation.
+ * @param set - Pointer to the DataRegionLsmSet.
+ * @param region - The DataRegion to add or remove.
+ * @param isAdd - True (1) to add 'region', false (0) to remove it.
+ * @returns - The DataRegionSetResult that defines the result of the
+ *          operation. */
+DataRegionSetResult _data_region_lsm_set_log(DataRegionLsmSet* set, DataRegion region, int isAdd)
+{
+  if(set == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(region))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  int doCompact = 0;
+  pthread_mutex_lock(&set->lock);
+  if(isAdd && set->over_capacity)
+  {
+    pthread_mutex_unlock(&set->lock);
+    return DATA_REGION_SET_OUT_OF_SPACE;
+  }
+
+  if(set->log_count == set->log_capacity)
+  {
+    if(_data_region_lsm_set_flush_log(set) != DATA_REGION_SET_SUCCESS)
+    {
+      pthread_mutex_unlock(&set->lock);
+      return DATA_REGION_SET_ALLOCATION_FAILED;
+    }
+
+    //Compacting the same runs again would fail again, until a remove frees space
+    if(set->run_count >= set->max_run_count && (!set->over_capacity || set->removed_since_compaction))
+    {
+      if(set->has_compactor)
+      {
+        set->compaction_pending = 1;
+        pthread_cond_signal(&set->compact_requested);
+      }
+      else
+      {
+        doCompact = 1;
+      }
+    }
+  }
+
+  _DataRegionLsmLogEntry entry = { region, isAdd };
+  set->log[set->log_count++] = entry;
+  if(!isAdd)
+    set->removed_since_compaction = 1;
+  pthread_mutex_unlock(&set->lock);
+
+  if(doCompact)
+    data_region_lsm_set_compact(set);
+  return DATA_REGION_SET_SUCCESS;
+}
+
+/* Adds a DataRegion to a DataRegionLsmSet.
+ * @param set - Pointer to the DataRegionLsmSet. If this argument is NULL,
+ *        then DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toAdd - The DataRegion to add. If this is invalid (see
+ *        data_region_is_valid), then DATA_REGION_SET_INVALID_REGION will
+ *        be returned.
+ * @returns - DATA_REGION_SET_SUCCESS, DATA_REGION_SET_OUT_OF_SPACE if the
+ *          last compaction found the set over its capacity, or
+ *          DATA_REGION_SET_ALLOCATION_FAILED if the full mutation log
+ *          couldn't be merged into a run.
+ * @remarks - The add is only logged, which takes amortized O(log n) time
+ *          for merging the log into runs. The capacity of the set is only
+ *          enforced when the runs are compacted (see
+ *          'data_region_lsm_set_compact'): the adds that were logged before
+ *          then are kept, and the later ones fail until removes make the
+ *          set fit again. */
+DataRegionSetResult data_region_lsm_set_add(DataRegionLsmSet* set, DataRegion toAdd)
+{
+  return _data_region_lsm_set_log(set, toAdd, 1);
+}
+
+/* Removes a DataRegion from a DataRegionLsmSet.
+ * @param set - Pointer to the DataRegionLsmSet. If this argument is NULL,
+ *        then DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toRemove - The DataRegion to remove. If this is invalid (see
+ *        data_region_is_valid), then DATA_REGION_SET_INVALID_REGION will
+ *        be returned.
+ * @returns - DATA_REGION_SET_SUCCESS, or DATA_REGION_SET_ALLOCATION_FAILED
+ *          if the full mutation log couldn't be merged into a run.
+ * @remarks - Like 'data_region_lsm_set_add', the removal is only logged.
+ *          If the set is over its capacity, then the next flush of the log
+ *          compacts the runs again. */
+DataRegionSetResult data_region_lsm_set_remove(DataRegionLsmSet* set, DataRegion toRemove)
+{
+  return _data_region_lsm_set_log(set, toRemove, 0);
+}
+
+/* Internal function to merge the base, the runs and the log of a
+ * DataRegionLsmSet within a boundary region.
+ * @param set - Pointer to the DataRegionLsmSet.
+ * @param boundaryRegion - The (valid) boundary region.
+ * @returns - A DataRegionSet whose DataRegions within 'boundaryRegion' are
+ *          those of 'set', or NULL if an allocation failed. Free it via
+ *          'data_region_set_free'. */
+DataRegionSet* _data_region_lsm_set_view(DataRegionLsmSet* set, DataRegion boundaryRegion)
+{
+  pthread_mutex_lock(&set->lock);
+  int64_t baseStart;
+  int64_t baseCount = _data_region_lsm_window(set->base->regions, set->base->count, boundaryRegion, &baseStart);
+  int64_t capacity = baseCount + set->log_count + 1;
+  for(int64_t i = 0; i < set->run_count; i++)
+  {
+    int64_t start;
+    capacity += _data_region_lsm_window(set->runs[i]->adds, set->runs[i]->add_count, boundaryRegion, &start);
+    capacity += _data_region_lsm_window(set->runs[i]->removes, set->runs[i]->remove_count, boundaryRegion, &start);
+  }
+
+  DataRegionSet* view = data_region_set_create(capacity);
+  DataRegion* temp = malloc(sizeof(DataRegion) * capacity);
+  if(view == NULL || temp == NULL)
+  {
+    pthread_mutex_unlock(&set->lock);
+    data_region_set_free(view);
+    free(temp);
+    return NULL;
+  }
+
+  int64_t count = baseCount;
+  memcpy(view->regions, set->base->regions + baseStart, sizeof(DataRegion) * count);
+  for(int64_t i = 0; i < set->run_count; i++)
+    count = _data_region_lsm_run_apply(view->regions, temp, count, set->runs[i], boundaryRegion);
+
+  view->count = count;
+  for(int64_t i = 0; i < count; i++)
+    view->total_length += data_region_length(view->regions[i]);
+
+  //Each logged mutation adds at most one DataRegion, for which 'capacity' has room
+  for(int64_t i = 0; i < set->log_count; i++)
+  {
+    if(!data_region_intersects(set->log[i].region, boundaryRegion))
+      continue;
+
+    if(set->log[i].is_add)
+      _data_region_set_add_delta(view, set->log[i].region, NULL, NULL, NULL);
+    else
+      _data_region_set_remove_delta(view, set->log[i].region, NULL, NULL, NULL);
+  }
+  pthread_mutex_unlock(&set->lock);
+
+  free(temp);
+  return view;
+}
+
+/* Copies a subset of DataRegions in a DataRegionLsmSet to an array.
+ * @remarks - This function behaves like 'data_region_set_crop', merging the
+ *          base, the runs and the log within the boundary region. If memory
+ *          for the merge cannot be allocated, then zero is returned and
+ *          'dstTooSmall' is set.
+ * @see data_region_set_crop */
+int64_t data_region_lsm_set_crop(DataRegion* dst, int64_t dstCapacity, DataRegionLsmSet* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  if(src == NULL || !data_region_is_valid(boundaryRegion))
+    return _data_region_set_crop(dst, dstCapacity, NULL, boundaryRegion, dstTooSmall);
+
+  DataRegionSet* view = _data_region_lsm_set_view(src, boundaryRegion);
+  if(view == NULL)
+  {
+    if(dstTooSmall != NULL)
+      *dstTooSmall = 1;
+    return 0;
+  }
+
+  int64_t count = _data_region_set_crop(dst, dstCapacity, view, boundaryRegion, dstTooSmall);
+  data_region_set_free(view);
+  return count;
+}
+
+/* Counts the number of DataRegions in a DataRegionLsmSet that are at least
+ * partially contained within a specific boundary region.
+ * @see data_region_set_count_crop */
+int64_t data_region_lsm_set_count_crop(DataRegionLsmSet* src, DataRegion boundaryRegion)
+{
+  return data_region_lsm_set_crop(NULL/*NULL indicates that we only want to count the DataRegions*/, 0, src, boundaryRegion, NULL);
+}
+
+/* Copies a 'negative' of a subset of DataRegions within a DataRegionLsmSet.
+ * @remarks - This function behaves like 'data_region_set_negative_crop',
+ *          merging the base, the runs and the log within the boundary
+ *          region. If memory for the merge cannot be allocated, then zero
+ *          is returned and 'dstTooSmall' is set.
+ * @see data_region_set_negative_crop */
+int64_t data_region_lsm_set_negative_crop(DataRegion* dst, int64_t dstCapacity, DataRegionLsmSet* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  if(dst == NULL || src == NULL || !data_region_is_valid(boundaryRegion))
+    return _data_region_set_negative_crop(dst, dstCapacity, NULL, boundaryRegion, dstTooSmall);
+
+  DataRegionSet* view = _data_region_lsm_set_view(src, boundaryRegion);
+  if(view == NULL)
+  {
+    if(dstTooSmall != NULL)
+      *dstTooSmall = 1;
+    return 0;
+  }
+
+  int64_t count = _data_region_set_negative_crop(dst, dstCapacity, view, boundaryRegion, dstTooSmall);
+  data_region_set_free(view);
+  return count;
+}
+
+/* Checks whether a DataRegionLsmSet contains every index of a DataRegion.
+ * @param set - Pointer to the DataRegionLsmSet. If this is NULL, then false
+ *        (0) will be returned.
+ * @param region - The DataRegion to check. If this is invalid (see
+ *        data_region_is_valid), then false (0) will be returned.
+ * @returns - True (1) if every index of 'region' is in the set, otherwise
+ *          false (0). */
+int data_region_lsm_set_contains(DataRegionLsmSet* set, DataRegion region)
+{
+  DataRegion present[1];
+  int tooSmall = 0;
+  if(data_region_lsm_set_crop(present, 1, set, region, &tooSmall) != 1 || tooSmall)
+    return 0;
+
+  return present[0].first_index == region.first_index && present[0].last_index == region.last_index;
+}
+
+/* Gets the number of DataRegions that are stored in a DataRegionLsmSet.
+ * @param set - Pointer to the DataRegionLsmSet. If this is NULL, then zero
+ *        will be returned.
+ * @returns - The number of DataRegions.
+ * @remarks - This merges every level of the set, which takes O(n) time. */
+int64_t data_region_lsm_set_count(DataRegionLsmSet* set)
+{
+  DataRegion everything = { INT64_MIN, INT64_MAX };
+  return data_region_lsm_set_count_crop(set, everything);
+}
+
+/* Gets the length of the sum of all DataRegions stored in a
+ * DataRegionLsmSet.
+ * @param set - Pointer to the DataRegionLsmSet. If this is NULL, then zero
+ *        will be returned.
+ * @returns - The total length of the DataRegions.
+ * @remarks - This merges every level of the set, which takes O(n) time. */
+int64_t data_region_lsm_set_total_length(DataRegionLsmSet* set)
+{
+  if(set == NULL)
+    return 0;
+
+  DataRegion everything = { INT64_MIN, INT64_MAX };
+  DataRegionSet* view = _data_region_lsm_set_view(set, everything);
+  int64_t totalLength = data_region_set_total_length(view);
+  data_region_set_free(view);
+  return totalLength;
+}
+
+#endif//DATA_REGION_LSM_H
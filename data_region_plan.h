@@ -0,0 +1,262 @@
+#ifndef DATA_REGION_PLAN_H
+#define DATA_REGION_PLAN_H
+#include "data_region.h"
+
+/* Cost model of a fetch plan. The cost of one fetch is
+ * 'request_overhead_bytes' plus the number of bytes it reads.
+ * @see data_region_plan_fetches */
+typedef struct DataRegionPlanCostModel
+{
+  /* The fixed cost of issuing one fetch, expressed in bytes (for example,
+   * the latency of a request times the throughput of the source). */
+  int64_t request_overhead_bytes;
+
+  /* The maximum number of present bytes that a fetch re-reads in order to
+   * bridge two missing byte ranges. */
+  int64_t max_gap_bytes;
+
+  /* The maximum number of bytes of one fetch, or zero for no limit. */
+  int64_t max_io_bytes;
+
+  /* The alignment of the offset and length of each fetch (for example, the
+   * block size for O_DIRECT), or one for no alignment. */
+  int64_t alignment;
+} DataRegionPlanCostModel;
+
+/* One read of a fetch plan, which maps directly onto an iovec-based read
+ * (such as preadv) or an io_uring read. */
+typedef struct DataRegionFetch
+{
+  int64_t offset;
+  int64_t length;
+} DataRegionFetch;
+
+/* Internal function to round an index down to a multiple of an
+ * alignment. */
+int64_t _data_region_plan_align_down(int64_t index, int64_t alignment)
+{
+  int64_t remainder = index % alignment;
+  if(remainder < 0)
+    remainder += alignment;
+  return index - remainder;
+}
+
+/* Internal function to widen a DataRegion to whole multiples of an
+ * alignment. */
+DataRegion _data_region_plan_align(DataRegion region, int64_t alignment)
+{
+  if(alignment <= 1)
+    return region;
+
+  DataRegion aligned;
+  aligned.first_index = _data_region_plan_align_down(region.first_index, alignment);
+  int64_t lastBlock = _data_region_plan_align_down(region.last_index, alignment);
+  aligned.last_index = lastBlock > INT64_MAX - (alignment - 1) ? INT64_MAX : lastBlock + (alignment - 1);
+  return aligned;
+}
+
+/* Internal function to get the number of fetches that a single missing
+ * byte range is split into.
+ * @param length - The length of the byte range.
+ * @param maxIoBytes - The maximum number of bytes per fetch, or zero.
+ * @returns - The number of fetches. */
+int64_t _data_region_plan_chunk_count(int64_t length, int64_t maxIoBytes)
+{
+  if(maxIoBytes <= 0 || length <= maxIoBytes)
+    return 1;
+  return (length / maxIoBytes) + (length % maxIoBytes != 0);
+}
+
+/* Internal function to append the fetches for a byte range to a plan,
+ * splitting it into fetches of at most 'maxIoBytes'.
+ * @returns - False (0) if 'dst' was too small, otherwise true (1). */
+int _data_region_plan_emit(DataRegionFetch* dst, int64_t dstCapacity, int64_t* count, DataRegion region, int64_t maxIoBytes)
+{
+  int64_t offset = region.first_index;
+  int64_t remaining = data_region_length(region);
+  while(remaining > 0)
+  {
+    int64_t length = maxIoBytes > 0 && remaining > maxIoBytes ? maxIoBytes : remaining;
+    if(dst != NULL)
+    {
+      if(*count >= dstCapacity)
+        return 0;
+      dst[*count].offset = offset;
+      dst[*count].length = length;
+    }
+    (*count)++;
+    offset += length;
+    remaining -= length;
+  }
+  return 1;
+}
+
+/* Plans the fetches which read the missing bytes of a request region. This
+ * is like 'data_region_set_negative_crop', except that nearby missing byte
+ * ranges are fetched together when re-reading the present bytes between
+ * them is cheaper than issuing another fetch.
+ * @param dst - The destination array of fetches, ordered by offset. This
+ *        may be NULL if you want to only count the fetches.
+ * @param dstCapacity - The maximum number of fetches that can be stored in
+ *        the 'dst' array. If this is less than zero, then zero is returned.
+ * @param present - The DataRegionSet of present bytes. If this is NULL,
+ *        then zero will be returned.
+ * @param request - The requested byte range. If this is invalid (see
+ *        data_region_is_valid), then zero will be returned.
+ * @param model - The cost model. If this is NULL, then zero will be
+ *        returned.
+ * @param dstTooSmall - Optional pointer to an integer that will be assigned
+ *        to true (1) if the destination buffer was too small to contain the
+ *        plan (or if memory for planning could not be allocated), otherwise
+ *        false (0).
+ * @returns - The number of fetches in the plan, limited to 'dstCapacity' if
+ *          'dst' was non-NULL.
+ * @remarks - The plan minimizes the total cost (see
+ *          DataRegionPlanCostModel) over all plans in which each fetch
+ *          covers whole aligned missing byte ranges, bridges only gaps of
+ *          at most 'max_gap_bytes', and reads at most 'max_io_bytes' (a
+ *          single missing byte range that is longer is split). Aligned
+ *          fetches may extend beyond 'request'. Without an I/O size limit
+ *          this takes O(n) time, otherwise O(n * k) time, where 'k' is the
+ *          number of missing byte ranges within 'max_io_bytes'. */
+int64_t data_region_plan_fetches(DataRegionFetch* dst, int64_t dstCapacity, const DataRegionSet* present, DataRegion request, const DataRegionPlanCostModel* model, int* dstTooSmall)
+{
+  int dstTooSmallPlaceholder;
+  if(dstTooSmall == NULL)
+    dstTooSmall = &dstTooSmallPlaceholder;
+  *dstTooSmall = 0;
+
+  if(present == NULL || model == NULL)
+    return 0;
+  if(!data_region_is_valid(request))
+    return 0;
+
+  if(dstCapacity < 0)
+  {
+    *dstTooSmall = 1;
+    return 0;
+  }
+
+  int64_t alignment = model->alignment > 1 ? model->alignment : 1;
+  int64_t maxIoBytes = model->max_io_bytes > 0 ? model->max_io_bytes : 0;
+  if(maxIoBytes > 0)
+  {
+    //Fetches that are split must stay aligned
+    maxIoBytes = maxIoBytes < alignment ? alignment : _data_region_plan_align_down(maxIoBytes, alignment);
+  }
+
+  //Find the missing byte ranges, aligned, and combined wherever alignment made them meet
+  int64_t gapCapacity = data_region_set_count_crop(present, request) + 1;
+  DataRegion* gaps = malloc(sizeof(DataRegion) * gapCapacity);
+  if(gaps == NULL)
+  {
+    *dstTooSmall = 1;
+    return 0;
+  }
+
+  int64_t gapCount = data_region_set_negative_crop(gaps, gapCapacity, present, request, NULL);
+  int64_t alignedCount = 0;
+  for(int64_t i = 0; i < gapCount; i++)
+  {
+    DataRegion aligned = _data_region_plan_align(gaps[i], alignment);
+    if(alignedCount > 0 && data_region_can_combine(gaps[alignedCount - 1], aligned))
+      gaps[alignedCount - 1] = data_region_combine(gaps[alignedCount - 1], aligned);
+    else
+      gaps[alignedCount++] = aligned;
+  }
+  gapCount = alignedCount;
+  if(gapCount == 0)
+  {
+    free(gaps);
+    return 0;
+  }
+
+  int64_t count = 0;
+  if(maxIoBytes == 0)
+  {
+    //Without an I/O size limit, bridging each gap is an independent decision
+    DataRegion current = gaps[0];
+    for(int64_t i = 1; i <= gapCount; i++)
+    {
+      if(i < gapCount)
+      {
+        int64_t gapBytes = gaps[i].first_index - current.last_index - 1;
+        if(gapBytes <= model->max_gap_bytes && gapBytes <= model->request_overhead_bytes)
+        {
+          current.last_index = gaps[i].last_index;
+          continue;
+        }
+      }
+
+      if(!_data_region_plan_emit(dst, dstCapacity, &count, current, 0))
+      {
+        *dstTooSmall = 1;
+        break;
+      }
+      if(i < gapCount)
+        current = gaps[i];
+    }
+    free(gaps);
+    return count;
+  }
+
+  //'cost[i]' is the minimum cost of fetching the first 'i' missing byte ranges, whose last fetch starts at 'start[i]'
+  int64_t* cost = malloc(sizeof(int64_t) * (gapCount + 1));
+  int64_t* start = malloc(sizeof(int64_t) * (gapCount + 1));
+  if(cost == NULL || start == NULL)
+  {
+    free(gaps);
+    free(cost);
+    free(start);
+    *dstTooSmall = 1;
+    return 0;
+  }
+
+  cost[0] = 0;
+  for(int64_t i = 1; i <= gapCount; i++)
+  {
+    DataRegion last = gaps[i - 1];
+    int64_t lastLength = data_region_length(last);
+    cost[i] = cost[i - 1] + (_data_region_plan_chunk_count(lastLength, maxIoBytes) * model->request_overhead_bytes) + lastLength;
+    start[i] = i - 1;
+
+    for(int64_t j = i - 2; j >= 0; j--)
+    {
+      int64_t gapBytes = gaps[j + 1].first_index - gaps[j].last_index - 1;
+      int64_t span = last.last_index - gaps[j].first_index + 1;
+      if(gapBytes > model->max_gap_bytes || span > maxIoBytes)
+        break;
+
+      //Prefer fewer fetches when the cost is equal
+      int64_t candidate = cost[j] + model->request_overhead_bytes + span;
+      if(candidate <= cost[i])
+      {
+        cost[i] = candidate;
+        start[i] = j;
+      }
+    }
+  }
+
+  //Walk the chosen fetches back to front, then emit them in order
+  int64_t fetchCount = 0;
+  for(int64_t i = gapCount; i > 0; i = start[i])
+    cost[fetchCount++] = i;
+
+  for(int64_t k = fetchCount - 1; k >= 0; k--)
+  {
+    int64_t i = cost[k];
+    DataRegion fetch = { gaps[start[i]].first_index, gaps[i - 1].last_index };
+    if(!_data_region_plan_emit(dst, dstCapacity, &count, fetch, maxIoBytes))
+    {
+      *dstTooSmall = 1;
+      break;
+    }
+  }
+
+  free(gaps);
+  free(cost);
+  free(start);
+  return count;
+}
+
+#endif//DATA_REGION_PLAN_H
@@ -0,0 +1,485 @@
+#ifndef DATA_REGION_READAHEAD_H
+#define DATA_REGION_READAHEAD_H
+#include "data_region.h"
+#include "data_region_cache.h"
+#include <pthread.h>
+
+/* The access pattern of a readahead stream. */
+typedef enum DataRegionAccessPattern
+{
+  /* No pattern was detected, so nothing is prefetched. */
+  DATA_REGION_ACCESS_RANDOM = 0,
+
+  /* Each request starts right after the previous one. */
+  DATA_REGION_ACCESS_SEQUENTIAL = 1,
+
+  /* The requests start a constant distance (the stride) apart. */
+  DATA_REGION_ACCESS_STRIDED = 2
+} DataRegionAccessPattern;
+
+/* Options of a DataRegionReadahead. */
+typedef struct DataRegionReadaheadOptions
+{
+  /* The number of streams that are tracked at once. When a new stream is
+   * observed, the least recently used one is forgotten. */
+  int64_t stream_capacity;
+
+  /* The initial and minimum number of bytes predicted ahead of a request. */
+  int64_t min_window_bytes;
+
+  /* The maximum number of bytes predicted ahead of a request. */
+  int64_t max_window_bytes;
+
+  /* The maximum number of requests predicted ahead of a strided request. */
+  int64_t max_stride_count;
+} DataRegionReadaheadOptions;
+
+/* Information about one stream of a DataRegionReadahead.
+ * @see data_region_readahead_get_info */
+typedef struct DataRegionReadaheadInfo
+{
+  DataRegionAccessPattern pattern;
+
+  /* The distance between the starts of the last two requests. */
+  int64_t stride;
+
+  /* The number of bytes currently predicted ahead of a request. */
+  int64_t window_bytes;
+
+  /* The number of prefetched bytes that were requested afterwards, and
+   * the number that were skipped over (or abandoned when the pattern
+   * broke). */
+  int64_t used_bytes;
+  int64_t wasted_bytes;
+} DataRegionReadaheadInfo;
+
+/* Internal state of one stream of a DataRegionReadahead. */
+typedef struct _DataRegionReadaheadStream
+{
+  int64_t id;
+  int in_use;
+  uint64_t last_use;
+
+  /* The previous request. */
+  DataRegion last;
+
+  DataRegionReadaheadInfo info;
+
+  /* The used and wasted bytes since the window was last resized. */
+  int64_t epoch_used_bytes;
+  int64_t epoch_wasted_bytes;
+
+  /* The prefetched byte ranges that weren't requested yet. */
+  DataRegionSet* pending;
+} _DataRegionReadaheadStream;
+
+/* Sequential-access detector which predicts the byte ranges that each
+ * stream (for example, a client or an open file) will request next, so
+ * that the missing ones can be prefetched before they are requested. The
+ * prediction window of a stream grows while its prefetched bytes are used,
+ * and shrinks while they are wasted.
+ * @see data_region_readahead_create
+ * @see data_region_readahead_observe */
+typedef struct DataRegionReadahead
+{
+  /* Protects the streams. */
+  pthread_mutex_t lock;
+
+  DataRegionReadaheadOptions options;
+  _DataRegionReadaheadStream* streams;
+  uint64_t clock;
+} DataRegionReadahead;
+
+/* Gets the default options of a DataRegionReadahead: 64 streams, a window
+ * of 128 KiB to 4 MiB, and up to 64 strided requests ahead. */
+DataRegionReadaheadOptions data_region_readahead_default_options(void)
+{
+  DataRegionReadaheadOptions options;
+  options.stream_capacity = 64;
+  options.min_window_bytes = 128 * 1024;
+  options.max_window_bytes = 4 * 1024 * 1024;
+  options.max_stride_count = 64;
+  return options;
+}
+
+/* Allocates a new DataRegionReadahead without any streams.
+ * @param options - The options. If this is NULL, then the default options
+ *        (see data_region_readahead_default_options) are used. If any count
+ *        is less than one, or 'max_window_bytes' is less than
+ *        'min_window_bytes', then NULL will be returned.
+ * @returns - A pointer to the allocated DataRegionReadahead, or NULL upon
+ *          failure.
+ * @remarks - Be sure to free the returned DataRegionReadahead by calling the
+ *          'data_region_readahead_free' function.
+ * @see data_region_readahead_free */
+DataRegionReadahead* data_region_readahead_create(const DataRegionReadaheadOptions* options)
+{
+  DataRegionReadaheadOptions readaheadOptions = data_region_readahead_default_options();
+  if(options != NULL)
+    readaheadOptions = *options;
+  if(readaheadOptions.stream_capacity < 1 || readaheadOptions.min_window_bytes < 1 || readaheadOptions.max_stride_count < 1)
+    return NULL;
+  if(readaheadOptions.max_window_bytes < readaheadOptions.min_window_bytes)
+    return NULL;
+
+  DataRegionReadahead* readahead = malloc(sizeof(DataRegionReadahead));
+  if(readahead == NULL)
+    return NULL;
+
+  readahead->streams = calloc((size_t)readaheadOptions.stream_capacity, sizeof(_DataRegionReadaheadStream));
+  if(readahead->streams == NULL)
+  {
+    free(readahead);
+    return NULL;
+  }
+
+  //Each prediction adds at most 'max_stride_count' byte ranges to 'pending'
+  for(int64_t i = 0; i < readaheadOptions.stream_capacity; i++)
+  {
+    readahead->streams[i].pending = data_region_set_create(readaheadOptions.max_stride_count * 2);
+    if(readahead->streams[i].pending == NULL)
+    {
+      for(int64_t j = 0; j < i; j++)
+        data_region_set_free(readahead->streams[j].pending);
+      free(readahead->streams);
+      free(readahead);
+      return NULL;
+    }
+  }
+
+  pthread_mutex_init(&readahead->lock, NULL);
+  readahead->options = readaheadOptions;
+  readahead->clock = 0;
+  return readahead;
+}
+
+/* Frees a DataRegionReadahead that was allocated by the
+ * 'data_region_readahead_create' function.
+ * @param readahead - Pointer to the DataRegionReadahead. If this argument
+ *        is NULL, then nothing will happen. */
+void data_region_readahead_free(DataRegionReadahead* readahead)
+{
+  if(readahead == NULL)
+    return;
+
+  for(int64_t i = 0; i < readahead->options.stream_capacity; i++)
+    data_region_set_free(readahead->streams[i].pending);
+  pthread_mutex_destroy(&readahead->lock);
+  free(readahead->streams);
+  free(readahead);
+}
+
+/* Internal function to find a stream, or to replace the least recently
+ * used one if it isn't tracked.
+ * @param isNew - Receives true (1) if the stream was replaced, otherwise
+ *        false (0). */
+_DataRegionReadaheadStream* _data_region_readahead_find(DataRegionReadahead* readahead, int64_t streamId, int* isNew)
+{
+  _DataRegionReadaheadStream* oldest = &readahead->streams[0];
+  for(int64_t i = 0; i < readahead->options.stream_capacity; i++)
+  {
+    _DataRegionReadaheadStream* stream = &readahead->streams[i];
+    if(stream->in_use && stream->id == streamId)
+    {
+      *isNew = 0;
+      return stream;
+    }
+    if(!stream->in_use || (oldest->in_use && stream->last_use < oldest->last_use))
+      oldest = stream;
+  }
+
+  *isNew = 1;
+  oldest->id = streamId;
+  oldest->in_use = 1;
+  oldest->info = (DataRegionReadaheadInfo){ DATA_REGION_ACCESS_RANDOM, 0, readahead->options.min_window_bytes, 0, 0 };
+  oldest->epoch_used_bytes = 0;
+  oldest->epoch_wasted_bytes = 0;
+  data_region_set_clear(oldest->pending);
+  return oldest;
+}
+
+/* Internal function to take the pending bytes of a stream that are within
+ * a byte range.
+ * @returns - The number of bytes that were taken. */
+int64_t _data_region_readahead_take(_DataRegionReadaheadStream* stream, DataRegion region)
+{
+  int64_t count = 0;
+  for(int64_t i = _data_region_set_lower_bound(stream->pending, region.first_index); i < stream->pending->count; i++)
+  {
+    DataRegion pending = stream->pending->regions[i];
+    if(pending.first_index > region.last_index)
+      break;
+
+    DataRegion overlap = { pending.first_index > region.first_index ? pending.first_index : region.first_index,
+                           pending.last_index < region.last_index ? pending.last_index : region.last_index };
+    count += data_region_length(overlap);
+  }
+
+  //Removing a byte range can split a pending one, so forget them all if it doesn't fit
+  if(count > 0 && data_region_set_remove(stream->pending, region) != DATA_REGION_SET_SUCCESS)
+    data_region_set_clear(stream->pending);
+  return count;
+}
+
+/* Internal function to emit the bytes of a predicted byte range that are
+ * neither present nor already pending.
+ * @returns - One upon success, zero if 'dst' was too small (or memory could
+ *          not be allocated), or -1 if the stream can't remember any more
+ *          pending byte ranges. */
+int _data_region_readahead_emit(DataRegion* dst, int64_t dstCapacity, int64_t* count, _DataRegionReadaheadStream* stream, const DataRegionSet* present, DataRegion predicted)
+{
+  int64_t gapCapacity = data_region_set_count_crop(present, predicted) + 1;
+  DataRegion* gaps = malloc(sizeof(DataRegion) * gapCapacity);
+  if(gaps == NULL)
+    return 0;
+  int64_t gapCount = data_region_set_negative_crop(gaps, gapCapacity, present, predicted, NULL);
+
+  int result = 1;
+  for(int64_t i = 0; i < gapCount && result == 1; i++)
+  {
+    int64_t missingCapacity = data_region_set_count_crop(stream->pending, gaps[i]) + 1;
+    DataRegion* missing = malloc(sizeof(DataRegion) * missingCapacity);
+    if(missing == NULL)
+    {
+      result = 0;
+      break;
+    }
+
+    int64_t missingCount = data_region_set_negative_crop(missing, missingCapacity, stream->pending, gaps[i], NULL);
+    for(int64_t j = 0; j < missingCount; j++)
+    {
+      if(*count >= dstCapacity)
+      {
+        result = 0;
+        break;
+      }
+
+      //A prefetch that isn't remembered would be returned again, so stop predicting instead
+      if(data_region_set_add(stream->pending, missing[j]) != DATA_REGION_SET_SUCCESS)
+      {
+        result = -1;
+        break;
+      }
+      dst[(*count)++] = missing[j];
+    }
+    free(missing);
+  }
+
+  free(gaps);
+  return result;
+}
+
+/* Observes a request of a stream, and gets the byte ranges to prefetch.
+ * @param dst - The destination array of byte ranges to prefetch, in the
+ *        order in which they are expected to be requested. If this is NULL,
+ *        then zero will be returned.
+ * @param dstCapacity - The maximum number of byte ranges that can be stored
+ *        in the 'dst' array.
+ * @param readahead - The DataRegionReadahead. If this is NULL, then zero
+ *        will be returned.
+ * @param streamId - Identifies the stream that made the request.
+ * @param request - The requested byte range. If this is invalid (see
+ *        data_region_is_valid), then zero will be returned.
+ * @param present - The DataRegionSet of bytes which are present (or are
+ *        being fetched), which are not prefetched. If this is NULL, then
+ *        zero will be returned.
+ * @param dstTooSmall - Optional pointer to an integer that will be assigned
+ *        to true (1) if the destination buffer was too small to contain all
+ *        byte ranges to prefetch (or if memory could not be allocated),
+ *        otherwise false (0).
+ * @returns - The number of byte ranges to prefetch.
+ * @remarks - A stream is sequential once a request starts right after the
+ *          previous one, and strided once two consecutive requests start
+ *          the same distance apart. Then the window ahead of the request is
+ *          predicted (for a strided stream, the next requests of the same
+ *          length), and its missing bytes are returned. Each returned byte
+ *          range is remembered as prefetched, so it is not returned again.
+ *          Prefetched bytes are wasted once the stream passes them without
+ *          requesting them (for a backward stream, once it is below them).
+ *          Every time the window's worth of prefetched bytes is used or
+ *          wasted, the window is doubled if at least 3/4 of them were used,
+ *          or halved if less than half of them were. A stream remembers at
+ *          most twice 'max_stride_count' byte ranges, so the prediction
+ *          stops early (without setting 'dstTooSmall') if the missing bytes
+ *          are more fragmented than that. */
+int64_t data_region_readahead_observe(DataRegion* dst, int64_t dstCapacity, DataRegionReadahead* readahead, int64_t streamId, DataRegion request, const DataRegionSet* present, int* dstTooSmall)
+{
+  int dstTooSmallPlaceholder;
+  if(dstTooSmall == NULL)
+    dstTooSmall = &dstTooSmallPlaceholder;
+  *dstTooSmall = 0;
+
+  if(dst == NULL || readahead == NULL || present == NULL)
+    return 0;
+  if(!data_region_is_valid(request))
+    return 0;
+
+  pthread_mutex_lock(&readahead->lock);
+  int isNew;
+  _DataRegionReadaheadStream* stream = _data_region_readahead_find(readahead, streamId, &isNew);
+  stream->last_use = ++readahead->clock;
+  if(isNew)
+  {
+    stream->last = request;
+    pthread_mutex_unlock(&readahead->lock);
+    return 0;
+  }
+
+  //Classify the request against the previous one
+  DataRegionReadaheadInfo* info = &stream->info;
+  int64_t stride = request.first_index - stream->last.first_index;
+  if(stream->last.last_index < INT64_MAX && request.first_index == stream->last.last_index + 1)
+    info->pattern = DATA_REGION_ACCESS_SEQUENTIAL;
+  else if(stride != 0 && stride == info->stride)
+    info->pattern = DATA_REGION_ACCESS_STRIDED;
+  else
+    info->pattern = DATA_REGION_ACCESS_RANDOM;
+  info->stride = stride;
+  stream->last = request;
+
+  //Prefetched bytes that were requested are used, and the ones that were skipped over are wasted
+  int64_t used = _data_region_readahead_take(stream, request);
+  int64_t wasted = 0;
+  if(info->pattern == DATA_REGION_ACCESS_RANDOM)
+  {
+    wasted = data_region_set_total_length(stream->pending);
+    data_region_set_clear(stream->pending);
+  }
+  else if(info->pattern == DATA_REGION_ACCESS_STRIDED && stride < 0)
+  {
+    //A backward stream skips over the predictions above the request
+    if(request.last_index < INT64_MAX)
+      wasted = _data_region_readahead_take(stream, (DataRegion){ request.last_index + 1, INT64_MAX });
+  }
+  else if(request.first_index > INT64_MIN)
+    wasted = _data_region_readahead_take(stream, (DataRegion){ INT64_MIN, request.first_index - 1 });
+  info->used_bytes += used;
+  info->wasted_bytes += wasted;
+  stream->epoch_used_bytes += used;
+  stream->epoch_wasted_bytes += wasted;
+
+  //Resize the window according to its hit rate
+  int64_t epochBytes = stream->epoch_used_bytes + stream->epoch_wasted_bytes;
+  if(epochBytes >= info->window_bytes)
+  {
+    if(stream->epoch_used_bytes >= epochBytes - (epochBytes / 4))
+      info->window_bytes = info->window_bytes > readahead->options.max_window_bytes / 2 ? readahead->options.max_window_bytes : info->window_bytes * 2;
+    else if(stream->epoch_used_bytes < epochBytes / 2)
+      info->window_bytes = info->window_bytes / 2 < readahead->options.min_window_bytes ? readahead->options.min_window_bytes : info->window_bytes / 2;
+    stream->epoch_used_bytes = 0;
+    stream->epoch_wasted_bytes = 0;
+  }
+
+  int64_t count = 0;
+  if(info->pattern == DATA_REGION_ACCESS_SEQUENTIAL && request.last_index < INT64_MAX)
+  {
+    DataRegion predicted = { request.last_index + 1, request.last_index > INT64_MAX - info->window_bytes ? INT64_MAX : request.last_index + info->window_bytes };
+    if(_data_region_readahead_emit(dst, dstCapacity, &count, stream, present, predicted) == 0)
+      *dstTooSmall = 1;
+  }
+  else if(info->pattern == DATA_REGION_ACCESS_STRIDED)
+  {
+    //Predict the next requests of the same length, as many as fit in the window
+    int64_t length = data_region_length(request);
+    int64_t strideCount = length > info->window_bytes ? 1 : info->window_bytes / length;
+    if(strideCount > readahead->options.max_stride_count)
+      strideCount = readahead->options.max_stride_count;
+
+    DataRegion predicted = request;
+    for(int64_t i = 0; i < strideCount; i++)
+    {
+      if(stride > 0 ? predicted.last_index > INT64_MAX - stride : predicted.first_index < -stride)
+        break;
+      predicted.first_index += stride;
+      predicted.last_index += stride;
+      int result = _data_region_readahead_emit(dst, dstCapacity, &count, stream, present, predicted);
+      if(result != 1)
+      {
+        *dstTooSmall = result == 0;
+        break;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&readahead->lock);
+  return count;
+}
+
+/* Gets information about a stream of a DataRegionReadahead.
+ * @param readahead - The DataRegionReadahead. If this is NULL, then false
+ *        (0) will be returned.
+ * @param streamId - Identifies the stream.
+ * @param dst - Receives the information. If this is NULL, then false (0)
+ *        will be returned.
+ * @returns - True (1) if the stream is tracked, otherwise false (0). */
+int data_region_readahead_get_info(DataRegionReadahead* readahead, int64_t streamId, DataRegionReadaheadInfo* dst)
+{
+  if(readahead == NULL || dst == NULL)
+    return 0;
+
+  int found = 0;
+  pthread_mutex_lock(&readahead->lock);
+  for(int64_t i = 0; i < readahead->options.stream_capacity; i++)
+  {
+    if(readahead->streams[i].in_use && readahead->streams[i].id == streamId)
+    {
+      *dst = readahead->streams[i].info;
+      found = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&readahead->lock);
+  return found;
+}
+
+/* Reads bytes through a DataRegionCache (see data_region_cache_read), then
+ * prefetches the byte ranges that the stream is predicted to request next.
+ * @param readahead - The DataRegionReadahead. If this is NULL, then -1 will
+ *        be returned.
+ * @param streamId - Identifies the stream that reads.
+ * @param cache - The DataRegionCache. If this is NULL, then -1 will be
+ *        returned.
+ * @param dst - The destination buffer of 'length' bytes.
+ * @param offset - The offset of the first byte to read.
+ * @param length - The number of bytes to read.
+ * @returns - The number of bytes read (see data_region_cache_read), or -1
+ *          upon failure.
+ * @remarks - Prefetching is synchronous, after the read; call this from the
+ *          thread that serves the stream, or prefetch the byte ranges that
+ *          'data_region_readahead_observe' returns on another thread.
+ *          Prefetched bytes count as missed bytes of the cache when they
+ *          are fetched, and as hit bytes when they are read. */
+int64_t data_region_readahead_cache_read(DataRegionReadahead* readahead, int64_t streamId, DataRegionCache* cache, void* dst, int64_t offset, int64_t length)
+{
+  if(readahead == NULL || cache == NULL || dst == NULL || offset < 0 || length < 0 || length > INT64_MAX - offset)
+    return -1;
+
+  int64_t result = data_region_cache_read(cache, dst, offset, length);
+  if(result <= 0)
+    return result;
+
+  DataRegion prefetches[64];
+  DataRegion request = { offset, offset + result - 1 };
+  pthread_mutex_lock(&cache->lock);
+  int64_t prefetchCount = data_region_readahead_observe(prefetches, 64, readahead, streamId, request, cache->present, NULL);
+  pthread_mutex_unlock(&cache->lock);
+
+  int64_t scratchLength = 0;
+  for(int64_t i = 0; i < prefetchCount; i++)
+  {
+    if(data_region_length(prefetches[i]) > scratchLength)
+      scratchLength = data_region_length(prefetches[i]);
+  }
+
+  //A failed prefetch only costs a later miss
+  void* scratch = prefetchCount > 0 ? malloc((size_t)scratchLength) : NULL;
+  for(int64_t i = 0; i < prefetchCount && scratch != NULL; i++)
+  {
+    if(data_region_cache_read(cache, scratch, prefetches[i].first_index, data_region_length(prefetches[i])) < data_region_length(prefetches[i]))
+      break;
+  }
+  free(scratch);
+  return result;
+}
+
+#endif//DATA_REGION_READAHEAD_H
@@ -0,0 +1,344 @@
+#ifndef DATA_REGION_SCHEDULER_H
+#define DATA_REGION_SCHEDULER_H
+#include "data_region.h"
+#include <pthread.h>
+
+/* A priority point of a DataRegionScheduler, such as a playhead or a seek
+ * target. Missing bytes are fetched forward from it.
+ * @see data_region_scheduler_set_point */
+typedef struct DataRegionSchedulerPoint
+{
+  /* Whether the point is set. */
+  int active;
+
+  /* The offset that missing bytes are fetched forward from. */
+  int64_t offset;
+
+  /* How urgent the point is (at least one). The distance of a missing byte
+   * from the point is divided by this. */
+  int64_t urgency;
+
+  /* The number of bytes after 'offset' that are fetched for this point, or
+   * zero for no limit. */
+  int64_t horizon_bytes;
+
+  /* No byte in ['offset', 'cursor') is missing and not being fetched. */
+  int64_t cursor;
+} DataRegionSchedulerPoint;
+
+/* Scheduler that yields the missing bytes of a file as fixed-size work
+ * units, in order of their distance from a set of priority points, divided
+ * by the urgency of each point. Each point keeps a cursor past the bytes
+ * that are present or being fetched, so a decision only looks at the
+ * DataRegions around the cursor of each point, and moving a point only
+ * resets its cursor.
+ * @see data_region_scheduler_create
+ * @see data_region_scheduler_set_point
+ * @see data_region_scheduler_next
+ * @see data_region_scheduler_complete */
+typedef struct DataRegionScheduler
+{
+  /* Protects everything below. */
+  pthread_mutex_t lock;
+
+  /* The bytes that are present, and the bytes that are being fetched. */
+  DataRegionSet* present;
+  DataRegionSet* inflight;
+
+  /* The number of work units being fetched. Each DataRegion of 'inflight'
+   * holds at least one, so removing a unit never exceeds its capacity. */
+  int64_t inflight_count;
+
+  /* The size (and alignment) of a work unit. */
+  int64_t unit_bytes;
+
+  /* The length of the file. */
+  int64_t length;
+
+  DataRegionSchedulerPoint* points;
+  int64_t point_capacity;
+} DataRegionScheduler;
+
+/* Allocates a new DataRegionScheduler, in which no bytes are present and
+ * no priority points are set.
+ * @param regionCapacity - The maximum number of separate byte ranges that
+ *        are present, and that are being fetched. If this is less than
+ *        one, then NULL will be returned.
+ * @param pointCapacity - The maximum number of priority points. If this is
+ *        less than one, then NULL will be returned.
+ * @param unitBytes - The size of a work unit. Units are aligned to this
+ *        size, and are shorter where they meet present bytes or the end of
+ *        the file. If this is less than one, then NULL will be returned.
+ * @param length - The length of the file. If this is less than zero, then
+ *        NULL will be returned.
+ * @returns - A pointer to the allocated DataRegionScheduler, or NULL upon
+ *          failure.
+ * @remarks - Be sure to free the returned DataRegionScheduler by calling
+ *          the 'data_region_scheduler_free' function.
+ * @see data_region_scheduler_free */
+DataRegionScheduler* data_region_scheduler_create(int64_t regionCapacity, int64_t pointCapacity, int64_t unitBytes, int64_t length)
+{
+  if(regionCapacity < 1 || pointCapacity < 1 || unitBytes < 1 || length < 0)
+    return NULL;
+
+  DataRegionScheduler* scheduler = malloc(sizeof(DataRegionScheduler));
+  if(scheduler == NULL)
+    return NULL;
+
+  scheduler->present = data_region_set_create(regionCapacity);
+  scheduler->inflight = data_region_set_create(regionCapacity);
+  scheduler->points = calloc((size_t)pointCapacity, sizeof(DataRegionSchedulerPoint));
+  if(scheduler->present == NULL || scheduler->inflight == NULL || scheduler->points == NULL)
+  {
+    data_region_set_free(scheduler->present);
+    data_region_set_free(scheduler->inflight);
+    free(scheduler->points);
+    free(scheduler);
+    return NULL;
+  }
+
+  pthread_mutex_init(&scheduler->lock, NULL);
+  scheduler->inflight_count = 0;
+  scheduler->unit_bytes = unitBytes;
+  scheduler->length = length;
+  scheduler->point_capacity = pointCapacity;
+  return scheduler;
+}
+
+/* Frees a DataRegionScheduler that was allocated by the
+ * 'data_region_scheduler_create' function.
+ * @param scheduler - Pointer to the DataRegionScheduler. If this argument
+ *        is NULL, then nothing will happen. */
+void data_region_scheduler_free(DataRegionScheduler* scheduler)
+{
+  if(scheduler == NULL)
+    return;
+
+  pthread_mutex_destroy(&scheduler->lock);
+  data_region_set_free(scheduler->present);
+  data_region_set_free(scheduler->inflight);
+  free(scheduler->points);
+  free(scheduler);
+}
+
+/* Sets (or moves) a priority point. Only the point's cursor is reset, so
+ * this takes O(1) time.
+ * @param scheduler - The DataRegionScheduler. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param pointIndex - The index of the point. If this isn't less than the
+ *        point capacity, then DATA_REGION_SET_OUT_OF_SPACE will be returned.
+ * @param offset - The offset that missing bytes are fetched forward from.
+ * @param urgency - How urgent the point is; a point with twice the urgency
+ *        is fetched twice as far ahead at the same priority.
+ * @param horizonBytes - The number of bytes after 'offset' that are fetched
+ *        for this point, or zero for no limit.
+ * @returns - DATA_REGION_SET_SUCCESS upon success,
+ *          DATA_REGION_SET_INVALID_REGION if 'offset' or 'horizonBytes' is
+ *          less than zero or 'urgency' is less than one, or another
+ *          DataRegionSetResult upon failure (see above). */
+DataRegionSetResult data_region_scheduler_set_point(DataRegionScheduler* scheduler, int64_t pointIndex, int64_t offset, int64_t urgency, int64_t horizonBytes)
+{
+  if(scheduler == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(offset < 0 || urgency < 1 || horizonBytes < 0)
+    return DATA_REGION_SET_INVALID_REGION;
+  if(pointIndex < 0 || pointIndex >= scheduler->point_capacity)
+    return DATA_REGION_SET_OUT_OF_SPACE;
+
+  pthread_mutex_lock(&scheduler->lock);
+  DataRegionSchedulerPoint* point = &scheduler->points[pointIndex];
+  point->active = 1;
+  point->offset = offset;
+  point->urgency = urgency;
+  point->horizon_bytes = horizonBytes;
+  point->cursor = offset;
+  pthread_mutex_unlock(&scheduler->lock);
+  return DATA_REGION_SET_SUCCESS;
+}
+
+/* Clears a priority point, so that no more bytes are fetched for it.
+ * @param scheduler - The DataRegionScheduler. If this is NULL, then nothing
+ *        will happen.
+ * @param pointIndex - The index of the point. If this is out of range, then
+ *        nothing will happen. */
+void data_region_scheduler_clear_point(DataRegionScheduler* scheduler, int64_t pointIndex)
+{
+  if(scheduler == NULL || pointIndex < 0 || pointIndex >= scheduler->point_capacity)
+    return;
+
+  pthread_mutex_lock(&scheduler->lock);
+  scheduler->points[pointIndex].active = 0;
+  pthread_mutex_unlock(&scheduler->lock);
+}
+
+/* Internal function to move an index past the DataRegion of a set that
+ * contains it, if any. */
+int64_t _data_region_scheduler_skip(const DataRegionSet* set, int64_t index)
+{
+  int64_t i = _data_region_set_lower_bound(set, index);
+  if(i < set->count && set->regions[i].first_index <= index)
+    return set->regions[i].last_index == INT64_MAX ? INT64_MAX : set->regions[i].last_index + 1;
+  return index;
+}
+
+/* Internal function to get the last index before the next DataRegion of a
+ * set that starts after an index (which isn't in the set). */
+int64_t _data_region_scheduler_gap_end(const DataRegionSet* set, int64_t index)
+{
+  int64_t i = _data_region_set_lower_bound(set, index);
+  return i < set->count ? set->regions[i].first_index - 1 : INT64_MAX;
+}
+
+/* Internal function to rewind the cursors of the points that may have
+ * passed a byte range which became missing again. */
+void _data_region_scheduler_rewind(DataRegionScheduler* scheduler, DataRegion region)
+{
+  for(int64_t i = 0; i < scheduler->point_capacity; i++)
+  {
+    DataRegionSchedulerPoint* point = &scheduler->points[i];
+    if(point->cursor > region.first_index && point->offset <= region.last_index)
+      point->cursor = point->offset > region.first_index ? point->offset : region.first_index;
+  }
+}
+
+/* Gets the next work unit to fetch, and marks it as being fetched.
+ * @param scheduler - The DataRegionScheduler. If this is NULL, then false
+ *        (0) will be returned.
+ * @param dst - Receives the work unit. If this is NULL, then false (0) will
+ *        be returned.
+ * @returns - True (1) if a work unit was found, or false (0) if no point
+ *          has missing bytes within its horizon (or if the byte ranges
+ *          being fetched are at capacity, in which case a unit has to
+ *          complete first).
+ * @remarks - The unit with the lowest distance from a point divided by the
+ *          point's urgency is chosen. Finding it takes O(p * log n) time
+ *          for 'p' points, plus the time to move their cursors past the
+ *          byte ranges that were fetched since the previous decision. */
+int data_region_scheduler_next(DataRegionScheduler* scheduler, DataRegion* dst)
+{
+  if(scheduler == NULL || dst == NULL)
+    return 0;
+
+  pthread_mutex_lock(&scheduler->lock);
+  int found = 0;
+  double bestScore = 0;
+  DataRegion best = { 0, 0 };
+  for(int64_t i = 0; i < scheduler->point_capacity; i++)
+  {
+    DataRegionSchedulerPoint* point = &scheduler->points[i];
+    if(!point->active)
+      continue;
+
+    //Move the cursor past the present bytes and the bytes being fetched (only the ones passed since the last decision)
+    int64_t cursor = point->cursor;
+    for(;;)
+    {
+      int64_t skipped = _data_region_scheduler_skip(scheduler->inflight, _data_region_scheduler_skip(scheduler->present, cursor));
+      if(skipped == cursor)
+        break;
+      cursor = skipped;
+    }
+    point->cursor = cursor;
+
+    int64_t end = scheduler->length - 1;
+    if(point->horizon_bytes > 0 && point->offset <= INT64_MAX - point->horizon_bytes && point->offset + point->horizon_bytes - 1 < end)
+      end = point->offset + point->horizon_bytes - 1;
+    if(cursor > end)
+      continue;
+
+    double score = (double)(cursor - point->offset) / (double)point->urgency;
+    if(found && score >= bestScore)
+      continue;
+
+    //The unit ends at its alignment boundary, the horizon, or the next present or fetching byte
+    int64_t unitEnd = cursor - (cursor % scheduler->unit_bytes);
+    unitEnd = unitEnd > INT64_MAX - (scheduler->unit_bytes - 1) ? INT64_MAX : unitEnd + (scheduler->unit_bytes - 1);
+    int64_t presentEnd = _data_region_scheduler_gap_end(scheduler->present, cursor);
+    int64_t inflightEnd = _data_region_scheduler_gap_end(scheduler->inflight, cursor);
+    if(presentEnd < unitEnd)
+      unitEnd = presentEnd;
+    if(inflightEnd < unitEnd)
+      unitEnd = inflightEnd;
+    if(end < unitEnd)
+      unitEnd = end;
+
+    found = 1;
+    bestScore = score;
+    best.first_index = cursor;
+    best.last_index = unitEnd;
+  }
+
+  if(found && (scheduler->inflight_count >= scheduler->inflight->capacity || data_region_set_add(scheduler->inflight, best) != DATA_REGION_SET_SUCCESS))
+    found = 0;
+  if(found)
+    scheduler->inflight_count++;
+  pthread_mutex_unlock(&scheduler->lock);
+
+  if(found)
+    *dst = best;
+  return found;
+}
+
+/* Completes a work unit that was returned by 'data_region_scheduler_next'.
+ * @param scheduler - The DataRegionScheduler. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param unit - The work unit.
+ * @param fetched - True (1) if the unit's bytes are now present, or false
+ *        (0) if fetching them failed, so that they are missing again.
+ * @returns - A DataRegionSetResult of adding the unit to the present bytes.
+ *          If this fails, then the unit's bytes are missing again. */
+DataRegionSetResult data_region_scheduler_complete(DataRegionScheduler* scheduler, DataRegion unit, int fetched)
+{
+  if(scheduler == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(unit))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  pthread_mutex_lock(&scheduler->lock);
+
+  if(data_region_set_remove(scheduler->inflight, unit) == DATA_REGION_SET_SUCCESS && scheduler->inflight_count > 0)
+    scheduler->inflight_count--;
+  DataRegionSetResult result = DATA_REGION_SET_SUCCESS;
+  if(fetched)
+    result = data_region_set_add(scheduler->present, unit);
+  if(!fetched || result != DATA_REGION_SET_SUCCESS)
+    _data_region_scheduler_rewind(scheduler, unit);
+  pthread_mutex_unlock(&scheduler->lock);
+  return result;
+}
+
+/* Marks bytes as present, which were fetched outside of the scheduler.
+ * @param scheduler - The DataRegionScheduler. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param region - The present bytes.
+ * @returns - A DataRegionSetResult (see data_region_set_add). */
+DataRegionSetResult data_region_scheduler_mark_present(DataRegionScheduler* scheduler, DataRegion region)
+{
+  if(scheduler == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+
+  pthread_mutex_lock(&scheduler->lock);
+  DataRegionSetResult result = data_region_set_add(scheduler->present, region);
+  pthread_mutex_unlock(&scheduler->lock);
+  return result;
+}
+
+/* Marks bytes as missing, for example after they were evicted.
+ * @param scheduler - The DataRegionScheduler. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param region - The missing bytes.
+ * @returns - A DataRegionSetResult (see data_region_set_remove). */
+DataRegionSetResult data_region_scheduler_mark_missing(DataRegionScheduler* scheduler, DataRegion region)
+{
+  if(scheduler == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+
+  pthread_mutex_lock(&scheduler->lock);
+  DataRegionSetResult result = data_region_set_remove(scheduler->present, region);
+  if(result == DATA_REGION_SET_SUCCESS)
+    _data_region_scheduler_rewind(scheduler, region);
+  pthread_mutex_unlock(&scheduler->lock);
+  return result;
+}
+
+#endif//DATA_REGION_SCHEDULER_H
@@ -0,0 +1,554 @@
+#ifndef DATA_REGION_SHARDED_H
+#define DATA_REGION_SHARDED_H
+#include "data_region.h"
+#include <pthread.h>
+
+/* One partition of a DataRegionShardedSet. Each shard owns a contiguous range
+ * of indices, and stores the portions of DataRegions within that range in
+ * its own DataRegionSet. */
+typedef struct DataRegionShard
+{
+  /* Protects 'set'. Aligned so that neighboring shard locks do not share a
+   * cache line. */
+  _Alignas(64) pthread_mutex_t lock;
+
+  /* The DataRegions (clipped to 'range') stored in this shard. */
+  DataRegionSet* set;
+
+  /* The indices that are owned by this shard. */
+  DataRegion range;
+} DataRegionShard;
+
+/* Collection of DataRegions which is partitioned into shards, so that
+ * threads which mutate different parts of the index space do not contend
+ * for the same lock (nor shift the same DataRegion array).
+ * A DataRegion that straddles a shard boundary is split into one piece per
+ * shard, and the pieces are transparently re-joined by all queries.
+ * Allocate one via 'data_region_sharded_set_create'.
+ * @see data_region_sharded_set_add
+ * @see data_region_sharded_set_remove
+ * @see data_region_sharded_set_crop
+ * @see data_region_sharded_set_negative_crop */
+typedef struct DataRegionShardedSet
+{
+  /* The first index owned by the second shard, minus 'shard_width'. */
+  int64_t first_index;
+
+  /* The number of indices owned by each shard (except the first and last
+   * shards, which extend to INT64_MIN and INT64_MAX respectively). */
+  int64_t shard_width;
+
+  /* The number of shards stored in 'shards'. */
+  int64_t shard_count;
+
+  /* The shards, in ascending order of their ranges. */
+  DataRegionShard shards[];
+} DataRegionShardedSet;
+
+/* Allocates a new, empty DataRegionShardedSet.
+ * @param firstIndex - The first index of the second shard's range, minus
+ *        'shardWidth'. Indices below this value belong to the first shard.
+ * @param shardWidth - The number of indices that are owned by each shard.
+ *        If this is less than one, then NULL will be returned.
+ * @param shardCount - The number of shards. If this is less than one, then
+ *        NULL will be returned.
+ * @param shardCapacity - The maximum number of DataRegions that can be stored
+ *        in each shard. If this is less than zero, then NULL will be
+ *        returned.
+ * @returns - A pointer to the allocated DataRegionShardedSet, or NULL upon
+ *          failure.
+ * @remarks - Shard 'i' owns the indices from 'firstIndex + (i * shardWidth)'
+ *          through 'firstIndex + ((i + 1) * shardWidth) - 1', except that
+ *          the first shard also owns all lower indices, and the last shard
+ *          also owns all higher indices. Choose the partitioning so that
+ *          concurrent writers usually touch different shards.
+ *          Be sure to free the returned DataRegionShardedSet by calling the
+ *          'data_region_sharded_set_free' function.
+ * @see data_region_sharded_set_free */
+DataRegionShardedSet* data_region_sharded_set_create(int64_t firstIndex, int64_t shardWidth, int64_t shardCount, int64_t shardCapacity)
+{
+  if(shardWidth < 1 || shardCount < 1 || shardCapacity < 0)
+    return NULL;
+
+  size_t size = sizeof(DataRegionShardedSet) + (sizeof(DataRegionShard) * shardCount);
+  size = (size + 63) & ~(size_t)63;//'aligned_alloc' requires a multiple of the alignment
+  DataRegionShardedSet* set = aligned_alloc(64, size);
+  if(set == NULL)
+    return NULL;
+
+  set->first_index = firstIndex;
+  set->shard_width = shardWidth;
+  set->shard_count = shardCount;
+
+  int64_t rangeFirst = INT64_MIN;
+  for(int64_t i = 0; i < shardCount; i++)
+  {
+    DataRegionShard* shard = &set->shards[i];
+    shard->set = data_region_set_create(shardCapacity);
+    if(shard->set == NULL)
+    {
+      for(int64_t j = 0; j < i; j++)
+      {
+        pthread_mutex_destroy(&set->shards[j].lock);
+        data_region_set_free(set->shards[j].set);
+      }
+      free(set);
+      return NULL;
+    }
+    pthread_mutex_init(&shard->lock, NULL);
+
+    //The range is computed with unsigned arithmetic so that a huge index space can't overflow
+    shard->range.first_index = rangeFirst;
+    if(i == shardCount - 1)
+    {
+      shard->range.last_index = INT64_MAX;
+    }
+    else
+    {
+      uint64_t end = (uint64_t)firstIndex + ((uint64_t)(i + 1) * (uint64_t)shardWidth);
+      shard->range.last_index = (int64_t)(end - 1);
+      rangeFirst = (int64_t)end;
+    }
+  }
+
+  return set;
+}
+
+/* Frees a DataRegionShardedSet that was allocated by the
+ * 'data_region_sharded_set_create' function.
+ * @param set - Pointer to the DataRegionShardedSet. If this argument is NULL,
+ *        then nothing will happen.
+ * @remarks - No other thread may be using the set when it is freed. */
+void data_region_sharded_set_free(DataRegionShardedSet* set)
+{
+  if(set == NULL)
+    return;
+
+  for(int64_t i = 0; i < set->shard_count; i++)
+  {
+    pthread_mutex_destroy(&set->shards[i].lock);
+    data_region_set_free(set->shards[i].set);
+  }
+  free(set);
+}
+
+/* Internal function to get the shard which owns a specific index.
+ * @param set - The DataRegionShardedSet.
+ * @param index - The index.
+ * @returns - The zero-based position of the shard that owns 'index'. */
+int64_t _data_region_sharded_set_shard_of(const DataRegionShardedSet* set, int64_t index)
+{
+  if(index < set->first_index + set->shard_width || set->shard_count == 1)
+    return 0;
+
+  uint64_t shard = ((uint64_t)index - (uint64_t)set->first_index) / (uint64_t)set->shard_width;
+  if(shard >= (uint64_t)set->shard_count)
+    return set->shard_count - 1;
+  return (int64_t)shard;
+}
+
+/* Internal function to lock a range of shards in ascending order (so that
+ * two threads can never deadlock).
+ * @param set - The DataRegionShardedSet.
+ * @param first - The position of the first shard to lock.
+ * @param last - The position of the last shard to lock. */
+void _data_region_sharded_set_lock(DataRegionShardedSet* set, int64_t first, int64_t last)
+{
+  for(int64_t i = first; i <= last; i++)
+    pthread_mutex_lock(&set->shards[i].lock);
+}
+
+/* Internal function to unlock a range of shards.
+ * @param set - The DataRegionShardedSet.
+ * @param first - The position of the first shard to unlock.
+ * @param last - The position of the last shard to unlock. */
+void _data_region_sharded_set_unlock(DataRegionShardedSet* set, int64_t first, int64_t last)
+{
+  for(int64_t i = last; i >= first; i--)
+    pthread_mutex_unlock(&set->shards[i].lock);
+}
+
+/* Internal function to clip a DataRegion to the range of a shard.
+ * @param shard - The shard.
+ * @param region - The DataRegion, which must intersect the shard's range.
+ * @returns - The portion of 'region' that is owned by 'shard'. */
+DataRegion _data_region_shard_clip(const DataRegionShard* shard, DataRegion region)
+{
+  if(region.first_index < shard->range.first_index)
+    region.first_index = shard->range.first_index;
+  if(region.last_index > shard->range.last_index)
+    region.last_index = shard->range.last_index;
+  return region;
+}
+
+/* Adds a DataRegion to a DataRegionShardedSet.
+ * @param set - The destination DataRegionShardedSet. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toAdd - The DataRegion to add. If this is invalid (see
+ *        data_region_is_valid), then DATA_REGION_SET_INVALID_REGION will
+ *        be returned.
+ * @returns - The DataRegionSetResult that defines the result of the add
+ *          operation. If all arguments are non-null and valid, then the
+ *          result will be either DATA_REGION_SET_SUCCESS or
+ *          DATA_REGION_SET_OUT_OF_SPACE.
+ * @remarks - Only the shards that 'toAdd' intersects are locked. If 'toAdd'
+ *          straddles several shards, then either all of its pieces are added
+ *          or (if any shard lacks the capacity) nothing will change. */
+DataRegionSetResult data_region_sharded_set_add(DataRegionShardedSet* set, DataRegion toAdd)
+{
+  if(set == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(toAdd))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  int64_t first = _data_region_sharded_set_shard_of(set, toAdd.first_index);
+  int64_t last = _data_region_sharded_set_shard_of(set, toAdd.last_index);
+  _data_region_sharded_set_lock(set, first, last);
+
+  //Check every shard before changing any of them
+  for(int64_t i = first; i <= last; i++)
+  {
+    if(!_data_region_set_can_add(set->shards[i].set, _data_region_shard_clip(&set->shards[i], toAdd)))
+    {
+      _data_region_sharded_set_unlock(set, first, last);
+      return DATA_REGION_SET_OUT_OF_SPACE;
+    }
+  }
+
+  for(int64_t i = first; i <= last; i++)
+    data_region_set_add(set->shards[i].set, _data_region_shard_clip(&set->shards[i], toAdd));
+
+  _data_region_sharded_set_unlock(set, first, last);
+  return DATA_REGION_SET_SUCCESS;
+}
+
+/* Removes a DataRegion from a DataRegionShardedSet.
+ * @param set - Pointer to the DataRegionShardedSet from which to remove the
+ *        DataRegion. If this argument is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toRemove - The DataRegion to remove. If this is invalid
+ *        (see data_region_is_valid), then DATA_REGION_SET_INVALID_REGION
+ *        will be returned.
+ * @returns - The DataRegionSetResult that defines the result of the removal
+ *          operation. If all arguments are non-null and valid, then the
+ *          result will be either DATA_REGION_SET_SUCCESS or
+ *          DATA_REGION_SET_OUT_OF_SPACE.
+ * @remarks - Only the shards that 'toRemove' intersects are locked. Like
+ *          'data_region_sharded_set_add', the removal is all-or-nothing. */
+DataRegionSetResult data_region_sharded_set_remove(DataRegionShardedSet* set, DataRegion toRemove)
+{
+  if(set == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(toRemove))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  int64_t first = _data_region_sharded_set_shard_of(set, toRemove.first_index);
+  int64_t last = _data_region_sharded_set_shard_of(set, toRemove.last_index);
+  _data_region_sharded_set_lock(set, first, last);
+
+  //Check every shard before changing any of them
+  for(int64_t i = first; i <= last; i++)
+  {
+    if(!_data_region_set_can_remove(set->shards[i].set, _data_region_shard_clip(&set->shards[i], toRemove)))
+    {
+      _data_region_sharded_set_unlock(set, first, last);
+      return DATA_REGION_SET_OUT_OF_SPACE;
+    }
+  }
+
+  for(int64_t i = first; i <= last; i++)
+    data_region_set_remove(set->shards[i].set, _data_region_shard_clip(&set->shards[i], toRemove));
+
+  _data_region_sharded_set_unlock(set, first, last);
+  return DATA_REGION_SET_SUCCESS;
+}
+
+/* Internal iterator over the DataRegions of a DataRegionShardedSet within a
+ * boundary, which re-joins the pieces of DataRegions that straddle shard
+ * boundaries. The shards must be locked while it is used. */
+typedef struct _DataRegionShardedCursor
+{
+  const DataRegionShardedSet* set;
+  DataRegion boundary;
+  int64_t shard;
+  int64_t last_shard;
+  int64_t position;
+} _DataRegionShardedCursor;
+
+/* Internal function to initialize a _DataRegionShardedCursor.
+ * @param cursor - The cursor to initialize.
+ * @param set - The DataRegionShardedSet to iterate.
+ * @param boundary - The (valid) boundary of the iteration.
+ * @remarks - The shards that intersect 'boundary' have to be locked. */
+void _data_region_sharded_cursor_init(_DataRegionShardedCursor* cursor, const DataRegionShardedSet* set, DataRegion boundary)
+{
+  cursor->set = set;
+  cursor->boundary = boundary;
+  cursor->shard = _data_region_sharded_set_shard_of(set, boundary.first_index);
+  cursor->last_shard = _data_region_sharded_set_shard_of(set, boundary.last_index);
+  cursor->position = _data_region_set_lower_bound(set->shards[cursor->shard].set, boundary.first_index);
+}
+
+/* Internal function to get the next stored piece (clipped to the boundary)
+ * without re-joining pieces from neighboring shards.
+ * @param cursor - The cursor.
+ * @param piece - Receives the next piece.
+ * @returns - True (1) if a piece was found, otherwise false (0). */
+int _data_region_sharded_cursor_next_piece(_DataRegionShardedCursor* cursor, DataRegion* piece)
+{
+  while(cursor->shard <= cursor->last_shard)
+  {
+    const DataRegionSet* shardSet = cursor->set->shards[cursor->shard].set;
+    if(cursor->position < shardSet->count && shardSet->regions[cursor->position].first_index <= cursor->boundary.last_index)
+    {
+      DataRegion current = shardSet->regions[cursor->position++];
+      if(current.first_index < cursor->boundary.first_index)
+        current.first_index = cursor->boundary.first_index;
+      if(current.last_index > cursor->boundary.last_index)
+        current.last_index = cursor->boundary.last_index;
+      *piece = current;
+      return 1;
+    }
+
+    //Move on to the first DataRegion of the next shard
+    cursor->shard++;
+    cursor->position = 0;
+  }
+  return 0;
+}
+
+/* Internal function to get the next DataRegion, re-joining any pieces that
+ * were split at shard boundaries.
+ * @param cursor - The cursor.
+ * @param region - Receives the next DataRegion (clipped to the boundary).
+ * @returns - True (1) if a DataRegion was found, otherwise false (0). */
+int _data_region_sharded_cursor_next(_DataRegionShardedCursor* cursor, DataRegion* region)
+{
+  if(!_data_region_sharded_cursor_next_piece(cursor, region))
+    return 0;
+
+  //A piece which ends at its shard's boundary may continue in the next shard
+  while(cursor->shard < cursor->last_shard
+    && region->last_index == cursor->set->shards[cursor->shard].range.last_index)
+  {
+    const DataRegionSet* shardSet = cursor->set->shards[cursor->shard].set;
+    if(cursor->position < shardSet->count)
+      break;//More DataRegions remain in this shard, so the piece can't continue
+
+    const DataRegionShard* next = &cursor->set->shards[cursor->shard + 1];
+    if(next->set->count == 0 || next->set->regions[0].first_index != next->range.first_index)
+      break;
+
+    DataRegion continuation;
+    _data_region_sharded_cursor_next_piece(cursor, &continuation);
+    region->last_index = continuation.last_index;
+  }
+  return 1;
+}
+
+/* Copies a subset of DataRegions in a DataRegionShardedSet to an array.
+ * @remarks - This function behaves exactly like 'data_region_set_crop', but
+ *          reads from a DataRegionShardedSet. DataRegions that straddle
+ *          shard boundaries are yielded as one DataRegion. All shards that
+ *          intersect the 'boundaryRegion' are locked together, so the result
+ *          is a consistent view of the set.
+ * @see data_region_set_crop */
+int64_t data_region_sharded_set_crop(DataRegion* dst, int64_t dstCapacity, DataRegionShardedSet* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  int dstTooSmallPlaceholder;
+  if(dstTooSmall == NULL)
+    dstTooSmall = &dstTooSmallPlaceholder;
+  *dstTooSmall = 0;
+
+  if(src == NULL)
+    return 0;
+  if(!data_region_is_valid(boundaryRegion))
+    return 0;
+
+  if(dstCapacity < 0)
+  {
+    //Cannot have a negative destination capacity
+    *dstTooSmall = 1;
+    return 0;
+  }
+
+  //The cursor reads the first shard's DataRegions, so it's initialized under the locks
+  int64_t firstShard = _data_region_sharded_set_shard_of(src, boundaryRegion.first_index);
+  int64_t lastShard = _data_region_sharded_set_shard_of(src, boundaryRegion.last_index);
+  _data_region_sharded_set_lock(src, firstShard, lastShard);
+  _DataRegionShardedCursor cursor;
+  _data_region_sharded_cursor_init(&cursor, src, boundaryRegion);
+
+  int64_t count = 0;
+  DataRegion current;
+  while(_data_region_sharded_cursor_next(&cursor, &current))
+  {
+    if(dst != NULL)
+    {
+      if(count < dstCapacity)
+      {
+        dst[count++] = current;
+      }
+      else
+      {
+        *dstTooSmall = 1;
+        break;
+      }
+    }
+    else
+    {
+      //When 'dst' is NULL, it indicates that we are only counting the DataRegions
+      count++;
+    }
+  }
+
+  _data_region_sharded_set_unlock(src, firstShard, lastShard);
+  return count;
+}
+
+/* Counts the number of DataRegions in a DataRegionShardedSet that are at
+ * least partially contained within a specific boundary region.
+ * @remarks - This function behaves exactly like 'data_region_set_count_crop',
+ *          but reads from a DataRegionShardedSet.
+ * @see data_region_set_count_crop */
+int64_t data_region_sharded_set_count_crop(DataRegionShardedSet* src, DataRegion boundaryRegion)
+{
+  if(src == NULL)
+    return 0;
+  if(!data_region_is_valid(boundaryRegion))
+    return 0;
+
+  return data_region_sharded_set_crop(NULL/*NULL indicates that we only want to count the DataRegions*/, 0, src, boundaryRegion, NULL);
+}
+
+/* Copies a 'negative' of a subset of DataRegions within a
+ * DataRegionShardedSet.
+ * @remarks - This function behaves exactly like
+ *          'data_region_set_negative_crop', but reads from a
+ *          DataRegionShardedSet. All shards that intersect the
+ *          'boundaryRegion' are locked together, so the result is a
+ *          consistent view of the set.
+ * @see data_region_set_negative_crop */
+int64_t data_region_sharded_set_negative_crop(DataRegion* dst, int64_t dstCapacity, DataRegionShardedSet* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  int dstTooSmallPlaceholder;
+  if (dstTooSmall == NULL)
+    dstTooSmall = &dstTooSmallPlaceholder;
+  *dstTooSmall = 0;
+
+  if(dst == NULL)
+    return 0;
+  if(src == NULL)
+    return 0;
+  if(!data_region_is_valid(boundaryRegion))
+    return 0;
+
+  if(dstCapacity < 1)
+  {
+    //Like 'data_region_set_negative_crop', at least one DataRegion is required
+    *dstTooSmall = 1;
+    return 0;
+  }
+
+  //The cursor reads the first shard's DataRegions, so it's initialized under the locks
+  int64_t firstShard = _data_region_sharded_set_shard_of(src, boundaryRegion.first_index);
+  int64_t lastShard = _data_region_sharded_set_shard_of(src, boundaryRegion.last_index);
+  _data_region_sharded_set_lock(src, firstShard, lastShard);
+  _DataRegionShardedCursor cursor;
+  _data_region_sharded_cursor_init(&cursor, src, boundaryRegion);
+
+  int64_t count = 0;
+  int64_t nextMissing = boundaryRegion.first_index;
+  int complete = 0;
+  DataRegion current;
+  while(_data_region_sharded_cursor_next(&cursor, &current))
+  {
+    if(current.first_index > nextMissing)
+    {
+      //Yield the gap before 'current'
+      if(count >= dstCapacity)
+      {
+        *dstTooSmall = 1;
+        count = 0;
+        complete = 1;
+        break;
+      }
+      dst[count++] = (DataRegion){ nextMissing, current.first_index - 1 };
+    }
+
+    if(current.last_index >= boundaryRegion.last_index)
+    {
+      complete = 1;//The remainder of the boundary region is present
+      break;
+    }
+    nextMissing = current.last_index + 1;
+  }
+
+  if(!complete)
+  {
+    //Yield the gap after the last present DataRegion
+    if(count >= dstCapacity)
+    {
+      *dstTooSmall = 1;
+      count = 0;
+    }
+    else
+    {
+      dst[count++] = (DataRegion){ nextMissing, boundaryRegion.last_index };
+    }
+  }
+
+  _data_region_sharded_set_unlock(src, firstShard, lastShard);
+  return count;
+}
+
+/* Gets the number of DataRegions that are stored in a DataRegionShardedSet.
+ * @param set - Pointer to the DataRegionShardedSet. If this is NULL, then
+ *        zero will be returned.
+ * @returns - The number of DataRegions, where a DataRegion that straddles
+ *          shard boundaries is only counted once.
+ * @remarks - All shards are locked together, so the result is consistent. */
+int64_t data_region_sharded_set_count(DataRegionShardedSet* set)
+{
+  if(set == NULL)
+    return 0;
+
+  _data_region_sharded_set_lock(set, 0, set->shard_count - 1);
+  int64_t count = 0;
+  for(int64_t i = 0; i < set->shard_count; i++)
+  {
+    const DataRegionShard* shard = &set->shards[i];
+    count += shard->set->count;
+
+    //Don't count the continuation of a DataRegion from the previous shard
+    if(i > 0 && shard->set->count > 0 && shard->set->regions[0].first_index == shard->range.first_index)
+    {
+      const DataRegionSet* previous = set->shards[i - 1].set;
+      if(previous->count > 0 && previous->regions[previous->count - 1].last_index == set->shards[i - 1].range.last_index)
+        count--;
+    }
+  }
+  _data_region_sharded_set_unlock(set, 0, set->shard_count - 1);
+  return count;
+}
+
+/* Gets the length of the sum of all DataRegions stored in a
+ * DataRegionShardedSet.
+ * @param set - Pointer to the DataRegionShardedSet. If this is NULL, then
+ *        zero will be returned.
+ * @returns - The total length of all stored DataRegions.
+ * @remarks - All shards are locked together, so the result is consistent. */
+int64_t data_region_sharded_set_total_length(DataRegionShardedSet* set)
+{
+  if(set == NULL)
+    return 0;
+
+  _data_region_sharded_set_lock(set, 0, set->shard_count - 1);
+  int64_t totalLength = 0;
+  for(int64_t i = 0; i < set->shard_count; i++)
+    totalLength += set->shards[i].set->total_length;
+  _data_region_sharded_set_unlock(set, 0, set->shard_count - 1);
+  return totalLength;
+}
+
+#endif//DATA_REGION_SHARDED_H
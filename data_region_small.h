@@ -0,0 +1,216 @@
+#ifndef DATA_REGION_SMALL_H
+#define DATA_REGION_SMALL_H
+#include "data_region.h"
+
+/* The number of DataRegions that a DataRegionSmallSet stores inline. */
+#ifndef DATA_REGION_SMALL_SET_INLINE_CAPACITY
+#define DATA_REGION_SMALL_SET_INLINE_CAPACITY 3
+#endif
+
+/* DataRegionSet that stores up to DATA_REGION_SMALL_SET_INLINE_CAPACITY
+ * DataRegions inside itself, and only moves them to the heap when it grows
+ * past that. It is meant to be embedded into (or allocated along with) the
+ * objects that it tracks: with the default inline capacity, it takes 88
+ * bytes and no allocation, where 'data_region_set_create' takes a pointer
+ * plus a separate allocation of 32 bytes and 16 per DataRegion.
+ * @remarks - A DataRegionSmallSet may be copied or moved with 'memcpy' only
+ *          while it isn't on the heap (or if the original isn't used or
+ *          freed anymore); the functions of this header re-point 'set' to
+ *          the inline DataRegions before using it.
+ * @see data_region_small_set_init
+ * @see data_region_small_set_get */
+typedef struct DataRegionSmallSet
+{
+  /* The DataRegionSet, whose 'regions' point to 'inline_regions' or to the
+   * heap. */
+  DataRegionSet set;
+
+  /* The maximum capacity that the set grows to. */
+  int64_t max_capacity;
+
+  DataRegion inline_regions[DATA_REGION_SMALL_SET_INLINE_CAPACITY];
+} DataRegionSmallSet;
+
+/* Initializes an empty DataRegionSmallSet, which doesn't allocate anything
+ * until it grows past DATA_REGION_SMALL_SET_INLINE_CAPACITY DataRegions.
+ * @param set - The DataRegionSmallSet to initialize. If this is NULL, then
+ *        nothing will happen.
+ * @param maxCapacity - The maximum number of separate DataRegions, beyond
+ *        which adds and removes return DATA_REGION_SET_OUT_OF_SPACE. If this
+ *        is less than one, then the set grows without a limit.
+ * @remarks - Be sure to call 'data_region_small_set_free' if the set may
+ *          have grown past its inline capacity.
+ * @see data_region_small_set_free */
+void data_region_small_set_init(DataRegionSmallSet* set, int64_t maxCapacity)
+{
+  if(set == NULL)
+    return;
+
+  set->max_capacity = maxCapacity < 1 ? INT64_MAX : maxCapacity;
+  set->set.regions = set->inline_regions;
+  set->set.count = 0;
+  set->set.capacity = set->max_capacity < DATA_REGION_SMALL_SET_INLINE_CAPACITY ? set->max_capacity : DATA_REGION_SMALL_SET_INLINE_CAPACITY;
+  set->set.total_length = 0;
+}
+
+/* Internal function to get the DataRegionSet of a DataRegionSmallSet whose
+ * DataRegions are inline, even if it was copied or moved. */
+DataRegionSet* _data_region_small_set_fix(DataRegionSmallSet* set)
+{
+  if(set->set.capacity <= DATA_REGION_SMALL_SET_INLINE_CAPACITY)
+    set->set.regions = set->inline_regions;
+  return &set->set;
+}
+
+/* Internal function to move the DataRegions of a DataRegionSmallSet to a
+ * larger heap array.
+ * @returns - DATA_REGION_SET_SUCCESS, DATA_REGION_SET_OUT_OF_SPACE if it is
+ *          at its maximum capacity, or DATA_REGION_SET_ALLOCATION_FAILED. */
+DataRegionSetResult _data_region_small_set_grow(DataRegionSmallSet* set)
+{
+  int64_t capacity = set->set.capacity;
+  if(capacity >= set->max_capacity)
+    return DATA_REGION_SET_OUT_OF_SPACE;
+
+  int64_t newCapacity = capacity <= set->max_capacity / 2 ? capacity * 2 : set->max_capacity;
+  newCapacity = newCapacity > DATA_REGION_SMALL_SET_INLINE_CAPACITY ? newCapacity : DATA_REGION_SMALL_SET_INLINE_CAPACITY + 1;
+  int isInline = _data_region_small_set_fix(set)->regions == set->inline_regions;
+  DataRegion* regions = realloc(isInline ? NULL : set->set.regions, sizeof(DataRegion) * newCapacity);
+  if(regions == NULL)
+    return DATA_REGION_SET_ALLOCATION_FAILED;
+
+  if(isInline)
+    memcpy(regions, set->inline_regions, sizeof(DataRegion) * set->set.count);
+  set->set.regions = regions;
+  set->set.capacity = newCapacity;
+  return DATA_REGION_SET_SUCCESS;
+}
+
+/* Internal function to move the DataRegions of a DataRegionSmallSet back
+ * inline once few enough remain. Only half of the inline capacity may
+ * remain, so that alternating adds and removes don't allocate each time. */
+void _data_region_small_set_shrink(DataRegionSmallSet* set)
+{
+  DataRegion* regions = _data_region_small_set_fix(set)->regions;
+  if(regions != set->inline_regions && set->set.count <= DATA_REGION_SMALL_SET_INLINE_CAPACITY / 2)
+  {
+    memcpy(set->inline_regions, regions, sizeof(DataRegion) * set->set.count);
+    free(regions);
+    set->set.regions = set->inline_regions;
+    set->set.capacity = set->max_capacity < DATA_REGION_SMALL_SET_INLINE_CAPACITY ? set->max_capacity : DATA_REGION_SMALL_SET_INLINE_CAPACITY;
+  }
+}
+
+/* Frees the heap DataRegions of a DataRegionSmallSet (if any), leaving it
+ * empty and usable.
+ * @param set - The DataRegionSmallSet. If this argument is NULL, then
+ *        nothing will happen. */
+void data_region_small_set_free(DataRegionSmallSet* set)
+{
+  if(set == NULL)
+    return;
+
+  DataRegion* regions = _data_region_small_set_fix(set)->regions;
+  if(regions != set->inline_regions)
+    free(regions);
+  data_region_small_set_init(set, set->max_capacity);
+}
+
+/* Removes all DataRegions from a DataRegionSmallSet, and frees its heap
+ * DataRegions (if any).
+ * @param set - The DataRegionSmallSet. If this argument is NULL, then
+ *        nothing will happen. */
+void data_region_small_set_clear(DataRegionSmallSet* set)
+{
+  data_region_small_set_free(set);
+}
+
+/* Gets the DataRegionSet of a DataRegionSmallSet, for the functions of
+ * data_region.h and of the other headers.
+ * @param set - The DataRegionSmallSet.
+ * @returns - The DataRegionSet, or NULL if 'set' is NULL.
+ * @remarks - The DataRegionSet doesn't grow by itself: adds and removes on it
+ *          return DATA_REGION_SET_OUT_OF_SPACE when its current capacity is
+ *          full. It is valid until the next add or remove of the
+ *          DataRegionSmallSet. */
+DataRegionSet* data_region_small_set_get(DataRegionSmallSet* set)
+{
+  return set != NULL ? _data_region_small_set_fix(set) : NULL;
+}
+
+/* Adds a DataRegion to a DataRegionSmallSet, moving its DataRegions to the
+ * heap (or to a larger heap array) if they don't fit.
+ * @param set - The DataRegionSmallSet.
+ * @param toAdd - The DataRegion to add.
+ * @returns - The DataRegionSetResult of 'data_region_set_add', or
+ *          DATA_REGION_SET_ALLOCATION_FAILED if the heap array couldn't be
+ *          allocated (in which case nothing changes). */
+DataRegionSetResult data_region_small_set_add(DataRegionSmallSet* set, DataRegion toAdd)
+{
+  if(set == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+
+  //Grow before the add, so that it is done (and counted by data_region_stats.h) only once
+  DataRegionSet* inner = _data_region_small_set_fix(set);
+  if(data_region_is_valid(toAdd) && !_data_region_set_can_add(inner, toAdd) && _data_region_small_set_grow(set) == DATA_REGION_SET_ALLOCATION_FAILED)
+    return DATA_REGION_SET_ALLOCATION_FAILED;
+  return data_region_set_add(inner, toAdd);
+}
+
+/* Removes a DataRegion from a DataRegionSmallSet, moving its DataRegions to
+ * the heap if a split doesn't fit, and back inline once few remain.
+ * @param set - The DataRegionSmallSet.
+ * @param toRemove - The DataRegion to remove.
+ * @returns - The DataRegionSetResult of 'data_region_set_remove', or
+ *          DATA_REGION_SET_ALLOCATION_FAILED if the heap array couldn't be
+ *          allocated (in which case nothing changes). */
+DataRegionSetResult data_region_small_set_remove(DataRegionSmallSet* set, DataRegion toRemove)
+{
+  if(set == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+
+  DataRegionSet* inner = _data_region_small_set_fix(set);
+  if(data_region_is_valid(toRemove) && !_data_region_set_can_remove(inner, toRemove) && _data_region_small_set_grow(set) == DATA_REGION_SET_ALLOCATION_FAILED)
+    return DATA_REGION_SET_ALLOCATION_FAILED;
+  DataRegionSetResult result = data_region_set_remove(inner, toRemove);
+  if(result == DATA_REGION_SET_SUCCESS)
+    _data_region_small_set_shrink(set);
+  return result;
+}
+
+/* Copies the DataRegions of a DataRegionSmallSet within a boundary region
+ * (see data_region_set_crop). */
+int64_t data_region_small_set_crop(DataRegion* dst, int64_t dstCapacity, DataRegionSmallSet* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  return data_region_set_crop(dst, dstCapacity, data_region_small_set_get(src), boundaryRegion, dstTooSmall);
+}
+
+/* Counts the DataRegions of a DataRegionSmallSet within a boundary region
+ * (see data_region_set_count_crop). */
+int64_t data_region_small_set_count_crop(DataRegionSmallSet* src, DataRegion boundaryRegion)
+{
+  return data_region_set_count_crop(data_region_small_set_get(src), boundaryRegion);
+}
+
+/* Copies the gaps of a DataRegionSmallSet within a boundary region (see
+ * data_region_set_negative_crop). */
+int64_t data_region_small_set_negative_crop(DataRegion* dst, int64_t dstCapacity, DataRegionSmallSet* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  return data_region_set_negative_crop(dst, dstCapacity, data_region_small_set_get(src), boundaryRegion, dstTooSmall);
+}
+
+/* Gets the number of DataRegions of a DataRegionSmallSet (zero if it is
+ * NULL). */
+int64_t data_region_small_set_count(DataRegionSmallSet* set)
+{
+  return set != NULL ? set->set.count : 0;
+}
+
+/* Gets the total length of the DataRegions of a DataRegionSmallSet (zero if
+ * it is NULL). */
+int64_t data_region_small_set_total_length(DataRegionSmallSet* set)
+{
+  return set != NULL ? set->set.total_length : 0;
+}
+
+#endif//DATA_REGION_SMALL_H
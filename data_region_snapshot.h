@@ -0,0 +1,651 @@
+#ifndef DATA_REGION_SNAPSHOT_H
+#define DATA_REGION_SNAPSHOT_H
+#include "data_region.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+/* The maximum number of DataRegions stored in each DataRegionChunk. Larger
+ * chunks make queries cheaper but make each mutation copy more DataRegions. */
+#ifndef DATA_REGION_SNAPSHOT_CHUNK_CAPACITY
+#define DATA_REGION_SNAPSHOT_CHUNK_CAPACITY 64
+#endif
+
+/* Immutable block of DataRegions which may be shared by many snapshots.
+ * A chunk is never modified after it has been published, it is only
+ * released once no snapshot references it. */
+typedef struct DataRegionChunk
+{
+  /* The number of DataRegionSnapshots that reference this chunk. */
+  atomic_int_fast64_t ref_count;
+
+  /* The number of DataRegions stored in 'regions'. */
+  int64_t count;
+
+  /* The sum of the lengths of all DataRegions stored in 'regions'. */
+  int64_t total_length;
+
+  /* The DataRegions, in ascending order. */
+  DataRegion regions[DATA_REGION_SNAPSHOT_CHUNK_CAPACITY];
+} DataRegionChunk;
+
+/* Immutable, reference-counted view of a DataRegionCowSet at a specific
+ * point in time. The DataRegions are stored in ascending order across all
+ * chunks, and no DataRegions are overlapping or immediately adjacent.
+ * Obtain a snapshot via 'data_region_cow_set_snapshot', and release it via
+ * 'data_region_snapshot_release'.
+ * @see data_region_snapshot_count
+ * @see data_region_snapshot_crop
+ * @see data_region_snapshot_negative_crop */
+typedef struct DataRegionSnapshot
+{
+  /* The number of owners of this snapshot (including the DataRegionCowSet
+   * while this is its current snapshot). */
+  atomic_int_fast64_t ref_count;
+
+  /* The total number of DataRegions stored in all chunks. */
+  int64_t count;
+
+  /* The sum of the lengths of all DataRegions stored in all chunks. */
+  int64_t total_length;
+
+  /* The number of pointers stored in 'chunks'. */
+  int64_t chunk_count;
+
+  /* The chunks, in ascending order. No chunk is empty. */
+  DataRegionChunk* chunks[];
+} DataRegionSnapshot;
+
+/* Copy-on-write collection of DataRegions which can be snapshotted in O(1).
+ * Mutations copy only the chunks that they modify (plus the array of chunk
+ * pointers), and share all untouched chunks with older snapshots.
+ * Any number of threads may take snapshots while another thread mutates the
+ * set. Concurrent mutations are serialized.
+ * Allocate one via 'data_region_cow_set_create'.
+ * @see data_region_cow_set_add
+ * @see data_region_cow_set_remove
+ * @see data_region_cow_set_snapshot */
+typedef struct DataRegionCowSet
+{
+  /* Serializes the mutating operations. */
+  pthread_mutex_t write_lock;
+
+  /* Protects 'current' while it is being replaced. This lock is only held
+   * for O(1) time. */
+  pthread_mutex_t publish_lock;
+
+  /* The most recently published snapshot. */
+  DataRegionSnapshot* current;
+} DataRegionCowSet;
+
+/* Internal function to allocate a new DataRegionChunk with a reference count
+ * of one.
+ * @returns - The new chunk, or NULL if 'malloc' failed. */
+DataRegionChunk* _data_region_chunk_create()
+{
+  DataRegionChunk* chunk = malloc(sizeof(DataRegionChunk));
+  if(chunk == NULL)
+    return NULL;
+
+  atomic_init(&chunk->ref_count, 1);
+  chunk->count = 0;
+  chunk->total_length = 0;
+  return chunk;
+}
+
+/* Internal function to release one reference to a DataRegionChunk.
+ * @param chunk - The chunk to release. It will be freed once its last
+ *        reference has been released. */
+void _data_region_chunk_release(DataRegionChunk* chunk)
+{
+  if(atomic_fetch_sub(&chunk->ref_count, 1) == 1)
+    free(chunk);
+}
+
+/* Internal function to allocate a DataRegionSnapshot with a reference count
+ * of one.
+ * @param chunkCount - The number of chunk pointers to allocate.
+ * @returns - The new snapshot (with uninitialized 'chunks'), or NULL if
+ *          'malloc' failed. */
+DataRegionSnapshot* _data_region_snapshot_alloc(int64_t chunkCount)
+{
+  DataRegionSnapshot* snapshot = malloc(sizeof(DataRegionSnapshot) + (sizeof(DataRegionChunk*) * chunkCount));
+  if(snapshot == NULL)
+    return NULL;
+
+  atomic_init(&snapshot->ref_count, 1);
+  snapshot->count = 0;
+  snapshot->total_length = 0;
+  snapshot->chunk_count = chunkCount;
+  return snapshot;
+}
+
+/* Acquires an additional reference to a DataRegionSnapshot.
+ * @param snapshot - The snapshot to retain. If this is NULL, then nothing
+ *        will happen.
+ * @returns - The 'snapshot' argument.
+ * @remarks - Each call to this function must be paired with a call to
+ *          'data_region_snapshot_release'. */
+DataRegionSnapshot* data_region_snapshot_retain(DataRegionSnapshot* snapshot)
+{
+  if(snapshot != NULL)
+    atomic_fetch_add(&snapshot->ref_count, 1);
+  return snapshot;
+}
+
+/* Releases a reference to a DataRegionSnapshot.
+ * @param snapshot - The snapshot to release. If this is NULL, then nothing
+ *        will happen.
+ * @remarks - The snapshot (and any chunks which are no longer shared with
+ *          another snapshot) will be freed once its last reference has been
+ *          released. */
+void data_region_snapshot_release(DataRegionSnapshot* snapshot)
+{
+  if(snapshot == NULL)
+    return;
+
+  if(atomic_fetch_sub(&snapshot->ref_count, 1) == 1)
+  {
+    for(int64_t i = 0; i < snapshot->chunk_count; i++)
+      _data_region_chunk_release(snapshot->chunks[i]);
+    free(snapshot);
+  }
+}
+
+/* Gets the number of DataRegions that are stored in a DataRegionSnapshot.
+ * @param snapshot - Pointer to the snapshot. If this is NULL, then zero
+ *        will be returned.
+ * @returns - The number of DataRegions stored in the snapshot. */
+int64_t data_region_snapshot_count(const DataRegionSnapshot* snapshot)
+{
+  if(snapshot == NULL)
+    return 0;
+  else
+    return snapshot->count;
+}
+
+/* Gets the length of the sum of all DataRegions stored in a
+ * DataRegionSnapshot.
+ * @param snapshot - Pointer to the snapshot. If this is NULL, then zero
+ *        will be returned.
+ * @returns - The total length of all stored DataRegions. */
+int64_t data_region_snapshot_total_length(const DataRegionSnapshot* snapshot)
+{
+  if(snapshot == NULL)
+    return 0;
+  else
+    return snapshot->total_length;
+}
+
+/* Gets a pointer to a DataRegion stored at a particular index in a
+ * DataRegionSnapshot.
+ * @param snapshot - Pointer to the snapshot. If this is NULL, then NULL
+ *        will be returned.
+ * @param index - The zero-based index of the DataRegion. If this is out
+ *        of bounds, then NULL will be returned.
+ * @returns - The pointer to the DataRegion stored in the 'snapshot' at the
+ *          specified 'index'. The pointer remains valid until the snapshot
+ *          is released. */
+const DataRegion* data_region_snapshot_at(const DataRegionSnapshot* snapshot, int64_t index)
+{
+  if(snapshot == NULL || index < 0 || index >= snapshot->count)
+    return NULL;
+
+  for(int64_t i = 0; i < snapshot->chunk_count; i++)
+  {
+    if(index < snapshot->chunks[i]->count)
+      return &snapshot->chunks[i]->regions[index];
+    index -= snapshot->chunks[i]->count;
+  }
+
+  return NULL;
+}
+
+/* Internal function to find the first chunk that may contain a specific
+ * index.
+ * @param snapshot - The snapshot to search.
+ * @param index - The index to search for.
+ * @returns - The position of the first chunk whose last DataRegion ends at or
+ *          after 'index', or the 'chunk_count' if there is no such chunk. */
+int64_t _data_region_snapshot_find_chunk(const DataRegionSnapshot* snapshot, int64_t index)
+{
+  int64_t low = 0, high = snapshot->chunk_count;
+  while(low < high)
+  {
+    int64_t mid = low + ((high - low) / 2);
+    const DataRegionChunk* chunk = snapshot->chunks[mid];
+    if(chunk->regions[chunk->count - 1].last_index < index)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+/* Checks whether a DataRegion is entirely present in a DataRegionSnapshot.
+ * @param snapshot - Pointer to the snapshot. If this is NULL, then false (0)
+ *        will be returned.
+ * @param region - The DataRegion to look for. If this is invalid (see
+ *        data_region_is_valid), then false (0) will be returned.
+ * @returns - True (1) if a single stored DataRegion contains all of 'region',
+ *          otherwise false (0). */
+int data_region_snapshot_contains(const DataRegionSnapshot* snapshot, DataRegion region)
+{
+  if(snapshot == NULL || !data_region_is_valid(region))
+    return 0;
+
+  int64_t chunkIndex = _data_region_snapshot_find_chunk(snapshot, region.first_index);
+  if(chunkIndex >= snapshot->chunk_count)
+    return 0;
+
+  //Find the first DataRegion (within the chunk) that ends at or after 'region'
+  const DataRegionChunk* chunk = snapshot->chunks[chunkIndex];
+  int64_t low = 0, high = chunk->count;
+  while(low < high)
+  {
+    int64_t mid = low + ((high - low) / 2);
+    if(chunk->regions[mid].last_index < region.first_index)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return data_region_contains(chunk->regions[low], region);
+}
+
+/* Copies a subset of DataRegions in a DataRegionSnapshot to an array.
+ * @remarks - This function behaves exactly like 'data_region_set_crop', but
+ *          reads from a DataRegionSnapshot. Only the chunks that intersect
+ *          the 'boundaryRegion' are visited.
+ * @see data_region_set_crop */
+int64_t data_region_snapshot_crop(DataRegion* dst, int64_t dstCapacity, const DataRegionSnapshot* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  int dstTooSmallPlaceholder;
+  if(dstTooSmall == NULL)
+    dstTooSmall = &dstTooSmallPlaceholder;
+  *dstTooSmall = 0;
+
+  if(src == NULL)
+    return 0;
+  if(!data_region_is_valid(boundaryRegion))
+    return 0;
+
+  if(dstCapacity < 0)
+  {
+    //Cannot have a negative destination capacity
+    *dstTooSmall = 1;
+    return 0;
+  }
+
+  int64_t count = 0;
+  for(int64_t i = _data_region_snapshot_find_chunk(src, boundaryRegion.first_index); i < src->chunk_count; i++)
+  {
+    DataRegionChunk* chunk = src->chunks[i];
+    if(chunk->regions[0].first_index > boundaryRegion.last_index)
+      break;//Beyond the boundary region, no need to continue iterating
+
+    //Crop the chunk as if it were a (read-only) DataRegionSet
+    DataRegionSet view;
+    _data_region_set_init(&view, chunk->regions, chunk->count);
+    view.count = chunk->count;
+    view.total_length = chunk->total_length;
+
+    if(dst != NULL)
+    {
+      count += _data_region_set_crop(dst + count, dstCapacity - count, &view, boundaryRegion, dstTooSmall);
+      if(*dstTooSmall)
+        break;
+    }
+    else
+    {
+      //When 'dst' is NULL, it indicates that we are only counting the DataRegions
+      count += _data_region_set_crop(NULL, 0, &view, boundaryRegion, NULL);
+    }
+  }
+
+  return count;
+}
+
+/* Counts the number of DataRegions in a DataRegionSnapshot that are at least
+ * partially contained within a specific boundary region.
+ * @remarks - This function behaves exactly like 'data_region_set_count_crop',
+ *          but reads from a DataRegionSnapshot.
+ * @see data_region_set_count_crop */
+int64_t data_region_snapshot_count_crop(const DataRegionSnapshot* src, DataRegion boundaryRegion)
+{
+  if(src == NULL)
+    return 0;
+  if(!data_region_is_valid(boundaryRegion))
+    return 0;
+
+  return data_region_snapshot_crop(NULL/*NULL indicates that we only want to count the DataRegions*/, 0, src, boundaryRegion, NULL);
+}
+
+/* Copies a 'negative' of a subset of DataRegions within a DataRegionSnapshot.
+ * @remarks - This function behaves exactly like
+ *          'data_region_set_negative_crop', but reads from a
+ *          DataRegionSnapshot.
+ * @see data_region_set_negative_crop */
+int64_t data_region_snapshot_negative_crop(DataRegion* dst, int64_t dstCapacity, const DataRegionSnapshot* src, DataRegion boundaryRegion, int* dstTooSmall)
+{
+  int dstTooSmallPlaceholder;
+  if (dstTooSmall == NULL)
+    dstTooSmall = &dstTooSmallPlaceholder;
+  *dstTooSmall = 0;
+
+  if(dst == NULL)
+    return 0;
+  if(src == NULL)
+    return 0;
+  if(!data_region_is_valid(boundaryRegion))
+    return 0;
+
+  if(dstCapacity < 1)
+  {
+    //Like 'data_region_set_negative_crop', at least one DataRegion is required
+    *dstTooSmall = 1;
+    return 0;
+  }
+
+  int64_t count = 0;
+  int64_t nextMissing = boundaryRegion.first_index;
+  for(int64_t i = _data_region_snapshot_find_chunk(src, boundaryRegion.first_index); i < src->chunk_count; i++)
+  {
+    const DataRegionChunk* chunk = src->chunks[i];
+    for(int64_t j = 0; j < chunk->count; j++)
+    {
+      DataRegion current = chunk->regions[j];
+      if(current.last_index < nextMissing)
+        continue;//Before the boundary region
+      if(current.first_index > boundaryRegion.last_index)
+        goto done;//Beyond the boundary region, no need to continue iterating
+
+      if(current.first_index > nextMissing)
+      {
+        //Yield the gap before 'current'
+        if(count >= dstCapacity)
+        {
+          *dstTooSmall = 1;
+          return 0;
+        }
+        dst[count++] = (DataRegion){ nextMissing, current.first_index - 1 };
+      }
+
+      if(current.last_index >= boundaryRegion.last_index)
+        return count;//The remainder of the boundary region is present
+      nextMissing = current.last_index + 1;
+    }
+  }
+
+done:
+  //Yield the gap after the last present DataRegion
+  if(count >= dstCapacity)
+  {
+    *dstTooSmall = 1;
+    return 0;
+  }
+  dst[count++] = (DataRegion){ nextMissing, boundaryRegion.last_index };
+  return count;
+}
+
+/* Allocates a new, empty DataRegionCowSet.
+ * @returns - A pointer to the allocated DataRegionCowSet, or NULL upon
+ *          failure.
+ * @remarks - Be sure to free the returned DataRegionCowSet by calling the
+ *          'data_region_cow_set_free' function.
+ * @see data_region_cow_set_free */
+DataRegionCowSet* data_region_cow_set_create()
+{
+  DataRegionCowSet* set = malloc(sizeof(DataRegionCowSet));
+  if(set == NULL)
+    return NULL;
+
+  set->current = _data_region_snapshot_alloc(0);
+  if(set->current == NULL)
+  {
+    free(set);
+    return NULL;
+  }
+
+  pthread_mutex_init(&set->write_lock, NULL);
+  pthread_mutex_init(&set->publish_lock, NULL);
+  return set;
+}
+
+/* Frees a DataRegionCowSet that was allocated by the
+ * 'data_region_cow_set_create' function.
+ * @param set - Pointer to the DataRegionCowSet. If this argument is NULL, then
+ *        nothing will happen.
+ * @remarks - Snapshots which were obtained from the set remain valid until
+ *          they are released. No other thread may be using the set when it
+ *          is freed. */
+void data_region_cow_set_free(DataRegionCowSet* set)
+{
+  if(set == NULL)
+    return;
+
+  data_region_snapshot_release(set->current);
+  pthread_mutex_destroy(&set->write_lock);
+  pthread_mutex_destroy(&set->publish_lock);
+  free(set);
+}
+
+/* Obtains the current contents of a DataRegionCowSet in O(1) time.
+ * @param set - Pointer to the DataRegionCowSet. If this is NULL, then NULL
+ *        will be returned.
+ * @returns - The current snapshot, which will never change even if the set
+ *          is mutated afterward.
+ * @remarks - Be sure to release the returned snapshot by calling the
+ *          'data_region_snapshot_release' function.
+ * @see data_region_snapshot_release */
+DataRegionSnapshot* data_region_cow_set_snapshot(DataRegionCowSet* set)
+{
+  if(set == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&set->publish_lock);
+  DataRegionSnapshot* snapshot = data_region_snapshot_retain(set->current);
+  pthread_mutex_unlock(&set->publish_lock);
+  return snapshot;
+}
+
+/* Internal function to add or remove a DataRegion by copying the affected
+ * chunks and publishing a new snapshot.
+ * @param set - The DataRegionCowSet to mutate.
+ * @param region - The (valid) DataRegion to add or remove.
+ * @param isAdd - True (1) to add 'region', false (0) to remove it.
+ * @returns - DATA_REGION_SET_SUCCESS, or DATA_REGION_SET_ALLOCATION_FAILED in
+ *          which case the set remains unchanged. */
+DataRegionSetResult _data_region_cow_set_mutate(DataRegionCowSet* set, DataRegion region, int isAdd)
+{
+  pthread_mutex_lock(&set->write_lock);
+  DataRegionSnapshot* old = set->current;//Only writers replace 'current', so no need for 'publish_lock'
+
+  if(isAdd && data_region_snapshot_contains(old, region))
+  {
+    //Nothing would change
+    pthread_mutex_unlock(&set->write_lock);
+    return DATA_REGION_SET_SUCCESS;
+  }
+
+  //Find the span of chunks [first, last) which will be modified. Note that adjacent DataRegions are also affected by an add.
+  int64_t affectedFirst = region.first_index, affectedLast = region.last_index;
+  if(isAdd)
+  {
+    affectedFirst = affectedFirst > INT64_MIN ? affectedFirst - 1 : affectedFirst;
+    affectedLast = affectedLast < INT64_MAX ? affectedLast + 1 : affectedLast;
+  }
+  int64_t first = _data_region_snapshot_find_chunk(old, affectedFirst);
+  if(isAdd && first == old->chunk_count && first > 0)
+    first--;//Append to the last chunk
+  int64_t last = first;
+  while(last < old->chunk_count && old->chunks[last]->regions[0].first_index <= affectedLast)
+    last++;
+
+  if(last == first)
+  {
+    if(!isAdd)
+    {
+      //Nothing intersects the DataRegion to remove
+      pthread_mutex_unlock(&set->write_lock);
+      return DATA_REGION_SET_SUCCESS;
+    }
+
+    if(first < old->chunk_count)
+      last++;//Insert into the chunk which follows 'region'
+  }
+
+  int64_t spanCount = 0, spanLength = 0;
+  for(int64_t i = first; i < last; i++)
+  {
+    spanCount += old->chunks[i]->count;
+    spanLength += old->chunks[i]->total_length;
+  }
+
+  //Avoid accumulating small chunks by absorbing a neighbor into a small span
+  if(spanCount < DATA_REGION_SNAPSHOT_CHUNK_CAPACITY / 2)
+  {
+    if(last < old->chunk_count)
+    {
+      spanCount += old->chunks[last]->count;
+      spanLength += old->chunks[last]->total_length;
+      last++;
+    }
+    else if(first > 0)
+    {
+      first--;
+      spanCount += old->chunks[first]->count;
+      spanLength += old->chunks[first]->total_length;
+    }
+  }
+
+  //Apply the operation to a copy of the span (an add or remove changes the count by at most one)
+  DataRegion* buffer = malloc(sizeof(DataRegion) * (spanCount + 1));
+  if(buffer == NULL)
+  {
+    pthread_mutex_unlock(&set->write_lock);
+    return DATA_REGION_SET_ALLOCATION_FAILED;
+  }
+
+  DataRegionSet span;
+  _data_region_set_init(&span, buffer, spanCount + 1);
+  for(int64_t i = first; i < last; i++)
+  {
+    memcpy(buffer + span.count, old->chunks[i]->regions, sizeof(DataRegion) * old->chunks[i]->count);
+    span.count += old->chunks[i]->count;
+  }
+  span.total_length = spanLength;
+
+  //The span is scratch space, so the instrumented functions aren't used on it
+  if(isAdd)
+    _data_region_set_add_delta(&span, region, NULL, NULL, NULL);
+  else
+    _data_region_set_remove_delta(&span, region, NULL, NULL, NULL);
+
+  //Split the span evenly into new chunks
+  int64_t newChunkCount = (span.count + DATA_REGION_SNAPSHOT_CHUNK_CAPACITY - 1) / DATA_REGION_SNAPSHOT_CHUNK_CAPACITY;
+  DataRegionSnapshot* snapshot = _data_region_snapshot_alloc(old->chunk_count - (last - first) + newChunkCount);
+  if(snapshot == NULL)
+  {
+    free(buffer);
+    pthread_mutex_unlock(&set->write_lock);
+    return DATA_REGION_SET_ALLOCATION_FAILED;
+  }
+
+  for(int64_t i = 0; i < newChunkCount; i++)
+  {
+    DataRegionChunk* chunk = _data_region_chunk_create();
+    if(chunk == NULL)
+    {
+      for(int64_t j = 0; j < i; j++)
+        _data_region_chunk_release(snapshot->chunks[first + j]);
+      free(snapshot);
+      free(buffer);
+      pthread_mutex_unlock(&set->write_lock);
+      return DATA_REGION_SET_ALLOCATION_FAILED;
+    }
+
+    int64_t begin = (span.count * i) / newChunkCount;
+    int64_t end = (span.count * (i + 1)) / newChunkCount;
+    chunk->count = end - begin;
+    for(int64_t j = begin; j < end; j++)
+    {
+      chunk->regions[j - begin] = buffer[j];
+      chunk->total_length += data_region_length(buffer[j]);
+    }
+    snapshot->chunks[first + i] = chunk;
+  }
+  free(buffer);
+
+  //Share all untouched chunks with the old snapshot
+  for(int64_t i = 0; i < first; i++)
+  {
+    atomic_fetch_add(&old->chunks[i]->ref_count, 1);
+    snapshot->chunks[i] = old->chunks[i];
+  }
+  for(int64_t i = last; i < old->chunk_count; i++)
+  {
+    atomic_fetch_add(&old->chunks[i]->ref_count, 1);
+    snapshot->chunks[i - (last - first) + newChunkCount] = old->chunks[i];
+  }
+  snapshot->count = old->count - spanCount + span.count;
+  snapshot->total_length = old->total_length - spanLength + span.total_length;
+
+  //Publish the new snapshot
+  pthread_mutex_lock(&set->publish_lock);
+  set->current = snapshot;
+  pthread_mutex_unlock(&set->publish_lock);
+
+  pthread_mutex_unlock(&set->write_lock);
+  data_region_snapshot_release(old);
+  return DATA_REGION_SET_SUCCESS;
+}
+
+/* Adds a DataRegion to a DataRegionCowSet.
+ * @param set - The destination DataRegionCowSet. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toAdd - The DataRegion to add. If this is invalid (see
+ *        data_region_is_valid), then DATA_REGION_SET_INVALID_REGION will
+ *        be returned.
+ * @returns - The DataRegionSetResult that defines the result of the add
+ *          operation. If all arguments are non-null and valid, then the
+ *          result will be either DATA_REGION_SET_SUCCESS or
+ *          DATA_REGION_SET_ALLOCATION_FAILED.
+ * @remarks - This behaves like 'data_region_set_add', but existing snapshots
+ *          are not affected. Only the chunks that intersect (or are adjacent
+ *          to) 'toAdd' are copied. */
+DataRegionSetResult data_region_cow_set_add(DataRegionCowSet* set, DataRegion toAdd)
+{
+  if(set == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(toAdd))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  return _data_region_cow_set_mutate(set, toAdd, 1);
+}
+
+/* Removes a DataRegion from a DataRegionCowSet.
+ * @param set - Pointer to the DataRegionCowSet from which to remove the
+ *        DataRegion. If this argument is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param toRemove - The DataRegion to remove. If this is invalid
+ *        (see data_region_is_valid), then DATA_REGION_SET_INVALID_REGION
+ *        will be returned.
+ * @returns - The DataRegionSetResult that defines the result of the removal
+ *          operation. If all arguments are non-null and valid, then the
+ *          result will be either DATA_REGION_SET_SUCCESS or
+ *          DATA_REGION_SET_ALLOCATION_FAILED.
+ * @remarks - This behaves like 'data_region_set_remove', but existing
+ *          snapshots are not affected. Only the chunks that intersect
+ *          'toRemove' are copied. */
+DataRegionSetResult data_region_cow_set_remove(DataRegionCowSet* set, DataRegion toRemove)
+{
+  if(set == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+  if(!data_region_is_valid(toRemove))
+    return DATA_REGION_SET_INVALID_REGION;
+
+  return _data_region_cow_set_mutate(set, toRemove, 0);
+}
+
+#endif//DATA_REGION_SNAPSHOT_H
@@ -0,0 +1,512 @@
+#ifndef DATA_REGION_TRACE_H
+#define DATA_REGION_TRACE_H
+#include "data_region.h"
+#include <stdio.h>
+
+/* The operation of one record of a trace (the same values as
+ * DataRegionStatsOperation). */
+typedef enum DataRegionTraceOperation
+{
+  DATA_REGION_TRACE_ADD = 0,
+  DATA_REGION_TRACE_REMOVE = 1,
+  DATA_REGION_TRACE_CROP = 2,
+  DATA_REGION_TRACE_COUNT_CROP = 3,
+  DATA_REGION_TRACE_NEGATIVE_CROP = 4
+} DataRegionTraceOperation;
+
+/* One operation on a DataRegionSet, and its DataRegion argument (the
+ * boundary region of the crop operations). */
+typedef struct DataRegionTraceRecord
+{
+  DataRegionTraceOperation operation;
+  DataRegion region;
+
+  /* Whether 'result' holds the result that the operation returned when it
+   * was recorded (see data_region_trace_write_recording). Generated
+   * records have no result. */
+  int has_result;
+
+  /* The returned DataRegionSetResult (adds and removes) or number of
+   * DataRegions (crops). */
+  int64_t result;
+} DataRegionTraceRecord;
+
+/* The workloads that a DataRegionTraceGenerator models. */
+typedef enum DataRegionTraceWorkload
+{
+  /* A cache of HTTP range requests. Chunks are requested with Zipf
+   * popularity; each request looks up its missing bytes, fills them, and
+   * sometimes evicts an unpopular chunk. */
+  DATA_REGION_TRACE_HTTP_RANGES = 0,
+
+  /* A peer-to-peer download. A few pieces at a time arrive block by block
+   * in random order; each completed piece is checked, a few fail their hash
+   * check and are discarded, and the missing bytes of the whole file are
+   * queried now and then. */
+  DATA_REGION_TRACE_P2P_PIECES = 1,
+
+  /* A video player. Segments are fetched ahead of the playhead, the
+   * buffered bytes around it are queried, the bytes far behind it are
+   * evicted, and the playhead sometimes seeks to a random position. */
+  DATA_REGION_TRACE_VIDEO_SEEK = 2,
+
+  /* The dirty pages of a database file. Pages are written with a hot/cold
+   * skew, and a checkpoint regularly enumerates and writes back the dirty
+   * pages of the next slice of the file. */
+  DATA_REGION_TRACE_DB_WRITEBACK = 3
+} DataRegionTraceWorkload;
+
+/* The number of pieces that a P2P trace downloads at once. */
+#define DATA_REGION_TRACE_ACTIVE_PIECES 8
+
+/* Deterministic generator of a trace of one workload. The records depend
+ * only on the workload, the length and the seed.
+ * @see data_region_trace_generator_init
+ * @see data_region_trace_generator_next */
+typedef struct DataRegionTraceGenerator
+{
+  DataRegionTraceWorkload workload;
+
+  /* The length of the modeled file (or object), and the size of its chunks,
+   * pieces, segments or pages. */
+  int64_t length;
+  int64_t unit;
+  int64_t unit_count;
+
+  /* The state of the random number generator. */
+  uint64_t state;
+
+  /* The records of the current event that weren't returned yet. */
+  DataRegionTraceRecord pending[4];
+  int pending_count;
+  int pending_next;
+
+  /* The number of generated events. */
+  int64_t event_count;
+
+  /* The video playhead, or the next slice of a database checkpoint. */
+  int64_t position;
+
+  /* The next P2P piece, as a position within a random permutation. */
+  int64_t next_piece;
+  int64_t piece_stride;
+
+  /* The P2P pieces being downloaded, and their next blocks. */
+  int64_t active_pieces[DATA_REGION_TRACE_ACTIVE_PIECES];
+  int64_t active_blocks[DATA_REGION_TRACE_ACTIVE_PIECES];
+} DataRegionTraceGenerator;
+
+/* Writer of the binary trace format. A trace is the 8-byte header "DRTRACE1"
+ * followed by one record per operation: the operation byte, the zigzag
+ * varint of the distance from the first index of the previous record, and
+ * the varint of the region length minus one. Records of nearby byte ranges
+ * take 3 to 5 bytes, and records far apart within a large file up to 10.
+ * If the record has a result, then the high bit of the operation byte is
+ * set, and the zigzag varint of the result follows.
+ * @see data_region_trace_writer_init
+ * @see data_region_trace_reader_init */
+typedef struct DataRegionTraceWriter
+{
+  FILE* file;
+  int64_t previous_first;
+  int64_t record_count;
+} DataRegionTraceWriter;
+
+/* Reader of the binary trace format (see DataRegionTraceWriter). */
+typedef struct DataRegionTraceReader
+{
+  FILE* file;
+  int64_t previous_first;
+} DataRegionTraceReader;
+
+#define _DATA_REGION_TRACE_MAGIC "DRTRACE1"
+#define _DATA_REGION_TRACE_HAS_RESULT 0x80
+
+/* Initializes a DataRegionTraceWriter, and writes the trace header.
+ * @param writer - The DataRegionTraceWriter to initialize.
+ * @param file - The file to write to, which has to stay open while the
+ *        writer is used.
+ * @returns - True (1) on success, otherwise false (0). */
+int data_region_trace_writer_init(DataRegionTraceWriter* writer, FILE* file)
+{
+  if(writer == NULL || file == NULL)
+    return 0;
+
+  writer->file = file;
+  writer->previous_first = 0;
+  writer->record_count = 0;
+  return fwrite(_DATA_REGION_TRACE_MAGIC, 1, 8, file) == 8;
+}
+
+/* Internal function to write a base-128 varint. */
+int _data_region_trace_write_varint(FILE* file, uint64_t value)
+{
+  uint8_t bytes[10];
+  int count = 0;
+  while(value >= 0x80)
+  {
+    bytes[count++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  bytes[count++] = (uint8_t)value;
+  return fwrite(bytes, 1, (size_t)count, file) == (size_t)count;
+}
+
+/* Internal function to read a base-128 varint.
+ * @returns - 1 on success, 0 at the end of the file (before the first
+ *          byte), or -1 if the varint is truncated or too long. */
+int _data_region_trace_read_varint(FILE* file, uint64_t* value)
+{
+  *value = 0;
+  for(int shift = 0; shift < 64; shift += 7)
+  {
+    int byte = fgetc(file);
+    if(byte == EOF)
+      return shift == 0 ? 0 : -1;
+
+    *value |= (uint64_t)(byte & 0x7F) << shift;
+    if((byte & 0x80) == 0)
+      return 1;
+  }
+  return -1;
+}
+
+/* Appends a record to a trace.
+ * @param writer - The DataRegionTraceWriter.
+ * @param record - The record, whose region has to be valid.
+ * @returns - True (1) on success, otherwise false (0). */
+int data_region_trace_write(DataRegionTraceWriter* writer, DataRegionTraceRecord record)
+{
+  if(writer == NULL || !data_region_is_valid(record.region) || (unsigned)record.operation > DATA_REGION_TRACE_NEGATIVE_CROP)
+    return 0;
+
+  //Zigzag encoding keeps small backward distances short, too
+  uint64_t delta = (uint64_t)record.region.first_index - (uint64_t)writer->previous_first;
+  uint64_t zigzag = (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+  uint64_t lengthMinusOne = (uint64_t)record.region.last_index - (uint64_t)record.region.first_index;
+  uint64_t result = ((uint64_t)record.result << 1) ^ (uint64_t)(record.result >> 63);
+  int operation = (int)record.operation | (record.has_result ? _DATA_REGION_TRACE_HAS_RESULT : 0);
+  if(fputc(operation, writer->file) == EOF
+    || !_data_region_trace_write_varint(writer->file, zigzag)
+    || !_data_region_trace_write_varint(writer->file, lengthMinusOne)
+    || (record.has_result && !_data_region_trace_write_varint(writer->file, result)))
+  {
+    return 0;
+  }
+
+  writer->previous_first = record.region.first_index;
+  writer->record_count++;
+  return 1;
+}
+
+/* Initializes a DataRegionTraceReader, and reads the trace header.
+ * @param reader - The DataRegionTraceReader to initialize.
+ * @param file - The file to read from, which has to stay open while the
+ *        reader is used.
+ * @returns - True (1) on success, or false (0) if the file doesn't start
+ *          with a trace header. */
+int data_region_trace_reader_init(DataRegionTraceReader* reader, FILE* file)
+{
+  if(reader == NULL || file == NULL)
+    return 0;
+
+  char magic[8];
+  reader->file = file;
+  reader->previous_first = 0;
+  return fread(magic, 1, 8, file) == 8 && memcmp(magic, _DATA_REGION_TRACE_MAGIC, 8) == 0;
+}
+
+/* Reads the next record of a trace.
+ * @param reader - The DataRegionTraceReader.
+ * @param record - Assigned to the record.
+ * @returns - 1 if a record was read, 0 at the end of the trace, or -1 if the
+ *          trace is corrupt. */
+int data_region_trace_read(DataRegionTraceReader* reader, DataRegionTraceRecord* record)
+{
+  if(reader == NULL || record == NULL)
+    return -1;
+
+  int operation = fgetc(reader->file);
+  if(operation == EOF)
+    return 0;
+  int hasResult = (operation & _DATA_REGION_TRACE_HAS_RESULT) != 0;
+  operation &= ~_DATA_REGION_TRACE_HAS_RESULT;
+  if(operation > DATA_REGION_TRACE_NEGATIVE_CROP)
+    return -1;
+
+  uint64_t zigzag, lengthMinusOne, result = 0;
+  if(_data_region_trace_read_varint(reader->file, &zigzag) != 1 || _data_region_trace_read_varint(reader->file, &lengthMinusOne) != 1)
+    return -1;
+  if(hasResult && _data_region_trace_read_varint(reader->file, &result) != 1)
+    return -1;
+
+  uint64_t delta = (zigzag >> 1) ^ (0 - (zigzag & 1));
+  int64_t first = (int64_t)((uint64_t)reader->previous_first + delta);
+  record->operation = (DataRegionTraceOperation)operation;
+  record->has_result = hasResult;
+  record->result = (int64_t)((result >> 1) ^ (0 - (result & 1)));
+  record->region.first_index = first;
+  record->region.last_index = (int64_t)((uint64_t)first + lengthMinusOne);
+  if(!data_region_is_valid(record->region))//The last index overflowed
+    return -1;
+
+  reader->previous_first = first;
+  return 1;
+}
+
+/* Internal xorshift64 step of a DataRegionTraceGenerator. */
+uint64_t _data_region_trace_rand(DataRegionTraceGenerator* generator)
+{
+  uint64_t x = generator->state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return generator->state = x;
+}
+
+/* Internal function to get a random number within [0, bound). */
+int64_t _data_region_trace_uniform(DataRegionTraceGenerator* generator, int64_t bound)
+{
+  return (int64_t)(_data_region_trace_rand(generator) % (uint64_t)bound);
+}
+
+/* Internal function to get a Zipf-distributed rank within [0, bound), where
+ * rank r is picked with a probability of roughly 1/(r+1). A power of two is
+ * picked uniformly first, and then a number within it, which needs no
+ * floating-point math. */
+int64_t _data_region_trace_zipf(DataRegionTraceGenerator* generator, int64_t bound)
+{
+  int bits = 0;
+  while(bits < 62 && ((int64_t)1 << (bits + 1)) <= bound)
+    bits++;
+
+  int64_t low = ((int64_t)1 << _data_region_trace_uniform(generator, bits + 1)) - 1;
+  int64_t high = (low * 2) + 1 < bound ? (low * 2) + 1 : bound;
+  return low + _data_region_trace_uniform(generator, high - low);
+}
+
+/* Internal function to queue a record of the current event. */
+void _data_region_trace_emit(DataRegionTraceGenerator* generator, DataRegionTraceOperation operation, int64_t first, int64_t length)
+{
+  if(first + length > generator->length)
+    length = generator->length - first;
+
+  DataRegionTraceRecord* record = &generator->pending[generator->pending_count++];
+  record->operation = operation;
+  record->region.first_index = first;
+  record->region.last_index = first + length - 1;
+  record->has_result = 0;
+  record->result = 0;
+}
+
+/* Initializes a DataRegionTraceGenerator.
+ * @param generator - The DataRegionTraceGenerator to initialize.
+ * @param workload - The modeled workload.
+ * @param length - The length of the modeled file. The units are 64 KiB
+ *        HTTP chunks, 256 KiB P2P pieces (of 16 KiB blocks), 512 KiB video
+ *        segments or 8 KiB database pages, so it has to hold at least 16 of
+ *        them (a partial unit at the end is never used).
+ * @param seed - The seed of the random number generator.
+ * @returns - True (1) on success, or false (0) if an argument is invalid. */
+int data_region_trace_generator_init(DataRegionTraceGenerator* generator, DataRegionTraceWorkload workload, int64_t length, uint64_t seed)
+{
+  static const int64_t units[] = { 64 * 1024, 256 * 1024, 512 * 1024, 8 * 1024 };
+  if(generator == NULL || (unsigned)workload > DATA_REGION_TRACE_DB_WRITEBACK)
+    return 0;
+  if(length / units[workload] < 16)
+    return 0;
+
+  memset(generator, 0, sizeof(DataRegionTraceGenerator));
+  generator->workload = workload;
+  generator->length = length;
+  generator->unit = units[workload];
+  generator->unit_count = length / generator->unit;
+  generator->state = seed != 0 ? seed : 0x9E3779B97F4A7C15ull;
+
+  //Pieces are visited in the order 'i * stride mod count', with a stride coprime to the count
+  int64_t stride = 1 + _data_region_trace_uniform(generator, generator->unit_count - 1);
+  for(;;)
+  {
+    int64_t a = stride, b = generator->unit_count;
+    while(b != 0)
+    {
+      int64_t t = a % b;
+      a = b;
+      b = t;
+    }
+    if(a == 1)
+      break;
+    stride++;
+  }
+  generator->piece_stride = stride;
+  for(int i = 0; i < DATA_REGION_TRACE_ACTIVE_PIECES; i++)
+    generator->active_pieces[i] = -1;
+  return 1;
+}
+
+/* Internal function to generate the records of one HTTP range request. */
+void _data_region_trace_http_event(DataRegionTraceGenerator* generator)
+{
+  //Popular chunks are spread over the object, rather than all at its start
+  int64_t rank = _data_region_trace_zipf(generator, generator->unit_count);
+  int64_t chunk = (rank * generator->piece_stride) % generator->unit_count;
+  int64_t first = (chunk * generator->unit) + (_data_region_trace_uniform(generator, 4) * (generator->unit / 4));
+  int64_t length = (1 + _data_region_trace_uniform(generator, 4)) * (generator->unit / 2);
+  _data_region_trace_emit(generator, DATA_REGION_TRACE_NEGATIVE_CROP, first, length);
+  _data_region_trace_emit(generator, DATA_REGION_TRACE_ADD, first, length);
+
+  if(_data_region_trace_uniform(generator, 4) == 0)
+  {
+    int64_t evicted = _data_region_trace_uniform(generator, generator->unit_count);
+    _data_region_trace_emit(generator, DATA_REGION_TRACE_REMOVE, evicted * generator->unit, generator->unit);
+  }
+}
+
+/* Internal function to generate the records of one arriving P2P block. */
+void _data_region_trace_p2p_event(DataRegionTraceGenerator* generator)
+{
+  const int64_t blockSize = 16 * 1024;
+  int slot = (int)_data_region_trace_uniform(generator, DATA_REGION_TRACE_ACTIVE_PIECES);
+  if(generator->active_pieces[slot] < 0)
+  {
+    //Start the next piece (after the last one, the download starts over)
+    generator->active_pieces[slot] = (generator->next_piece * generator->piece_stride) % generator->unit_count;
+    generator->active_blocks[slot] = 0;
+    generator->next_piece = (generator->next_piece + 1) % generator->unit_count;
+  }
+
+  int64_t pieceFirst = generator->active_pieces[slot] * generator->unit;
+  int64_t blockFirst = pieceFirst + (generator->active_blocks[slot] * blockSize);
+  _data_region_trace_emit(generator, DATA_REGION_TRACE_ADD, blockFirst, blockSize);
+  generator->active_blocks[slot]++;
+  if(generator->active_blocks[slot] * blockSize >= generator->unit)
+  {
+    _data_region_trace_emit(generator, DATA_REGION_TRACE_COUNT_CROP, pieceFirst, generator->unit);
+    if(_data_region_trace_uniform(generator, 100) == 0)
+      _data_region_trace_emit(generator, DATA_REGION_TRACE_REMOVE, pieceFirst, generator->unit);
+    generator->active_pieces[slot] = -1;
+  }
+
+  if(generator->event_count % 256 == 255)
+    _data_region_trace_emit(generator, DATA_REGION_TRACE_NEGATIVE_CROP, 0, generator->length);
+}
+
+/* Internal function to generate the records of one video segment. */
+void _data_region_trace_video_event(DataRegionTraceGenerator* generator)
+{
+  const int64_t readahead = 8, backBuffer = 16;
+  if(_data_region_trace_uniform(generator, 200) == 0)
+  {
+    generator->position = _data_region_trace_uniform(generator, generator->unit_count);
+    _data_region_trace_emit(generator, DATA_REGION_TRACE_NEGATIVE_CROP, generator->position * generator->unit, readahead * generator->unit);
+  }
+
+  int64_t fetched = (generator->position + readahead) % generator->unit_count;
+  _data_region_trace_emit(generator, DATA_REGION_TRACE_ADD, fetched * generator->unit, generator->unit);
+  _data_region_trace_emit(generator, DATA_REGION_TRACE_CROP, generator->position * generator->unit, readahead * generator->unit);
+  if(generator->position >= backBuffer)
+    _data_region_trace_emit(generator, DATA_REGION_TRACE_REMOVE, (generator->position - backBuffer) * generator->unit, generator->unit);
+  generator->position = (generator->position + 1) % generator->unit_count;
+}
+
+/* Internal function to generate the records of one database page write. */
+void _data_region_trace_db_event(DataRegionTraceGenerator* generator)
+{
+  //Nine of ten writes go to the hot tenth of the pages
+  int64_t hotCount = generator->unit_count / 10;
+  int64_t page = _data_region_trace_uniform(generator, 10) != 0
+    ? _data_region_trace_uniform(generator, hotCount)
+    : hotCount + _data_region_trace_uniform(generator, generator->unit_count - hotCount);
+  _data_region_trace_emit(generator, DATA_REGION_TRACE_ADD, page * generator->unit, generator->unit);
+
+  if(generator->event_count % 64 == 63)
+  {
+    //Write back the next sixteenth of the file
+    int64_t sliceLength = generator->length / 16;
+    int64_t sliceFirst = generator->position * sliceLength;
+    _data_region_trace_emit(generator, DATA_REGION_TRACE_CROP, sliceFirst, sliceLength);
+    _data_region_trace_emit(generator, DATA_REGION_TRACE_REMOVE, sliceFirst, sliceLength);
+    generator->position = (generator->position + 1) % 16;
+  }
+}
+
+/* Generates the next record of a trace.
+ * @param generator - The DataRegionTraceGenerator.
+ * @returns - The record, whose region lies within [0, length). */
+DataRegionTraceRecord data_region_trace_generator_next(DataRegionTraceGenerator* generator)
+{
+  if(generator->pending_next == generator->pending_count)
+  {
+    generator->pending_count = 0;
+    generator->pending_next = 0;
+    if(generator->workload == DATA_REGION_TRACE_HTTP_RANGES)
+      _data_region_trace_http_event(generator);
+    else if(generator->workload == DATA_REGION_TRACE_P2P_PIECES)
+      _data_region_trace_p2p_event(generator);
+    else if(generator->workload == DATA_REGION_TRACE_VIDEO_SEEK)
+      _data_region_trace_video_event(generator);
+    else
+      _data_region_trace_db_event(generator);
+    generator->event_count++;
+  }
+  return generator->pending[generator->pending_next++];
+}
+
+/* Appends the operations that the optional recording of data_region.h
+ * captured (see data_region_record_collect) to a trace, with their results,
+ * so that a production workload can be replayed offline.
+ * @param writer - The DataRegionTraceWriter.
+ * @param set - Only the operations on this DataRegionSet are written. If
+ *        this is NULL, then the operations on all sets are written.
+ * @param nextTimestamp - Optional pointer to the timestamp of the first
+ *        operation to write (see data_region_record_timestamp), which will
+ *        be assigned to the timestamp after the last written one. Pass the
+ *        same variable to consecutive calls to write a continuous trace. If
+ *        this is NULL, then all retained operations are written.
+ * @param lost - Optional pointer to an integer that will be assigned to
+ *        true (1) if operations were overwritten before they could be
+ *        written (in which case the trace has a gap), otherwise false (0).
+ * @returns - The number of written records, or -1 upon failure.
+ * @remarks - The ring buffers only keep the last operations of each thread
+ *          (see DATA_REGION_RECORD_CAPACITY), so call this often enough (or enlarge
+ *          them) to write a trace without gaps. A trace that starts after
+ *          the set was first used replays against an initially empty set. */
+int64_t data_region_trace_write_recording(DataRegionTraceWriter* writer, const DataRegionSet* set, uint64_t* nextTimestamp, int* lost)
+{
+  int lostPlaceholder;
+  if(lost == NULL)
+    lost = &lostPlaceholder;
+  *lost = 0;
+
+  if(writer == NULL)
+    return -1;
+
+  //The number of threads can grow while collecting, so retry with a larger buffer
+  int64_t count = -1;
+  DataRegionRecordEntry* entries = NULL;
+  for(int attempt = 0; attempt < 4 && count < 0; attempt++)
+  {
+    int64_t capacity = data_region_record_retained() + DATA_REGION_RECORD_CAPACITY;
+    free(entries);
+    entries = (DataRegionRecordEntry*)malloc(sizeof(DataRegionRecordEntry) * capacity);
+    if(entries == NULL)
+      return -1;
+    count = data_region_record_collect(entries, capacity, set, nextTimestamp != NULL ? *nextTimestamp : 0, lost);
+  }
+
+  for(int64_t i = 0; i < count; i++)
+  {
+    DataRegionTraceRecord record = { (DataRegionTraceOperation)entries[i].operation, entries[i].region, 1, entries[i].result };
+    if(!data_region_trace_write(writer, record))
+    {
+      count = -1;
+      break;
+    }
+    if(nextTimestamp != NULL)
+      *nextTimestamp = entries[i].timestamp + 1;
+  }
+  free(entries);
+  return count;
+}
+
+#endif//DATA_REGION_TRACE_H
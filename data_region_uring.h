@@ -0,0 +1,662 @@
+#ifndef DATA_REGION_URING_H
+#define DATA_REGION_URING_H
+#include "data_region.h"
+#include "data_region_plan.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/* Defines how a DataRegionFill issues its reads. */
+typedef enum DataRegionFillBackend
+{
+  /* io_uring if the kernel supports it, otherwise a thread pool. */
+  DATA_REGION_FILL_AUTO = 0,
+
+  /* Batched io_uring reads, submitted and reaped by the calling thread. */
+  DATA_REGION_FILL_URING = 1,
+
+  /* A thread pool, in which each thread issues blocking preads. */
+  DATA_REGION_FILL_THREADS = 2,
+} DataRegionFillBackend;
+
+/* Options of a DataRegionFill.
+ * @see data_region_fill_default_options */
+typedef struct DataRegionFillOptions
+{
+  /* The maximum number of reads in flight at once. */
+  int64_t queue_depth;
+
+  /* The maximum number of bytes in flight at once. A single read that is
+   * larger is still issued (alone). */
+  int64_t max_inflight_bytes;
+
+  /* The number of threads of the thread pool backend. */
+  int64_t thread_count;
+
+  /* How missing byte ranges are turned into reads (see
+   * 'data_region_plan_fetches'). Reads are limited to 1 GiB. */
+  DataRegionPlanCostModel plan;
+
+  DataRegionFillBackend backend;
+} DataRegionFillOptions;
+
+/* Internal state of one read slot of a DataRegionFill. */
+typedef struct _DataRegionFillOp
+{
+  int64_t offset;
+  int64_t length;
+
+  /* The number of bytes that have been read so far. */
+  int64_t done;
+} _DataRegionFillOp;
+
+/* Internal completion of a read slot. */
+typedef struct _DataRegionFillCompletion
+{
+  int64_t slot;
+
+  /* The number of bytes read, or a negative errno value. */
+  int64_t result;
+} _DataRegionFillCompletion;
+
+/* Asynchronous fill pipeline, which reads the missing byte ranges of a
+ * presence DataRegionSet from a backing file (or block device) into memory,
+ * keeping up to 'queue_depth' reads in flight, and adds them to the
+ * DataRegionSet as they complete.
+ * @see data_region_fill_create
+ * @see data_region_fill_run */
+typedef struct DataRegionFill
+{
+  /* The backing file, which is not owned by the DataRegionFill. */
+  int fd;
+
+  /* The memory that holds bytes 'buffer_base' to 'buffer_base' +
+   * 'buffer_length' - 1 of the backing file. */
+  char* buffer;
+  int64_t buffer_base;
+  int64_t buffer_length;
+
+  DataRegionFillOptions options;
+
+  /* The backend that is in use (never DATA_REGION_FILL_AUTO). */
+  DataRegionFillBackend backend;
+
+  /* The read slots, and which of them are free. */
+  _DataRegionFillOp* ops;
+  int64_t* free_slots;
+  int64_t free_count;
+
+  /* Completions that are reaped, but not yet handled. */
+  _DataRegionFillCompletion* completions;
+
+#if defined(__linux__)
+  /* The io_uring backend. */
+  int ring_fd;
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+  unsigned pending_submissions;
+#endif
+
+  /* The thread pool backend. Workers take slots from 'submitted' and put
+   * their results into 'completed' (both protected by 'lock'). */
+  pthread_t* threads;
+  int64_t started_threads;
+  pthread_mutex_t lock;
+  pthread_cond_t has_submissions;
+  pthread_cond_t has_completions;
+  int64_t* submitted;
+  int64_t submitted_head;
+  int64_t submitted_count;
+  _DataRegionFillCompletion* completed;
+  int64_t completed_count;
+  int stopping;
+} DataRegionFill;
+
+/* Gets the default options of a DataRegionFill, which suit NVMe drives: 64
+ * reads (and up to 64 MiB) in flight, reads of up to 1 MiB, and io_uring if
+ * it is available.
+ * @returns - The default options. */
+DataRegionFillOptions data_region_fill_default_options(void)
+{
+  DataRegionFillOptions options;
+  options.queue_depth = 64;
+  options.max_inflight_bytes = 64 * 1024 * 1024;
+  options.thread_count = 8;
+  options.plan = (DataRegionPlanCostModel){ 0, 0, 1024 * 1024, 1 };
+  options.backend = DATA_REGION_FILL_AUTO;
+  return options;
+}
+
+#if defined(__linux__)
+/* Internal function to set up the io_uring backend of a DataRegionFill.
+ * @returns - True (1) upon success, otherwise false (0). */
+int _data_region_fill_uring_init(DataRegionFill* fill)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int ringFd = (int)syscall(__NR_io_uring_setup, (unsigned)fill->options.queue_depth, &params);
+  if(ringFd < 0)
+    return 0;
+
+  fill->ring_fd = ringFd;
+  fill->sq_ring_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+  fill->cq_ring_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+  if(params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if(fill->cq_ring_size > fill->sq_ring_size)
+      fill->sq_ring_size = fill->cq_ring_size;
+    fill->cq_ring_size = fill->sq_ring_size;
+  }
+
+  fill->sq_ring = mmap(NULL, fill->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+  fill->cq_ring = MAP_FAILED;
+  fill->sqes = MAP_FAILED;
+  if(fill->sq_ring != MAP_FAILED)
+  {
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+      fill->cq_ring = fill->sq_ring;
+    else
+      fill->cq_ring = mmap(NULL, fill->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+
+    fill->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    fill->sqes = mmap(NULL, fill->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+  }
+
+  if(fill->sq_ring == MAP_FAILED || fill->cq_ring == MAP_FAILED || fill->sqes == MAP_FAILED)
+  {
+    if(fill->sqes != MAP_FAILED)
+      munmap(fill->sqes, fill->sqes_size);
+    if(fill->cq_ring != MAP_FAILED && fill->cq_ring != fill->sq_ring)
+      munmap(fill->cq_ring, fill->cq_ring_size);
+    if(fill->sq_ring != MAP_FAILED)
+      munmap(fill->sq_ring, fill->sq_ring_size);
+    close(ringFd);
+    return 0;
+  }
+
+  char* sq = fill->sq_ring;
+  char* cq = fill->cq_ring;
+  fill->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+  fill->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+  fill->sq_array = (unsigned*)(sq + params.sq_off.array);
+  fill->cq_head = (unsigned*)(cq + params.cq_off.head);
+  fill->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+  fill->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+  fill->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+  fill->pending_submissions = 0;
+  return 1;
+}
+
+/* Internal function to tear down the io_uring backend of a DataRegionFill. */
+void _data_region_fill_uring_destroy(DataRegionFill* fill)
+{
+  munmap(fill->sqes, fill->sqes_size);
+  if(fill->cq_ring != fill->sq_ring)
+    munmap(fill->cq_ring, fill->cq_ring_size);
+  munmap(fill->sq_ring, fill->sq_ring_size);
+  close(fill->ring_fd);
+}
+
+/* Internal function to queue the read of a slot in the submission ring (it
+ * is submitted by the next '_data_region_fill_uring_wait'). */
+void _data_region_fill_uring_submit(DataRegionFill* fill, int64_t slot)
+{
+  _DataRegionFillOp* op = fill->ops + slot;
+  unsigned tail = *fill->sq_tail;
+  unsigned index = tail & *fill->sq_mask;
+  struct io_uring_sqe* sqe = fill->sqes + index;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fill->fd;
+  sqe->off = (uint64_t)(op->offset + op->done);
+  sqe->addr = (uint64_t)(uintptr_t)(fill->buffer + (op->offset + op->done - fill->buffer_base));
+  sqe->len = (unsigned)(op->length - op->done);
+  sqe->user_data = (uint64_t)slot;
+  fill->sq_array[index] = index;
+
+  //The kernel must see the entry before the new tail
+  atomic_store_explicit((_Atomic unsigned*)fill->sq_tail, tail + 1, memory_order_release);
+  fill->pending_submissions++;
+}
+
+/* Internal function to submit all queued reads, wait for at least one
+ * completion, and reap all available completions.
+ * @returns - The number of completions in 'fill->completions', or -1 upon
+ *          failure. */
+int64_t _data_region_fill_uring_wait(DataRegionFill* fill)
+{
+  for(;;)
+  {
+    long entered = syscall(__NR_io_uring_enter, fill->ring_fd, fill->pending_submissions, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if(entered >= 0)
+    {
+      fill->pending_submissions -= (unsigned)entered;
+      break;
+    }
+    if(errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      return -1;
+  }
+
+  int64_t count = 0;
+  unsigned head = *fill->cq_head;
+  unsigned tail = atomic_load_explicit((_Atomic unsigned*)fill->cq_tail, memory_order_acquire);
+  for(; head != tail; head++)
+  {
+    struct io_uring_cqe* cqe = fill->cqes + (head & *fill->cq_mask);
+    fill->completions[count].slot = (int64_t)cqe->user_data;
+    fill->completions[count].result = cqe->res;
+    count++;
+  }
+  atomic_store_explicit((_Atomic unsigned*)fill->cq_head, head, memory_order_release);
+  return count;
+}
+
+/* Internal function to wait, after '_data_region_fill_uring_wait' failed,
+ * until the kernel has completed every read that it was given, so that none
+ * of them writes into the buffer after the fill returns. The queued reads
+ * that weren't submitted yet are dropped from the submission ring instead.
+ * @param inflightCount - The number of reads in flight (queued, submitted,
+ *        or completed but not reaped). */
+void _data_region_fill_uring_drain(DataRegionFill* fill, int64_t inflightCount)
+{
+  //Without SQPOLL, the kernel only consumes submissions in 'io_uring_enter', so unsubmitted ones can be taken back
+  unsigned tail = *fill->sq_tail;
+  atomic_store_explicit((_Atomic unsigned*)fill->sq_tail, tail - fill->pending_submissions, memory_order_release);
+  int64_t remaining = inflightCount - fill->pending_submissions;
+  fill->pending_submissions = 0;
+
+  while(remaining > 0)
+  {
+    unsigned head = *fill->cq_head;
+    unsigned cqTail = atomic_load_explicit((_Atomic unsigned*)fill->cq_tail, memory_order_acquire);
+    if(head != cqTail)
+    {
+      remaining -= (int64_t)(cqTail - head);
+      atomic_store_explicit((_Atomic unsigned*)fill->cq_head, cqTail, memory_order_release);
+      continue;
+    }
+
+    //Wait in the kernel if the ring still allows it, otherwise poll the completion ring
+    if(syscall(__NR_io_uring_enter, fill->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+      sched_yield();
+  }
+}
+#endif
+
+/* Internal function that runs a thread of the thread pool backend.
+ * @param arg - The DataRegionFill. */
+void* _data_region_fill_worker(void* arg)
+{
+  DataRegionFill* fill = arg;
+  pthread_mutex_lock(&fill->lock);
+  for(;;)
+  {
+    while(!fill->stopping && fill->submitted_count == 0)
+      pthread_cond_wait(&fill->has_submissions, &fill->lock);
+    if(fill->stopping)
+      break;
+
+    int64_t slot = fill->submitted[fill->submitted_head];
+    fill->submitted_head = (fill->submitted_head + 1) % fill->options.queue_depth;
+    fill->submitted_count--;
+    _DataRegionFillOp op = fill->ops[slot];
+    pthread_mutex_unlock(&fill->lock);
+
+    ssize_t result = pread(fill->fd, fill->buffer + (op.offset + op.done - fill->buffer_base), (size_t)(op.length - op.done), (off_t)(op.offset + op.done));
+
+    pthread_mutex_lock(&fill->lock);
+    fill->completed[fill->completed_count].slot = slot;
+    fill->completed[fill->completed_count].result = result < 0 ? -errno : result;
+    fill->completed_count++;
+    pthread_cond_signal(&fill->has_completions);
+  }
+  pthread_mutex_unlock(&fill->lock);
+  return NULL;
+}
+
+/* Internal function to issue the read of a slot. */
+void _data_region_fill_submit(DataRegionFill* fill, int64_t slot)
+{
+#if defined(__linux__)
+  if(fill->backend == DATA_REGION_FILL_URING)
+  {
+    _data_region_fill_uring_submit(fill, slot);
+    return;
+  }
+#endif
+
+  pthread_mutex_lock(&fill->lock);
+  fill->submitted[(fill->submitted_head + fill->submitted_count) % fill->options.queue_depth] = slot;
+  fill->submitted_count++;
+  pthread_cond_signal(&fill->has_submissions);
+  pthread_mutex_unlock(&fill->lock);
+}
+
+/* Internal function to wait for at least one completed read.
+ * @returns - The number of completions in 'fill->completions', or -1 upon
+ *          failure. */
+int64_t _data_region_fill_wait(DataRegionFill* fill)
+{
+#if defined(__linux__)
+  if(fill->backend == DATA_REGION_FILL_URING)
+    return _data_region_fill_uring_wait(fill);
+#endif
+
+  pthread_mutex_lock(&fill->lock);
+  while(fill->completed_count == 0)
+    pthread_cond_wait(&fill->has_completions, &fill->lock);
+  int64_t count = fill->completed_count;
+  memcpy(fill->completions, fill->completed, sizeof(_DataRegionFillCompletion) * count);
+  fill->completed_count = 0;
+  pthread_mutex_unlock(&fill->lock);
+  return count;
+}
+
+/* Frees a DataRegionFill that was allocated by the 'data_region_fill_create'
+ * function.
+ * @param fill - Pointer to the DataRegionFill. If this argument is NULL, then
+ *        nothing will happen.
+ * @remarks - The backing file is not closed. */
+void data_region_fill_free(DataRegionFill* fill)
+{
+  if(fill == NULL)
+    return;
+
+#if defined(__linux__)
+  if(fill->backend == DATA_REGION_FILL_URING)
+    _data_region_fill_uring_destroy(fill);
+#endif
+
+  if(fill->started_threads > 0)
+  {
+    pthread_mutex_lock(&fill->lock);
+    fill->stopping = 1;
+    pthread_cond_broadcast(&fill->has_submissions);
+    pthread_mutex_unlock(&fill->lock);
+    for(int64_t i = 0; i < fill->started_threads; i++)
+      pthread_join(fill->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&fill->has_completions);
+  pthread_cond_destroy(&fill->has_submissions);
+  pthread_mutex_destroy(&fill->lock);
+  free(fill->threads);
+  free(fill->submitted);
+  free(fill->completed);
+  free(fill->completions);
+  free(fill->free_slots);
+  free(fill->ops);
+  free(fill);
+}
+
+/* Allocates a new DataRegionFill.
+ * @param fd - The backing file (or block device) to read from. If this is
+ *        less than zero, then NULL will be returned.
+ * @param buffer - The memory that receives the bytes. If this is NULL, then
+ *        NULL will be returned.
+ * @param bufferBase - The offset within the backing file of the first byte
+ *        of 'buffer'. If this is less than zero, then NULL will be returned.
+ * @param bufferLength - The number of bytes of 'buffer'. If this is less
+ *        than one, then NULL will be returned.
+ * @param options - The options (see 'data_region_fill_default_options'). If
+ *        this is NULL, then the default options are used.
+ * @returns - A pointer to the allocated DataRegionFill, or NULL upon failure
+ *          (including when DATA_REGION_FILL_URING was requested, but
+ *          io_uring isn't available).
+ * @remarks - Be sure to free the returned DataRegionFill by calling the
+ *          'data_region_fill_free' function.
+ * @see data_region_fill_free */
+DataRegionFill* data_region_fill_create(int fd, void* buffer, int64_t bufferBase, int64_t bufferLength, const DataRegionFillOptions* options)
+{
+  DataRegionFillOptions fillOptions = options != NULL ? *options : data_region_fill_default_options();
+  if(fd < 0 || buffer == NULL || bufferBase < 0 || bufferLength < 1 || bufferLength > INT64_MAX - bufferBase)
+    return NULL;
+  if(fillOptions.queue_depth < 1 || fillOptions.queue_depth > 4096 || fillOptions.max_inflight_bytes < 1)
+    return NULL;
+
+  //io_uring reads take a 32-bit length
+  const int64_t maxReadBytes = 1 << 30;
+  if(fillOptions.plan.max_io_bytes <= 0 || fillOptions.plan.max_io_bytes > maxReadBytes)
+    fillOptions.plan.max_io_bytes = maxReadBytes;
+
+  DataRegionFill* fill = calloc(1, sizeof(DataRegionFill));
+  if(fill == NULL)
+    return NULL;
+
+  pthread_mutex_init(&fill->lock, NULL);
+  pthread_cond_init(&fill->has_submissions, NULL);
+  pthread_cond_init(&fill->has_completions, NULL);
+  fill->fd = fd;
+  fill->buffer = buffer;
+  fill->buffer_base = bufferBase;
+  fill->buffer_length = bufferLength;
+  fill->options = fillOptions;
+  fill->backend = DATA_REGION_FILL_THREADS;
+
+  int64_t queueDepth = fillOptions.queue_depth;
+  fill->ops = malloc(sizeof(_DataRegionFillOp) * queueDepth);
+  fill->free_slots = malloc(sizeof(int64_t) * queueDepth);
+  fill->completions = malloc(sizeof(_DataRegionFillCompletion) * queueDepth * 2);
+  if(fill->ops == NULL || fill->free_slots == NULL || fill->completions == NULL)
+  {
+    data_region_fill_free(fill);
+    return NULL;
+  }
+
+#if defined(__linux__)
+  if(fillOptions.backend != DATA_REGION_FILL_THREADS && _data_region_fill_uring_init(fill))
+  {
+    fill->backend = DATA_REGION_FILL_URING;
+    return fill;
+  }
+#endif
+  if(fillOptions.backend == DATA_REGION_FILL_URING || fillOptions.thread_count < 1)
+  {
+    data_region_fill_free(fill);
+    return NULL;
+  }
+
+  fill->threads = malloc(sizeof(pthread_t) * fillOptions.thread_count);
+  fill->submitted = malloc(sizeof(int64_t) * queueDepth);
+  fill->completed = malloc(sizeof(_DataRegionFillCompletion) * queueDepth);
+  if(fill->threads == NULL || fill->submitted == NULL || fill->completed == NULL)
+  {
+    data_region_fill_free(fill);
+    return NULL;
+  }
+  for(; fill->started_threads < fillOptions.thread_count; fill->started_threads++)
+  {
+    if(pthread_create(&fill->threads[fill->started_threads], NULL, _data_region_fill_worker, fill) != 0)
+    {
+      data_region_fill_free(fill);
+      return NULL;
+    }
+  }
+  return fill;
+}
+
+/* Internal function to add the byte ranges of a batch of completed reads to
+ * a presence DataRegionSet.
+ * @param present - The presence DataRegionSet.
+ * @param batch - The completed byte ranges (which are normalized here).
+ * @param batchCount - The number of byte ranges in 'batch'.
+ * @param scratch - Scratch space for '_data_region_set_merge'.
+ * @returns - DATA_REGION_SET_SUCCESS, or DATA_REGION_SET_OUT_OF_SPACE if not
+ *          all byte ranges could be added. */
+DataRegionSetResult _data_region_fill_apply(DataRegionSet* present, DataRegion* batch, int64_t batchCount, DataRegion* scratch)
+{
+  batchCount = _data_region_array_normalize(batch, batchCount);
+  if(_data_region_set_merge(present, batch, batchCount, 1, scratch) == DATA_REGION_SET_SUCCESS)
+    return DATA_REGION_SET_SUCCESS;
+
+  //Add what fits
+  DataRegionSetResult result = DATA_REGION_SET_SUCCESS;
+  for(int64_t i = 0; i < batchCount; i++)
+  {
+    if(data_region_set_add(present, batch[i]) != DATA_REGION_SET_SUCCESS)
+      result = DATA_REGION_SET_OUT_OF_SPACE;
+  }
+  return result;
+}
+
+/* Reads the missing bytes of a request region into the buffer of a
+ * DataRegionFill, and adds them to a presence DataRegionSet.
+ * @param fill - Pointer to the DataRegionFill. If this is NULL, then -1 will
+ *        be returned.
+ * @param present - The presence DataRegionSet, whose missing byte ranges
+ *        within 'request' are read (see 'data_region_plan_fetches'). If this
+ *        is NULL, then -1 will be returned.
+ * @param request - The requested byte range, which is limited to the buffer
+ *        of 'fill'. If this is invalid (see data_region_is_valid), then -1
+ *        will be returned.
+ * @param presentTooSmall - Optional pointer to an integer that will be
+ *        assigned to true (1) if some bytes were read but couldn't be added
+ *        to 'present' due to its capacity, otherwise false (0).
+ * @returns - The number of bytes read, or -1 upon failure. Bytes beyond the
+ *          end of the backing file are not read (and not added). No read is
+ *          in flight anymore when this returns, even upon failure.
+ * @remarks - Reads are issued while fewer than 'queue_depth' reads and fewer
+ *          than 'max_inflight_bytes' bytes are in flight, and each batch of
+ *          completions is added to 'present' with one merge pass. Only the
+ *          calling thread touches 'present'. */
+int64_t data_region_fill_run(DataRegionFill* fill, DataRegionSet* present, DataRegion request, int* presentTooSmall)
+{
+  int presentTooSmallPlaceholder;
+  if(presentTooSmall == NULL)
+    presentTooSmall = &presentTooSmallPlaceholder;
+  *presentTooSmall = 0;
+
+  if(fill == NULL || present == NULL || !data_region_is_valid(request))
+    return -1;
+
+  DataRegion bufferRegion = { fill->buffer_base, fill->buffer_base + fill->buffer_length - 1 };
+  if(!data_region_intersects(request, bufferRegion))
+    return 0;
+  if(request.first_index < bufferRegion.first_index)
+    request.first_index = bufferRegion.first_index;
+  if(request.last_index > bufferRegion.last_index)
+    request.last_index = bufferRegion.last_index;
+
+  int64_t fetchCount = data_region_plan_fetches(NULL, 0, present, request, &fill->options.plan, NULL);
+  int64_t queueDepth = fill->options.queue_depth;
+  DataRegionFetch* fetches = malloc(sizeof(DataRegionFetch) * (fetchCount + 1));
+  DataRegion* batch = malloc(sizeof(DataRegion) * queueDepth * 2);
+  DataRegion* scratch = malloc(sizeof(DataRegion) * (data_region_set_capacity(present) + (queueDepth * 2)));
+  int tooSmall = 0;
+  if(fetches != NULL)
+    fetchCount = data_region_plan_fetches(fetches, fetchCount, present, request, &fill->options.plan, &tooSmall);
+  if(fetches == NULL || batch == NULL || scratch == NULL || tooSmall)
+  {
+    free(fetches);
+    free(batch);
+    free(scratch);
+    return -1;
+  }
+
+  for(int64_t i = 0; i < queueDepth; i++)
+    fill->free_slots[i] = queueDepth - 1 - i;
+  fill->free_count = queueDepth;
+
+  int64_t next = 0, inflightCount = 0, inflightBytes = 0, totalBytes = 0;
+  int failed = 0;
+  while((next < fetchCount && !failed) || inflightCount > 0)
+  {
+    //Keep the queue full, within the in-flight byte limit
+    while(!failed && next < fetchCount && fill->free_count > 0)
+    {
+      //Aligned fetches may reach beyond the buffer
+      DataRegion fetch = { fetches[next].offset, fetches[next].offset + fetches[next].length - 1 };
+      if(fetch.first_index < bufferRegion.first_index)
+        fetch.first_index = bufferRegion.first_index;
+      if(fetch.last_index > bufferRegion.last_index)
+        fetch.last_index = bufferRegion.last_index;
+
+      int64_t length = data_region_length(fetch);
+      if(inflightCount > 0 && inflightBytes + length > fill->options.max_inflight_bytes)
+        break;
+
+      int64_t slot = fill->free_slots[--fill->free_count];
+      fill->ops[slot] = (_DataRegionFillOp){ fetch.first_index, length, 0 };
+      _data_region_fill_submit(fill, slot);
+      inflightCount++;
+      inflightBytes += length;
+      next++;
+    }
+
+    int64_t completionCount = _data_region_fill_wait(fill);
+    if(completionCount < 0)
+    {
+      //The ring itself failed, but the reads in flight still write into the buffer until they complete
+#if defined(__linux__)
+      if(fill->backend == DATA_REGION_FILL_URING)
+        _data_region_fill_uring_drain(fill, inflightCount);
+#endif
+      failed = 1;
+      break;
+    }
+
+    int64_t batchCount = 0;
+    for(int64_t i = 0; i < completionCount; i++)
+    {
+      int64_t slot = fill->completions[i].slot;
+      int64_t result = fill->completions[i].result;
+      _DataRegionFillOp* op = fill->ops + slot;
+      if(result == -EINTR || result == -EAGAIN)
+      {
+        _data_region_fill_submit(fill, slot);
+        continue;
+      }
+
+      if(result > 0)
+      {
+        DataRegion read = { op->offset + op->done, op->offset + op->done + result - 1 };
+        batch[batchCount++] = read;
+        op->done += result;
+        totalBytes += result;
+        if(op->done < op->length)
+        {
+          //Short read, so read the rest
+          _data_region_fill_submit(fill, slot);
+          continue;
+        }
+      }
+      else if(result < 0)
+      {
+        failed = 1;
+      }
+
+      //The read is complete (or failed, or reached the end of the file)
+      inflightCount--;
+      inflightBytes -= op->length;
+      fill->free_slots[fill->free_count++] = slot;
+    }
+
+    if(_data_region_fill_apply(present, batch, batchCount, scratch) != DATA_REGION_SET_SUCCESS)
+      *presentTooSmall = 1;
+  }
+
+  free(fetches);
+  free(batch);
+  free(scratch);
+  return failed ? -1 : totalBytes;
+}
+
+#endif//DATA_REGION_URING_H
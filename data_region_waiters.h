@@ -0,0 +1,419 @@
+#ifndef DATA_REGION_WAITERS_H
+#define DATA_REGION_WAITERS_H
+#include "data_region.h"
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Result of waiting for a byte range to become present. */
+typedef enum DataRegionWaitResult
+{
+  /* The waiter is still registered. */
+  DATA_REGION_WAIT_PENDING = 0,
+
+  /* The whole byte range is present. */
+  DATA_REGION_WAIT_PRESENT = 1,
+
+  /* The timeout elapsed first. */
+  DATA_REGION_WAIT_TIMED_OUT = 2,
+
+  /* The waiter was cancelled (see data_region_wait_set_cancel). */
+  DATA_REGION_WAIT_CANCELLED = 3,
+
+  /* An argument was NULL or invalid, or there was no room for the waiter. */
+  DATA_REGION_WAIT_FAILED = -1
+} DataRegionWaitResult;
+
+/* Function that is called when the byte range of a waiter becomes present.
+ * It is called without holding the lock of the DataRegionWaitSet, so it may
+ * use the DataRegionWaitSet (and free or reuse its waiter). */
+typedef void (*DataRegionWaitCallback)(void* context, DataRegion region);
+
+/* Interest in a byte range of a DataRegionWaitSet. The caller owns the
+ * memory of each waiter, and has to keep it valid while the waiter is
+ * registered.
+ * @see data_region_wait_set_notify
+ * @see data_region_wait_set_wait */
+typedef struct DataRegionWaiter
+{
+  DataRegion region;
+
+  /* The callback, or NULL for a waiter that blocks. */
+  DataRegionWaitCallback callback;
+  void* context;
+
+  /* Signaled when a waiter that blocks is woken. */
+  pthread_cond_t woken;
+
+  DataRegionWaitResult result;
+
+  /* Links the waiters whose callbacks are due. */
+  struct DataRegionWaiter* next;
+} DataRegionWaiter;
+
+/* DataRegionSet of present bytes, whose readers can wait for byte ranges to
+ * become present, instead of polling 'data_region_set_crop'. The waiters
+ * are kept in ascending order of their first byte, so each add only checks
+ * the waiters that start within the DataRegion that the added bytes joined.
+ * @see data_region_wait_set_create
+ * @see data_region_wait_set_add
+ * @see data_region_wait_set_wait
+ * @see data_region_wait_set_notify */
+typedef struct DataRegionWaitSet
+{
+  /* Protects everything below. */
+  pthread_mutex_t lock;
+
+  DataRegionSet* present;
+
+  /* The registered waiters, in ascending order of 'region.first_index'. */
+  DataRegionWaiter** waiters;
+  int64_t waiter_count;
+  int64_t waiter_capacity;
+} DataRegionWaitSet;
+
+/* Allocates a new DataRegionWaitSet, in which no bytes are present.
+ * @param regionCapacity - The maximum number of separate present byte
+ *        ranges. If this is less than one, then NULL will be returned.
+ * @param waiterCapacity - The maximum number of registered waiters. If this
+ *        is less than one, then NULL will be returned.
+ * @returns - A pointer to the allocated DataRegionWaitSet, or NULL upon
+ *          failure.
+ * @remarks - Be sure to free the returned DataRegionWaitSet by calling the
+ *          'data_region_wait_set_free' function.
+ * @see data_region_wait_set_free */
+DataRegionWaitSet* data_region_wait_set_create(int64_t regionCapacity, int64_t waiterCapacity)
+{
+  if(regionCapacity < 1 || waiterCapacity < 1)
+    return NULL;
+
+  DataRegionWaitSet* waitSet = malloc(sizeof(DataRegionWaitSet) + (sizeof(DataRegionWaiter*) * waiterCapacity));
+  if(waitSet == NULL)
+    return NULL;
+
+  waitSet->present = data_region_set_create(regionCapacity);
+  if(waitSet->present == NULL)
+  {
+    free(waitSet);
+    return NULL;
+  }
+
+  pthread_mutex_init(&waitSet->lock, NULL);
+  waitSet->waiters = (DataRegionWaiter**)(waitSet + 1);
+  waitSet->waiter_count = 0;
+  waitSet->waiter_capacity = waiterCapacity;
+  return waitSet;
+}
+
+/* Frees a DataRegionWaitSet that was allocated by the
+ * 'data_region_wait_set_create' function.
+ * @param waitSet - Pointer to the DataRegionWaitSet. If this argument is
+ *        NULL, then nothing will happen.
+ * @remarks - No thread may be blocked in 'data_region_wait_set_wait'.
+ *          Waiters with callbacks that are still registered are dropped
+ *          without calling them. */
+void data_region_wait_set_free(DataRegionWaitSet* waitSet)
+{
+  if(waitSet == NULL)
+    return;
+
+  pthread_mutex_destroy(&waitSet->lock);
+  data_region_set_free(waitSet->present);
+  free(waitSet);
+}
+
+/* Internal function to find the first registered waiter whose byte range
+ * starts at or after an index. */
+int64_t _data_region_wait_set_lower_bound(const DataRegionWaitSet* waitSet, int64_t index)
+{
+  int64_t low = 0, high = waitSet->waiter_count;
+  while(low < high)
+  {
+    int64_t mid = low + ((high - low) / 2);
+    if(waitSet->waiters[mid]->region.first_index < index)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+/* Internal function to check whether a byte range is present. */
+int _data_region_wait_set_is_present(const DataRegionWaitSet* waitSet, DataRegion region)
+{
+  int64_t i = _data_region_set_lower_bound(waitSet->present, region.first_index);
+  return i < waitSet->present->count && data_region_contains(waitSet->present->regions[i], region);
+}
+
+/* Internal function to register a waiter.
+ * @returns - False (0) if there is no room for it, otherwise true (1). */
+int _data_region_wait_set_register(DataRegionWaitSet* waitSet, DataRegionWaiter* waiter)
+{
+  if(waitSet->waiter_count >= waitSet->waiter_capacity)
+    return 0;
+
+  //Insert after the waiters that start at the same byte
+  int64_t i = _data_region_wait_set_lower_bound(waitSet, waiter->region.first_index == INT64_MAX ? INT64_MAX : waiter->region.first_index + 1);
+  memmove(waitSet->waiters + i + 1, waitSet->waiters + i, sizeof(DataRegionWaiter*) * (waitSet->waiter_count - i));
+  waitSet->waiters[i] = waiter;
+  waitSet->waiter_count++;
+  waiter->result = DATA_REGION_WAIT_PENDING;
+  return 1;
+}
+
+/* Internal function to unregister a waiter.
+ * @returns - True (1) if it was registered, otherwise false (0). */
+int _data_region_wait_set_unregister(DataRegionWaitSet* waitSet, DataRegionWaiter* waiter)
+{
+  for(int64_t i = _data_region_wait_set_lower_bound(waitSet, waiter->region.first_index); i < waitSet->waiter_count; i++)
+  {
+    if(waitSet->waiters[i]->region.first_index != waiter->region.first_index)
+      break;
+    if(waitSet->waiters[i] == waiter)
+    {
+      memmove(waitSet->waiters + i, waitSet->waiters + i + 1, sizeof(DataRegionWaiter*) * (waitSet->waiter_count - i - 1));
+      waitSet->waiter_count--;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Adds present bytes to a DataRegionWaitSet, and wakes the waiters whose
+ * byte ranges became fully present.
+ * @param waitSet - The DataRegionWaitSet. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param region - The present bytes.
+ * @returns - A DataRegionSetResult (see data_region_set_add).
+ * @remarks - Only the waiters that start within the DataRegion that
+ *          'region' joined, no later than the end of 'region', are checked
+ *          (every other waiter either doesn't overlap 'region' or was
+ *          already woken), which takes O(log w + k) time. Callbacks are
+ *          called after the lock is released, in ascending order. */
+DataRegionSetResult data_region_wait_set_add(DataRegionWaitSet* waitSet, DataRegion region)
+{
+  if(waitSet == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+
+  pthread_mutex_lock(&waitSet->lock);
+  DataRegionSetResult result = data_region_set_add(waitSet->present, region);
+  DataRegionWaiter* due = NULL;
+  DataRegionWaiter** dueTail = &due;
+  if(result == DATA_REGION_SET_SUCCESS)
+  {
+    DataRegion joined = waitSet->present->regions[_data_region_set_lower_bound(waitSet->present, region.first_index)];
+    int64_t first = _data_region_wait_set_lower_bound(waitSet, joined.first_index);
+    int64_t kept = first;
+    int64_t i = first;
+    for(; i < waitSet->waiter_count && waitSet->waiters[i]->region.first_index <= region.last_index; i++)
+    {
+      DataRegionWaiter* waiter = waitSet->waiters[i];
+      if(waiter->region.last_index > joined.last_index)
+      {
+        waitSet->waiters[kept++] = waiter;
+        continue;
+      }
+
+      waiter->result = DATA_REGION_WAIT_PRESENT;
+      if(waiter->callback != NULL)
+      {
+        waiter->next = NULL;
+        *dueTail = waiter;
+        dueTail = &waiter->next;
+      }
+      else
+      {
+        pthread_cond_signal(&waiter->woken);
+      }
+    }
+
+    //Close the gap left by the woken waiters
+    memmove(waitSet->waiters + kept, waitSet->waiters + i, sizeof(DataRegionWaiter*) * (waitSet->waiter_count - i));
+    waitSet->waiter_count -= i - kept;
+  }
+  pthread_mutex_unlock(&waitSet->lock);
+
+  while(due != NULL)
+  {
+    //The callback may reuse the waiter, so read its link first
+    DataRegionWaiter* waiter = due;
+    due = waiter->next;
+    waiter->callback(waiter->context, waiter->region);
+  }
+  return result;
+}
+
+/* Removes bytes from a DataRegionWaitSet, for example after they were
+ * evicted. Waiters that were already woken are not affected.
+ * @param waitSet - The DataRegionWaitSet. If this is NULL, then
+ *        DATA_REGION_SET_NULL_ARG will be returned.
+ * @param region - The bytes to remove.
+ * @returns - A DataRegionSetResult (see data_region_set_remove). */
+DataRegionSetResult data_region_wait_set_remove(DataRegionWaitSet* waitSet, DataRegion region)
+{
+  if(waitSet == NULL)
+    return DATA_REGION_SET_NULL_ARG;
+
+  pthread_mutex_lock(&waitSet->lock);
+  DataRegionSetResult result = data_region_set_remove(waitSet->present, region);
+  pthread_mutex_unlock(&waitSet->lock);
+  return result;
+}
+
+/* Checks whether a byte range is present in a DataRegionWaitSet.
+ * @param waitSet - The DataRegionWaitSet. If this is NULL, then false (0)
+ *        will be returned.
+ * @param region - The byte range. If this is invalid, then false (0) will be
+ *        returned.
+ * @returns - True (1) if every byte of 'region' is present, otherwise false
+ *          (0). */
+int data_region_wait_set_contains(DataRegionWaitSet* waitSet, DataRegion region)
+{
+  if(waitSet == NULL || !data_region_is_valid(region))
+    return 0;
+
+  pthread_mutex_lock(&waitSet->lock);
+  int present = _data_region_wait_set_is_present(waitSet, region);
+  pthread_mutex_unlock(&waitSet->lock);
+  return present;
+}
+
+/* Registers a callback that is called once a byte range is fully present.
+ * @param waitSet - The DataRegionWaitSet. If this is NULL, then
+ *        DATA_REGION_WAIT_FAILED will be returned.
+ * @param waiter - The memory of the waiter, which has to stay valid until
+ *        the callback was called or the waiter was cancelled. If this is
+ *        NULL, then DATA_REGION_WAIT_FAILED will be returned.
+ * @param region - The byte range. If this is invalid (see
+ *        data_region_is_valid), then DATA_REGION_WAIT_FAILED will be
+ *        returned.
+ * @param callback - The callback. If this is NULL, then
+ *        DATA_REGION_WAIT_FAILED will be returned.
+ * @param context - Passed to the callback.
+ * @returns - DATA_REGION_WAIT_PRESENT if the byte range was already present
+ *          (in which case the callback was called before returning),
+ *          DATA_REGION_WAIT_PENDING if the waiter was registered, or
+ *          DATA_REGION_WAIT_FAILED if there was no room for it. */
+DataRegionWaitResult data_region_wait_set_notify(DataRegionWaitSet* waitSet, DataRegionWaiter* waiter, DataRegion region, DataRegionWaitCallback callback, void* context)
+{
+  if(waitSet == NULL || waiter == NULL || callback == NULL || !data_region_is_valid(region))
+    return DATA_REGION_WAIT_FAILED;
+
+  waiter->region = region;
+  waiter->callback = callback;
+  waiter->context = context;
+
+  pthread_mutex_lock(&waitSet->lock);
+  DataRegionWaitResult result = DATA_REGION_WAIT_PRESENT;
+  if(!_data_region_wait_set_is_present(waitSet, region))
+    result = _data_region_wait_set_register(waitSet, waiter) ? DATA_REGION_WAIT_PENDING : DATA_REGION_WAIT_FAILED;
+  pthread_mutex_unlock(&waitSet->lock);
+
+  if(result == DATA_REGION_WAIT_PRESENT)
+  {
+    waiter->result = DATA_REGION_WAIT_PRESENT;
+    callback(context, region);
+  }
+  return result;
+}
+
+/* Blocks until a byte range is fully present, the timeout elapses, or the
+ * waiter is cancelled by another thread.
+ * @param waitSet - The DataRegionWaitSet. If this is NULL, then
+ *        DATA_REGION_WAIT_FAILED will be returned.
+ * @param waiter - The memory of the waiter, which another thread can pass
+ *        to 'data_region_wait_set_cancel'. If this is NULL, then
+ *        DATA_REGION_WAIT_FAILED will be returned.
+ * @param region - The byte range. If this is invalid (see
+ *        data_region_is_valid), then DATA_REGION_WAIT_FAILED will be
+ *        returned.
+ * @param timeoutMicroseconds - The maximum time to wait, or a negative
+ *        number to wait without a timeout.
+ * @returns - DATA_REGION_WAIT_PRESENT, DATA_REGION_WAIT_TIMED_OUT,
+ *          DATA_REGION_WAIT_CANCELLED, or DATA_REGION_WAIT_FAILED if there
+ *          was no room for the waiter. */
+DataRegionWaitResult data_region_wait_set_wait(DataRegionWaitSet* waitSet, DataRegionWaiter* waiter, DataRegion region, int64_t timeoutMicroseconds)
+{
+  if(waitSet == NULL || waiter == NULL || !data_region_is_valid(region))
+    return DATA_REGION_WAIT_FAILED;
+
+  //Timeouts are measured on the monotonic clock, so that changing the time of day doesn't affect them
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  if(timeoutMicroseconds >= 0)
+  {
+    deadline.tv_sec += (time_t)(timeoutMicroseconds / 1000000);
+    deadline.tv_nsec += (long)((timeoutMicroseconds % 1000000) * 1000);
+    if(deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+  }
+
+  pthread_condattr_t attributes;
+  pthread_condattr_init(&attributes);
+  pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+  pthread_cond_init(&waiter->woken, &attributes);
+  pthread_condattr_destroy(&attributes);
+  waiter->region = region;
+  waiter->callback = NULL;
+  waiter->context = NULL;
+
+  pthread_mutex_lock(&waitSet->lock);
+  DataRegionWaitResult result = DATA_REGION_WAIT_PRESENT;
+  if(!_data_region_wait_set_is_present(waitSet, region))
+  {
+    if(!_data_region_wait_set_register(waitSet, waiter))
+    {
+      result = DATA_REGION_WAIT_FAILED;
+    }
+    else
+    {
+      while(waiter->result == DATA_REGION_WAIT_PENDING)
+      {
+        int error = timeoutMicroseconds >= 0 ? pthread_cond_timedwait(&waiter->woken, &waitSet->lock, &deadline) : pthread_cond_wait(&waiter->woken, &waitSet->lock);
+        if(error == ETIMEDOUT && waiter->result == DATA_REGION_WAIT_PENDING)
+        {
+          _data_region_wait_set_unregister(waitSet, waiter);
+          waiter->result = DATA_REGION_WAIT_TIMED_OUT;
+        }
+      }
+      result = waiter->result;
+    }
+  }
+  pthread_mutex_unlock(&waitSet->lock);
+
+  pthread_cond_destroy(&waiter->woken);
+  return result;
+}
+
+/* Cancels a waiter that is registered with 'data_region_wait_set_notify'
+ * or is blocked in 'data_region_wait_set_wait' (which then returns
+ * DATA_REGION_WAIT_CANCELLED). Callbacks are not called for cancelled
+ * waiters.
+ * @param waitSet - The DataRegionWaitSet. If this is NULL, then false (0)
+ *        will be returned.
+ * @param waiter - The waiter. If this is NULL, then false (0) will be
+ *        returned.
+ * @returns - True (1) if the waiter was cancelled, or false (0) if it
+ *          wasn't registered (for example, because its callback was already
+ *          called, or is being called). */
+int data_region_wait_set_cancel(DataRegionWaitSet* waitSet, DataRegionWaiter* waiter)
+{
+  if(waitSet == NULL || waiter == NULL)
+    return 0;
+
+  pthread_mutex_lock(&waitSet->lock);
+  int cancelled = _data_region_wait_set_unregister(waitSet, waiter);
+  if(cancelled)
+  {
+    waiter->result = DATA_REGION_WAIT_CANCELLED;
+    if(waiter->callback == NULL)
+      pthread_cond_signal(&waiter->woken);
+  }
+  pthread_mutex_unlock(&waitSet->lock);
+  return cancelled;
+}
+
+#endif//DATA_REGION_WAITERS_H
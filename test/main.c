@@ -1,4 +1,51 @@
+//Every test also runs with the optional instrumentation and recording compiled in
+#define DATA_REGION_STATS
+#define DATA_REGION_RECORD
+
+#include <stdlib.h>
+
+/* The number of allocations of DataRegionLockFreeSets that succeed before
+ * all of them fail, or -1 to never fail. */
+int lockfreeAllocsLeft = -1;
+
+void* test_lockfree_malloc(size_t size)
+{
+  if(lockfreeAllocsLeft == 0)
+    return NULL;
+  if(lockfreeAllocsLeft > 0)
+    lockfreeAllocsLeft--;
+  return malloc(size);
+}
+
+void* test_lockfree_realloc(void* pointer, size_t size)
+{
+  if(lockfreeAllocsLeft == 0)
+    return NULL;
+  if(lockfreeAllocsLeft > 0)
+    lockfreeAllocsLeft--;
+  return realloc(pointer, size);
+}
+
+#define DATA_REGION_LOCKFREE_MALLOC(size) test_lockfree_malloc(size)
+#define DATA_REGION_LOCKFREE_REALLOC(pointer, size) test_lockfree_realloc(pointer, size)
 #include "../data_region.h"
+#include "../data_region_snapshot.h"
+#include "../data_region_sharded.h"
+#include "../data_region_lockfree.h"
+#include "../data_region_combining.h"
+#include "../data_region_buffered.h"
+#include "../data_region_lsm.h"
+#include "../data_region_cache.h"
+#include "../data_region_plan.h"
+#include "../data_region_uring.h"
+#include "../data_region_flush.h"
+#include "../data_region_readahead.h"
+#include "../data_region_scheduler.h"
+#include "../data_region_inflight.h"
+#include "../data_region_waiters.h"
+#include "../data_region_batch.h"
+#include "../data_region_trace.h"
+#include "../data_region_small.h"
 #include "gidunit.h"
 
 DataRegionSet* init_test_data_region_set(DataRegionSet* set, int randCount)
@@ -32,6 +79,25 @@ DataRegionSet* clone_data_region_set(const DataRegionSet* set)
   return ret;
 }
 
+
+/* Deterministic pseudo-random generator (xorshift64) for the randomized tests. */
+uint64_t test_rand(uint64_t* state)
+{
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+/* Generates a random (valid) DataRegion within [0, span). */
+DataRegion test_rand_region(uint64_t* state, int64_t span, int64_t maxLength)
+{
+  int64_t first = (int64_t)(test_rand(state) % (uint64_t)span);
+  int64_t length = 1 + (int64_t)(test_rand(state) % (uint64_t)maxLength);
+  return (DataRegion){ .first_index = first, .last_index = first + length - 1 };
+}
+
 #define assert_data_region_array_eq(array, ...)                               \
 {                                                                             \
   DataRegion _local_expect[] = {__VA_ARGS__};                                 \
@@ -949,6 +1015,20 @@ BEGIN_TEST_SUITE(DataRegionSetFunctionTests)
 
 END_TEST_SUITE()
 
+/* Records the byte ranges reported by the delta variants of add and
+ * remove. */
+typedef struct DeltaTestRecord
+{
+  int64_t count;
+  DataRegion regions[200];
+} DeltaTestRecord;
+
+void delta_test_callback(void* context, DataRegion changed)
+{
+  DeltaTestRecord* record = context;
+  record->regions[record->count++] = changed;
+}
+
 BEGIN_TEST_SUITE(DataRegionSetAddTests)
 
   Test(data_region_set_add_when_dst_is_NULL)
@@ -1608,6 +1688,74 @@ Test(data_region_set_add_partially_overlapping_one_of_two_existing,
     free_test_data_region_set(set);
   }
 
+  Test(data_region_set_add_delta_reports_newly_covered_bytes)
+  {
+    DataRegionSet* set = data_region_set_create(8);
+    DeltaTestRecord record = { 0 };
+    int64_t changedLength;
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_set_add_delta(NULL, DR(0, 0), delta_test_callback, &record, &changedLength));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_set_add_delta(set, DR(1, 0), delta_test_callback, &record, &changedLength));
+    assert_int_eq(0, changedLength);
+
+    data_region_set_add(set, DR(10, 19));
+    data_region_set_add(set, DR(30, 39));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add_delta(set, DR(0, 49), delta_test_callback, &record, &changedLength));
+    assert_int_eq(30, changedLength);
+    assert_int_eq(3, record.count);
+    assert_data_region_array_eq(record.regions, DR(0, 9), DR(20, 29), DR(40, 49));
+    assert_data_region_set_eq_array(set, DR(0, 49));
+
+    //Adjacent bytes are combined, but only the new bytes are reported
+    record.count = 0;
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add_delta(set, DR(50, 59), delta_test_callback, &record, &changedLength));
+    assert_int_eq(10, changedLength);
+    assert_data_region_array_eq(record.regions, DR(50, 59));
+
+    record.count = 0;
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add_delta(set, DR(5, 15), delta_test_callback, &record, NULL));
+    assert_int_eq(0, record.count);
+    free(set);
+  }
+
+  Test(data_region_set_add_delta_reports_nothing_when_full)
+  {
+    DataRegionSet* set = data_region_set_create(1);
+    DeltaTestRecord record = { 0 };
+    int64_t changedLength;
+    data_region_set_add(set, DR(0, 9));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_set_add_delta(set, DR(20, 29), delta_test_callback, &record, &changedLength));
+    assert_int_eq(0, changedLength);
+    assert_int_eq(0, record.count);
+    assert_data_region_set_eq_array(set, DR(0, 9));
+    free(set);
+  }
+
+  Test(data_region_set_add_delta_matches_negative_crop,
+    RangeParam(seed, 1, 20))
+  {
+    uint64_t rng = seed;
+    DataRegionSet* set = data_region_set_create(200);
+    DataRegion expected[200];
+    for(int i = 0; i < 500; i++)
+    {
+      DataRegion toAdd = test_rand_region(&rng, 5000, 100);
+      if(test_rand(&rng) % 3 == 0)
+        data_region_set_remove(set, test_rand_region(&rng, 5000, 300));
+
+      DeltaTestRecord record = { 0 };
+      int64_t changedLength;
+      int64_t previousLength = data_region_set_total_length(set);
+      int64_t expectedCount = data_region_set_negative_crop(expected, 200, set, toAdd, NULL);
+      if(data_region_set_add_delta(set, toAdd, delta_test_callback, &record, &changedLength) != DATA_REGION_SET_SUCCESS)
+        continue;
+
+      assert_int_eq(expectedCount, record.count);
+      assert_memory_eq(expected, record.regions, sizeof(DataRegion) * expectedCount);
+      assert_int_eq(data_region_set_total_length(set) - previousLength, changedLength);
+    }
+    free(set);
+  }
+
 END_TEST_SUITE()
 
 
@@ -2148,6 +2296,60 @@ BEGIN_TEST_SUITE(DataRegionSetRemoveTests)
     free_test_data_region_set(set);
   }
 
+  Test(data_region_set_remove_delta_reports_removed_bytes)
+  {
+    DataRegionSet* set = data_region_set_create(3);
+    DeltaTestRecord record = { 0 };
+    int64_t changedLength;
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_set_remove_delta(NULL, DR(0, 0), delta_test_callback, &record, &changedLength));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_set_remove_delta(set, DR(1, 0), delta_test_callback, &record, &changedLength));
+
+    data_region_set_add(set, DR(0, 9));
+    data_region_set_add(set, DR(20, 29));
+    data_region_set_add(set, DR(40, 49));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_remove_delta(set, DR(5, 44), delta_test_callback, &record, &changedLength));
+    assert_int_eq(20, changedLength);
+    assert_data_region_array_eq(record.regions, DR(5, 9), DR(20, 29), DR(40, 44));
+    assert_data_region_set_eq_array(set, DR(0, 4), DR(45, 49));
+
+    record.count = 0;
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_remove_delta(set, DR(10, 40), delta_test_callback, &record, &changedLength));
+    assert_int_eq(0, changedLength);
+    assert_int_eq(0, record.count);
+
+    //A split that doesn't fit reports nothing
+    data_region_set_add(set, DR(60, 69));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_set_remove_delta(set, DR(2, 2), delta_test_callback, &record, &changedLength));
+    assert_int_eq(0, changedLength);
+    assert_int_eq(0, record.count);
+    free(set);
+  }
+
+  Test(data_region_set_remove_delta_matches_crop,
+    RangeParam(seed, 1, 20))
+  {
+    uint64_t rng = seed;
+    DataRegionSet* set = data_region_set_create(200);
+    DataRegion expected[200];
+    for(int i = 0; i < 500; i++)
+    {
+      data_region_set_add(set, test_rand_region(&rng, 5000, 100));
+      DataRegion toRemove = test_rand_region(&rng, 5000, 100);
+
+      DeltaTestRecord record = { 0 };
+      int64_t changedLength;
+      int64_t previousLength = data_region_set_total_length(set);
+      int64_t expectedCount = data_region_set_crop(expected, 200, set, toRemove, NULL);
+      if(data_region_set_remove_delta(set, toRemove, delta_test_callback, &record, &changedLength) != DATA_REGION_SET_SUCCESS)
+        continue;
+
+      assert_int_eq(expectedCount, record.count);
+      assert_memory_eq(expected, record.regions, sizeof(DataRegion) * expectedCount);
+      assert_int_eq(previousLength - data_region_set_total_length(set), changedLength);
+    }
+    free(set);
+  }
+
 END_TEST_SUITE()
 
 BEGIN_TEST_SUITE(DataRegionSetGetBoundedDataRegionsTests)
@@ -3346,6 +3548,3563 @@ BEGIN_TEST_SUITE(DataRegionSetGetMissingDataRegionsTests)
 END_TEST_SUITE()
 
 
+#define assert_data_region_snapshot_eq_set(snapshot, set)                    \
+{                                                                             \
+  const DataRegionSnapshot* _local_snap = (snapshot);                         \
+  const DataRegionSet* _local_set = (set);                                    \
+  assert_int_eq(_local_set->count, data_region_snapshot_count(_local_snap));  \
+  assert_int_eq(data_region_set_total_length(_local_set),                     \
+    data_region_snapshot_total_length(_local_snap));                          \
+  for(int64_t _local_i = 0; _local_i < _local_set->count; _local_i++)         \
+  {                                                                           \
+    const DataRegion* _local_at = data_region_snapshot_at(_local_snap, _local_i);\
+    assert_not_null(_local_at);                                               \
+    assert_int_eq(_local_set->regions[_local_i].first_index, _local_at->first_index);\
+    assert_int_eq(_local_set->regions[_local_i].last_index, _local_at->last_index);\
+  }                                                                           \
+}
+
+/* Writer thread used by the DataRegionCowSet concurrency test. */
+void* cow_set_test_writer(void* arg)
+{
+  DataRegionCowSet* set = arg;
+  uint64_t rng = 12345;
+  for(int i = 0; i < 20000; i++)
+  {
+    DataRegion region = test_rand_region(&rng, 100000, 50);
+    if(i % 4 == 0)
+      data_region_cow_set_remove(set, region);
+    else
+      data_region_cow_set_add(set, region);
+  }
+  return NULL;
+}
+
+BEGIN_TEST_SUITE(DataRegionCowSetTests)
+
+  Test(data_region_cow_set_NULL_args)
+  {
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_cow_set_add(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_cow_set_remove(NULL, DR(0, 0)));
+    assert_null(data_region_cow_set_snapshot(NULL));
+    assert_int_eq(0, data_region_snapshot_count(NULL));
+    assert_int_eq(0, data_region_snapshot_total_length(NULL));
+    assert_null(data_region_snapshot_at(NULL, 0));
+    assert_int_eq(0, data_region_snapshot_contains(NULL, DR(0, 0)));
+    data_region_snapshot_release(NULL);
+    data_region_cow_set_free(NULL);
+  }
+
+  Test(data_region_cow_set_invalid_region)
+  {
+    DataRegionCowSet* set = data_region_cow_set_create();
+    assert_not_null(set);
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_cow_set_add(set, DR(5, 4)));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_cow_set_remove(set, DR(5, 4)));
+    data_region_cow_set_free(set);
+  }
+
+  Test(data_region_cow_set_regions_at_the_index_limits)
+  {
+    DataRegionCowSet* set = data_region_cow_set_create();
+    assert_not_null(set);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_add(set, DR(0, 9)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_add(set, DR(INT64_MIN, INT64_MIN + 4)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_add(set, DR(INT64_MAX - 4, INT64_MAX)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_add(set, DR(INT64_MIN + 5, INT64_MIN + 9)));
+
+    DataRegionSnapshot* snapshot = data_region_cow_set_snapshot(set);
+    assert_int_eq(3, data_region_snapshot_count(snapshot));
+    assert_int_eq(25, data_region_snapshot_total_length(snapshot));
+    assert_int_eq(INT64_MIN + 9, data_region_snapshot_at(snapshot, 0)->last_index);
+    assert_int_eq(INT64_MAX - 4, data_region_snapshot_at(snapshot, 2)->first_index);
+    data_region_snapshot_release(snapshot);
+
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_remove(set, DR(INT64_MAX, INT64_MAX)));
+    snapshot = data_region_cow_set_snapshot(set);
+    assert_int_eq(24, data_region_snapshot_total_length(snapshot));
+    data_region_snapshot_release(snapshot);
+    data_region_cow_set_free(set);
+  }
+
+  Test(data_region_cow_set_starts_empty)
+  {
+    DataRegionCowSet* set = data_region_cow_set_create();
+    DataRegionSnapshot* snapshot = data_region_cow_set_snapshot(set);
+    assert_int_eq(0, data_region_snapshot_count(snapshot));
+    assert_int_eq(0, data_region_snapshot_total_length(snapshot));
+    assert_null(data_region_snapshot_at(snapshot, 0));
+
+    DataRegion dst[1];
+    assert_int_eq(1, data_region_snapshot_negative_crop(dst, 1, snapshot, DR(3, 9), NULL));
+    assert_data_region_array_eq(dst, DR(3, 9));
+    assert_int_eq(0, data_region_snapshot_count_crop(snapshot, DR(3, 9)));
+
+    data_region_snapshot_release(snapshot);
+    data_region_cow_set_free(set);
+  }
+
+  Test(data_region_cow_set_matches_data_region_set,
+    EnumParam(seed, 1, 2, 3, 4, 5)
+    EnumParam(maxLength, 1, 10, 500))
+  {
+    uint64_t rng = 0x9E3779B97F4A7C15ull * seed;
+    DataRegionSet* expected = data_region_set_create(10000);
+    DataRegionCowSet* set = data_region_cow_set_create();
+
+    for(int i = 0; i < 3000; i++)
+    {
+      DataRegion region = test_rand_region(&rng, 20000, maxLength);
+      if(test_rand(&rng) % 3 == 0)
+      {
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_remove(expected, region));
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_remove(set, region));
+      }
+      else
+      {
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add(expected, region));
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_add(set, region));
+      }
+    }
+
+    DataRegionSnapshot* snapshot = data_region_cow_set_snapshot(set);
+    assert_data_region_snapshot_eq_set(snapshot, expected);
+
+    //Compare the queries against the DataRegionSet equivalents
+    DataRegion* expectedDst = gid_malloc(sizeof(DataRegion) * 10001);
+    DataRegion* actualDst = gid_malloc(sizeof(DataRegion) * 10001);
+    for(int i = 0; i < 200; i++)
+    {
+      DataRegion boundary = test_rand_region(&rng, 22000, 3000);
+      int expectedTooSmall, actualTooSmall;
+
+      int64_t expectedCount = data_region_set_crop(expectedDst, 10001, expected, boundary, &expectedTooSmall);
+      int64_t actualCount = data_region_snapshot_crop(actualDst, 10001, snapshot, boundary, &actualTooSmall);
+      assert_int_eq(expectedCount, actualCount);
+      assert_int_eq(expectedTooSmall, actualTooSmall);
+      assert_memory_eq(expectedDst, actualDst, sizeof(DataRegion) * expectedCount);
+      assert_int_eq(expectedCount, data_region_snapshot_count_crop(snapshot, boundary));
+
+      expectedCount = data_region_set_negative_crop(expectedDst, 10001, expected, boundary, &expectedTooSmall);
+      actualCount = data_region_snapshot_negative_crop(actualDst, 10001, snapshot, boundary, &actualTooSmall);
+      assert_int_eq(expectedCount, actualCount);
+      assert_int_eq(expectedTooSmall, actualTooSmall);
+      assert_memory_eq(expectedDst, actualDst, sizeof(DataRegion) * expectedCount);
+
+      int expectedContains = data_region_set_count_crop(expected, boundary) == 1
+        && data_region_set_negative_crop(expectedDst, 10001, expected, boundary, NULL) == 0;
+      assert_int_eq(expectedContains, data_region_snapshot_contains(snapshot, boundary));
+    }
+
+    gid_free(expectedDst);
+    gid_free(actualDst);
+    data_region_snapshot_release(snapshot);
+    data_region_cow_set_free(set);
+    data_region_set_free(expected);
+  }
+
+  Test(data_region_snapshot_crop_dst_too_small)
+  {
+    DataRegionCowSet* set = data_region_cow_set_create();
+    for(int64_t i = 0; i < 300; i++)
+      assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_add(set, DR(i * 10, (i * 10) + 4)));
+
+    DataRegionSnapshot* snapshot = data_region_cow_set_snapshot(set);
+    DataRegion dst[100];
+    int dstTooSmall = 5;//Initial garbage value
+    assert_int_eq(100, data_region_snapshot_crop(dst, 100, snapshot, DR(0, 2999), &dstTooSmall));
+    assert_int_eq(1, dstTooSmall);
+    assert_int_eq(300, data_region_snapshot_count_crop(snapshot, DR(0, 2999)));
+
+    assert_int_eq(0, data_region_snapshot_negative_crop(dst, 100, snapshot, DR(0, 2999), &dstTooSmall));
+    assert_int_eq(1, dstTooSmall);
+
+    assert_int_eq(0, data_region_snapshot_negative_crop(dst, 0, snapshot, DR(0, 4), &dstTooSmall));
+    assert_int_eq(1, dstTooSmall);
+
+    data_region_snapshot_release(snapshot);
+    data_region_cow_set_free(set);
+  }
+
+  Test(data_region_snapshot_is_unaffected_by_later_mutations)
+  {
+    DataRegionCowSet* set = data_region_cow_set_create();
+    DataRegionSet* expected = data_region_set_create(1000);
+    for(int64_t i = 0; i < 500; i++)
+    {
+      assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_add(set, DR(i * 4, (i * 4) + 1)));
+      assert_data_region_set_add(expected, i * 4, (i * 4) + 1);
+    }
+
+    DataRegionSnapshot* before = data_region_cow_set_snapshot(set);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_add(set, DR(0, 1000)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_remove(set, DR(1500, 1500)));
+    DataRegionSnapshot* after = data_region_cow_set_snapshot(set);
+
+    assert_data_region_snapshot_eq_set(before, expected);
+    assert_data_region_set_add(expected, 0, 1000);
+    assert_data_region_set_remove(expected, 1500, 1500);
+    assert_data_region_snapshot_eq_set(after, expected);
+
+    data_region_snapshot_release(before);
+    data_region_snapshot_release(after);
+    data_region_cow_set_free(set);
+    data_region_set_free(expected);
+  }
+
+  Test(data_region_cow_set_mutation_shares_untouched_chunks)
+  {
+    DataRegionCowSet* set = data_region_cow_set_create();
+    for(int64_t i = 0; i < 100 * DATA_REGION_SNAPSHOT_CHUNK_CAPACITY; i++)
+      assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_add(set, DR(i * 4, (i * 4) + 1)));
+
+    DataRegionSnapshot* before = data_region_cow_set_snapshot(set);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_remove(set, DR(8001, 8001)));
+    DataRegionSnapshot* after = data_region_cow_set_snapshot(set);
+
+    int64_t shared = 0;
+    for(int64_t i = 0; i < after->chunk_count; i++)
+    {
+      for(int64_t j = 0; j < before->chunk_count; j++)
+      {
+        if(after->chunks[i] == before->chunks[j])
+          shared++;
+      }
+    }
+    assert_message_format(shared >= after->chunk_count - 2,
+      "Expected at most two chunks to be copied, but only %"PRId64" of %"PRId64" were shared.",
+      shared, after->chunk_count);
+
+    data_region_snapshot_release(before);
+    data_region_snapshot_release(after);
+    data_region_cow_set_free(set);
+  }
+
+  Test(data_region_snapshot_consistent_while_writer_mutates)
+  {
+    DataRegionCowSet* set = data_region_cow_set_create();
+    pthread_t writer;
+    assert_int_eq(0, pthread_create(&writer, NULL, cow_set_test_writer, set));
+
+    for(int i = 0; i < 200; i++)
+    {
+      //Every snapshot must be internally consistent, even while the writer is running
+      DataRegionSnapshot* snapshot = data_region_cow_set_snapshot(set);
+      int64_t totalLength = 0;
+      const DataRegion* previous = NULL;
+      for(int64_t j = 0; j < data_region_snapshot_count(snapshot); j++)
+      {
+        const DataRegion* current = data_region_snapshot_at(snapshot, j);
+        assert_not_null(current);
+        assert_message(data_region_is_valid(*current), "Snapshot contained an invalid DataRegion.");
+        if(previous != NULL)
+          assert_message(current->first_index > previous->last_index + 1, "Snapshot DataRegions were not sorted and separated.");
+        totalLength += data_region_length(*current);
+        previous = current;
+      }
+      assert_int_eq(totalLength, data_region_snapshot_total_length(snapshot));
+      data_region_snapshot_release(snapshot);
+    }
+
+    pthread_join(writer, NULL);
+    data_region_cow_set_free(set);
+  }
+
+  Test(data_region_snapshot_outlives_set)
+  {
+    DataRegionCowSet* set = data_region_cow_set_create();
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_add(set, DR(10, 20)));
+    DataRegionSnapshot* snapshot = data_region_cow_set_snapshot(set);
+    data_region_cow_set_free(set);
+
+    assert_int_eq(1, data_region_snapshot_count(snapshot));
+    assert_int_eq(1, data_region_snapshot_contains(snapshot, DR(12, 20)));
+    assert_int_eq(0, data_region_snapshot_contains(snapshot, DR(12, 21)));
+    data_region_snapshot_release(snapshot);
+  }
+
+END_TEST_SUITE()
+
+
+/* Arguments for the DataRegionShardedSet concurrency test writers. */
+typedef struct ShardedSetTestWriter
+{
+  DataRegionShardedSet* set;
+  int64_t offset;
+} ShardedSetTestWriter;
+
+/* Writer thread used by the DataRegionShardedSet concurrency test. Each
+ * writer fills every other index of its own 1000-index range, then fills
+ * in the gaps. */
+void* sharded_set_test_writer(void* arg)
+{
+  ShardedSetTestWriter* writer = arg;
+  for(int64_t i = 0; i < 1000; i += 2)
+    data_region_sharded_set_add(writer->set, DR(writer->offset + i, writer->offset + i));
+  for(int64_t i = 1; i < 1000; i += 2)
+    data_region_sharded_set_add(writer->set, DR(writer->offset + i, writer->offset + i));
+  return NULL;
+}
+
+BEGIN_TEST_SUITE(DataRegionShardedSetTests)
+
+  Test(data_region_sharded_set_create_invalid_args)
+  {
+    assert_null(data_region_sharded_set_create(0, 0, 4, 10));
+    assert_null(data_region_sharded_set_create(0, 100, 0, 10));
+    assert_null(data_region_sharded_set_create(0, 100, 4, -1));
+  }
+
+  Test(data_region_sharded_set_NULL_args)
+  {
+    DataRegion dst[1];
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_sharded_set_add(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_sharded_set_remove(NULL, DR(0, 0)));
+    assert_int_eq(0, data_region_sharded_set_crop(dst, 1, NULL, DR(0, 0), NULL));
+    assert_int_eq(0, data_region_sharded_set_negative_crop(dst, 1, NULL, DR(0, 0), NULL));
+    assert_int_eq(0, data_region_sharded_set_count(NULL));
+    assert_int_eq(0, data_region_sharded_set_total_length(NULL));
+    data_region_sharded_set_free(NULL);
+  }
+
+  Test(data_region_sharded_set_joins_straddling_regions)
+  {
+    DataRegionShardedSet* set = data_region_sharded_set_create(0, 100, 4, 10);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_sharded_set_add(set, DR(-50, 250)));
+    assert_int_eq(1, data_region_sharded_set_count(set));
+    assert_int_eq(301, data_region_sharded_set_total_length(set));
+
+    DataRegion dst[4];
+    assert_int_eq(1, data_region_sharded_set_crop(dst, 4, set, DR(-1000, 1000), NULL));
+    assert_data_region_array_eq(dst, DR(-50, 250));
+
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_sharded_set_remove(set, DR(100, 100)));
+    assert_int_eq(2, data_region_sharded_set_count(set));
+    assert_int_eq(2, data_region_sharded_set_crop(dst, 4, set, DR(-1000, 1000), NULL));
+    assert_data_region_array_eq(dst, DR(-50, 99), DR(101, 250));
+
+    assert_int_eq(3, data_region_sharded_set_negative_crop(dst, 4, set, DR(-100, 400), NULL));
+    assert_data_region_array_eq(dst, DR(-100, -51), DR(100, 100), DR(251, 400));
+
+    data_region_sharded_set_free(set);
+  }
+
+  Test(data_region_sharded_set_matches_data_region_set,
+    EnumParam(seed, 1, 2, 3)
+    EnumParam(shardWidth, 1, 7, 1000, 100000)
+    EnumParam(maxLength, 1, 50, 2000))
+  {
+    uint64_t rng = 0x9E3779B97F4A7C15ull * seed;
+    DataRegionSet* expected = data_region_set_create(10000);
+    DataRegionShardedSet* set = data_region_sharded_set_create(1000, shardWidth, 16, 10000);
+    assert_not_null(set);
+
+    for(int i = 0; i < 1000; i++)
+    {
+      DataRegion region = test_rand_region(&rng, 20000, maxLength);
+      if(test_rand(&rng) % 3 == 0)
+      {
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_remove(expected, region));
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_sharded_set_remove(set, region));
+      }
+      else
+      {
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add(expected, region));
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_sharded_set_add(set, region));
+      }
+    }
+
+    assert_int_eq(expected->count, data_region_sharded_set_count(set));
+    assert_int_eq(data_region_set_total_length(expected), data_region_sharded_set_total_length(set));
+
+    DataRegion* expectedDst = gid_malloc(sizeof(DataRegion) * 10001);
+    DataRegion* actualDst = gid_malloc(sizeof(DataRegion) * 10001);
+    for(int i = 0; i < 100; i++)
+    {
+      DataRegion boundary = test_rand_region(&rng, 22000, 5000);
+      int expectedTooSmall, actualTooSmall;
+
+      int64_t expectedCount = data_region_set_crop(expectedDst, 10001, expected, boundary, &expectedTooSmall);
+      int64_t actualCount = data_region_sharded_set_crop(actualDst, 10001, set, boundary, &actualTooSmall);
+      assert_int_eq(expectedCount, actualCount);
+      assert_int_eq(expectedTooSmall, actualTooSmall);
+      assert_memory_eq(expectedDst, actualDst, sizeof(DataRegion) * expectedCount);
+      assert_int_eq(expectedCount, data_region_sharded_set_count_crop(set, boundary));
+
+      expectedCount = data_region_set_negative_crop(expectedDst, 10001, expected, boundary, &expectedTooSmall);
+      actualCount = data_region_sharded_set_negative_crop(actualDst, 10001, set, boundary, &actualTooSmall);
+      assert_int_eq(expectedCount, actualCount);
+      assert_int_eq(expectedTooSmall, actualTooSmall);
+      assert_memory_eq(expectedDst, actualDst, sizeof(DataRegion) * expectedCount);
+    }
+
+    gid_free(expectedDst);
+    gid_free(actualDst);
+    data_region_sharded_set_free(set);
+    data_region_set_free(expected);
+  }
+
+  Test(data_region_sharded_set_add_is_all_or_nothing)
+  {
+    DataRegionShardedSet* set = data_region_sharded_set_create(0, 100, 3, 1);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_sharded_set_add(set, DR(250, 250)));
+
+    //The first two shards have space, but the third shard is full
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_sharded_set_add(set, DR(50, 220)));
+    assert_int_eq(1, data_region_sharded_set_count(set));
+    assert_int_eq(1, data_region_sharded_set_total_length(set));
+
+    //Combining with the existing DataRegion does not require more space
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_sharded_set_add(set, DR(50, 249)));
+    assert_int_eq(1, data_region_sharded_set_count(set));
+    assert_int_eq(201, data_region_sharded_set_total_length(set));
+
+    //Splitting the DataRegion in the middle shard would exceed its capacity
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_sharded_set_remove(set, DR(120, 150)));
+    assert_int_eq(201, data_region_sharded_set_total_length(set));
+
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_sharded_set_remove(set, DR(60, 199)));
+    assert_int_eq(2, data_region_sharded_set_count(set));
+    assert_int_eq(61, data_region_sharded_set_total_length(set));
+
+    data_region_sharded_set_free(set);
+  }
+
+  Test(data_region_sharded_set_concurrent_writers,
+    EnumParam(threadCount, 1, 2, 8))
+  {
+    DataRegionShardedSet* set = data_region_sharded_set_create(0, 1000, 8, 1000);
+    pthread_t threads[8];
+    ShardedSetTestWriter writers[8];
+    for(int i = 0; i < threadCount; i++)
+    {
+      writers[i] = (ShardedSetTestWriter){ set, i * 1000 };
+      assert_int_eq(0, pthread_create(&threads[i], NULL, sharded_set_test_writer, &writers[i]));
+    }
+    for(int i = 0; i < threadCount; i++)
+      pthread_join(threads[i], NULL);
+
+    //All of the writers' ranges are adjacent, so they form a single DataRegion
+    DataRegion dst[1];
+    assert_int_eq(1, data_region_sharded_set_count(set));
+    assert_int_eq(1, data_region_sharded_set_crop(dst, 1, set, DR(INT64_MIN, INT64_MAX), NULL));
+    assert_data_region_array_eq(dst, DR(0, (threadCount * 1000) - 1));
+    data_region_sharded_set_free(set);
+  }
+
+END_TEST_SUITE()
+
+
+/* Arguments for the DataRegionLockFreeSet concurrency test threads. */
+typedef struct LockFreeSetTestThread
+{
+  DataRegionLockFreeSet* set;
+  int64_t offset;
+  int64_t violations;
+} LockFreeSetTestThread;
+
+/* Writer thread used by the DataRegionLockFreeSet concurrency test. Each
+ * writer fills every other index of its own 1000-index range, punches holes
+ * into it, then fills in all gaps. */
+void* lockfree_set_test_writer(void* arg)
+{
+  LockFreeSetTestThread* writer = arg;
+  DataRegionLockFreeHandle* handle = data_region_lockfree_set_attach(writer->set);
+  for(int64_t i = 0; i < 1000; i += 2)
+    data_region_lockfree_set_add(handle, DR(writer->offset + i, writer->offset + i));
+  for(int64_t i = 0; i < 1000; i += 10)
+    data_region_lockfree_set_remove(handle, DR(writer->offset + i, writer->offset + i + 4));
+  for(int64_t i = 1; i < 1000; i += 2)
+    data_region_lockfree_set_add(handle, DR(writer->offset + i - 1, writer->offset + i));
+  data_region_lockfree_set_detach(handle);
+  return NULL;
+}
+
+/* Reader thread used by the DataRegionLockFreeSet concurrency test. Index
+ * -1 is always present and index -2 never is, so every membership query on
+ * them must return the same answer while the writers mutate the set. */
+void* lockfree_set_test_reader(void* arg)
+{
+  LockFreeSetTestThread* reader = arg;
+  DataRegionLockFreeHandle* handle = data_region_lockfree_set_attach(reader->set);
+  for(int i = 0; i < 20000; i++)
+  {
+    if(!data_region_lockfree_set_contains(handle, DR(-1, -1)))
+      reader->violations++;
+    if(data_region_lockfree_set_contains(handle, DR(-2, -2)))
+      reader->violations++;
+  }
+  data_region_lockfree_set_detach(handle);
+  return NULL;
+}
+
+BEGIN_TEST_SUITE(DataRegionLockFreeSetTests)
+
+  Test(data_region_lockfree_set_NULL_args)
+  {
+    DataRegion dst[1];
+    assert_null(data_region_lockfree_set_attach(NULL));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_lockfree_set_add(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_lockfree_set_remove(NULL, DR(0, 0)));
+    assert_int_eq(0, data_region_lockfree_set_contains(NULL, DR(0, 0)));
+    assert_int_eq(0, data_region_lockfree_set_crop(dst, 1, NULL, DR(0, 0), NULL));
+    assert_int_eq(0, data_region_lockfree_set_negative_crop(dst, 1, NULL, DR(0, 0), NULL));
+    assert_int_eq(0, data_region_lockfree_set_count(NULL));
+    assert_int_eq(0, data_region_lockfree_set_total_length(NULL));
+    data_region_lockfree_set_detach(NULL);
+    data_region_lockfree_set_free(NULL);
+  }
+
+  Test(data_region_lockfree_set_invalid_region)
+  {
+    DataRegionLockFreeSet* set = data_region_lockfree_set_create();
+    DataRegionLockFreeHandle* handle = data_region_lockfree_set_attach(set);
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_lockfree_set_add(handle, DR(1, 0)));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_lockfree_set_remove(handle, DR(1, 0)));
+    assert_int_eq(0, data_region_lockfree_set_count(set));
+    data_region_lockfree_set_detach(handle);
+    data_region_lockfree_set_free(set);
+  }
+
+  Test(data_region_lockfree_set_combines_and_splits)
+  {
+    DataRegionLockFreeSet* set = data_region_lockfree_set_create();
+    DataRegionLockFreeHandle* handle = data_region_lockfree_set_attach(set);
+    DataRegion dst[4];
+
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_add(handle, DR(0, 9)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_add(handle, DR(20, 29)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_add(handle, DR(INT64_MIN, INT64_MIN)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_add(handle, DR(INT64_MAX, INT64_MAX)));
+    assert_int_eq(4, data_region_lockfree_set_count(set));
+
+    //Adjacent on both sides
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_add(handle, DR(10, 19)));
+    assert_int_eq(3, data_region_lockfree_set_count(set));
+    assert_int_eq(1, data_region_lockfree_set_crop(dst, 4, handle, DR(-100, 100), NULL));
+    assert_data_region_array_eq(dst, DR(0, 29));
+    assert_int_eq(1, data_region_lockfree_set_contains(handle, DR(5, 25)));
+    assert_int_eq(0, data_region_lockfree_set_contains(handle, DR(5, 30)));
+
+    //Already present
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_add(handle, DR(3, 4)));
+    assert_int_eq(3, data_region_lockfree_set_count(set));
+
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_remove(handle, DR(10, 14)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_remove(handle, DR(INT64_MIN, INT64_MIN)));
+    assert_int_eq(3, data_region_lockfree_set_count(set));
+    assert_int_eq(26, data_region_lockfree_set_total_length(set));
+    assert_int_eq(3, data_region_lockfree_set_negative_crop(dst, 4, handle, DR(-5, 35), NULL));
+    assert_data_region_array_eq(dst, DR(-5, -1), DR(10, 14), DR(30, 35));
+
+    data_region_lockfree_set_detach(handle);
+    data_region_lockfree_set_free(set);
+  }
+
+  Test(data_region_lockfree_set_matches_data_region_set,
+    EnumParam(seed, 1, 2, 3)
+    EnumParam(maxLength, 1, 50, 2000))
+  {
+    uint64_t rng = 0x9E3779B97F4A7C15ull * seed;
+    DataRegionSet* expected = data_region_set_create(10000);
+    DataRegionLockFreeSet* set = data_region_lockfree_set_create();
+    DataRegionLockFreeHandle* handle = data_region_lockfree_set_attach(set);
+    assert_not_null(handle);
+
+    for(int i = 0; i < 2000; i++)
+    {
+      DataRegion region = test_rand_region(&rng, 20000, maxLength);
+      if(test_rand(&rng) % 3 == 0)
+      {
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_remove(expected, region));
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_remove(handle, region));
+      }
+      else
+      {
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add(expected, region));
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_add(handle, region));
+      }
+    }
+
+    assert_int_eq(expected->count, data_region_lockfree_set_count(set));
+    assert_int_eq(data_region_set_total_length(expected), data_region_lockfree_set_total_length(set));
+
+    DataRegion* expectedDst = gid_malloc(sizeof(DataRegion) * 10001);
+    DataRegion* actualDst = gid_malloc(sizeof(DataRegion) * 10001);
+    for(int i = 0; i < 100; i++)
+    {
+      DataRegion boundary = test_rand_region(&rng, 22000, 5000);
+      int expectedTooSmall, actualTooSmall;
+
+      int64_t expectedCount = data_region_set_crop(expectedDst, 10001, expected, boundary, &expectedTooSmall);
+      int64_t actualCount = data_region_lockfree_set_crop(actualDst, 10001, handle, boundary, &actualTooSmall);
+      assert_int_eq(expectedCount, actualCount);
+      assert_int_eq(expectedTooSmall, actualTooSmall);
+      assert_memory_eq(expectedDst, actualDst, sizeof(DataRegion) * expectedCount);
+      assert_int_eq(expectedCount, data_region_lockfree_set_count_crop(handle, boundary));
+      assert_int_eq(expectedCount == 1 && data_region_contains(expectedDst[0], boundary), data_region_lockfree_set_contains(handle, boundary));
+
+      expectedCount = data_region_set_negative_crop(expectedDst, 10001, expected, boundary, &expectedTooSmall);
+      actualCount = data_region_lockfree_set_negative_crop(actualDst, 10001, handle, boundary, &actualTooSmall);
+      assert_int_eq(expectedCount, actualCount);
+      assert_int_eq(expectedTooSmall, actualTooSmall);
+      assert_memory_eq(expectedDst, actualDst, sizeof(DataRegion) * expectedCount);
+
+      expectedCount = data_region_set_negative_crop(expectedDst, 2, expected, boundary, &expectedTooSmall);
+      actualCount = data_region_lockfree_set_negative_crop(actualDst, 2, handle, boundary, &actualTooSmall);
+      assert_int_eq(expectedCount, actualCount);
+      assert_int_eq(expectedTooSmall, actualTooSmall);
+    }
+
+    gid_free(expectedDst);
+    gid_free(actualDst);
+    data_region_lockfree_set_detach(handle);
+    data_region_lockfree_set_free(set);
+    data_region_set_free(expected);
+  }
+
+  Test(data_region_lockfree_set_reports_allocation_failures)
+  {
+    DataRegionLockFreeSet* set = data_region_lockfree_set_create();
+    DataRegionLockFreeHandle* handle = data_region_lockfree_set_attach(set);
+    for(int64_t i = 0; i < 20; i++)
+      assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_add(handle, DR(i * 10, i * 10 + 4)));
+
+    //Fail to allocate the new node, the SCX record, and the grown scratch sequence in turn
+    int64_t allocsLeft[] = { 0, 1 };
+    for(int i = 0; i < 2; i++)
+    {
+      lockfreeAllocsLeft = allocsLeft[i];
+      assert_int_eq(DATA_REGION_SET_ALLOCATION_FAILED, data_region_lockfree_set_add(handle, DR(500, 510)));
+      assert_int_eq(DATA_REGION_SET_ALLOCATION_FAILED, data_region_lockfree_set_add(handle, DR(5, 5)));
+      assert_int_eq(DATA_REGION_SET_ALLOCATION_FAILED, data_region_lockfree_set_remove(handle, DR(12, 12)));
+      assert_int_eq(DATA_REGION_SET_ALLOCATION_FAILED, data_region_lockfree_set_remove(handle, DR(10, 14)));
+    }
+    lockfreeAllocsLeft = 0;
+    assert_int_eq(DATA_REGION_SET_ALLOCATION_FAILED, data_region_lockfree_set_add(handle, DR(0, 1000)));
+    assert_int_eq(DATA_REGION_SET_ALLOCATION_FAILED, data_region_lockfree_set_remove(handle, DR(0, 1000)));
+    //Nothing to change doesn't need to allocate
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_add(handle, DR(11, 13)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_remove(handle, DR(5, 9)));
+    lockfreeAllocsLeft = -1;
+
+    assert_int_eq(20, data_region_lockfree_set_count(set));
+    assert_int_eq(100, data_region_lockfree_set_total_length(set));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_add(handle, DR(0, 1000)));
+    assert_int_eq(1, data_region_lockfree_set_count(set));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_remove(handle, DR(0, 1000)));
+    assert_int_eq(0, data_region_lockfree_set_count(set));
+    assert_int_eq(0, data_region_lockfree_set_total_length(set));
+
+    data_region_lockfree_set_detach(handle);
+    data_region_lockfree_set_free(set);
+  }
+
+  Test(data_region_lockfree_set_reuses_detached_handles)
+  {
+    DataRegionLockFreeSet* set = data_region_lockfree_set_create();
+    DataRegionLockFreeHandle* first = data_region_lockfree_set_attach(set);
+    DataRegionLockFreeHandle* second = data_region_lockfree_set_attach(set);
+    assert_not_null(first);
+    assert_not_null(second);
+    assert_int_eq(0, first == second);
+
+    data_region_lockfree_set_detach(first);
+    assert_pointer_eq(first, data_region_lockfree_set_attach(set));
+    data_region_lockfree_set_free(set);
+  }
+
+  Test(data_region_lockfree_set_concurrent_writers,
+    EnumParam(threadCount, 1, 2, 8))
+  {
+    DataRegionLockFreeSet* set = data_region_lockfree_set_create();
+    DataRegionLockFreeHandle* handle = data_region_lockfree_set_attach(set);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lockfree_set_add(handle, DR(-1, -1)));
+
+    pthread_t threads[10];
+    LockFreeSetTestThread args[10];
+    for(int i = 0; i < threadCount + 2; i++)
+    {
+      args[i] = (LockFreeSetTestThread){ set, i * 1000, 0 };
+      assert_int_eq(0, pthread_create(&threads[i], NULL, i < threadCount ? lockfree_set_test_writer : lockfree_set_test_reader, &args[i]));
+    }
+    for(int i = 0; i < threadCount + 2; i++)
+    {
+      pthread_join(threads[i], NULL);
+      assert_int_eq(0, args[i].violations);
+    }
+
+    //All of the writers' ranges are adjacent to each other and to index -1
+    DataRegion dst[2];
+    assert_int_eq(1, data_region_lockfree_set_count(set));
+    assert_int_eq(1, data_region_lockfree_set_crop(dst, 2, handle, DR(INT64_MIN, INT64_MAX), NULL));
+    assert_data_region_array_eq(dst, DR(-1, (threadCount * 1000) - 1));
+    assert_int_eq(threadCount * 1000 + 1, data_region_lockfree_set_total_length(set));
+
+    data_region_lockfree_set_detach(handle);
+    data_region_lockfree_set_free(set);
+  }
+
+END_TEST_SUITE()
+
+
+/* Arguments for the DataRegionCombiningSet concurrency test writers. */
+typedef struct CombiningSetTestWriter
+{
+  DataRegionCombiningSet* set;
+  int64_t offset;
+} CombiningSetTestWriter;
+
+/* Writer thread used by the DataRegionCombiningSet concurrency test. Each
+ * writer fills every other index of its own 1000-index range, punches holes
+ * into it, then fills in all gaps. */
+void* combining_set_test_writer(void* arg)
+{
+  CombiningSetTestWriter* writer = arg;
+  DataRegionCombiningSlot* slot = data_region_combining_set_attach(writer->set);
+  for(int64_t i = 0; i < 1000; i += 2)
+    data_region_combining_set_add(slot, DR(writer->offset + i, writer->offset + i));
+  for(int64_t i = 0; i < 1000; i += 10)
+    data_region_combining_set_remove(slot, DR(writer->offset + i, writer->offset + i + 4));
+  for(int64_t i = 1; i < 1000; i += 2)
+    data_region_combining_set_add(slot, DR(writer->offset + i - 1, writer->offset + i));
+  data_region_combining_set_detach(slot);
+  return NULL;
+}
+
+/* Publishes an operation in a slot without waiting for it, so that a test
+ * can apply a whole batch with '_data_region_combining_set_combine'. */
+void combining_set_test_publish(DataRegionCombiningSlot* slot, DataRegion region, int isAdd)
+{
+  slot->region = region;
+  slot->is_add = isAdd;
+  atomic_store(&slot->state, _DATA_REGION_COMBINING_PENDING);
+}
+
+BEGIN_TEST_SUITE(DataRegionCombiningSetTests)
+
+  Test(data_region_combining_set_NULL_args)
+  {
+    DataRegion dst[1];
+    assert_null(data_region_combining_set_create(-1));
+    assert_null(data_region_combining_set_attach(NULL));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_combining_set_add(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_combining_set_remove(NULL, DR(0, 0)));
+    assert_int_eq(0, data_region_combining_set_crop(dst, 1, NULL, DR(0, 0), NULL));
+    assert_int_eq(0, data_region_combining_set_negative_crop(dst, 1, NULL, DR(0, 0), NULL));
+    assert_int_eq(0, data_region_combining_set_count(NULL));
+    assert_int_eq(0, data_region_combining_set_total_length(NULL));
+    data_region_combining_set_detach(NULL);
+    data_region_combining_set_free(NULL);
+  }
+
+  Test(data_region_combining_set_invalid_region)
+  {
+    DataRegionCombiningSet* set = data_region_combining_set_create(10);
+    DataRegionCombiningSlot* slot = data_region_combining_set_attach(set);
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_combining_set_add(slot, DR(1, 0)));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_combining_set_remove(slot, DR(1, 0)));
+    data_region_combining_set_free(set);
+  }
+
+  Test(data_region_combining_set_matches_data_region_set,
+    EnumParam(seed, 1, 2, 3)
+    EnumParam(capacity, 10, 10000)
+    EnumParam(maxLength, 1, 50, 2000))
+  {
+    uint64_t rng = 0x9E3779B97F4A7C15ull * seed;
+    DataRegionSet* expected = data_region_set_create(capacity);
+    DataRegionCombiningSet* set = data_region_combining_set_create(capacity);
+    DataRegionCombiningSlot* slot = data_region_combining_set_attach(set);
+
+    for(int i = 0; i < 1000; i++)
+    {
+      DataRegion region = test_rand_region(&rng, 20000, maxLength);
+      if(test_rand(&rng) % 3 == 0)
+      {
+        assert_int_eq(data_region_set_remove(expected, region), data_region_combining_set_remove(slot, region));
+      }
+      else
+      {
+        assert_int_eq(data_region_set_add(expected, region), data_region_combining_set_add(slot, region));
+      }
+    }
+
+    assert_int_eq(expected->count, data_region_combining_set_count(set));
+    assert_int_eq(data_region_set_total_length(expected), data_region_combining_set_total_length(set));
+    assert_memory_eq(expected->regions, set->set->regions, sizeof(DataRegion) * expected->count);
+
+    data_region_combining_set_free(set);
+    data_region_set_free(expected);
+  }
+
+  Test(data_region_combining_set_applies_batch)
+  {
+    DataRegionCombiningSet* set = data_region_combining_set_create(10);
+    DataRegionCombiningSlot* slots[5];
+    for(int i = 0; i < 5; i++)
+      slots[i] = data_region_combining_set_attach(set);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_combining_set_add(slots[0], DR(100, 199)));
+
+    combining_set_test_publish(slots[0], DR(10, 19), 1);
+    combining_set_test_publish(slots[1], DR(0, 9), 1);
+    combining_set_test_publish(slots[2], DR(20, 99), 1);
+    combining_set_test_publish(slots[3], DR(300, 300), 1);
+    combining_set_test_publish(slots[4], DR(150, 159), 0);
+    pthread_mutex_lock(&set->lock);
+    _data_region_combining_set_combine(set);
+    pthread_mutex_unlock(&set->lock);
+
+    for(int i = 0; i < 5; i++)
+    {
+      assert_int_eq(_DATA_REGION_COMBINING_DONE, atomic_load(&slots[i]->state));
+      assert_int_eq(DATA_REGION_SET_SUCCESS, slots[i]->result);
+    }
+
+    DataRegion dst[4];
+    assert_int_eq(3, data_region_combining_set_crop(dst, 4, set, DR(INT64_MIN, INT64_MAX), NULL));
+    assert_data_region_array_eq(dst, DR(0, 149), DR(160, 199), DR(300, 300));
+    assert_int_eq(191, data_region_combining_set_total_length(set));
+    data_region_combining_set_free(set);
+  }
+
+  Test(data_region_combining_set_scratch_fits_the_batch)
+  {
+    DataRegionCombiningSet* set = data_region_combining_set_create(100000);
+    DataRegionCombiningSlot* slots[2];
+    for(int i = 0; i < 2; i++)
+      slots[i] = data_region_combining_set_attach(set);
+    for(int64_t i = 0; i < 1000; i++)
+      assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_combining_set_add(slots[0], DR(i * 10, i * 10 + 4)));
+
+    //The scratch space is sized by the slots and the merge window, not by the capacity of the set
+    combining_set_test_publish(slots[0], DR(5000, 5020), 1);
+    combining_set_test_publish(slots[1], DR(6002, 6002), 0);
+    pthread_mutex_lock(&set->lock);
+    _data_region_combining_set_combine(set);
+    pthread_mutex_unlock(&set->lock);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, slots[0]->result);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, slots[1]->result);
+    assert_int_eq(2, set->pending_capacity);
+    assert_message(set->merged_capacity <= 8, "merged scratch space should fit the merge window");
+
+    assert_int_eq(999, data_region_combining_set_count(set));
+    assert_int_eq(5009, data_region_combining_set_total_length(set));
+    data_region_combining_set_free(set);
+  }
+
+  Test(data_region_combining_set_batch_out_of_space)
+  {
+    DataRegionCombiningSet* set = data_region_combining_set_create(2);
+    DataRegionCombiningSlot* slots[3];
+    for(int i = 0; i < 3; i++)
+      slots[i] = data_region_combining_set_attach(set);
+
+    //The batch doesn't fit as a whole, so the operations are applied one by one
+    combining_set_test_publish(slots[0], DR(0, 0), 1);
+    combining_set_test_publish(slots[1], DR(10, 10), 1);
+    combining_set_test_publish(slots[2], DR(20, 20), 1);
+    pthread_mutex_lock(&set->lock);
+    _data_region_combining_set_combine(set);
+    pthread_mutex_unlock(&set->lock);
+
+    int successCount = 0, outOfSpaceCount = 0;
+    for(int i = 0; i < 3; i++)
+    {
+      successCount += slots[i]->result == DATA_REGION_SET_SUCCESS;
+      outOfSpaceCount += slots[i]->result == DATA_REGION_SET_OUT_OF_SPACE;
+    }
+    assert_int_eq(2, successCount);
+    assert_int_eq(1, outOfSpaceCount);
+    assert_int_eq(2, data_region_combining_set_count(set));
+    data_region_combining_set_free(set);
+  }
+
+  Test(data_region_combining_set_concurrent_writers,
+    EnumParam(threadCount, 1, 2, 8))
+  {
+    DataRegionCombiningSet* set = data_region_combining_set_create(10000);
+    pthread_t threads[8];
+    CombiningSetTestWriter writers[8];
+    for(int i = 0; i < threadCount; i++)
+    {
+      writers[i] = (CombiningSetTestWriter){ set, i * 1000 };
+      assert_int_eq(0, pthread_create(&threads[i], NULL, combining_set_test_writer, &writers[i]));
+    }
+    for(int i = 0; i < threadCount; i++)
+      pthread_join(threads[i], NULL);
+
+    //All of the writers' ranges are adjacent, so they form a single DataRegion
+    DataRegion dst[1];
+    assert_int_eq(1, data_region_combining_set_count(set));
+    assert_int_eq(1, data_region_combining_set_crop(dst, 1, set, DR(INT64_MIN, INT64_MAX), NULL));
+    assert_data_region_array_eq(dst, DR(0, (threadCount * 1000) - 1));
+    data_region_combining_set_free(set);
+  }
+
+END_TEST_SUITE()
+
+/* Arguments for the DataRegionBufferedSet concurrency test writers. */
+typedef struct BufferedSetTestWriter
+{
+  DataRegionBufferedSet* set;
+  int64_t offset;
+} BufferedSetTestWriter;
+
+/* Writer thread used by the DataRegionBufferedSet concurrency test. Each
+ * writer fills every other index of its own 1000-index range, queries the
+ * set, then fills in all gaps. */
+void* buffered_set_test_writer(void* arg)
+{
+  BufferedSetTestWriter* writer = arg;
+  DataRegionBufferedWriter* handle = data_region_buffered_set_attach(writer->set);
+  for(int64_t i = 0; i < 1000; i += 2)
+    data_region_buffered_set_add(handle, DR(writer->offset + i, writer->offset + i));
+  data_region_buffered_set_count(writer->set, DATA_REGION_BUFFERED_INCLUDE_PENDING);
+  for(int64_t i = 1; i < 1000; i += 2)
+    data_region_buffered_set_add(handle, DR(writer->offset + i, writer->offset + i));
+  data_region_buffered_set_detach(handle);
+  return NULL;
+}
+
+BEGIN_TEST_SUITE(DataRegionBufferedSetTests)
+
+  Test(data_region_buffered_set_NULL_args)
+  {
+    DataRegion dst[1];
+    assert_null(data_region_buffered_set_create(-1, 1));
+    assert_null(data_region_buffered_set_create(1, 0));
+    assert_null(data_region_buffered_set_attach(NULL));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_buffered_set_add(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_buffered_set_remove(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_buffered_set_flush(NULL));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_buffered_set_flush_all(NULL));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_buffered_set_detach(NULL));
+    assert_int_eq(0, data_region_buffered_set_crop(dst, 1, NULL, DR(0, 0), DATA_REGION_BUFFERED_SHARED_ONLY, NULL));
+    assert_int_eq(0, data_region_buffered_set_negative_crop(dst, 1, NULL, DR(0, 0), DATA_REGION_BUFFERED_SHARED_ONLY, NULL));
+    assert_int_eq(0, data_region_buffered_set_count(NULL, DATA_REGION_BUFFERED_SHARED_ONLY));
+    assert_int_eq(0, data_region_buffered_set_total_length(NULL, DATA_REGION_BUFFERED_SHARED_ONLY));
+    data_region_buffered_set_free(NULL);
+  }
+
+  Test(data_region_buffered_set_invalid_region)
+  {
+    DataRegionBufferedSet* set = data_region_buffered_set_create(10, 4);
+    DataRegionBufferedWriter* writer = data_region_buffered_set_attach(set);
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_buffered_set_add(writer, DR(1, 0)));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_buffered_set_remove(set, DR(1, 0)));
+    data_region_buffered_set_free(set);
+  }
+
+  Test(data_region_buffered_set_query_modes)
+  {
+    DataRegionBufferedSet* set = data_region_buffered_set_create(10, 4);
+    DataRegionBufferedWriter* a = data_region_buffered_set_attach(set);
+    DataRegionBufferedWriter* b = data_region_buffered_set_attach(set);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(a, DR(0, 9)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(b, DR(10, 19)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(b, DR(30, 39)));
+
+    //Buffered DataRegions are only seen when asked for
+    DataRegion dst[4];
+    assert_int_eq(0, data_region_buffered_set_count(set, DATA_REGION_BUFFERED_SHARED_ONLY));
+    assert_int_eq(2, data_region_buffered_set_crop(dst, 4, set, DR(INT64_MIN, INT64_MAX), DATA_REGION_BUFFERED_INCLUDE_PENDING, NULL));
+    assert_data_region_array_eq(dst, DR(0, 19), DR(30, 39));
+    assert_int_eq(1, data_region_buffered_set_negative_crop(dst, 4, set, DR(0, 39), DATA_REGION_BUFFERED_INCLUDE_PENDING, NULL));
+    assert_data_region_array_eq(dst, DR(20, 29));
+    assert_int_eq(30, data_region_buffered_set_total_length(set, DATA_REGION_BUFFERED_INCLUDE_PENDING));
+    assert_int_eq(0, data_region_buffered_set_count(set, DATA_REGION_BUFFERED_SHARED_ONLY));
+
+    //Flushing one writer publishes only its own buffer
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_flush(a));
+    assert_int_eq(1, data_region_buffered_set_crop(dst, 4, set, DR(INT64_MIN, INT64_MAX), DATA_REGION_BUFFERED_SHARED_ONLY, NULL));
+    assert_data_region_array_eq(dst, DR(0, 9));
+
+    assert_int_eq(2, data_region_buffered_set_count_crop(set, DR(INT64_MIN, INT64_MAX), DATA_REGION_BUFFERED_FLUSH_FIRST));
+    assert_int_eq(2, data_region_buffered_set_count(set, DATA_REGION_BUFFERED_SHARED_ONLY));
+    assert_int_eq(0, b->buffer->count);
+    data_region_buffered_set_free(set);
+  }
+
+  Test(data_region_buffered_set_flushes_full_buffer)
+  {
+    DataRegionBufferedSet* set = data_region_buffered_set_create(10, 2);
+    DataRegionBufferedWriter* writer = data_region_buffered_set_attach(set);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(writer, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(writer, DR(10, 10)));
+    assert_int_eq(0, data_region_buffered_set_count(set, DATA_REGION_BUFFERED_SHARED_ONLY));
+
+    //Combining into the buffer needs no space
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(writer, DR(1, 9)));
+    assert_int_eq(0, data_region_buffered_set_count(set, DATA_REGION_BUFFERED_SHARED_ONLY));
+
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(writer, DR(20, 20)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(writer, DR(30, 30)));
+    DataRegion dst[4];
+    assert_int_eq(2, data_region_buffered_set_crop(dst, 4, set, DR(INT64_MIN, INT64_MAX), DATA_REGION_BUFFERED_SHARED_ONLY, NULL));
+    assert_data_region_array_eq(dst, DR(0, 10), DR(20, 20));
+    assert_int_eq(1, writer->buffer->count);
+    data_region_buffered_set_free(set);
+  }
+
+  Test(data_region_buffered_set_shared_out_of_space)
+  {
+    DataRegionBufferedSet* set = data_region_buffered_set_create(2, 4);
+    DataRegionBufferedWriter* writer = data_region_buffered_set_attach(set);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(writer, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(writer, DR(10, 10)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(writer, DR(20, 20)));
+
+    //What doesn't fit stays buffered
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_buffered_set_flush(writer));
+    assert_int_eq(2, data_region_buffered_set_count(set, DATA_REGION_BUFFERED_SHARED_ONLY));
+    assert_int_eq(1, writer->buffer->count);
+    assert_int_eq(1, data_region_set_total_length(writer->buffer));
+    assert_int_eq(3, data_region_buffered_set_total_length(set, DATA_REGION_BUFFERED_INCLUDE_PENDING));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_buffered_set_remove(set, DR(0, 0)));
+    data_region_buffered_set_free(set);
+  }
+
+  Test(data_region_buffered_set_remove_includes_pending)
+  {
+    DataRegionBufferedSet* set = data_region_buffered_set_create(10, 4);
+    DataRegionBufferedWriter* writer = data_region_buffered_set_attach(set);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(writer, DR(0, 99)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_remove(set, DR(10, 19)));
+
+    DataRegion dst[4];
+    assert_int_eq(2, data_region_buffered_set_crop(dst, 4, set, DR(INT64_MIN, INT64_MAX), DATA_REGION_BUFFERED_SHARED_ONLY, NULL));
+    assert_data_region_array_eq(dst, DR(0, 9), DR(20, 99));
+    assert_int_eq(0, writer->buffer->count);
+    data_region_buffered_set_free(set);
+  }
+
+  Test(data_region_buffered_set_reuses_detached_writer)
+  {
+    DataRegionBufferedSet* set = data_region_buffered_set_create(10, 4);
+    DataRegionBufferedWriter* writer = data_region_buffered_set_attach(set);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_add(writer, DR(0, 9)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_buffered_set_detach(writer));
+    assert_int_eq(1, data_region_buffered_set_count(set, DATA_REGION_BUFFERED_SHARED_ONLY));
+    assert_pointer_eq(writer, data_region_buffered_set_attach(set));
+    data_region_buffered_set_free(set);
+  }
+
+  Test(data_region_buffered_set_matches_data_region_set,
+    EnumParam(seed, 1, 2, 3)
+    EnumParam(bufferCapacity, 1, 8, 64)
+    EnumParam(maxLength, 1, 50, 2000))
+  {
+    uint64_t rng = 0x9E3779B97F4A7C15ull * seed;
+    DataRegionSet* expected = data_region_set_create(10000);
+    DataRegionBufferedSet* set = data_region_buffered_set_create(10000, bufferCapacity);
+    DataRegionBufferedWriter* writer = data_region_buffered_set_attach(set);
+
+    for(int i = 0; i < 1000; i++)
+    {
+      DataRegion region = test_rand_region(&rng, 20000, maxLength);
+      if(test_rand(&rng) % 3 == 0)
+      {
+        assert_int_eq(data_region_set_remove(expected, region), data_region_buffered_set_remove(set, region));
+      }
+      else
+      {
+        assert_int_eq(data_region_set_add(expected, region), data_region_buffered_set_add(writer, region));
+      }
+
+      if(i % 100 == 0)
+      {
+        assert_int_eq(expected->count, data_region_buffered_set_count(set, DATA_REGION_BUFFERED_INCLUDE_PENDING));
+        assert_int_eq(data_region_set_total_length(expected), data_region_buffered_set_total_length(set, DATA_REGION_BUFFERED_INCLUDE_PENDING));
+      }
+    }
+
+    assert_int_eq(expected->count, data_region_buffered_set_count(set, DATA_REGION_BUFFERED_FLUSH_FIRST));
+    assert_int_eq(data_region_set_total_length(expected), data_region_buffered_set_total_length(set, DATA_REGION_BUFFERED_SHARED_ONLY));
+    assert_memory_eq(expected->regions, set->set->regions, sizeof(DataRegion) * expected->count);
+
+    data_region_buffered_set_free(set);
+    data_region_set_free(expected);
+  }
+
+  Test(data_region_buffered_set_concurrent_writers,
+    EnumParam(threadCount, 1, 2, 8))
+  {
+    DataRegionBufferedSet* set = data_region_buffered_set_create(10000, 16);
+    pthread_t threads[8];
+    BufferedSetTestWriter writers[8];
+    for(int i = 0; i < threadCount; i++)
+    {
+      writers[i] = (BufferedSetTestWriter){ set, i * 1000 };
+      assert_int_eq(0, pthread_create(&threads[i], NULL, buffered_set_test_writer, &writers[i]));
+    }
+    for(int i = 0; i < threadCount; i++)
+      pthread_join(threads[i], NULL);
+
+    //Detaching flushed every writer, and all ranges are adjacent
+    DataRegion dst[1];
+    assert_int_eq(1, data_region_buffered_set_count(set, DATA_REGION_BUFFERED_SHARED_ONLY));
+    assert_int_eq(1, data_region_buffered_set_crop(dst, 1, set, DR(INT64_MIN, INT64_MAX), DATA_REGION_BUFFERED_SHARED_ONLY, NULL));
+    assert_data_region_array_eq(dst, DR(0, (threadCount * 1000) - 1));
+    data_region_buffered_set_free(set);
+  }
+
+END_TEST_SUITE()
+
+
+/* Arguments for the DataRegionLsmSet concurrency test writers. */
+typedef struct LsmSetTestWriter
+{
+  DataRegionLsmSet* set;
+  int64_t offset;
+} LsmSetTestWriter;
+
+/* Writer thread used by the DataRegionLsmSet concurrency test. Each writer
+ * fills every other index of its own 1000-index range, punches holes into
+ * it, then fills in all gaps. */
+void* lsm_set_test_writer(void* arg)
+{
+  LsmSetTestWriter* writer = arg;
+  for(int64_t i = 0; i < 1000; i += 2)
+    data_region_lsm_set_add(writer->set, DR(writer->offset + i, writer->offset + i));
+  for(int64_t i = 0; i < 1000; i += 10)
+    data_region_lsm_set_remove(writer->set, DR(writer->offset + i, writer->offset + i + 4));
+  data_region_lsm_set_count(writer->set);
+  for(int64_t i = 1; i < 1000; i += 2)
+    data_region_lsm_set_add(writer->set, DR(writer->offset + i - 1, writer->offset + i));
+  return NULL;
+}
+
+BEGIN_TEST_SUITE(DataRegionLsmSetTests)
+
+  Test(data_region_lsm_set_NULL_args)
+  {
+    DataRegion dst[1];
+    assert_null(data_region_lsm_set_create(-1, 1, 1, 0));
+    assert_null(data_region_lsm_set_create(1, 0, 1, 0));
+    assert_null(data_region_lsm_set_create(1, 1, 0, 0));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_lsm_set_add(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_lsm_set_remove(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_lsm_set_compact(NULL));
+    assert_int_eq(0, data_region_lsm_set_crop(dst, 1, NULL, DR(0, 0), NULL));
+    assert_int_eq(0, data_region_lsm_set_negative_crop(dst, 1, NULL, DR(0, 0), NULL));
+    assert_int_eq(0, data_region_lsm_set_contains(NULL, DR(0, 0)));
+    assert_int_eq(0, data_region_lsm_set_count(NULL));
+    assert_int_eq(0, data_region_lsm_set_total_length(NULL));
+    data_region_lsm_set_free(NULL);
+  }
+
+  Test(data_region_lsm_set_invalid_region)
+  {
+    DataRegionLsmSet* set = data_region_lsm_set_create(10, 4, 2, 0);
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_lsm_set_add(set, DR(1, 0)));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_lsm_set_remove(set, DR(1, 0)));
+    assert_int_eq(0, data_region_lsm_set_contains(set, DR(1, 0)));
+    assert_int_eq(0, set->log_count);
+    data_region_lsm_set_free(set);
+  }
+
+  Test(data_region_lsm_set_merges_levels)
+  {
+    DataRegionLsmSet* set = data_region_lsm_set_create(10, 2, 100, 0);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_add(set, DR(0, 99)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_compact(set));
+    assert_int_eq(1, set->base->count);
+
+    //One run (removing and re-adding part of 10..19), and one logged removal
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_remove(set, DR(10, 19)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_add(set, DR(15, 16)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_remove(set, DR(50, 50)));
+    assert_int_eq(1, set->run_count);
+    assert_int_eq(1, set->log_count);
+
+    DataRegion dst[5];
+    assert_int_eq(4, data_region_lsm_set_crop(dst, 5, set, DR(INT64_MIN, INT64_MAX), NULL));
+    assert_data_region_array_eq(dst, DR(0, 9), DR(15, 16), DR(20, 49), DR(51, 99));
+    assert_int_eq(2, data_region_lsm_set_crop(dst, 5, set, DR(16, 30), NULL));
+    assert_data_region_array_eq(dst, DR(16, 16), DR(20, 30));
+    assert_int_eq(2, data_region_lsm_set_negative_crop(dst, 5, set, DR(5, 20), NULL));
+    assert_data_region_array_eq(dst, DR(10, 14), DR(17, 19));
+    assert_int_eq(1, data_region_lsm_set_contains(set, DR(20, 49)));
+    assert_int_eq(0, data_region_lsm_set_contains(set, DR(45, 55)));
+    assert_int_eq(4, data_region_lsm_set_count(set));
+    assert_int_eq(91, data_region_lsm_set_total_length(set));
+
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_compact(set));
+    assert_int_eq(0, set->run_count);
+    assert_int_eq(0, set->log_count);
+    assert_int_eq(4, set->base->count);
+    assert_int_eq(91, data_region_set_total_length(set->base));
+    data_region_lsm_set_free(set);
+  }
+
+  Test(data_region_lsm_set_compact_out_of_space)
+  {
+    DataRegionLsmSet* set = data_region_lsm_set_create(2, 8, 100, 0);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_add(set, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_add(set, DR(10, 10)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_add(set, DR(20, 20)));
+
+    //The runs are kept, so nothing is lost
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_lsm_set_compact(set));
+    assert_int_eq(0, set->base->count);
+    assert_int_eq(3, data_region_lsm_set_count(set));
+
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_remove(set, DR(10, 10)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_compact(set));
+    assert_int_eq(2, set->base->count);
+    data_region_lsm_set_free(set);
+  }
+
+  Test(data_region_lsm_set_rejects_adds_while_over_capacity)
+  {
+    DataRegionLsmSet* set = data_region_lsm_set_create(2, 1, 1, 0);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_add(set, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_add(set, DR(10, 10)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_add(set, DR(20, 20)));
+    //Logging this add compacts all four, which don't fit
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_add(set, DR(30, 30)));
+    assert_int_eq(2, set->base->count);
+    assert_int_eq(1, set->over_capacity);
+
+    //Later adds fail without growing the runs or compacting them again
+    int64_t runCount = set->run_count;
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_lsm_set_add(set, DR(40, 40)));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_lsm_set_add(set, DR(50, 50)));
+    assert_int_eq(runCount, set->run_count);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_remove(set, DR(0, 0)));
+    assert_int_eq(1, set->over_capacity);
+    assert_int_eq(3, data_region_lsm_set_count(set));
+
+    //The remove frees enough space once it is compacted
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_remove(set, DR(10, 10)));
+    assert_int_eq(0, set->over_capacity);
+    assert_int_eq(2, set->base->count);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_add(set, DR(40, 40)));
+    data_region_lsm_set_free(set);
+  }
+
+  Test(data_region_lsm_set_matches_data_region_set,
+    EnumParam(seed, 1, 2, 3)
+    EnumParam(logCapacity, 1, 4, 64)
+    EnumParam(maxRunCount, 1, 4)
+    EnumParam(maxLength, 1, 50, 2000))
+  {
+    uint64_t rng = 0x9E3779B97F4A7C15ull * seed;
+    DataRegionSet* expected = data_region_set_create(10000);
+    DataRegionLsmSet* set = data_region_lsm_set_create(10000, logCapacity, maxRunCount, 0);
+    DataRegion expectedDst[64], dst[64];
+
+    for(int i = 0; i < 1000; i++)
+    {
+      DataRegion region = test_rand_region(&rng, 20000, maxLength);
+      if(test_rand(&rng) % 3 == 0)
+      {
+        data_region_set_remove(expected, region);
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_remove(set, region));
+      }
+      else
+      {
+        data_region_set_add(expected, region);
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_add(set, region));
+      }
+
+      if(i % 50 == 0)
+      {
+        DataRegion boundary = test_rand_region(&rng, 20000, 1000);
+        int64_t count = data_region_set_crop(expectedDst, 64, expected, boundary, NULL);
+        assert_int_eq(count, data_region_lsm_set_crop(dst, 64, set, boundary, NULL));
+        assert_memory_eq(expectedDst, dst, sizeof(DataRegion) * count);
+
+        count = data_region_set_negative_crop(expectedDst, 64, expected, boundary, NULL);
+        assert_int_eq(count, data_region_lsm_set_negative_crop(dst, 64, set, boundary, NULL));
+        assert_memory_eq(expectedDst, dst, sizeof(DataRegion) * count);
+        assert_int_eq(data_region_set_count_crop(expected, boundary) == 1 && data_region_set_negative_crop(expectedDst, 64, expected, boundary, NULL) == 0,
+          data_region_lsm_set_contains(set, boundary));
+      }
+    }
+
+    assert_int_eq(expected->count, data_region_lsm_set_count(set));
+    assert_int_eq(data_region_set_total_length(expected), data_region_lsm_set_total_length(set));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_compact(set));
+    assert_int_eq(expected->count, set->base->count);
+    assert_memory_eq(expected->regions, set->base->regions, sizeof(DataRegion) * expected->count);
+
+    data_region_lsm_set_free(set);
+    data_region_set_free(expected);
+  }
+
+  Test(data_region_lsm_set_concurrent_writers,
+    EnumParam(threadCount, 1, 2, 8)
+    EnumParam(backgroundCompaction, 0, 1))
+  {
+    DataRegionLsmSet* set = data_region_lsm_set_create(10000, 32, 4, backgroundCompaction);
+    pthread_t threads[8];
+    LsmSetTestWriter writers[8];
+    for(int i = 0; i < threadCount; i++)
+    {
+      writers[i] = (LsmSetTestWriter){ set, i * 1000 };
+      assert_int_eq(0, pthread_create(&threads[i], NULL, lsm_set_test_writer, &writers[i]));
+    }
+    for(int i = 0; i < threadCount; i++)
+      pthread_join(threads[i], NULL);
+
+    //All of the writers' ranges are adjacent, so they form a single DataRegion
+    DataRegion dst[1];
+    assert_int_eq(1, data_region_lsm_set_crop(dst, 1, set, DR(INT64_MIN, INT64_MAX), NULL));
+    assert_data_region_array_eq(dst, DR(0, (threadCount * 1000) - 1));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_compact(set));
+    assert_int_eq(1, set->base->count);
+    data_region_lsm_set_free(set);
+  }
+
+END_TEST_SUITE()
+
+
+/* Creates a source file of 'size' bytes, where each byte is derived from its
+ * offset, and opens a DataRegionCache (with a slowed backend) in front of
+ * it. */
+DataRegionCache* cache_test_create(int64_t size, int64_t regionCapacity, int64_t maxCachedBytes)
+{
+  char sourcePath[64], cachePath[64];
+  snprintf(sourcePath, sizeof(sourcePath), "/tmp/data_region_cache_test_%d.src", (int)getpid());
+  snprintf(cachePath, sizeof(cachePath), "/tmp/data_region_cache_test_%d.cache", (int)getpid());
+
+  FILE* source = fopen(sourcePath, "wb");
+  for(int64_t i = 0; i < size; i++)
+    fputc((int)((i * 7) & 0xFF), source);
+  fclose(source);
+
+  DataRegionCacheBackend file, slow;
+  if(!data_region_cache_file_backend_open(&file, sourcePath))
+    return NULL;
+  data_region_cache_slow_backend_create(&slow, file, 0);
+  DataRegionCache* cache = data_region_cache_create(slow, cachePath, regionCapacity, maxCachedBytes);
+  unlink(sourcePath);
+  unlink(cachePath);
+  return cache;
+}
+
+/* Checks that 'length' bytes read at 'offset' match the source file. */
+int cache_test_bytes_match(const unsigned char* bytes, int64_t offset, int64_t length)
+{
+  for(int64_t i = 0; i < length; i++)
+  {
+    if(bytes[i] != (unsigned char)(((offset + i) * 7) & 0xFF))
+      return 0;
+  }
+  return 1;
+}
+
+/* Arguments of the DataRegionCache concurrency test threads. */
+typedef struct CacheTestReader
+{
+  DataRegionCache* cache;
+  int64_t offset;
+  int64_t length;
+  int matched;
+} CacheTestReader;
+
+/* Thread of the DataRegionCache concurrency test, which reads one range. */
+void* cache_test_reader(void* arg)
+{
+  CacheTestReader* reader = arg;
+  unsigned char bytes[500];
+  reader->matched = data_region_cache_read(reader->cache, bytes, reader->offset, reader->length) == reader->length &&
+    cache_test_bytes_match(bytes, reader->offset, reader->length);
+  return NULL;
+}
+
+BEGIN_TEST_SUITE(DataRegionCacheTests)
+
+  Test(data_region_cache_NULL_args)
+  {
+    DataRegionCacheBackend backend = { NULL, NULL, NULL };
+    char byte;
+    assert_int_eq(0, data_region_cache_file_backend_open(NULL, "/dev/null"));
+    assert_int_eq(0, data_region_cache_file_backend_open(&backend, NULL));
+    assert_int_eq(0, data_region_cache_slow_backend_create(NULL, backend, 0));
+    assert_int_eq(0, data_region_cache_slow_backend_create(&backend, backend, 0));
+    assert_null(data_region_cache_create(backend, "/dev/null", 1, 1));
+    assert_int_eq(-1, data_region_cache_read(NULL, &byte, 0, 1));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_cache_evict(NULL, 0, 1));
+    assert_int_eq(0, data_region_cache_get_stats(NULL).hit_bytes);
+    assert_int_eq(0, data_region_cache_cached_bytes(NULL));
+    data_region_cache_free(NULL);
+  }
+
+  Test(data_region_cache_invalid_args)
+  {
+    DataRegionCache* cache = cache_test_create(100, 10, 100);
+    char bytes[4];
+    assert_not_null(cache);
+    assert_int_eq(-1, data_region_cache_read(cache, NULL, 0, 1));
+    assert_int_eq(-1, data_region_cache_read(cache, bytes, -1, 1));
+    assert_int_eq(-1, data_region_cache_read(cache, bytes, 0, -1));
+    assert_int_eq(-1, data_region_cache_read(cache, bytes, 1, INT64_MAX));
+    assert_int_eq(0, data_region_cache_read(cache, bytes, 0, 0));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_cache_evict(cache, 0, 0));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_cache_evict(cache, 0, -1));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_cache_evict(cache, INT64_MAX, 2));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_cache_evict(cache, 2, INT64_MAX));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cache_evict(cache, INT64_MAX, 1));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cache_evict(cache, 0, INT64_MAX));
+    data_region_cache_free(cache);
+  }
+
+  Test(data_region_cache_fetches_only_gaps)
+  {
+    DataRegionCache* cache = cache_test_create(1000, 10, 1000);
+    DataRegionCacheSlowBackend* backend = cache->backend.context;
+    unsigned char bytes[1000];
+
+    assert_int_eq(10, data_region_cache_read(cache, bytes, 100, 10));
+    assert_int_eq(10, data_region_cache_read(cache, bytes, 200, 10));
+    assert_int_eq(2, atomic_load(&backend->read_count));
+
+    //Only 0..99, 110..199 and 210..299 are fetched
+    assert_int_eq(300, data_region_cache_read(cache, bytes, 0, 300));
+    assert_int_eq(1, cache_test_bytes_match(bytes, 0, 300));
+    assert_int_eq(5, atomic_load(&backend->read_count));
+    assert_int_eq(300, atomic_load(&backend->read_bytes));
+
+    DataRegionCacheStats stats = data_region_cache_get_stats(cache);
+    assert_int_eq(20, stats.hit_bytes);
+    assert_int_eq(300, stats.miss_bytes);
+    assert_int_eq(0, stats.evicted_bytes);
+    assert_int_eq(300, data_region_cache_cached_bytes(cache));
+    assert_int_eq(1, cache->present->count);
+    data_region_cache_free(cache);
+  }
+
+  Test(data_region_cache_short_read)
+  {
+    DataRegionCache* cache = cache_test_create(100, 10, 1000);
+    unsigned char bytes[100];
+    assert_int_eq(10, data_region_cache_read(cache, bytes, 90, 50));
+    assert_int_eq(1, cache_test_bytes_match(bytes, 90, 10));
+    assert_int_eq(10, data_region_cache_read(cache, bytes, 90, 50));
+    assert_int_eq(0, data_region_cache_read(cache, bytes, 200, 50));
+    assert_int_eq(10, data_region_cache_cached_bytes(cache));
+    data_region_cache_free(cache);
+  }
+
+  Test(data_region_cache_evicts)
+  {
+    DataRegionCache* cache = cache_test_create(1000, 10, 1000);
+    DataRegionCacheSlowBackend* backend = cache->backend.context;
+    unsigned char bytes[100];
+
+    assert_int_eq(100, data_region_cache_read(cache, bytes, 0, 100));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cache_evict(cache, 40, 20));
+    assert_int_eq(80, data_region_cache_cached_bytes(cache));
+    assert_int_eq(20, data_region_cache_get_stats(cache).evicted_bytes);
+
+    //Only the evicted bytes are fetched again, and the rest is read from the (sparse) cache file
+    assert_int_eq(100, data_region_cache_read(cache, bytes, 0, 100));
+    assert_int_eq(1, cache_test_bytes_match(bytes, 0, 100));
+    assert_int_eq(2, atomic_load(&backend->read_count));
+    assert_int_eq(120, atomic_load(&backend->read_bytes));
+    data_region_cache_free(cache);
+  }
+
+  Test(data_region_cache_refetches_hits_evicted_during_a_read)
+  {
+    DataRegionCache* cache = cache_test_create(1000, 10, 1000);
+    DataRegionCacheSlowBackend* slow = cache->backend.context;
+    unsigned char bytes[100];
+    assert_int_eq(100, data_region_cache_read(cache, bytes, 0, 100));
+
+    //The reader fetches 100..199 first, and only then reads 0..99, which were evicted (and punched) meanwhile
+    slow->delay_microseconds = 50000;
+    pthread_t thread;
+    CacheTestReader reader = { cache, 0, 200, 0 };
+    assert_int_eq(0, pthread_create(&thread, NULL, cache_test_reader, &reader));
+    usleep(10000);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cache_evict(cache, 0, 100));
+    pthread_join(thread, NULL);
+
+    assert_int_eq(1, reader.matched);
+    assert_int_eq(300, atomic_load(&slow->read_bytes));
+    assert_int_eq(0, data_region_cache_get_stats(cache).hit_bytes);
+    assert_int_eq(200, data_region_cache_cached_bytes(cache));
+    data_region_cache_free(cache);
+  }
+
+  Test(data_region_cache_limits_cached_bytes)
+  {
+    DataRegionCache* cache = cache_test_create(1000, 3, 250);
+    unsigned char bytes[200];
+
+    //The bytes farthest from each read are evicted first
+    assert_int_eq(200, data_region_cache_read(cache, bytes, 0, 200));
+    assert_int_eq(100, data_region_cache_read(cache, bytes, 500, 100));
+    assert_int_eq(250, data_region_cache_cached_bytes(cache));
+    assert_int_eq(2, cache->present->count);
+    assert_data_region_array_eq(cache->present->regions, DR(50, 199), DR(500, 599));
+
+    assert_int_eq(10, data_region_cache_read(cache, bytes, 300, 10));
+    assert_data_region_array_eq(cache->present->regions, DR(50, 199), DR(300, 309), DR(500, 589));
+
+    //Out of DataRegions, so whole ranges are evicted
+    assert_int_eq(10, data_region_cache_read(cache, bytes, 900, 10));
+    assert_int_eq(3, cache->present->count);
+    assert_data_region_array_eq(cache->present->regions, DR(300, 309), DR(500, 589), DR(900, 909));
+    assert_int_eq(210, data_region_cache_get_stats(cache).evicted_bytes);
+
+    //Reads larger than the cache are still returned
+    assert_int_eq(1, cache_test_bytes_match(bytes, 900, 10));
+    unsigned char large[300];
+    assert_int_eq(300, data_region_cache_read(cache, large, 0, 300));
+    assert_int_eq(1, cache_test_bytes_match(large, 0, 300));
+    data_region_cache_free(cache);
+  }
+
+  Test(data_region_cache_matches_source,
+    EnumParam(seed, 1, 2, 3)
+    EnumParam(maxCachedBytes, 100, 5000))
+  {
+    DataRegionCache* cache = cache_test_create(5000, 8, maxCachedBytes);
+    uint64_t rng = 0x9E3779B97F4A7C15ull * seed;
+    unsigned char bytes[500];
+
+    for(int i = 0; i < 300; i++)
+    {
+      DataRegion region = test_rand_region(&rng, 5000, 500);
+      int64_t length = data_region_length(region);
+      int64_t expected = region.last_index < 5000 ? length : 5000 - region.first_index;
+      if(test_rand(&rng) % 5 == 0)
+      {
+        data_region_cache_evict(cache, region.first_index, length);
+      }
+      else
+      {
+        assert_int_eq(expected, data_region_cache_read(cache, bytes, region.first_index, length));
+        assert_int_eq(1, cache_test_bytes_match(bytes, region.first_index, expected));
+      }
+      assert_int_eq(1, data_region_cache_cached_bytes(cache) <= maxCachedBytes);
+    }
+    data_region_cache_free(cache);
+  }
+
+  Test(data_region_cache_concurrent_reads_fetch_once)
+  {
+    DataRegionCache* cache = cache_test_create(2000, 16, 2000);
+    DataRegionCacheSlowBackend* slow = cache->backend.context;
+    slow->delay_microseconds = 20000;
+
+    //Each thread reads an overlapping range, so every byte is fetched by exactly one of them
+    pthread_t threads[8];
+    CacheTestReader readers[8];
+    for(int i = 0; i < 8; i++)
+    {
+      readers[i] = (CacheTestReader){ cache, i * 50, 500, 0 };
+      assert_int_eq(0, pthread_create(&threads[i], NULL, cache_test_reader, &readers[i]));
+    }
+    for(int i = 0; i < 8; i++)
+    {
+      pthread_join(threads[i], NULL);
+      assert_int_eq(1, readers[i].matched);
+    }
+
+    assert_int_eq(850, atomic_load(&slow->read_bytes));
+    assert_int_eq(850, data_region_cache_get_stats(cache).miss_bytes);
+    data_region_cache_free(cache);
+  }
+
+END_TEST_SUITE()
+
+
+/* Computes the cost of a fetch plan under a cost model. */
+int64_t plan_test_cost(const DataRegionFetch* fetches, int64_t count, const DataRegionPlanCostModel* model)
+{
+  int64_t cost = 0;
+  for(int64_t i = 0; i < count; i++)
+    cost += model->request_overhead_bytes + fetches[i].length;
+  return cost;
+}
+
+/* Computes the minimum cost of fetching a list of (aligned) missing byte
+ * ranges by trying every combination of bridged gaps. */
+int64_t plan_test_brute_force_cost(const DataRegion* gaps, int64_t gapCount, const DataRegionPlanCostModel* model)
+{
+  int64_t best = INT64_MAX;
+  for(uint64_t mask = 0; mask < (1ull << (gapCount - 1)); mask++)
+  {
+    //Bit 'i' of 'mask' bridges the gap between 'gaps[i]' and 'gaps[i + 1]'
+    int64_t cost = 0;
+    int feasible = 1;
+    int64_t groupStart = 0;
+    for(int64_t i = 0; i < gapCount && feasible; i++)
+    {
+      if(i + 1 < gapCount && (mask & (1ull << i)))
+      {
+        feasible = gaps[i + 1].first_index - gaps[i].last_index - 1 <= model->max_gap_bytes;
+        continue;
+      }
+
+      int64_t span = gaps[i].last_index - gaps[groupStart].first_index + 1;
+      if(i > groupStart)
+      {
+        feasible = model->max_io_bytes == 0 || span <= model->max_io_bytes;
+        cost += model->request_overhead_bytes + span;
+      }
+      else
+      {
+        cost += (_data_region_plan_chunk_count(span, model->max_io_bytes) * model->request_overhead_bytes) + span;
+      }
+      groupStart = i + 1;
+    }
+
+    if(feasible && cost < best)
+      best = cost;
+  }
+  return best;
+}
+
+BEGIN_TEST_SUITE(DataRegionPlanTests)
+
+  Test(data_region_plan_NULL_args)
+  {
+    DataRegionSet* set = data_region_set_create(1);
+    DataRegionPlanCostModel model = { 0, 0, 0, 1 };
+    DataRegionFetch dst[1];
+    int tooSmall = 0;
+    assert_int_eq(0, data_region_plan_fetches(dst, 1, NULL, DR(0, 0), &model, NULL));
+    assert_int_eq(0, data_region_plan_fetches(dst, 1, set, DR(0, 0), NULL, NULL));
+    assert_int_eq(0, data_region_plan_fetches(dst, 1, set, DR(1, 0), &model, NULL));
+    assert_int_eq(0, data_region_plan_fetches(dst, -1, set, DR(0, 0), &model, &tooSmall));
+    assert_int_eq(1, tooSmall);
+    assert_int_eq(1, data_region_plan_fetches(NULL, 0, set, DR(0, 0), &model, NULL));
+    data_region_set_free(set);
+  }
+
+  Test(data_region_plan_nothing_missing)
+  {
+    DataRegionSet* set = data_region_set_create(1);
+    DataRegionPlanCostModel model = { 100, 100, 0, 1 };
+    DataRegionFetch dst[1];
+    data_region_set_add(set, DR(0, 99));
+    assert_int_eq(0, data_region_plan_fetches(dst, 1, set, DR(10, 20), &model, NULL));
+    data_region_set_free(set);
+  }
+
+  Test(data_region_plan_bridges_small_gaps)
+  {
+    DataRegionSet* set = data_region_set_create(10);
+    DataRegionFetch dst[10];
+    data_region_set_add(set, DR(10, 12));
+    data_region_set_add(set, DR(20, 49));
+    data_region_set_add(set, DR(60, 60));
+
+    //Without overhead, every missing byte range is fetched on its own
+    DataRegionPlanCostModel model = { 0, 100, 0, 1 };
+    assert_int_eq(4, data_region_plan_fetches(dst, 10, set, DR(0, 99), &model, NULL));
+    assert_memory_eq(((DataRegionFetch[]){ { 0, 10 }, { 13, 7 }, { 50, 10 }, { 61, 39 } }), dst, sizeof(DataRegionFetch) * 4);
+
+    //Gaps of up to the overhead are re-read
+    model.request_overhead_bytes = 5;
+    assert_int_eq(2, data_region_plan_fetches(dst, 10, set, DR(0, 99), &model, NULL));
+    assert_memory_eq(((DataRegionFetch[]){ { 0, 20 }, { 50, 50 } }), dst, sizeof(DataRegionFetch) * 2);
+
+    //...unless they are larger than 'max_gap_bytes'
+    model.max_gap_bytes = 2;
+    assert_int_eq(3, data_region_plan_fetches(dst, 10, set, DR(0, 99), &model, NULL));
+    assert_memory_eq(((DataRegionFetch[]){ { 0, 10 }, { 13, 7 }, { 50, 50 } }), dst, sizeof(DataRegionFetch) * 3);
+
+    model.request_overhead_bytes = 1000;
+    model.max_gap_bytes = 1000;
+    assert_int_eq(1, data_region_plan_fetches(dst, 10, set, DR(0, 99), &model, NULL));
+    assert_memory_eq(((DataRegionFetch[]){ { 0, 100 } }), dst, sizeof(DataRegionFetch));
+    data_region_set_free(set);
+  }
+
+  Test(data_region_plan_max_io_and_alignment)
+  {
+    DataRegionSet* set = data_region_set_create(10);
+    DataRegionFetch dst[10];
+    data_region_set_add(set, DR(0, 99));
+    data_region_set_add(set, DR(130, 135));
+
+    //Long missing byte ranges are split
+    DataRegionPlanCostModel model = { 0, 0, 64, 1 };
+    assert_int_eq(3, data_region_plan_fetches(dst, 10, set, DR(0, 249), &model, NULL));
+    assert_memory_eq(((DataRegionFetch[]){ { 100, 30 }, { 136, 64 }, { 200, 50 } }), dst, sizeof(DataRegionFetch) * 3);
+
+    //Fetches are widened to the alignment (and combined where they meet)
+    model.alignment = 16;
+    assert_int_eq(3, data_region_plan_fetches(dst, 10, set, DR(0, 249), &model, NULL));
+    assert_memory_eq(((DataRegionFetch[]){ { 96, 64 }, { 160, 64 }, { 224, 32 } }), dst, sizeof(DataRegionFetch) * 3);
+
+    //'max_io_bytes' is rounded down to the alignment
+    model.max_io_bytes = 40;
+    assert_int_eq(5, data_region_plan_fetches(dst, 10, set, DR(0, 249), &model, NULL));
+    assert_memory_eq(((DataRegionFetch[]){ { 96, 32 }, { 128, 32 }, { 160, 32 }, { 192, 32 }, { 224, 32 } }), dst, sizeof(DataRegionFetch) * 5);
+
+    int tooSmall = 0;
+    assert_int_eq(2, data_region_plan_fetches(dst, 2, set, DR(0, 249), &model, &tooSmall));
+    assert_int_eq(1, tooSmall);
+    data_region_set_free(set);
+  }
+
+  Test(data_region_plan_is_optimal,
+    EnumParam(seed, 1, 2, 3, 4, 5)
+    EnumParam(maxIoBytes, 0, 48, 200)
+    EnumParam(alignment, 1, 8))
+  {
+    uint64_t rng = 0x9E3779B97F4A7C15ull * seed;
+    DataRegionSet* set = data_region_set_create(100);
+    DataRegion gaps[16];
+    DataRegionFetch fetches[256];
+
+    for(int round = 0; round < 50; round++)
+    {
+      data_region_set_clear(set);
+      for(int i = 0; i < 12; i++)
+        data_region_set_add(set, test_rand_region(&rng, 400, 30));
+      DataRegion request = test_rand_region(&rng, 400, 400);
+      DataRegionPlanCostModel model = { (int64_t)(test_rand(&rng) % 40), (int64_t)(test_rand(&rng) % 40), maxIoBytes, alignment };
+
+      //The expected gaps, aligned as the planner does
+      int64_t gapCount = 0;
+      int64_t rawCount = data_region_set_negative_crop(gaps, 16, set, request, NULL);
+      for(int64_t i = 0; i < rawCount; i++)
+      {
+        DataRegion aligned = _data_region_plan_align(gaps[i], alignment);
+        if(gapCount > 0 && data_region_can_combine(gaps[gapCount - 1], aligned))
+          gaps[gapCount - 1] = data_region_combine(gaps[gapCount - 1], aligned);
+        else
+          gaps[gapCount++] = aligned;
+      }
+
+      int tooSmall = 0;
+      int64_t count = data_region_plan_fetches(fetches, 256, set, request, &model, &tooSmall);
+      assert_int_eq(0, tooSmall);
+      if(gapCount == 0)
+      {
+        assert_int_eq(0, count);
+        continue;
+      }
+
+      //Every fetch is aligned, within the size limit, and every missing byte is fetched
+      DataRegionSet* fetched = data_region_set_create(256);
+      for(int64_t i = 0; i < count; i++)
+      {
+        int64_t offsetRemainder = fetches[i].offset % alignment;
+        int64_t lengthRemainder = fetches[i].length % alignment;
+        assert_int_eq(0, offsetRemainder);
+        assert_int_eq(0, lengthRemainder);
+        assert_int_eq(1, maxIoBytes == 0 || fetches[i].length <= maxIoBytes);
+        data_region_set_add(fetched, DR(fetches[i].offset, fetches[i].offset + fetches[i].length - 1));
+      }
+      DataRegion missing[16];
+      for(int64_t i = 0; i < gapCount; i++)
+        assert_int_eq(1, data_region_set_count_crop(fetched, gaps[i]) == 1 && data_region_set_negative_crop(missing, 16, fetched, gaps[i], NULL) == 0);
+      data_region_set_free(fetched);
+
+      assert_int_eq(plan_test_brute_force_cost(gaps, gapCount, &model), plan_test_cost(fetches, count, &model));
+      assert_int_eq(count, data_region_plan_fetches(NULL, 0, set, request, &model, NULL));
+    }
+    data_region_set_free(set);
+  }
+
+END_TEST_SUITE()
+
+
+/* Creates a backing file of 'size' bytes for the DataRegionFill tests, where
+ * each byte is derived from its offset, and opens it. */
+int fill_test_open(int64_t size)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/data_region_fill_test_%d", (int)getpid());
+  FILE* file = fopen(path, "wb");
+  for(int64_t i = 0; i < size; i++)
+    fputc((int)((i * 13) & 0xFF), file);
+  fclose(file);
+
+  int fd = open(path, O_RDONLY);
+  unlink(path);
+  return fd;
+}
+
+BEGIN_TEST_SUITE(DataRegionFillTests)
+
+  Test(data_region_fill_NULL_args)
+  {
+    char buffer[16];
+    DataRegionSet* set = data_region_set_create(1);
+    DataRegionFillOptions options = data_region_fill_default_options();
+    assert_null(data_region_fill_create(-1, buffer, 0, 16, NULL));
+    assert_null(data_region_fill_create(0, NULL, 0, 16, NULL));
+    assert_null(data_region_fill_create(0, buffer, -1, 16, NULL));
+    assert_null(data_region_fill_create(0, buffer, 0, 0, NULL));
+    options.queue_depth = 0;
+    assert_null(data_region_fill_create(0, buffer, 0, 16, &options));
+    assert_int_eq(-1, data_region_fill_run(NULL, set, DR(0, 0), NULL));
+    data_region_fill_free(NULL);
+    data_region_set_free(set);
+  }
+
+  Test(data_region_fill_reads_missing_bytes,
+    EnumParam(backend, DATA_REGION_FILL_AUTO, DATA_REGION_FILL_URING, DATA_REGION_FILL_THREADS)
+    EnumParam(queueDepth, 1, 4, 32))
+  {
+    int fd = fill_test_open(100000);
+    unsigned char* buffer = calloc(100000, 1);
+    DataRegionSet* present = data_region_set_create(100);
+    DataRegionFillOptions options = data_region_fill_default_options();
+    options.backend = backend;
+    options.queue_depth = queueDepth;
+    options.max_inflight_bytes = 8192;
+    options.plan.max_io_bytes = 1000;
+    DataRegionFill* fill = data_region_fill_create(fd, buffer, 0, 100000, &options);
+    if(fill != NULL)
+    {
+      //Present bytes are not read again
+      data_region_set_add(present, DR(5000, 5999));
+      data_region_set_add(present, DR(70000, 70099));
+      assert_int_eq(-1, data_region_fill_run(fill, NULL, DR(0, 0), NULL));
+      assert_int_eq(-1, data_region_fill_run(fill, present, DR(1, 0), NULL));
+      assert_int_eq(80000 - 1100, data_region_fill_run(fill, present, DR(0, 79999), NULL));
+      assert_int_eq(1, present->count);
+      assert_data_region_array_eq(present->regions, DR(0, 79999));
+      int64_t mismatchCount = 0;
+      for(int64_t i = 0; i < 80000; i++)
+      {
+        int wasPresent = (i >= 5000 && i < 6000) || (i >= 70000 && i < 70100);
+        mismatchCount += !wasPresent && buffer[i] != (unsigned char)((i * 13) & 0xFF);
+      }
+      assert_int_eq(0, mismatchCount);
+
+      //Bytes beyond the end of the file (and the buffer) are not read
+      assert_int_eq(20000, data_region_fill_run(fill, present, DR(0, INT64_MAX), NULL));
+      assert_data_region_array_eq(present->regions, DR(0, 99999));
+      assert_int_eq(0, data_region_fill_run(fill, present, DR(0, 99999), NULL));
+      data_region_fill_free(fill);
+    }
+    else
+    {
+      //Only io_uring may be unavailable
+      assert_int_eq(DATA_REGION_FILL_URING, backend);
+    }
+
+    data_region_set_free(present);
+    free(buffer);
+    close(fd);
+  }
+
+  Test(data_region_fill_buffer_window)
+  {
+    int fd = fill_test_open(10000);
+    unsigned char buffer[1000];
+    DataRegionSet* present = data_region_set_create(10);
+    DataRegionFill* fill = data_region_fill_create(fd, buffer, 9500, 1000, NULL);
+    assert_not_null(fill);
+    assert_int_eq(0, data_region_fill_run(fill, present, DR(0, 9499), NULL));
+    assert_int_eq(500, data_region_fill_run(fill, present, DR(0, INT64_MAX), NULL));
+    assert_data_region_array_eq(present->regions, DR(9500, 9999));
+    assert_int_eq((9500 * 13) & 0xFF, buffer[0]);
+    data_region_fill_free(fill);
+    data_region_set_free(present);
+    close(fd);
+  }
+
+  Test(data_region_fill_present_too_small)
+  {
+    int fd = fill_test_open(10000);
+    unsigned char* buffer = calloc(10000, 1);
+    DataRegionSet* present = data_region_set_create(1);
+    DataRegionFill* fill = data_region_fill_create(fd, buffer, 0, 10000, NULL);
+    int presentTooSmall = 0;
+    data_region_set_add(present, DR(100, 199));
+
+    //Everything is read, but the presence set can't hold the separate ranges
+    assert_int_eq(100, data_region_fill_run(fill, present, DR(0, 99), &presentTooSmall));
+    assert_int_eq(0, presentTooSmall);
+    assert_int_eq(500, data_region_fill_run(fill, present, DR(300, 799), &presentTooSmall));
+    assert_int_eq(1, presentTooSmall);
+    assert_data_region_array_eq(present->regions, DR(0, 199));
+    assert_int_eq((700 * 13) & 0xFF, buffer[700]);
+    data_region_fill_free(fill);
+    data_region_set_free(present);
+    free(buffer);
+    close(fd);
+  }
+
+END_TEST_SUITE()
+
+
+/* Cached pages for the DataRegionFlusher tests, backed by one buffer. A
+ * page can be marked as not cached, and a callback can run when a page is
+ * first gathered for a write (to simulate a concurrent write). */
+typedef struct FlushTestSource
+{
+  unsigned char* buffer;
+  int64_t page_size;
+  int64_t page_count;
+  int64_t uncached_page;
+  void (*on_page)(struct FlushTestSource* source);
+  DataRegionFlusher* flusher;
+} FlushTestSource;
+
+void* flush_test_page(void* context, int64_t pageIndex)
+{
+  FlushTestSource* source = context;
+  if(pageIndex < 0 || pageIndex >= source->page_count || pageIndex == source->uncached_page)
+    return NULL;
+
+  if(source->on_page != NULL)
+  {
+    void (*onPage)(FlushTestSource*) = source->on_page;
+    source->on_page = NULL;
+    onPage(source);
+  }
+  return source->buffer + (pageIndex * source->page_size);
+}
+
+/* Opens an empty file for the DataRegionFlusher tests. */
+int flush_test_open(void)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/data_region_flush_test_%d", (int)getpid());
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  unlink(path);
+  return fd;
+}
+
+/* Writes bytes into the test buffer and marks them dirty. */
+void flush_test_write(FlushTestSource* source, int64_t offset, int64_t length, unsigned char value)
+{
+  memset(source->buffer + offset, value, (size_t)length);
+  data_region_flusher_mark_dirty(source->flusher, DR(offset, offset + length - 1));
+}
+
+/* Simulates a write that arrives while a flush is writing. */
+void flush_test_concurrent_write(FlushTestSource* source)
+{
+  flush_test_write(source, 10, 5, 0xEE);
+}
+
+/* Counts the bytes of the file that differ from the test buffer. */
+int64_t flush_test_mismatches(int fd, FlushTestSource* source, int64_t length)
+{
+  unsigned char* file = calloc((size_t)length, 1);
+  pread(fd, file, (size_t)length, 0);
+  int64_t mismatches = 0;
+  for(int64_t i = 0; i < length; i++)
+    mismatches += file[i] != source->buffer[i];
+  free(file);
+  return mismatches;
+}
+
+BEGIN_TEST_SUITE(DataRegionFlushTests)
+
+  Test(data_region_flusher_NULL_args)
+  {
+    DataRegionFlushSource source = { NULL, 16, flush_test_page };
+    DataRegionFlushSource noPage = { NULL, 16, NULL };
+    assert_null(data_region_flusher_create(-1, 10, source, NULL));
+    assert_null(data_region_flusher_create(0, 0, source, NULL));
+    assert_null(data_region_flusher_create(0, 10, noPage, NULL));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_flusher_mark_dirty(NULL, DR(0, 0)));
+    assert_int_eq(-1, data_region_flusher_flush(NULL, 0));
+    assert_int_eq(0, data_region_flusher_dirty_bytes(NULL));
+    data_region_flusher_free(NULL);
+  }
+
+  Test(data_region_flusher_flushes_dirty_bytes,
+    EnumParam(pageSize, 1, 16, 4096)
+    EnumParam(maxGapBytes, 0, 64))
+  {
+    unsigned char buffer[4096] = { 0 };
+    FlushTestSource testSource = { buffer, pageSize, 4096 / pageSize, -1, NULL, NULL };
+    DataRegionFlushSource source = { &testSource, pageSize, flush_test_page };
+    DataRegionFlushOptions options = { 100, maxGapBytes };
+    int fd = flush_test_open();
+    DataRegionFlusher* flusher = data_region_flusher_create(fd, 10, source, &options);
+    testSource.flusher = flusher;
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_flusher_mark_dirty(flusher, DR(-1, 0)));
+
+    flush_test_write(&testSource, 0, 10, 1);
+    flush_test_write(&testSource, 50, 10, 2);
+    flush_test_write(&testSource, 1000, 250, 3);
+    assert_int_eq(270, data_region_flusher_dirty_bytes(flusher));
+
+    //Combining re-writes the 40 clean bytes in between
+    assert_int_eq(maxGapBytes > 0 ? 310 : 270, data_region_flusher_flush(flusher, 0));
+    assert_int_eq(0, data_region_flusher_dirty_bytes(flusher));
+    assert_int_eq(0, flush_test_mismatches(fd, &testSource, 4096));
+    assert_int_eq(0, data_region_flusher_flush(flusher, 0));
+
+    data_region_flusher_free(flusher);
+    close(fd);
+  }
+
+  Test(data_region_flusher_budget_sweeps_in_order)
+  {
+    unsigned char buffer[1000] = { 0 };
+    FlushTestSource testSource = { buffer, 64, 16, -1, NULL, NULL };
+    DataRegionFlushSource source = { &testSource, 64, flush_test_page };
+    int fd = flush_test_open();
+    DataRegionFlusher* flusher = data_region_flusher_create(fd, 10, source, NULL);
+    testSource.flusher = flusher;
+
+    flush_test_write(&testSource, 100, 100, 1);
+    flush_test_write(&testSource, 300, 100, 2);
+    flush_test_write(&testSource, 500, 100, 3);
+
+    //Each flush continues where the previous one stopped
+    assert_int_eq(150, data_region_flusher_flush(flusher, 150));
+    assert_data_region_array_eq(flusher->dirty->regions, DR(350, 399), DR(500, 599));
+    flush_test_write(&testSource, 0, 10, 4);
+    assert_int_eq(120, data_region_flusher_flush(flusher, 120));
+    assert_data_region_array_eq(flusher->dirty->regions, DR(0, 9), DR(570, 599));
+
+    //After the end, the sweep wraps around to the lowest offset
+    assert_int_eq(40, data_region_flusher_flush(flusher, 150));
+    assert_int_eq(0, data_region_flusher_dirty_bytes(flusher));
+    assert_int_eq(0, flush_test_mismatches(fd, &testSource, 1000));
+    data_region_flusher_free(flusher);
+    close(fd);
+  }
+
+  Test(data_region_flusher_keeps_redirtied_bytes)
+  {
+    unsigned char buffer[1024] = { 0 };
+    FlushTestSource testSource = { buffer, 16, 64, -1, NULL, NULL };
+    DataRegionFlushSource source = { &testSource, 16, flush_test_page };
+    int fd = flush_test_open();
+    DataRegionFlusher* flusher = data_region_flusher_create(fd, 10, source, NULL);
+    testSource.flusher = flusher;
+
+    //Bytes 10..14 are written again while the flush writes 0..99
+    flush_test_write(&testSource, 0, 100, 1);
+    testSource.on_page = flush_test_concurrent_write;
+    assert_int_eq(100, data_region_flusher_flush(flusher, 0));
+    assert_int_eq(5, data_region_flusher_dirty_bytes(flusher));
+    assert_data_region_array_eq(flusher->dirty->regions, DR(10, 14));
+
+    assert_int_eq(5, data_region_flusher_flush(flusher, 0));
+    assert_int_eq(0, data_region_flusher_dirty_bytes(flusher));
+    assert_int_eq(0, flush_test_mismatches(fd, &testSource, 1024));
+    data_region_flusher_free(flusher);
+    close(fd);
+  }
+
+  Test(data_region_flusher_uncached_gap)
+  {
+    unsigned char buffer[1024] = { 0 };
+    FlushTestSource testSource = { buffer, 16, 64, 2, NULL, NULL };
+    DataRegionFlushSource source = { &testSource, 16, flush_test_page };
+    DataRegionFlushOptions options = { 1024, 100 };
+    int fd = flush_test_open();
+    DataRegionFlusher* flusher = data_region_flusher_create(fd, 10, source, &options);
+    testSource.flusher = flusher;
+
+    //Page 2 (bytes 32..47) isn't cached, so the gap 20..59 isn't re-written
+    flush_test_write(&testSource, 0, 20, 1);
+    flush_test_write(&testSource, 60, 20, 2);
+    flush_test_write(&testSource, 80, 20, 3);
+    assert_int_eq(60, data_region_flusher_flush(flusher, 0));
+    assert_int_eq(0, data_region_flusher_dirty_bytes(flusher));
+
+    //Dirty bytes which aren't cached can't be written, so they stay dirty
+    flush_test_write(&testSource, 40, 4, 4);
+    assert_int_eq(-1, data_region_flusher_flush(flusher, 0));
+    assert_int_eq(4, data_region_flusher_dirty_bytes(flusher));
+    data_region_flusher_free(flusher);
+    close(fd);
+  }
+
+END_TEST_SUITE()
+
+
+/* Creates a DataRegionReadahead for the tests. */
+DataRegionReadahead* readahead_test_create(int64_t streamCapacity, int64_t minWindowBytes, int64_t maxWindowBytes, int64_t maxStrideCount)
+{
+  DataRegionReadaheadOptions options = { streamCapacity, minWindowBytes, maxWindowBytes, maxStrideCount };
+  return data_region_readahead_create(&options);
+}
+
+BEGIN_TEST_SUITE(DataRegionReadaheadTests)
+
+  Test(data_region_readahead_NULL_args)
+  {
+    DataRegionReadaheadInfo info;
+    DataRegion dst[4];
+    DataRegionSet* present = data_region_set_create(4);
+    assert_null(readahead_test_create(0, 100, 100, 1));
+    assert_null(readahead_test_create(1, 0, 100, 1));
+    assert_null(readahead_test_create(1, 100, 99, 1));
+    assert_null(readahead_test_create(1, 100, 100, 0));
+
+    DataRegionReadahead* readahead = data_region_readahead_create(NULL);
+    assert_not_null(readahead);
+    assert_int_eq(0, data_region_readahead_observe(NULL, 4, readahead, 0, DR(0, 9), present, NULL));
+    assert_int_eq(0, data_region_readahead_observe(dst, 4, NULL, 0, DR(0, 9), present, NULL));
+    assert_int_eq(0, data_region_readahead_observe(dst, 4, readahead, 0, DR(9, 0), present, NULL));
+    assert_int_eq(0, data_region_readahead_observe(dst, 4, readahead, 0, DR(0, 9), NULL, NULL));
+    assert_int_eq(0, data_region_readahead_get_info(NULL, 0, &info));
+    assert_int_eq(0, data_region_readahead_get_info(readahead, 0, NULL));
+    assert_int_eq(0, data_region_readahead_get_info(readahead, 0, &info));
+    assert_int_eq(-1, data_region_readahead_cache_read(NULL, 0, NULL, dst, 0, 1));
+    data_region_readahead_free(readahead);
+    data_region_readahead_free(NULL);
+    data_region_set_free(present);
+  }
+
+  Test(data_region_readahead_sequential)
+  {
+    DataRegion dst[4];
+    DataRegionReadaheadInfo info;
+    DataRegionSet* present = data_region_set_create(4);
+    DataRegionReadahead* readahead = readahead_test_create(4, 1000, 1000, 4);
+
+    //The first request of a stream predicts nothing
+    assert_int_eq(0, data_region_readahead_observe(dst, 4, readahead, 7, DR(0, 99), present, NULL));
+    assert_int_eq(1, data_region_readahead_get_info(readahead, 7, &info));
+    assert_int_eq(DATA_REGION_ACCESS_RANDOM, info.pattern);
+
+    //Present bytes aren't prefetched
+    data_region_set_add(present, DR(500, 599));
+    assert_int_eq(2, data_region_readahead_observe(dst, 4, readahead, 7, DR(100, 199), present, NULL));
+    assert_data_region_array_eq(dst, DR(200, 499), DR(600, 1199));
+    assert_int_eq(1, data_region_readahead_get_info(readahead, 7, &info));
+    assert_int_eq(DATA_REGION_ACCESS_SEQUENTIAL, info.pattern);
+
+    //Bytes that were already prefetched aren't prefetched again
+    assert_int_eq(1, data_region_readahead_observe(dst, 4, readahead, 7, DR(200, 299), present, NULL));
+    assert_data_region_array_eq(dst, DR(1200, 1299));
+    assert_int_eq(1, data_region_readahead_get_info(readahead, 7, &info));
+    assert_int_eq(100, info.used_bytes);
+    assert_int_eq(0, info.wasted_bytes);
+
+    //Other streams are detected separately
+    assert_int_eq(0, data_region_readahead_observe(dst, 4, readahead, 8, DR(300, 399), present, NULL));
+    assert_int_eq(0, data_region_readahead_observe(dst, 4, readahead, 8, DR(5000, 5099), present, NULL));
+
+    int dstTooSmall;
+    assert_int_eq(0, data_region_readahead_observe(dst, 1, readahead, 9, DR(0, 99), present, &dstTooSmall));
+    assert_int_eq(1, data_region_readahead_observe(dst, 1, readahead, 9, DR(100, 199), present, &dstTooSmall));
+    assert_int_eq(1, dstTooSmall);
+
+    data_region_readahead_free(readahead);
+    data_region_set_free(present);
+  }
+
+  Test(data_region_readahead_strided)
+  {
+    DataRegion dst[8];
+    DataRegionReadaheadInfo info;
+    DataRegionSet* present = data_region_set_create(4);
+    DataRegionReadahead* readahead = readahead_test_create(4, 1000, 1000, 4);
+
+    assert_int_eq(0, data_region_readahead_observe(dst, 8, readahead, 0, DR(1000, 1009), present, NULL));
+    assert_int_eq(0, data_region_readahead_observe(dst, 8, readahead, 0, DR(1100, 1109), present, NULL));
+    assert_int_eq(4, data_region_readahead_observe(dst, 8, readahead, 0, DR(1200, 1209), present, NULL));
+    assert_data_region_array_eq(dst, DR(1300, 1309), DR(1400, 1409), DR(1500, 1509), DR(1600, 1609));
+    assert_int_eq(1, data_region_readahead_get_info(readahead, 0, &info));
+    assert_int_eq(DATA_REGION_ACCESS_STRIDED, info.pattern);
+    assert_int_eq(100, info.stride);
+
+    assert_int_eq(1, data_region_readahead_observe(dst, 8, readahead, 0, DR(1300, 1309), present, NULL));
+    assert_data_region_array_eq(dst, DR(1700, 1709));
+
+    //Breaking the pattern wastes the remaining predicted requests
+    assert_int_eq(0, data_region_readahead_observe(dst, 8, readahead, 0, DR(1500, 1509), present, NULL));
+    assert_int_eq(1, data_region_readahead_get_info(readahead, 0, &info));
+    assert_int_eq(DATA_REGION_ACCESS_RANDOM, info.pattern);
+    assert_int_eq(20, info.used_bytes);
+    assert_int_eq(30, info.wasted_bytes);
+
+    //Backward strides are detected as well, and stop at offset zero
+    assert_int_eq(0, data_region_readahead_observe(dst, 8, readahead, 1, DR(250, 259), present, NULL));
+    assert_int_eq(0, data_region_readahead_observe(dst, 8, readahead, 1, DR(200, 209), present, NULL));
+    assert_int_eq(3, data_region_readahead_observe(dst, 8, readahead, 1, DR(150, 159), present, NULL));
+    assert_data_region_array_eq(dst, DR(100, 109), DR(50, 59), DR(0, 9));
+
+    //The predictions below a backward request aren't skipped yet
+    assert_int_eq(0, data_region_readahead_observe(dst, 8, readahead, 1, DR(100, 109), present, NULL));
+    assert_int_eq(1, data_region_readahead_get_info(readahead, 1, &info));
+    assert_int_eq(DATA_REGION_ACCESS_STRIDED, info.pattern);
+    assert_int_eq(10, info.used_bytes);
+    assert_int_eq(0, info.wasted_bytes);
+    assert_int_eq(0, data_region_readahead_observe(dst, 8, readahead, 1, DR(0, 9), present, NULL));
+    assert_int_eq(1, data_region_readahead_get_info(readahead, 1, &info));
+    assert_int_eq(20, info.used_bytes);
+    assert_int_eq(10, info.wasted_bytes);
+
+    data_region_readahead_free(readahead);
+    data_region_set_free(present);
+  }
+
+  Test(data_region_readahead_stops_when_pending_is_full)
+  {
+    DataRegion dst[8];
+    DataRegionSet* present = data_region_set_create(4);
+    DataRegionReadahead* readahead = readahead_test_create(4, 1000, 1000, 1);
+    data_region_set_add(present, DR(200, 209));
+    data_region_set_add(present, DR(300, 309));
+    data_region_set_add(present, DR(400, 409));
+    data_region_set_add(present, DR(500, 509));
+
+    //Only two pending byte ranges fit, so the other two gaps aren't returned
+    int dstTooSmall;
+    assert_int_eq(0, data_region_readahead_observe(dst, 8, readahead, 0, DR(0, 99), present, NULL));
+    assert_int_eq(2, data_region_readahead_observe(dst, 8, readahead, 0, DR(100, 199), present, &dstTooSmall));
+    assert_data_region_array_eq(dst, DR(210, 299), DR(310, 399));
+    assert_int_eq(0, dstTooSmall);
+
+    //Once a pending byte range is used, the next gap is returned
+    assert_int_eq(1, data_region_readahead_observe(dst, 8, readahead, 0, DR(200, 299), present, &dstTooSmall));
+    assert_data_region_array_eq(dst, DR(410, 499));
+    assert_int_eq(0, dstTooSmall);
+
+    data_region_readahead_free(readahead);
+    data_region_set_free(present);
+  }
+
+  Test(data_region_readahead_window_follows_hit_rate)
+  {
+    DataRegion dst[8];
+    DataRegionReadaheadInfo info;
+    DataRegionSet* present = data_region_set_create(4);
+    DataRegionReadahead* readahead = readahead_test_create(4, 100, 800, 4);
+
+    //While prefetched bytes are used, the window grows
+    for(int64_t i = 0; i < 30; i++)
+      data_region_readahead_observe(dst, 8, readahead, 0, DR(i * 100, (i * 100) + 99), present, NULL);
+    assert_int_eq(1, data_region_readahead_get_info(readahead, 0, &info));
+    assert_int_eq(800, info.window_bytes);
+    assert_int_eq(0, info.wasted_bytes);
+
+    //Abandoning the window wastes it, so it shrinks
+    data_region_readahead_observe(dst, 8, readahead, 0, DR(100000, 100099), present, NULL);
+    assert_int_eq(1, data_region_readahead_get_info(readahead, 0, &info));
+    assert_int_eq(DATA_REGION_ACCESS_RANDOM, info.pattern);
+    assert_int_eq(800, info.wasted_bytes);
+    assert_int_eq(400, info.window_bytes);
+
+    data_region_readahead_free(readahead);
+    data_region_set_free(present);
+  }
+
+  Test(data_region_readahead_forgets_least_recently_used_stream)
+  {
+    DataRegion dst[4];
+    DataRegionReadaheadInfo info;
+    DataRegionSet* present = data_region_set_create(4);
+    DataRegionReadahead* readahead = readahead_test_create(2, 100, 100, 1);
+
+    data_region_readahead_observe(dst, 4, readahead, 1, DR(0, 9), present, NULL);
+    data_region_readahead_observe(dst, 4, readahead, 2, DR(0, 9), present, NULL);
+    data_region_readahead_observe(dst, 4, readahead, 1, DR(10, 19), present, NULL);
+    data_region_readahead_observe(dst, 4, readahead, 3, DR(0, 9), present, NULL);
+    assert_int_eq(1, data_region_readahead_get_info(readahead, 1, &info));
+    assert_int_eq(0, data_region_readahead_get_info(readahead, 2, &info));
+    assert_int_eq(1, data_region_readahead_get_info(readahead, 3, &info));
+
+    data_region_readahead_free(readahead);
+    data_region_set_free(present);
+  }
+
+  Test(data_region_readahead_turns_sequential_reads_into_hits)
+  {
+    unsigned char bytes[4096];
+    DataRegionCache* cache = cache_test_create(64 * 1024, 16, 64 * 1024);
+    DataRegionReadahead* readahead = readahead_test_create(4, 8 * 1024, 32 * 1024, 4);
+    for(int64_t offset = 0; offset < 64 * 1024; offset += 4096)
+    {
+      assert_int_eq(4096, data_region_readahead_cache_read(readahead, 0, cache, bytes, offset, 4096));
+      assert_int_eq(1, cache_test_bytes_match(bytes, offset, 4096));
+    }
+
+    //Only the first two reads miss
+    DataRegionCacheStats stats = data_region_cache_get_stats(cache);
+    assert_int_eq(56 * 1024, stats.hit_bytes);
+    assert_int_eq(64 * 1024, stats.miss_bytes);
+
+    data_region_readahead_free(readahead);
+    data_region_cache_free(cache);
+  }
+
+END_TEST_SUITE()
+
+
+BEGIN_TEST_SUITE(DataRegionSchedulerTests)
+
+  Test(data_region_scheduler_NULL_args)
+  {
+    DataRegion unit;
+    assert_null(data_region_scheduler_create(0, 1, 1, 0));
+    assert_null(data_region_scheduler_create(1, 0, 1, 0));
+    assert_null(data_region_scheduler_create(1, 1, 0, 0));
+    assert_null(data_region_scheduler_create(1, 1, 1, -1));
+
+    DataRegionScheduler* scheduler = data_region_scheduler_create(4, 2, 100, 1000);
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_scheduler_set_point(NULL, 0, 0, 1, 0));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_scheduler_set_point(scheduler, 0, -1, 1, 0));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_scheduler_set_point(scheduler, 0, 0, 0, 0));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_scheduler_set_point(scheduler, 2, 0, 1, 0));
+    assert_int_eq(0, data_region_scheduler_next(NULL, &unit));
+    assert_int_eq(0, data_region_scheduler_next(scheduler, NULL));
+    assert_int_eq(0, data_region_scheduler_next(scheduler, &unit));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_scheduler_complete(NULL, DR(0, 0), 1));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_scheduler_mark_present(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_scheduler_mark_missing(NULL, DR(0, 0)));
+    data_region_scheduler_clear_point(NULL, 0);
+    data_region_scheduler_free(scheduler);
+    data_region_scheduler_free(NULL);
+  }
+
+  Test(data_region_scheduler_units_skip_present_bytes)
+  {
+    DataRegion unit;
+    DataRegionScheduler* scheduler = data_region_scheduler_create(4, 1, 100, 450);
+    data_region_scheduler_mark_present(scheduler, DR(150, 249));
+    data_region_scheduler_set_point(scheduler, 0, 120, 1, 0);
+
+    //Units are aligned, and end where present bytes or the file begin
+    DataRegion expected[] = { DR(120, 149), DR(250, 299), DR(300, 399), DR(400, 449) };
+    for(int i = 0; i < 4; i++)
+    {
+      assert_int_eq(1, data_region_scheduler_next(scheduler, &unit));
+      assert_int_eq(expected[i].first_index, unit.first_index);
+      assert_int_eq(expected[i].last_index, unit.last_index);
+    }
+    assert_int_eq(0, data_region_scheduler_next(scheduler, &unit));
+
+    data_region_scheduler_free(scheduler);
+  }
+
+  Test(data_region_scheduler_orders_by_distance_and_urgency)
+  {
+    DataRegion unit;
+    DataRegionScheduler* scheduler = data_region_scheduler_create(10, 2, 100, 10000);
+    data_region_scheduler_set_point(scheduler, 0, 0, 1, 0);
+    data_region_scheduler_set_point(scheduler, 1, 500, 2, 0);
+
+    //Point 1 is twice as urgent, so it gets twice as far ahead
+    DataRegion expected[] = { DR(0, 99), DR(500, 599), DR(600, 699), DR(100, 199), DR(700, 799) };
+    for(int i = 0; i < 5; i++)
+    {
+      assert_int_eq(1, data_region_scheduler_next(scheduler, &unit));
+      assert_int_eq(expected[i].first_index, unit.first_index);
+      assert_int_eq(expected[i].last_index, unit.last_index);
+    }
+
+    //Moving a point (such as a seek) takes effect on the next decision
+    data_region_scheduler_set_point(scheduler, 1, 5050, 2, 0);
+    assert_int_eq(1, data_region_scheduler_next(scheduler, &unit));
+    assert_int_eq(5050, unit.first_index);
+    assert_int_eq(5099, unit.last_index);
+
+    data_region_scheduler_clear_point(scheduler, 1);
+    assert_int_eq(1, data_region_scheduler_next(scheduler, &unit));
+    assert_int_eq(200, unit.first_index);
+
+    data_region_scheduler_free(scheduler);
+  }
+
+  Test(data_region_scheduler_horizon)
+  {
+    DataRegion unit;
+    DataRegionScheduler* scheduler = data_region_scheduler_create(4, 1, 100, 1000);
+    data_region_scheduler_set_point(scheduler, 0, 0, 1, 250);
+    assert_int_eq(1, data_region_scheduler_next(scheduler, &unit));
+    assert_int_eq(1, data_region_scheduler_next(scheduler, &unit));
+    assert_int_eq(1, data_region_scheduler_next(scheduler, &unit));
+    assert_int_eq(200, unit.first_index);
+    assert_int_eq(249, unit.last_index);
+    assert_int_eq(0, data_region_scheduler_next(scheduler, &unit));
+    data_region_scheduler_free(scheduler);
+  }
+
+  Test(data_region_scheduler_failed_and_evicted_units_are_fetched_again)
+  {
+    DataRegion unit;
+    DataRegionScheduler* scheduler = data_region_scheduler_create(2, 1, 100, 1000);
+    data_region_scheduler_set_point(scheduler, 0, 0, 1, 0);
+    assert_int_eq(1, data_region_scheduler_next(scheduler, &unit));
+    assert_int_eq(1, data_region_scheduler_next(scheduler, &unit));
+
+    //Only as many units as the region capacity are fetched at once
+    assert_int_eq(0, data_region_scheduler_next(scheduler, &unit));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_scheduler_complete(scheduler, DR(0, 99), 0));
+    assert_int_eq(1, data_region_scheduler_next(scheduler, &unit));
+    assert_int_eq(0, unit.first_index);
+    assert_int_eq(99, unit.last_index);
+
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_scheduler_complete(scheduler, DR(0, 99), 1));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_scheduler_complete(scheduler, DR(100, 199), 1));
+    assert_data_region_array_eq(scheduler->present->regions, DR(0, 199));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_scheduler_mark_missing(scheduler, DR(50, 59)));
+    assert_int_eq(1, data_region_scheduler_next(scheduler, &unit));
+    assert_int_eq(50, unit.first_index);
+    assert_int_eq(59, unit.last_index);
+
+    data_region_scheduler_free(scheduler);
+  }
+
+  Test(data_region_scheduler_fetches_every_missing_byte_once,
+    RangeParam(seed, 1, 20))
+  {
+    uint64_t rng = seed;
+    DataRegion unit;
+    DataRegionScheduler* scheduler = data_region_scheduler_create(1000, 3, 64, 10000);
+    for(int i = 0; i < 50; i++)
+      data_region_scheduler_mark_present(scheduler, test_rand_region(&rng, 10000, 200));
+    int64_t lowest = INT64_MAX;
+    for(int i = 0; i < 3; i++)
+    {
+      int64_t offset = (int64_t)(test_rand(&rng) % 10000);
+      lowest = offset < lowest ? offset : lowest;
+      data_region_scheduler_set_point(scheduler, i, offset, 1 + (int64_t)(test_rand(&rng) % 4), 0);
+    }
+
+    //Complete units in a shuffled order, so that bytes being fetched and present bytes interleave
+    DataRegion pending[8];
+    int pendingCount = 0;
+    for(;;)
+    {
+      int found = data_region_scheduler_next(scheduler, &unit);
+      if(found)
+      {
+        assert_int_eq(0, data_region_set_count_crop(scheduler->present, unit));
+        pending[pendingCount++] = unit;
+      }
+      if(pendingCount == 0)
+        break;
+      if(!found || pendingCount == 8)
+      {
+        int index = (int)(test_rand(&rng) & 7);
+        index = index < pendingCount ? index : 0;
+        assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_scheduler_complete(scheduler, pending[index], 1));
+        pending[index] = pending[--pendingCount];
+      }
+    }
+
+    assert_int_eq(0, data_region_set_count_crop(scheduler->inflight, DR(0, 9999)));
+    DataRegion missing[1];
+    assert_int_eq(0, data_region_set_negative_crop(missing, 1, scheduler->present, DR(lowest, 9999), NULL));
+    data_region_scheduler_free(scheduler);
+  }
+
+END_TEST_SUITE()
+
+
+/* Arguments of the DataRegionInflight concurrency test threads. */
+typedef struct InflightTestArgs
+{
+  DataRegionInflight* inflight;
+  _Atomic int* owners;
+  _Atomic int64_t* violations;
+  uint64_t seed;
+} InflightTestArgs;
+
+/* Thread of the DataRegionInflight concurrency test, which checks that no
+ * byte is owned by two threads at once. */
+void* inflight_test_thread(void* arg)
+{
+  InflightTestArgs* args = arg;
+  uint64_t rng = args->seed;
+  DataRegionInflightClaim claims[64];
+  for(int i = 0; i < 2000; i++)
+  {
+    DataRegion region = test_rand_region(&rng, 1000, 100);
+    int64_t count = data_region_inflight_begin(claims, 64, args->inflight, region, NULL);
+    for(int64_t j = 0; j < count; j++)
+    {
+      if(!claims[j].is_owner)
+        continue;
+      for(int64_t k = claims[j].region.first_index; k <= claims[j].region.last_index; k++)
+      {
+        if(atomic_fetch_add(&args->owners[k], 1) != 0)
+          atomic_fetch_add(args->violations, 1);
+      }
+      for(int64_t k = claims[j].region.first_index; k <= claims[j].region.last_index; k++)
+        atomic_fetch_sub(&args->owners[k], 1);
+      data_region_inflight_end(args->inflight, claims[j].handle, 1);
+    }
+    for(int64_t j = 0; j < count; j++)
+    {
+      if(!claims[j].is_owner)
+      {
+        data_region_inflight_wait(claims[j].handle);
+        data_region_inflight_release(claims[j].handle);
+      }
+    }
+  }
+  return NULL;
+}
+
+BEGIN_TEST_SUITE(DataRegionInflightTests)
+
+  Test(data_region_inflight_NULL_args)
+  {
+    DataRegionInflightClaim claims[4];
+    assert_null(data_region_inflight_create(0));
+    DataRegionInflight* inflight = data_region_inflight_create(4);
+    assert_int_eq(0, data_region_inflight_begin(claims, 4, NULL, DR(0, 9), NULL));
+    assert_int_eq(0, data_region_inflight_begin(claims, 4, inflight, DR(9, 0), NULL));
+    assert_int_eq(0, data_region_inflight_wait(NULL));
+    assert_int_eq(0, data_region_inflight_count(NULL));
+    data_region_inflight_end(NULL, NULL, 1);
+    data_region_inflight_end(inflight, NULL, 1);
+    data_region_inflight_release(NULL);
+    data_region_inflight_free(inflight);
+    data_region_inflight_free(NULL);
+  }
+
+  Test(data_region_inflight_claims_split_around_fetches)
+  {
+    DataRegionInflightClaim first[4], second[4];
+    DataRegionInflight* inflight = data_region_inflight_create(4);
+    assert_int_eq(1, data_region_inflight_begin(first, 4, inflight, DR(100, 199), NULL));
+    assert_int_eq(1, first[0].is_owner);
+    assert_int_eq(1, data_region_inflight_count(inflight));
+
+    //Only the bytes that aren't being fetched yet are owned
+    assert_int_eq(3, data_region_inflight_begin(NULL, 0, inflight, DR(50, 300), NULL));
+    assert_int_eq(3, data_region_inflight_begin(second, 4, inflight, DR(50, 300), NULL));
+    assert_int_eq(1, second[0].is_owner);
+    assert_int_eq(50, second[0].region.first_index);
+    assert_int_eq(99, second[0].region.last_index);
+    assert_int_eq(0, second[1].is_owner);
+    assert_pointer_eq(first[0].handle, second[1].handle);
+    assert_int_eq(1, second[2].is_owner);
+    assert_int_eq(200, second[2].region.first_index);
+    assert_int_eq(300, second[2].region.last_index);
+    assert_int_eq(3, data_region_inflight_count(inflight));
+
+    //A claim within a fetch only waits
+    DataRegionInflightClaim third[4];
+    assert_int_eq(1, data_region_inflight_begin(third, 4, inflight, DR(120, 130), NULL));
+    assert_int_eq(0, third[0].is_owner);
+    assert_int_eq(120, third[0].region.first_index);
+    assert_int_eq(130, third[0].region.last_index);
+
+    data_region_inflight_end(inflight, first[0].handle, 1);
+    data_region_inflight_end(inflight, second[0].handle, 1);
+    data_region_inflight_end(inflight, second[2].handle, 0);
+    assert_int_eq(0, data_region_inflight_count(inflight));
+    assert_int_eq(1, data_region_inflight_wait(second[1].handle));
+    assert_int_eq(1, data_region_inflight_wait(third[0].handle));
+    data_region_inflight_release(second[1].handle);
+    data_region_inflight_release(third[0].handle);
+    data_region_inflight_free(inflight);
+  }
+
+  Test(data_region_inflight_claims_nothing_without_room)
+  {
+    DataRegionInflightClaim claims[4];
+    int dstTooSmall;
+    DataRegionInflight* inflight = data_region_inflight_create(2);
+    assert_int_eq(1, data_region_inflight_begin(claims, 4, inflight, DR(100, 199), NULL));
+    DataRegionInflightHandle* handle = claims[0].handle;
+
+    assert_int_eq(3, data_region_inflight_begin(claims, 2, inflight, DR(0, 300), &dstTooSmall));
+    assert_int_eq(1, dstTooSmall);
+    assert_int_eq(3, data_region_inflight_begin(claims, 4, inflight, DR(0, 300), &dstTooSmall));
+    assert_int_eq(1, dstTooSmall);
+    assert_int_eq(1, data_region_inflight_count(inflight));
+
+    assert_int_eq(2, data_region_inflight_begin(claims, 4, inflight, DR(150, 300), &dstTooSmall));
+    assert_int_eq(0, dstTooSmall);
+    assert_int_eq(2, data_region_inflight_count(inflight));
+    data_region_inflight_release(claims[0].handle);
+    data_region_inflight_end(inflight, claims[1].handle, 1);
+    data_region_inflight_end(inflight, handle, 1);
+    data_region_inflight_free(inflight);
+  }
+
+  Test(data_region_inflight_concurrent_claims_own_each_byte_once)
+  {
+    _Atomic int owners[1100] = { 0 };
+    _Atomic int64_t violations = 0;
+    DataRegionInflight* inflight = data_region_inflight_create(256);
+    pthread_t threads[4];
+    InflightTestArgs args[4];
+    for(int i = 0; i < 4; i++)
+    {
+      args[i] = (InflightTestArgs){ inflight, owners, &violations, (uint64_t)(i + 1) };
+      assert_int_eq(0, pthread_create(&threads[i], NULL, inflight_test_thread, &args[i]));
+    }
+    for(int i = 0; i < 4; i++)
+      pthread_join(threads[i], NULL);
+
+    assert_int_eq(0, atomic_load(&violations));
+    assert_int_eq(0, data_region_inflight_count(inflight));
+    data_region_inflight_free(inflight);
+  }
+
+END_TEST_SUITE()
+
+
+/* Records the callbacks of the DataRegionWaitSet tests. */
+typedef struct WaitTestRecord
+{
+  int64_t count;
+  DataRegion last;
+} WaitTestRecord;
+
+void wait_test_callback(void* context, DataRegion region)
+{
+  WaitTestRecord* record = context;
+  record->count++;
+  record->last = region;
+}
+
+/* Arguments of the DataRegionWaitSet tests' helper threads. */
+typedef struct WaitTestThread
+{
+  DataRegionWaitSet* wait_set;
+  DataRegionWaiter* waiter;
+  DataRegion region;
+  int64_t delay_microseconds;
+} WaitTestThread;
+
+/* Adds a byte range after a delay. */
+void* wait_test_adder(void* arg)
+{
+  WaitTestThread* thread = arg;
+  struct timespec delay = { 0, (long)(thread->delay_microseconds * 1000) };
+  nanosleep(&delay, NULL);
+  data_region_wait_set_add(thread->wait_set, thread->region);
+  return NULL;
+}
+
+/* Cancels a waiter once it is registered. */
+void* wait_test_canceller(void* arg)
+{
+  WaitTestThread* thread = arg;
+  struct timespec delay = { 0, 1000000 };
+  for(;;)
+  {
+    pthread_mutex_lock(&thread->wait_set->lock);
+    int registered = thread->wait_set->waiter_count > 0;
+    pthread_mutex_unlock(&thread->wait_set->lock);
+    if(registered)
+      break;
+    nanosleep(&delay, NULL);
+  }
+  data_region_wait_set_cancel(thread->wait_set, thread->waiter);
+  return NULL;
+}
+
+BEGIN_TEST_SUITE(DataRegionWaitSetTests)
+
+  Test(data_region_wait_set_NULL_args)
+  {
+    DataRegionWaiter waiter;
+    WaitTestRecord record = { 0 };
+    assert_null(data_region_wait_set_create(0, 1));
+    assert_null(data_region_wait_set_create(1, 0));
+    DataRegionWaitSet* waitSet = data_region_wait_set_create(4, 4);
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_wait_set_add(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_wait_set_add(waitSet, DR(1, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_wait_set_remove(NULL, DR(0, 0)));
+    assert_int_eq(0, data_region_wait_set_contains(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_WAIT_FAILED, data_region_wait_set_notify(NULL, &waiter, DR(0, 0), wait_test_callback, &record));
+    assert_int_eq(DATA_REGION_WAIT_FAILED, data_region_wait_set_notify(waitSet, NULL, DR(0, 0), wait_test_callback, &record));
+    assert_int_eq(DATA_REGION_WAIT_FAILED, data_region_wait_set_notify(waitSet, &waiter, DR(1, 0), wait_test_callback, &record));
+    assert_int_eq(DATA_REGION_WAIT_FAILED, data_region_wait_set_notify(waitSet, &waiter, DR(0, 0), NULL, &record));
+    assert_int_eq(DATA_REGION_WAIT_FAILED, data_region_wait_set_wait(NULL, &waiter, DR(0, 0), 0));
+    assert_int_eq(DATA_REGION_WAIT_FAILED, data_region_wait_set_wait(waitSet, NULL, DR(0, 0), 0));
+    assert_int_eq(0, data_region_wait_set_cancel(NULL, &waiter));
+    assert_int_eq(0, data_region_wait_set_cancel(waitSet, NULL));
+    assert_int_eq(0, record.count);
+    data_region_wait_set_free(waitSet);
+    data_region_wait_set_free(NULL);
+  }
+
+  Test(data_region_wait_set_notifies_when_fully_present)
+  {
+    DataRegionWaiter waiters[3];
+    WaitTestRecord records[3] = { { 0 }, { 0 }, { 0 } };
+    DataRegionWaitSet* waitSet = data_region_wait_set_create(8, 3);
+    assert_int_eq(DATA_REGION_WAIT_PENDING, data_region_wait_set_notify(waitSet, &waiters[0], DR(100, 199), wait_test_callback, &records[0]));
+    assert_int_eq(DATA_REGION_WAIT_PENDING, data_region_wait_set_notify(waitSet, &waiters[1], DR(150, 249), wait_test_callback, &records[1]));
+    assert_int_eq(DATA_REGION_WAIT_PENDING, data_region_wait_set_notify(waitSet, &waiters[2], DR(500, 509), wait_test_callback, &records[2]));
+
+    //Partially present byte ranges don't wake their waiters
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_wait_set_add(waitSet, DR(100, 149)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_wait_set_add(waitSet, DR(160, 249)));
+    assert_int_eq(0, records[0].count);
+    assert_int_eq(0, records[1].count);
+
+    //Filling the hole completes both
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_wait_set_add(waitSet, DR(150, 159)));
+    assert_int_eq(1, records[0].count);
+    assert_int_eq(100, records[0].last.first_index);
+    assert_int_eq(199, records[0].last.last_index);
+    assert_int_eq(1, records[1].count);
+    assert_int_eq(0, records[2].count);
+    assert_int_eq(DATA_REGION_WAIT_PRESENT, waiters[0].result);
+    assert_int_eq(1, waitSet->waiter_count);
+
+    //A woken waiter can be reused, and is called right away if its bytes are present
+    assert_int_eq(DATA_REGION_WAIT_PRESENT, data_region_wait_set_notify(waitSet, &waiters[0], DR(120, 130), wait_test_callback, &records[0]));
+    assert_int_eq(2, records[0].count);
+    assert_int_eq(1, data_region_wait_set_contains(waitSet, DR(100, 249)));
+    assert_int_eq(0, data_region_wait_set_contains(waitSet, DR(100, 250)));
+
+    //Cancelled waiters aren't called
+    assert_int_eq(1, data_region_wait_set_cancel(waitSet, &waiters[2]));
+    assert_int_eq(0, data_region_wait_set_cancel(waitSet, &waiters[2]));
+    assert_int_eq(DATA_REGION_WAIT_CANCELLED, waiters[2].result);
+    data_region_wait_set_add(waitSet, DR(500, 509));
+    assert_int_eq(0, records[2].count);
+
+    data_region_wait_set_free(waitSet);
+  }
+
+  Test(data_region_wait_set_waiter_capacity)
+  {
+    DataRegionWaiter waiters[2];
+    WaitTestRecord record = { 0 };
+    DataRegionWaitSet* waitSet = data_region_wait_set_create(4, 1);
+    assert_int_eq(DATA_REGION_WAIT_PENDING, data_region_wait_set_notify(waitSet, &waiters[0], DR(0, 9), wait_test_callback, &record));
+    assert_int_eq(DATA_REGION_WAIT_FAILED, data_region_wait_set_notify(waitSet, &waiters[1], DR(0, 9), wait_test_callback, &record));
+    assert_int_eq(DATA_REGION_WAIT_FAILED, data_region_wait_set_wait(waitSet, &waiters[1], DR(0, 9), 0));
+    data_region_wait_set_add(waitSet, DR(0, 9));
+    assert_int_eq(1, record.count);
+    assert_int_eq(DATA_REGION_WAIT_PRESENT, data_region_wait_set_wait(waitSet, &waiters[1], DR(0, 9), 0));
+    data_region_wait_set_free(waitSet);
+  }
+
+  Test(data_region_wait_set_wait_blocks_until_present)
+  {
+    DataRegionWaiter waiter;
+    DataRegionWaitSet* waitSet = data_region_wait_set_create(4, 4);
+    assert_int_eq(DATA_REGION_WAIT_TIMED_OUT, data_region_wait_set_wait(waitSet, &waiter, DR(0, 99), 10000));
+    assert_int_eq(0, waitSet->waiter_count);
+
+    pthread_t thread;
+    WaitTestThread adder = { waitSet, NULL, DR(0, 99), 20000 };
+    assert_int_eq(0, pthread_create(&thread, NULL, wait_test_adder, &adder));
+    assert_int_eq(DATA_REGION_WAIT_PRESENT, data_region_wait_set_wait(waitSet, &waiter, DR(10, 19), -1));
+    pthread_join(thread, NULL);
+
+    WaitTestThread canceller = { waitSet, &waiter, DR(0, 0), 0 };
+    assert_int_eq(0, pthread_create(&thread, NULL, wait_test_canceller, &canceller));
+    assert_int_eq(DATA_REGION_WAIT_CANCELLED, data_region_wait_set_wait(waitSet, &waiter, DR(0, 100), -1));
+    pthread_join(thread, NULL);
+    assert_int_eq(0, waitSet->waiter_count);
+    data_region_wait_set_free(waitSet);
+  }
+
+  Test(data_region_wait_set_wakes_exactly_the_covered_waiters,
+    RangeParam(seed, 1, 10))
+  {
+    uint64_t rng = seed;
+    DataRegionWaiter waiters[50];
+    WaitTestRecord records[50];
+    DataRegionWaitSet* waitSet = data_region_wait_set_create(1000, 50);
+    for(int i = 0; i < 50; i++)
+    {
+      records[i] = (WaitTestRecord){ 0 };
+      data_region_wait_set_notify(waitSet, &waiters[i], test_rand_region(&rng, 2000, 100), wait_test_callback, &records[i]);
+    }
+
+    for(int i = 0; i < 200; i++)
+    {
+      data_region_wait_set_add(waitSet, test_rand_region(&rng, 2000, 20));
+      for(int j = 0; j < 50; j++)
+      {
+        int present = data_region_wait_set_contains(waitSet, waiters[j].region);
+        assert_int_eq(present, records[j].count);
+      }
+    }
+    data_region_wait_set_free(waitSet);
+  }
+
+END_TEST_SUITE()
+
+
+BEGIN_TEST_SUITE(DataRegionBatchTests)
+
+  Test(data_region_batch_NULL_args)
+  {
+    DataRegionSet* set = data_region_set_create(4);
+    assert_null(data_region_batch_create(NULL, 4));
+    assert_null(data_region_batch_create(set, 0));
+    DataRegionBatch* batch = data_region_batch_create(set, 4);
+    assert_not_null(batch);
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_batch_add(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_batch_remove(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_batch_add(batch, DR(1, 0)));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_batch_remove(batch, DR(1, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_batch_commit(NULL));
+    assert_int_eq(-1, data_region_batch_result_count(NULL));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_commit(batch));
+    assert_int_eq(0, data_region_batch_result_count(batch));
+    data_region_batch_clear(NULL);
+    data_region_batch_free(batch);
+    data_region_batch_free(NULL);
+    free(set);
+  }
+
+  Test(data_region_batch_later_operations_override_earlier_ones)
+  {
+    DataRegionSet* set = data_region_set_create(8);
+    data_region_set_add(set, DR(0, 9));
+    data_region_set_add(set, DR(40, 49));
+    DataRegionBatch* batch = data_region_batch_create(set, 4);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_add(batch, DR(20, 29)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_remove(batch, DR(5, 24)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_add(batch, DR(10, 12)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_remove(batch, DR(45, 45)));
+
+    //Nothing changes before the commit
+    assert_data_region_set_eq_array(set, DR(0, 9), DR(40, 49));
+    assert_int_eq(5, data_region_batch_result_count(batch));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_commit(batch));
+    assert_data_region_set_eq_array(set, DR(0, 4), DR(10, 12), DR(25, 29), DR(40, 44), DR(46, 49));
+    assert_int_eq(22, data_region_set_total_length(set));
+
+    //A commit clears the batch
+    assert_int_eq(5, data_region_batch_result_count(batch));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_commit(batch));
+    assert_int_eq(5, data_region_set_count(set));
+    data_region_batch_free(batch);
+    free(set);
+  }
+
+  Test(data_region_batch_commits_all_or_nothing)
+  {
+    DataRegionSet* set = data_region_set_create(3);
+    data_region_set_add(set, DR(0, 99));
+    DataRegionBatch* batch = data_region_batch_create(set, 4);
+    data_region_batch_remove(batch, DR(10, 19));
+    data_region_batch_remove(batch, DR(30, 39));
+    data_region_batch_remove(batch, DR(50, 59));
+    assert_int_eq(4, data_region_batch_result_count(batch));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_batch_commit(batch));
+    assert_data_region_set_eq_array(set, DR(0, 99));
+    assert_int_eq(100, data_region_set_total_length(set));
+
+    //Filling one of the holes again makes the result fit, although removing the
+    //DataRegions one by one would run out of space
+    data_region_batch_add(batch, DR(25, 45));
+    assert_int_eq(3, data_region_batch_result_count(batch));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_commit(batch));
+    assert_data_region_set_eq_array(set, DR(0, 9), DR(20, 49), DR(60, 99));
+    data_region_batch_free(batch);
+    free(set);
+  }
+
+  Test(data_region_batch_records_nothing_without_room)
+  {
+    DataRegionSet* set = data_region_set_create(8);
+    DataRegionBatch* batch = data_region_batch_create(set, 2);
+    data_region_batch_add(batch, DR(0, 9));
+    data_region_batch_add(batch, DR(20, 29));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_batch_add(batch, DR(40, 49)));
+
+    //Splitting a recorded add would also need a third DataRegion
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_batch_remove(batch, DR(22, 24)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_add(batch, DR(10, 19)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_commit(batch));
+    assert_data_region_set_eq_array(set, DR(0, 29));
+    data_region_batch_free(batch);
+    free(set);
+  }
+
+  Test(data_region_batch_matches_sequential_operations,
+    RangeParam(seed, 1, 20))
+  {
+    uint64_t rng = seed;
+    DataRegionSet* set = data_region_set_create(100);
+    DataRegionSet* expected = data_region_set_create(1000);
+    DataRegionBatch* batch = data_region_batch_create(set, 100);
+    for(int round = 0; round < 50; round++)
+    {
+      DataRegionSet* before = clone_data_region_set(set);
+      int operationCount = (int)(test_rand(&rng) % 20);
+      for(int i = 0; i < operationCount; i++)
+      {
+        DataRegion region = test_rand_region(&rng, 5000, 200);
+        if(test_rand(&rng) % 3 == 0)
+        {
+          assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_remove(batch, region));
+          data_region_set_remove(expected, region);
+        }
+        else
+        {
+          assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_add(batch, region));
+          data_region_set_add(expected, region);
+        }
+      }
+
+      int64_t resultCount = data_region_batch_result_count(batch);
+      assert_int_eq(data_region_set_count(expected), resultCount);
+      if(data_region_batch_commit(batch) == DATA_REGION_SET_SUCCESS)
+      {
+        assert_int_eq(data_region_set_total_length(expected), data_region_set_total_length(set));
+        assert_memory_eq(expected->regions, set->regions, sizeof(DataRegion) * resultCount);
+      }
+      else
+      {
+        assert_message(resultCount > data_region_set_capacity(set), "Expected the result not to fit.");
+        assert_data_region_set_eq(before, set);
+        data_region_batch_clear(batch);
+        data_region_set_clear(expected);
+        for(int64_t i = 0; i < data_region_set_count(set); i++)
+          data_region_set_add(expected, *data_region_set_at(set, i));
+      }
+      free_clone_data_region_set(before);
+    }
+    data_region_batch_free(batch);
+    data_region_set_free(expected);
+    free(set);
+  }
+
+END_TEST_SUITE()
+
+BEGIN_TEST_SUITE(DataRegionTraceTests)
+
+  Test(data_region_trace_NULL_args)
+  {
+    DataRegionTraceWriter writer;
+    DataRegionTraceReader reader;
+    DataRegionTraceGenerator generator;
+    DataRegionTraceRecord record = { DATA_REGION_TRACE_ADD, DR(0, 0), 0, 0 };
+    FILE* file = tmpfile();
+    assert_not_null(file);
+    assert_int_eq(0, data_region_trace_writer_init(NULL, file));
+    assert_int_eq(0, data_region_trace_writer_init(&writer, NULL));
+    assert_int_eq(0, data_region_trace_write(NULL, record));
+    assert_int_eq(0, data_region_trace_reader_init(NULL, file));
+    assert_int_eq(0, data_region_trace_reader_init(&reader, NULL));
+    assert_int_eq(-1, data_region_trace_read(NULL, &record));
+    assert_int_eq(0, data_region_trace_generator_init(NULL, DATA_REGION_TRACE_DB_WRITEBACK, 1 << 20, 1));
+    assert_int_eq(0, data_region_trace_generator_init(&generator, (DataRegionTraceWorkload)4, 1 << 20, 1));
+    assert_int_eq(0, data_region_trace_generator_init(&generator, DATA_REGION_TRACE_DB_WRITEBACK, 15 * 8192, 1));
+
+    assert_int_eq(1, data_region_trace_writer_init(&writer, file));
+    record.region = DR(1, 0);
+    assert_int_eq(0, data_region_trace_write(&writer, record));
+    record.region = DR(0, 0);
+    record.operation = (DataRegionTraceOperation)5;
+    assert_int_eq(0, data_region_trace_write(&writer, record));
+    assert_int_eq(0, writer.record_count);
+    fclose(file);
+  }
+
+  Test(data_region_trace_round_trip)
+  {
+    DataRegionTraceRecord records[] =
+    {
+      { DATA_REGION_TRACE_ADD, DR(100, 199), 0, 0 },
+      { DATA_REGION_TRACE_REMOVE, DR(150, 150), 0, 0 },
+      { DATA_REGION_TRACE_CROP, DR(-5000, 5000), 0, 0 },
+      { DATA_REGION_TRACE_COUNT_CROP, DR(INT64_MIN, INT64_MAX), 0, 0 },
+      { DATA_REGION_TRACE_NEGATIVE_CROP, DR(INT64_MAX, INT64_MAX), 0, 0 },
+      { DATA_REGION_TRACE_ADD, DR(INT64_MIN, INT64_MIN + 1), 0, 0 },
+    };
+    FILE* file = tmpfile();
+    DataRegionTraceWriter writer;
+    assert_int_eq(1, data_region_trace_writer_init(&writer, file));
+    for(int i = 0; i < 6; i++)
+      assert_int_eq(1, data_region_trace_write(&writer, records[i]));
+    assert_int_eq(6, writer.record_count);
+
+    rewind(file);
+    DataRegionTraceReader reader;
+    DataRegionTraceRecord record;
+    assert_int_eq(1, data_region_trace_reader_init(&reader, file));
+    for(int i = 0; i < 6; i++)
+    {
+      assert_int_eq(1, data_region_trace_read(&reader, &record));
+      assert_int_eq(records[i].operation, record.operation);
+      assert_int_eq(records[i].region.first_index, record.region.first_index);
+      assert_int_eq(records[i].region.last_index, record.region.last_index);
+    }
+    assert_int_eq(0, data_region_trace_read(&reader, &record));
+    fclose(file);
+  }
+
+  Test(data_region_trace_rejects_corrupt_traces)
+  {
+    DataRegionTraceReader reader;
+    DataRegionTraceRecord record;
+    FILE* file = tmpfile();
+    fputs("DRTRACE0", file);
+    rewind(file);
+    assert_int_eq(0, data_region_trace_reader_init(&reader, file));
+    fclose(file);
+
+    //An unknown operation, a truncated varint, and an overflowing length
+    const uint8_t bodies[3][12] =
+    {
+      { 7, 0, 0 },
+      { 0, 0x80 },
+      { 0, 2, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F }
+    };
+    const size_t bodySizes[3] = { 3, 2, 11 };
+    for(int i = 0; i < 3; i++)
+    {
+      file = tmpfile();
+      fputs("DRTRACE1", file);
+      fwrite(bodies[i], 1, bodySizes[i], file);
+      rewind(file);
+      assert_int_eq(1, data_region_trace_reader_init(&reader, file));
+      assert_int_eq(-1, data_region_trace_read(&reader, &record));
+      fclose(file);
+    }
+  }
+
+  Test(data_region_trace_generators_are_deterministic,
+    EnumParam(workload, DATA_REGION_TRACE_HTTP_RANGES, DATA_REGION_TRACE_P2P_PIECES, DATA_REGION_TRACE_VIDEO_SEEK, DATA_REGION_TRACE_DB_WRITEBACK))
+  {
+    const int64_t length = (int64_t)1 << 30;
+    DataRegionTraceGenerator a, b, c;
+    assert_int_eq(1, data_region_trace_generator_init(&a, workload, length, 7));
+    assert_int_eq(1, data_region_trace_generator_init(&b, workload, length, 7));
+    assert_int_eq(1, data_region_trace_generator_init(&c, workload, length, 8));
+    int64_t operationCounts[5] = { 0 };
+    int differs = 0;
+    for(int i = 0; i < 20000; i++)
+    {
+      DataRegionTraceRecord recordA = data_region_trace_generator_next(&a);
+      DataRegionTraceRecord recordB = data_region_trace_generator_next(&b);
+      DataRegionTraceRecord recordC = data_region_trace_generator_next(&c);
+      assert_int_eq(recordA.operation, recordB.operation);
+      assert_int_eq(recordA.region.first_index, recordB.region.first_index);
+      assert_int_eq(recordA.region.last_index, recordB.region.last_index);
+      differs |= recordA.region.first_index != recordC.region.first_index;
+
+      assert_int_eq(1, data_region_is_valid(recordA.region));
+      assert_int_eq(1, recordA.region.first_index >= 0 && recordA.region.last_index < length);
+      operationCounts[recordA.operation]++;
+    }
+    assert_int_eq(1, differs);
+
+    //Every workload adds and removes bytes, and queries them
+    assert_int_eq(1, operationCounts[DATA_REGION_TRACE_ADD] > 0);
+    assert_int_eq(1, operationCounts[DATA_REGION_TRACE_REMOVE] > 0);
+    assert_int_eq(1, operationCounts[DATA_REGION_TRACE_CROP] + operationCounts[DATA_REGION_TRACE_COUNT_CROP] + operationCounts[DATA_REGION_TRACE_NEGATIVE_CROP] > 0);
+  }
+
+  Test(data_region_trace_p2p_pieces_complete_in_blocks)
+  {
+    DataRegionTraceGenerator generator;
+    DataRegionSet* set = data_region_set_create(1024);
+    assert_int_eq(1, data_region_trace_generator_init(&generator, DATA_REGION_TRACE_P2P_PIECES, 64 * 256 * 1024, 3));
+    int64_t completedCount = 0;
+    for(int i = 0; i < 5000; i++)
+    {
+      DataRegionTraceRecord record = data_region_trace_generator_next(&generator);
+      if(record.operation == DATA_REGION_TRACE_ADD)
+      {
+        assert_int_eq(16 * 1024, data_region_length(record.region));
+        data_region_set_add(set, record.region);
+      }
+      else if(record.operation == DATA_REGION_TRACE_COUNT_CROP)
+      {
+        //A piece is checked once all of its blocks arrived
+        assert_int_eq(256 * 1024, data_region_length(record.region));
+        assert_int_eq(1, data_region_set_count_crop(set, record.region));
+        completedCount++;
+      }
+      else if(record.operation == DATA_REGION_TRACE_REMOVE)
+      {
+        data_region_set_remove(set, record.region);
+      }
+    }
+    assert_int_eq(1, completedCount > 64);
+    free(set);
+  }
+
+END_TEST_SUITE()
+
+BEGIN_TEST_SUITE(DataRegionStatsTests)
+
+  Test(data_region_stats_snapshot_NULL_arg)
+  {
+    assert_int_eq(0, data_region_stats_snapshot(NULL));
+  }
+
+  Test(data_region_stats_bucket_bounds)
+  {
+    //Every bucket starts where the previous one ended, at most 25% later
+    assert_int_eq(0, data_region_stats_bucket_first(0));
+    assert_int_eq(4, data_region_stats_bucket_first(4));
+    assert_int_eq(5, data_region_stats_bucket_first(5));
+    assert_int_eq(8, data_region_stats_bucket_first(8));
+    assert_int_eq(10, data_region_stats_bucket_first(9));
+    for(int i = 5; i < DATA_REGION_STATS_LATENCY_BUCKETS; i++)
+    {
+      uint64_t first = data_region_stats_bucket_first(i);
+      uint64_t previous = data_region_stats_bucket_first(i - 1);
+      assert_message(first > previous && (first - previous) * 4 <= previous, "Buckets are not log-linear.");
+    }
+    assert_message(data_region_stats_bucket_first(DATA_REGION_STATS_LATENCY_BUCKETS - 1) > (UINT64_MAX / 8) * 7, "Last bucket doesn't reach UINT64_MAX.");
+  }
+
+  Test(data_region_stats_counts_operations)
+  {
+    DataRegionStats before, after;
+    DataRegion dst[8];
+    DataRegionSet* set = data_region_set_create(4);
+    assert_not_null(set);
+    assert_int_eq(1, data_region_stats_snapshot(&before));
+
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add(set, DR(0, 9)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add(set, DR(20, 29)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add(set, DR(40, 49)));
+    //Inserting before two DataRegions shifts them
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add(set, DR(-20, -11)));
+    //Combining three DataRegions into one
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add(set, DR(10, 39)));
+    //Splitting one DataRegion in two
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_remove_delta(set, DR(20, 29), NULL, NULL, NULL));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add(set, DR(100, 109)));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_set_add(set, DR(200, 209)));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_set_remove(set, DR(5, 5)));
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_set_remove(set, DR(1, 0)));
+    assert_int_eq(2, data_region_set_crop(dst, 8, set, DR(0, 35), NULL));
+    assert_int_eq(2, data_region_set_count_crop(set, DR(0, 35)));
+    assert_int_eq(0, data_region_set_count_crop(set, DR(1, 0)));
+    assert_int_eq(0, data_region_set_count_crop(NULL, DR(0, 35)));
+    //The adds and removes of negative crops aren't counted separately
+    assert_int_eq(2, data_region_set_negative_crop(dst, 8, set, DR(-30, 15), NULL));
+
+    assert_int_eq(1, data_region_stats_snapshot(&after));
+    assert_int_eq(7, after.calls[DATA_REGION_STATS_ADD] - before.calls[DATA_REGION_STATS_ADD]);
+    assert_int_eq(3, after.calls[DATA_REGION_STATS_REMOVE] - before.calls[DATA_REGION_STATS_REMOVE]);
+    assert_int_eq(1, after.calls[DATA_REGION_STATS_CROP] - before.calls[DATA_REGION_STATS_CROP]);
+    assert_int_eq(3, after.calls[DATA_REGION_STATS_COUNT_CROP] - before.calls[DATA_REGION_STATS_COUNT_CROP]);
+    assert_int_eq(1, after.calls[DATA_REGION_STATS_NEGATIVE_CROP] - before.calls[DATA_REGION_STATS_NEGATIVE_CROP]);
+    assert_int_eq(2, after.out_of_space - before.out_of_space);
+    assert_int_eq(3, after.regions_merged - before.regions_merged);
+    assert_int_eq(1, after.regions_split - before.regions_split);
+    //Only the insert before (0, 9), (20, 29) and (40, 49) shifted DataRegions
+    assert_int_eq(3, after.regions_shifted - before.regions_shifted);
+
+    for(int op = 0; op < DATA_REGION_STATS_OPERATION_COUNT; op++)
+    {
+      uint64_t latencies = 0;
+      for(int i = 0; i < DATA_REGION_STATS_LATENCY_BUCKETS; i++)
+        latencies += after.latency[op][i] - before.latency[op][i];
+      assert_int_eq(after.calls[op] - before.calls[op], latencies);
+    }
+    data_region_set_free(set);
+  }
+
+  Test(data_region_stats_skip_scratch_sets)
+  {
+    DataRegionStats before, after;
+    DataRegion dst[8];
+    uint64_t fromTimestamp = data_region_record_timestamp();
+    assert_int_eq(1, data_region_stats_snapshot(&before));
+
+    //The sets that other containers build internally aren't the application's operations
+    DataRegionCowSet* cow = data_region_cow_set_create();
+    assert_not_null(cow);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_add(cow, DR(0, 99)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_cow_set_remove(cow, DR(10, 19)));
+    DataRegionSnapshot* snapshot = data_region_cow_set_snapshot(cow);
+    assert_int_eq(2, data_region_snapshot_crop(dst, 8, snapshot, DR(0, 50), NULL));
+    assert_int_eq(2, data_region_snapshot_count_crop(snapshot, DR(0, 50)));
+    data_region_snapshot_release(snapshot);
+    data_region_cow_set_free(cow);
+
+    DataRegionLsmSet* lsm = data_region_lsm_set_create(16, 4, 2, 0);
+    assert_not_null(lsm);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_add(lsm, DR(0, 99)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_lsm_set_remove(lsm, DR(10, 19)));
+    assert_int_eq(2, data_region_lsm_set_crop(dst, 8, lsm, DR(0, 50), NULL));
+    assert_int_eq(1, data_region_lsm_set_negative_crop(dst, 8, lsm, DR(0, 50), NULL));
+    data_region_lsm_set_free(lsm);
+
+    DataRegionSet* set = data_region_set_create(4);
+    assert_not_null(set);
+    DataRegionBatch* batch = data_region_batch_create(set, 4);
+    assert_not_null(batch);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_add(batch, DR(0, 99)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_batch_remove(batch, DR(10, 19)));
+    data_region_batch_free(batch);
+    data_region_set_free(set);
+
+    assert_int_eq(1, data_region_stats_snapshot(&after));
+    for(int op = 0; op < DATA_REGION_STATS_OPERATION_COUNT; op++)
+      assert_int_eq(0, after.calls[op] - before.calls[op]);
+    DataRegionRecordEntry entries[1];
+    assert_int_eq(0, data_region_record_collect(entries, 1, NULL, fromTimestamp, NULL));
+  }
+
+  Test(data_region_stats_count_small_set_spills_once)
+  {
+    DataRegionStats before, after;
+    DataRegionSmallSet set;
+    data_region_small_set_init(&set, DATA_REGION_SMALL_SET_INLINE_CAPACITY + 1);
+    for(int64_t i = 0; i < DATA_REGION_SMALL_SET_INLINE_CAPACITY; i++)
+      assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_add(&set, DR(i * 10, (i * 10) + 4)));
+    uint64_t fromTimestamp = data_region_record_timestamp();
+    assert_int_eq(1, data_region_stats_snapshot(&before));
+
+    //The add and the split that move the DataRegions to the heap are each one operation, and so is a full set's failure
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_add(&set, DR(1000, 1004)));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_small_set_remove(&set, DR(1, 1)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_remove(&set, DR(1000, 1004)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_remove(&set, DR(1, 1)));
+
+    assert_int_eq(1, data_region_stats_snapshot(&after));
+    assert_int_eq(1, after.calls[DATA_REGION_STATS_ADD] - before.calls[DATA_REGION_STATS_ADD]);
+    assert_int_eq(3, after.calls[DATA_REGION_STATS_REMOVE] - before.calls[DATA_REGION_STATS_REMOVE]);
+    assert_int_eq(1, after.out_of_space - before.out_of_space);
+    DataRegionRecordEntry entries[8];
+    assert_int_eq(4, data_region_record_collect(entries, 8, &set.set, fromTimestamp, NULL));
+    data_region_small_set_free(&set);
+  }
+
+  Test(data_region_stats_latency_percentile)
+  {
+    DataRegionStats stats;
+    memset(&stats, 0, sizeof(stats));
+    assert_int_eq(0, data_region_stats_latency_percentile(&stats, DATA_REGION_STATS_ADD, 50));
+
+    stats.latency[DATA_REGION_STATS_ADD][2] = 90;
+    stats.latency[DATA_REGION_STATS_ADD][40] = 9;
+    stats.latency[DATA_REGION_STATS_ADD][80] = 1;
+    assert_int_eq(2, data_region_stats_latency_percentile(&stats, DATA_REGION_STATS_ADD, 0));
+    assert_int_eq(2, data_region_stats_latency_percentile(&stats, DATA_REGION_STATS_ADD, 90));
+    assert_int_eq(data_region_stats_bucket_first(41) - 1, data_region_stats_latency_percentile(&stats, DATA_REGION_STATS_ADD, 99));
+    assert_int_eq(data_region_stats_bucket_first(81) - 1, data_region_stats_latency_percentile(&stats, DATA_REGION_STATS_ADD, 100));
+  }
+
+END_TEST_SUITE()
+
+void* record_test_writer(void* arg)
+{
+  DataRegionSet* set = arg;
+  for(int64_t i = 0; i < 200000; i++)
+    data_region_set_add(set, DR(i * 8, i * 8));
+  return NULL;
+}
+
+BEGIN_TEST_SUITE(DataRegionRecordTests)
+
+  Test(data_region_record_NULL_args)
+  {
+    int lost = 1;
+    assert_int_eq(-1, data_region_record_collect(NULL, 10, NULL, 0, &lost));
+    assert_int_eq(0, lost);
+    assert_int_eq(-1, data_region_trace_write_recording(NULL, NULL, NULL, NULL));
+  }
+
+  Test(data_region_record_captures_operations)
+  {
+    DataRegion dst[4];
+    DataRegionSet* set = data_region_set_create(2);
+    DataRegionSet* other = data_region_set_create(2);
+    assert_not_null(set);
+    assert_not_null(other);
+    uint64_t from = data_region_record_timestamp();
+
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add(set, DR(0, 9)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add(other, DR(0, 9)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_set_add_delta(set, DR(20, 29), NULL, NULL, NULL));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_set_remove(set, DR(5, 5)));
+    //Operations that can't be replayed aren't recorded
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_set_add(set, DR(1, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_set_add(NULL, DR(0, 0)));
+    assert_int_eq(2, data_region_set_crop(dst, 4, set, DR(5, 25), NULL));
+    assert_int_eq(1, data_region_set_count_crop(set, DR(0, 15)));
+    //The adds and removes of a negative crop on 'dst' aren't recorded
+    assert_int_eq(3, data_region_set_negative_crop(dst, 4, set, DR(-5, 35), NULL));
+
+    const DataRegionRecordEntry expected[6] =
+    {
+      { 0, 0, set, DATA_REGION_STATS_ADD, DR(0, 9), DATA_REGION_SET_SUCCESS },
+      { 0, 0, set, DATA_REGION_STATS_ADD, DR(20, 29), DATA_REGION_SET_SUCCESS },
+      { 0, 0, set, DATA_REGION_STATS_REMOVE, DR(5, 5), DATA_REGION_SET_OUT_OF_SPACE },
+      { 0, 0, set, DATA_REGION_STATS_CROP, DR(5, 25), 2 },
+      { 0, 0, set, DATA_REGION_STATS_COUNT_CROP, DR(0, 15), 1 },
+      { 0, 0, set, DATA_REGION_STATS_NEGATIVE_CROP, DR(-5, 35), 3 }
+    };
+    int64_t capacity = data_region_record_retained();
+    DataRegionRecordEntry* entries = malloc(sizeof(DataRegionRecordEntry) * capacity);
+    assert_not_null(entries);
+    int lost = 1;
+    assert_int_eq(6, data_region_record_collect(entries, capacity, set, from, &lost));
+    assert_int_eq(0, lost);
+    for(int i = 0; i < 6; i++)
+    {
+      assert_message(i == 0 || entries[i].timestamp > entries[i - 1].timestamp, "Entries weren't ordered.");
+      assert_message(entries[i].set == set, "Entry of the wrong set.");
+      assert_int_eq(expected[i].operation, entries[i].operation);
+      assert_int_eq(expected[i].region.first_index, entries[i].region.first_index);
+      assert_int_eq(expected[i].region.last_index, entries[i].region.last_index);
+      assert_int_eq(expected[i].result, entries[i].result);
+    }
+
+    //All sets, and continuing after an entry
+    assert_int_eq(7, data_region_record_collect(entries, capacity, NULL, from, NULL));
+    assert_message(entries[1].set == other, "Entry of the wrong set.");
+    for(int i = 1; i < 7; i++)
+      assert_int_eq(entries[0].sequence + i, entries[i].sequence);
+    assert_int_eq(5, data_region_record_collect(entries, capacity, NULL, entries[2].timestamp, NULL));
+    assert_int_eq(0, data_region_record_collect(entries, capacity, NULL, data_region_record_timestamp(), NULL));
+    assert_int_eq(-1, data_region_record_collect(entries, 6, NULL, from, NULL));
+
+    free(entries);
+    data_region_set_free(set);
+    data_region_set_free(other);
+  }
+
+  Test(data_region_record_ring_overwrites_oldest)
+  {
+    DataRegionSet* set = data_region_set_create(DATA_REGION_RECORD_CAPACITY + 10);
+    assert_not_null(set);
+    uint64_t from = data_region_record_timestamp();
+    for(int64_t i = 0; i < DATA_REGION_RECORD_CAPACITY + 10; i++)
+      data_region_set_add(set, DR(i * 2, i * 2));
+
+    int64_t capacity = data_region_record_retained();
+    DataRegionRecordEntry* entries = malloc(sizeof(DataRegionRecordEntry) * capacity);
+    assert_not_null(entries);
+    int lost = 0;
+    assert_int_eq(DATA_REGION_RECORD_CAPACITY - 1, data_region_record_collect(entries, capacity, set, from, &lost));
+    assert_int_eq(1, lost);
+    assert_int_eq(22, entries[0].region.first_index);
+
+    //Nothing newer than the retained entries was lost
+    assert_int_eq(DATA_REGION_RECORD_CAPACITY - 1, data_region_record_collect(entries, capacity, set, entries[0].timestamp, &lost));
+    assert_int_eq(0, lost);
+    free(entries);
+    data_region_set_free(set);
+  }
+
+  Test(data_region_record_collect_while_thread_records)
+  {
+    //Earlier tests may have recorded operations on a freed set at the same address
+    uint64_t from = data_region_record_timestamp();
+    DataRegionSet* set = data_region_set_create(200000);
+    assert_not_null(set);
+    pthread_t writer;
+    assert_int_eq(0, pthread_create(&writer, NULL, record_test_writer, set));
+
+    //Every collected entry must be intact, even while its slot is being overwritten
+    int64_t capacity = data_region_record_retained() + (4 * DATA_REGION_RECORD_CAPACITY);
+    DataRegionRecordEntry* entries = malloc(sizeof(DataRegionRecordEntry) * capacity);
+    assert_not_null(entries);
+    for(int i = 0; i < 50; i++)
+    {
+      int64_t count = data_region_record_collect(entries, capacity, set, from, NULL);
+      assert_message(count >= 0, "Collecting failed.");
+      for(int64_t j = 0; j < count; j++)
+      {
+        assert_message(entries[j].operation == DATA_REGION_STATS_ADD && entries[j].result == DATA_REGION_SET_SUCCESS, "Entry was torn.");
+        assert_message(entries[j].region.first_index == entries[j].region.last_index && entries[j].region.first_index % 8 == 0, "Entry was torn.");
+        if(j > 0)
+          assert_message(entries[j].region.first_index > entries[j - 1].region.first_index, "Entries weren't ordered.");
+      }
+    }
+    assert_int_eq(0, pthread_join(writer, NULL));
+    free(entries);
+    data_region_set_free(set);
+  }
+
+  Test(data_region_record_writes_replayable_trace)
+  {
+    DataRegion dst[8];
+    DataRegionSet* set = data_region_set_create(8);
+    assert_not_null(set);
+    uint64_t next = data_region_record_timestamp();
+    FILE* file = tmpfile();
+    assert_not_null(file);
+    DataRegionTraceWriter writer;
+    assert_int_eq(1, data_region_trace_writer_init(&writer, file));
+
+    data_region_set_add(set, DR(100, 199));
+    data_region_set_remove(set, DR(120, 129));
+    assert_int_eq(2, data_region_trace_write_recording(&writer, set, &next, NULL));
+    data_region_set_crop(dst, 8, set, DR(0, 150), NULL);
+    data_region_set_negative_crop(dst, 8, set, DR(0, 300), NULL);
+    data_region_set_add(set, DR(-50, -40));
+    int lost = 1;
+    assert_int_eq(3, data_region_trace_write_recording(&writer, set, &next, &lost));
+    assert_int_eq(0, lost);
+    assert_int_eq(0, data_region_trace_write_recording(&writer, set, &next, NULL));
+    assert_int_eq(5, writer.record_count);
+
+    //Replaying the trace yields the recorded results
+    rewind(file);
+    DataRegionTraceReader reader;
+    DataRegionTraceRecord record;
+    DataRegionSet* replayed = data_region_set_create(8);
+    assert_not_null(replayed);
+    assert_int_eq(1, data_region_trace_reader_init(&reader, file));
+    for(int i = 0; i < 5; i++)
+    {
+      assert_int_eq(1, data_region_trace_read(&reader, &record));
+      assert_int_eq(1, record.has_result);
+      int64_t result;
+      if(record.operation == DATA_REGION_TRACE_ADD)
+        result = data_region_set_add(replayed, record.region);
+      else if(record.operation == DATA_REGION_TRACE_REMOVE)
+        result = data_region_set_remove(replayed, record.region);
+      else if(record.operation == DATA_REGION_TRACE_CROP)
+        result = data_region_set_crop(dst, 8, replayed, record.region, NULL);
+      else
+        result = data_region_set_negative_crop(dst, 8, replayed, record.region, NULL);
+      assert_int_eq(record.result, result);
+    }
+    assert_int_eq(0, data_region_trace_read(&reader, &record));
+    assert_data_region_set_eq(set, replayed);
+
+    fclose(file);
+    data_region_set_free(set);
+    data_region_set_free(replayed);
+  }
+
+END_TEST_SUITE()
+
+BEGIN_TEST_SUITE(DataRegionSmallSetTests)
+
+  Test(data_region_small_set_NULL_args)
+  {
+    data_region_small_set_init(NULL, 0);
+    data_region_small_set_free(NULL);
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_small_set_add(NULL, DR(0, 0)));
+    assert_int_eq(DATA_REGION_SET_NULL_ARG, data_region_small_set_remove(NULL, DR(0, 0)));
+    assert_null(data_region_small_set_get(NULL));
+    assert_int_eq(0, data_region_small_set_count(NULL));
+    assert_int_eq(0, data_region_small_set_total_length(NULL));
+  }
+
+  Test(data_region_small_set_stays_inline)
+  {
+    DataRegionSmallSet set;
+    data_region_small_set_init(&set, 0);
+    for(int64_t i = 0; i < DATA_REGION_SMALL_SET_INLINE_CAPACITY; i++)
+      assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_add(&set, DR(i * 10, (i * 10) + 4)));
+    assert_message(set.set.regions == set.inline_regions, "The DataRegions should be inline");
+    assert_int_eq(DATA_REGION_SMALL_SET_INLINE_CAPACITY, data_region_small_set_count(&set));
+    assert_int_eq(DATA_REGION_SMALL_SET_INLINE_CAPACITY * 5, data_region_small_set_total_length(&set));
+    //Merging DataRegions doesn't need any more space
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_add(&set, DR(0, 100)));
+    assert_message(set.set.regions == set.inline_regions, "The DataRegions should be inline");
+    assert_int_eq(1, data_region_small_set_count(&set));
+    data_region_small_set_free(&set);
+  }
+
+  Test(data_region_small_set_spills_and_shrinks)
+  {
+    DataRegionSmallSet set;
+    data_region_small_set_init(&set, 0);
+    for(int64_t i = 0; i < 100; i++)
+      assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_add(&set, DR(i * 10, (i * 10) + 4)));
+    assert_message(set.set.regions != set.inline_regions, "The DataRegions should be on the heap");
+    assert_int_eq(100, data_region_small_set_count(&set));
+    assert_int_eq(500, data_region_small_set_total_length(&set));
+
+    DataRegion dst[4];
+    int tooSmall = 1;
+    assert_int_eq(2, data_region_small_set_crop(dst, 4, &set, DR(12, 22), &tooSmall));
+    assert_int_eq(0, tooSmall);
+    assert_int_eq(12, dst[0].first_index);
+    assert_int_eq(22, dst[1].last_index);
+    assert_int_eq(3, data_region_small_set_count_crop(&set, DR(0, 24)));
+    assert_int_eq(2, data_region_small_set_negative_crop(dst, 4, &set, DR(0, 24), NULL));
+    assert_int_eq(5, dst[0].first_index);
+    assert_int_eq(19, dst[1].last_index);
+
+    //Splitting a DataRegion of a full set grows it, too
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_add(&set, DR(0, 2000)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_remove(&set, DR(100, 1900)));
+    assert_int_eq(2, data_region_small_set_count(&set));
+    assert_message(set.set.regions != set.inline_regions, "The DataRegions should stay on the heap");
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_remove(&set, DR(1901, 2000)));
+    assert_message(set.set.regions == set.inline_regions, "The DataRegions should be inline again");
+    assert_int_eq(1, data_region_small_set_count(&set));
+    assert_int_eq(100, data_region_small_set_total_length(&set));
+    assert_int_eq(DATA_REGION_SMALL_SET_INLINE_CAPACITY, set.set.capacity);
+    data_region_small_set_free(&set);
+  }
+
+  Test(data_region_small_set_max_capacity)
+  {
+    DataRegionSmallSet set;
+    data_region_small_set_init(&set, 5);
+    for(int64_t i = 0; i < 5; i++)
+      assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_add(&set, DR(i * 10, (i * 10) + 4)));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_small_set_add(&set, DR(100, 104)));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_small_set_remove(&set, DR(1, 1)));
+    assert_int_eq(5, data_region_small_set_count(&set));
+    assert_int_eq(5, set.set.capacity);
+    assert_int_eq(DATA_REGION_SET_INVALID_REGION, data_region_small_set_add(&set, DR(1, 0)));
+    data_region_small_set_clear(&set);
+    assert_int_eq(0, data_region_small_set_count(&set));
+    assert_message(set.set.regions == set.inline_regions, "The DataRegions should be inline again");
+    data_region_small_set_free(&set);
+
+    data_region_small_set_init(&set, 1);
+    assert_int_eq(1, set.set.capacity);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_add(&set, DR(0, 4)));
+    assert_int_eq(DATA_REGION_SET_OUT_OF_SPACE, data_region_small_set_add(&set, DR(10, 14)));
+    data_region_small_set_free(&set);
+  }
+
+  Test(data_region_small_set_can_be_moved)
+  {
+    DataRegionSmallSet sets[2];
+    data_region_small_set_init(&sets[0], 0);
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_add(&sets[0], DR(0, 4)));
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_add(&sets[0], DR(10, 14)));
+    memcpy(&sets[1], &sets[0], sizeof(DataRegionSmallSet));
+    memset(&sets[0], 0xFF, sizeof(DataRegionSmallSet));
+
+    assert_int_eq(DATA_REGION_SET_SUCCESS, data_region_small_set_add(&sets[1], DR(20, 24)));
+    DataRegionSet* set = data_region_small_set_get(&sets[1]);
+    assert_message(set->regions == sets[1].inline_regions, "The DataRegions should be inline");
+    assert_int_eq(3, set->count);
+    assert_int_eq(10, set->regions[1].first_index);
+    assert_int_eq(15, set->total_length);
+    data_region_small_set_free(&sets[1]);
+  }
+
+  Test(data_region_small_set_matches_data_region_set)
+  {
+    DataRegionSmallSet small;
+    data_region_small_set_init(&small, 0);
+    DataRegionSet* set = data_region_set_create(1000);
+    assert_not_null(set);
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for(int i = 0; i < 20000; i++)
+    {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      int64_t first = (int64_t)(state % 2000);
+      DataRegion region = DR(first, first + (int64_t)((state >> 32) % 40));
+      if((state >> 20) % 97 == 1)
+      {
+        data_region_set_clear(set);
+        data_region_small_set_clear(&small);
+      }
+      else if((state >> 20) % 3 == 0)
+      {
+        assert_int_eq(data_region_set_remove(set, region), data_region_small_set_remove(&small, region));
+      }
+      else
+      {
+        assert_int_eq(data_region_set_add(set, region), data_region_small_set_add(&small, region));
+      }
+
+      assert_int_eq(set->count, data_region_small_set_count(&small));
+      assert_int_eq(set->total_length, data_region_small_set_total_length(&small));
+      assert_message(memcmp(set->regions, small.set.regions, sizeof(DataRegion) * set->count) == 0, "The DataRegions should match");
+    }
+    data_region_set_free(set);
+    data_region_small_set_free(&small);
+  }
+
+END_TEST_SUITE()
+
 
 int main()
 {
@@ -3357,6 +7116,25 @@ int main()
   ADD_TEST_SUITE(DataRegionSetRemoveTests);
   ADD_TEST_SUITE(DataRegionSetGetBoundedDataRegionsTests);
   ADD_TEST_SUITE(DataRegionSetGetMissingDataRegionsTests);
+  ADD_TEST_SUITE(DataRegionCowSetTests);
+  ADD_TEST_SUITE(DataRegionShardedSetTests);
+  ADD_TEST_SUITE(DataRegionLockFreeSetTests);
+  ADD_TEST_SUITE(DataRegionCombiningSetTests);
+  ADD_TEST_SUITE(DataRegionBufferedSetTests);
+  ADD_TEST_SUITE(DataRegionLsmSetTests);
+  ADD_TEST_SUITE(DataRegionCacheTests);
+  ADD_TEST_SUITE(DataRegionPlanTests);
+  ADD_TEST_SUITE(DataRegionFillTests);
+  ADD_TEST_SUITE(DataRegionFlushTests);
+  ADD_TEST_SUITE(DataRegionReadaheadTests);
+  ADD_TEST_SUITE(DataRegionSchedulerTests);
+  ADD_TEST_SUITE(DataRegionInflightTests);
+  ADD_TEST_SUITE(DataRegionWaitSetTests);
+  ADD_TEST_SUITE(DataRegionBatchTests);
+  ADD_TEST_SUITE(DataRegionTraceTests);
+  ADD_TEST_SUITE(DataRegionStatsTests);
+  ADD_TEST_SUITE(DataRegionRecordTests);
+  ADD_TEST_SUITE(DataRegionSmallSetTests);
 
   return gidunit();
 }
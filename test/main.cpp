@@ -0,0 +1,352 @@
+//Tests of the C++ headers, which gidunit (a C library) can't compile.
+//Build with: g++ -std=c++20 -pthread -o cpptest main.cpp
+#include "../data_region_coro.hpp"
+#include "../data_region.hpp"
+#include <cstdio>
+#include <thread>
+
+static int checkCount = 0;
+static int failureCount = 0;
+
+#define CHECK(expression)                                                     \
+{                                                                             \
+  checkCount++;                                                               \
+  if(!(expression))                                                           \
+  {                                                                           \
+    failureCount++;                                                           \
+    printf("  Failed: %s (%s:%d)\n", #expression, __FILE__, __LINE__);       \
+  }                                                                           \
+}
+
+/* Coroutine that starts eagerly and destroys itself when it finishes. */
+struct Detached
+{
+  struct promise_type
+  {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+Detached await_available(data_region::RegionTracker& tracker, DataRegion region, int* resumed)
+{
+  co_await tracker.available(region);
+  (*resumed)++;
+}
+
+Detached await_flushed(data_region::RegionTracker& tracker, DataRegion region, int* resumed)
+{
+  co_await tracker.flushed(region);
+  (*resumed)++;
+}
+
+Detached await_fetch(data_region::FetchCompletion& completion, int* resumed, bool* succeeded)
+{
+  *succeeded = co_await completion;
+  (*resumed)++;
+}
+
+void test_available()
+{
+  data_region::QueueExecutor executor;
+  data_region::RegionTracker tracker(16, executor);
+  int resumed = 0;
+  await_available(tracker, { 100, 199 }, &resumed);
+  await_available(tracker, { 150, 249 }, &resumed);
+  await_available(tracker, { 500, 509 }, &resumed);
+  CHECK(resumed == 0);
+
+  //Partially present byte ranges don't resume their waiters
+  CHECK(tracker.mark_present({ 100, 149 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(tracker.mark_present({ 160, 249 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(executor.run() == 0);
+
+  //Filling the hole resumes both, through the executor
+  CHECK(tracker.mark_present({ 150, 159 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(resumed == 0);
+  CHECK(executor.run() == 2);
+  CHECK(resumed == 2);
+
+  //Present byte ranges don't suspend
+  await_available(tracker, { 120, 130 }, &resumed);
+  CHECK(resumed == 3);
+  CHECK(tracker.is_present({ 100, 249 }));
+  CHECK(!tracker.is_present({ 100, 250 }));
+
+  CHECK(tracker.mark_missing({ 500, 509 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(tracker.mark_present({ 500, 509 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(executor.run() == 1);
+  CHECK(resumed == 4);
+}
+
+void test_flushed()
+{
+  data_region::InlineExecutor executor;
+  data_region::RegionTracker tracker(16, executor);
+  int resumed = 0;
+  CHECK(tracker.mark_dirty({ 0, 99 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(tracker.mark_dirty({ 200, 299 }) == DATA_REGION_SET_SUCCESS);
+  await_flushed(tracker, { 50, 60 }, &resumed);
+  await_flushed(tracker, { 0, 299 }, &resumed);
+  await_flushed(tracker, { 120, 130 }, &resumed);
+  CHECK(resumed == 1);
+
+  CHECK(tracker.mark_clean({ 0, 49 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(resumed == 1);
+  CHECK(tracker.mark_clean({ 50, 99 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(resumed == 2);
+  CHECK(tracker.mark_clean({ 200, 299 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(resumed == 3);
+  CHECK(tracker.is_flushed({ 0, 299 }));
+}
+
+void test_fetch_completion()
+{
+  data_region::InlineExecutor executor;
+  data_region::FetchCompletion completion(executor);
+  int resumed = 0;
+  bool succeeded[3] = { false, false, false };
+  await_fetch(completion, &resumed, &succeeded[0]);
+  await_fetch(completion, &resumed, &succeeded[1]);
+  CHECK(resumed == 0);
+  CHECK(!completion.is_done());
+
+  completion.complete(true);
+  completion.complete(false);
+  CHECK(resumed == 2);
+  CHECK(succeeded[0] && succeeded[1]);
+
+  await_fetch(completion, &resumed, &succeeded[2]);
+  CHECK(resumed == 3);
+  CHECK(succeeded[2]);
+}
+
+void test_many_waiters_across_threads()
+{
+  //Thousands of suspended readers cost one coroutine frame each, not one thread each
+  data_region::QueueExecutor executor;
+  data_region::RegionTracker tracker(20000, executor);
+  int resumed = 0;
+  for(int64_t i = 0; i < 10000; i++)
+    await_available(tracker, { i * 10, (i * 10) + 9 }, &resumed);
+
+  std::thread producer([&tracker]()
+  {
+    for(int64_t i = 9999; i >= 0; i--)
+      tracker.mark_present({ i * 10, (i * 10) + 9 });
+  });
+  producer.join();
+
+  CHECK(executor.run() == 10000);
+  CHECK(resumed == 10000);
+  CHECK(tracker.is_present({ 0, 99999 }));
+}
+
+uint64_t test_rand(uint64_t* state)
+{
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+template<typename Set>
+bool same_regions(const Set& set, const DataRegionSet* expected)
+{
+  if(set.count() != expected->count || set.total_length() != expected->total_length)
+    return false;
+  for(int64_t i = 0; i < expected->count; i++)
+  {
+    if(set[i].first_index != expected->regions[i].first_index || set[i].last_index != expected->regions[i].last_index)
+      return false;
+  }
+  return true;
+}
+
+/* Applies random operations to a set and to a DataRegionSet, and checks that
+ * they agree. */
+template<typename Set>
+void check_against_c(Set& set)
+{
+  DataRegionSet* expected = data_region_set_create(16);
+  DataRegion dst[4], expectedDst[4];
+  uint64_t rng = 99;
+  bool agreed = true;
+  for(int i = 0; i < 20000 && agreed; i++)
+  {
+    int64_t first = static_cast<int64_t>(test_rand(&rng) % 400);
+    DataRegion region = { first, first + static_cast<int64_t>(test_rand(&rng) % 20) };
+    int tooSmall, expectedTooSmall;
+    int64_t found;
+    switch(test_rand(&rng) % 5)
+    {
+    case 0:
+    case 1:
+      agreed = set.add(region) == data_region_set_add(expected, region);
+      break;
+    case 2:
+      agreed = set.remove(region) == data_region_set_remove(expected, region);
+      break;
+    case 3:
+      region.last_index += 60;
+      found = set.crop(dst, 4, region, &tooSmall);
+      agreed = found == data_region_set_crop(expectedDst, 4, expected, region, &expectedTooSmall)
+        && tooSmall == expectedTooSmall && memcmp(dst, expectedDst, sizeof(DataRegion) * found) == 0
+        && set.count_crop(region) == data_region_set_count_crop(expected, region);
+      break;
+    default:
+      region.last_index += 60;
+      found = set.negative_crop(dst, 4, region, &tooSmall);
+      agreed = found == data_region_set_negative_crop(expectedDst, 4, expected, region, &expectedTooSmall)
+        && tooSmall == expectedTooSmall && memcmp(dst, expectedDst, sizeof(DataRegion) * found) == 0;
+      break;
+    }
+    agreed = agreed && same_regions(set, expected);
+  }
+  CHECK(agreed);
+  data_region_set_free(expected);
+}
+
+void test_region_set_storages()
+{
+  data_region::RegionSet vectorSet(16);
+  check_against_c(vectorSet);
+  data_region::BasicRegionSet<int64_t, data_region::InlineStorage<int64_t, 16>> inlineSet;
+  check_against_c(inlineSet);
+  data_region::CRegionSet cSet(16);
+  check_against_c(cSet);
+}
+
+void test_region_set_small_index()
+{
+  using SmallSet = data_region::BasicRegionSet<uint32_t, data_region::InlineStorage<uint32_t, 4>>;
+  using SmallRegion = data_region::Region<uint32_t>;
+  CHECK(sizeof(SmallRegion) == 8);
+
+  //Neither adjacency nor the gaps overflow at the limits of the index type
+  SmallSet set;
+  SmallRegion gaps[4];
+  CHECK(set.add({ UINT32_MAX - 1, UINT32_MAX }) == DATA_REGION_SET_SUCCESS);
+  CHECK(set.add({ 0, 0 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(set.add({ 1, 9 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(set.count() == 2 && set[0].last_index == 9);
+  CHECK(set.negative_crop(gaps, 4, { 0, UINT32_MAX }) == 1);
+  CHECK(gaps[0].first_index == 10 && gaps[0].last_index == UINT32_MAX - 2);
+  CHECK(set.add({ 20, 29 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(set.add({ 40, 49 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(set.add({ 60, 69 }) == DATA_REGION_SET_OUT_OF_SPACE);
+  CHECK(set.remove({ 45, 45 }) == DATA_REGION_SET_OUT_OF_SPACE);
+  CHECK(set.add({ 10, 19 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(set.count() == 3 && set.total_length() == 42);
+  CHECK(set.remove({ 0, UINT32_MAX }) == DATA_REGION_SET_SUCCESS);
+  CHECK(set.count() == 0 && set.total_length() == 0);
+}
+
+void test_region_set_c_interop()
+{
+  data_region::CRegionSet set(8);
+  DataRegionSet* cSet = set.get_storage().c_set();
+  CHECK(set.add({ 100, 199 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(data_region_set_add(cSet, { 300, 399 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(set.count() == 2 && data_region_set_count(cSet) == 2);
+  CHECK(set.begin() == cSet->regions);
+  CHECK(data_region_set_total_length(cSet) == set.total_length());
+
+  //Moving transfers the DataRegionSet itself
+  data_region::CRegionSet moved(std::move(set));
+  CHECK(moved.get_storage().c_set() == cSet);
+  CHECK(moved.remove({ 150, 349 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(data_region_set_count_crop(cSet, { 0, 1000 }) == 2);
+  DataRegionSet* released = moved.get_storage().release();
+  CHECK(released == cSet);
+  data_region_set_free(released);
+
+  //Int64 sets of any storage hold DataRegions, usable by the C functions
+  data_region::RegionSet vectorSet;
+  CHECK(vectorSet.add({ 5, 9 }) == DATA_REGION_SET_SUCCESS);
+  const DataRegion* regions = vectorSet.begin();
+  CHECK(data_region_length(regions[0]) == 5);
+  data_region::RegionSet copied = vectorSet;
+  CHECK(copied.count() == 1 && copied.begin() != regions);
+}
+
+/* A compile-time table of reserved ranges, which needs no initialization. */
+constexpr auto reservedRanges = data_region::make_static_region_set<4>({ { 0, 511 }, { 4096, 8191 }, { 512, 1023 }, { 65536, 131071 } }, { { 6000, 6999 } });
+static_assert(reservedRanges.count() == 4 && reservedRanges.total_length() == 1024 + 4096 - 1000 + 65536);
+static_assert(reservedRanges.count_crop({ 1024, 4095 }) == 0 && reservedRanges.count_crop({ 0, 4096 }) == 2);
+
+/* The whole range of a narrower index type, whose length doesn't fit it. */
+constexpr auto fullRange32 = data_region::make_static_region_set<2, int32_t>({ { INT32_MIN, -1 }, { 0, INT32_MAX } });
+static_assert(fullRange32.count() == 1 && fullRange32.total_length() == INT64_C(1) << 32);
+static_assert(data_region::length(data_region::Region<int16_t>{ INT16_MIN, INT16_MAX }) == 65536);
+
+/* Runs operations of a StaticRegionSet in a constant expression, returning
+ * the gaps of the resulting set. */
+constexpr data_region::StaticRegionSet<int64_t, 8> static_gaps()
+{
+  data_region::StaticRegionSet<int64_t, 2> set;
+  DataRegion gaps[8] = {};
+  int dstTooSmall = 0;
+  data_region::StaticRegionSet<int64_t, 8> result;
+  if(set.add({ 10, 19 }) != DATA_REGION_SET_SUCCESS || set.add({ 30, 39 }) != DATA_REGION_SET_SUCCESS
+    || set.add({ 50, 59 }) != DATA_REGION_SET_OUT_OF_SPACE || set.remove({ 15, 15 }) != DATA_REGION_SET_OUT_OF_SPACE
+    || set.add({ 20, 29 }) != DATA_REGION_SET_SUCCESS || set.remove({ 15, 15 }) != DATA_REGION_SET_SUCCESS
+    || set.add({ 1, 0 }) != DATA_REGION_SET_INVALID_REGION)
+    return result;
+
+  int64_t gapCount = set.negative_crop(gaps, 8, { 0, 49 }, &dstTooSmall);
+  for(int64_t i = 0; i < gapCount && dstTooSmall == 0; i++)
+    result.add(gaps[i]);
+  return result;
+}
+
+constexpr data_region::StaticRegionSet<int64_t, 8> staticGaps = static_gaps();
+static_assert(staticGaps.count() == 3 && staticGaps[1].first_index == 15 && staticGaps[1].last_index == 15);
+
+void test_static_region_set()
+{
+  //The compile-time results match the C functions
+  DataRegionSet* set = data_region_set_create(8);
+  CHECK(data_region_set_add(set, { 10, 39 }) == DATA_REGION_SET_SUCCESS);
+  CHECK(data_region_set_remove(set, { 15, 15 }) == DATA_REGION_SET_SUCCESS);
+  DataRegion gaps[8];
+  CHECK(data_region_set_negative_crop(gaps, 8, set, { 0, 49 }, nullptr) == staticGaps.count());
+  CHECK(memcmp(gaps, staticGaps.begin(), sizeof(DataRegion) * staticGaps.count()) == 0);
+  data_region_set_free(set);
+
+  //The queries also run on the constant table at runtime
+  volatile int64_t first = 100;
+  DataRegion cropped[4];
+  CHECK(reservedRanges.crop(cropped, 4, { first, 5000 }) == 2);
+  CHECK(cropped[0].first_index == 100 && cropped[0].last_index == 1023 && cropped[1].last_index == 5000);
+
+  //Sets that don't fit throw at runtime (and don't compile as constants)
+  bool threw = false;
+  try
+  {
+    data_region::make_static_region_set<1>({ { 0, 9 }, { 20, 29 } });
+  }
+  catch(const std::length_error&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+int main()
+{
+  test_available();
+  test_flushed();
+  test_fetch_completion();
+  test_many_waiters_across_threads();
+  test_region_set_storages();
+  test_region_set_small_index();
+  test_region_set_c_interop();
+  test_static_region_set();
+  printf("%d checks, %d failed.\n", checkCount, failureCount);
+  return failureCount == 0 ? 0 : 1;
+}